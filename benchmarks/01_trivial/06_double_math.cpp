@@ -0,0 +1,84 @@
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <cstdint>
+#include <stdio.h>
+
+#include "../common.h"
+#include "06_double_math_ispc.h"
+
+static Docs docs("Check performance of varying double precision math functions of stdlib:\n"
+                 "[exp, log, pow, sin, cos, tan, atan2] x [vector, scalar] versions.\n"
+                 "Vector versions call stdlib functions, which are vectorized for the default math library.\n"
+                 "Scalar versions call the C library for every lane, which was the only implementation before.\n"
+                 "Expectation:\n"
+                 " - Vector versions are faster than scalar versions\n"
+                 " - Results of both versions are within a few ulps of each other\n");
+
+// Minimum size is maximum target width, i.e. 64.
+// Larger buffer is better, but preferably to stay within L1.
+#define ARGS Arg(4096)
+
+static void init(double *src0, double *src1, double *dst, int count) {
+    for (int i = 0; i < count; i++) {
+        // Cover a few periods of the trigonometric functions and keep pow() finite.
+        src0[i] = 0.125 + 20.0 * i / count;
+        src1[i] = -10.0 + 20.0 * i / count;
+        dst[i] = 0;
+    }
+}
+
+static void check(double *dst, double (*ref)(double, double), double *src0, double *src1, int count) {
+    for (int i = 0; i < count; i++) {
+        double val = ref(src0[i], src1[i]);
+        if (std::fabs(val - dst[i]) > 1e-14 * std::fmax(1.0, std::fabs(val))) {
+            printf("Error i=%d\n", i);
+            return;
+        }
+    }
+}
+
+static double ref_exp(double x, double) { return std::exp(x); }
+static double ref_log(double x, double) { return std::log(x); }
+static double ref_sin(double x, double) { return std::sin(x); }
+static double ref_cos(double x, double) { return std::cos(x); }
+static double ref_tan(double x, double) { return std::tan(x); }
+static double ref_pow(double x, double y) { return std::pow(x, y); }
+static double ref_atan2(double x, double y) { return std::atan2(x, y); }
+
+#define DOUBLE_MATH(FUNC, VERSION, ...)                                                                                \
+    static void FUNC##_##VERSION(benchmark::State &state) {                                                            \
+        int count = static_cast<int>(state.range(0));                                                                  \
+        double *src0 = static_cast<double *>(aligned_alloc_helper(sizeof(double) * count));                            \
+        double *src1 = static_cast<double *>(aligned_alloc_helper(sizeof(double) * count));                            \
+        double *dst = static_cast<double *>(aligned_alloc_helper(sizeof(double) * count));                             \
+        init(src0, src1, dst, count);                                                                                  \
+                                                                                                                       \
+        for (auto _ : state) {                                                                                         \
+            ispc::FUNC##_##VERSION(__VA_ARGS__, dst, count);                                                           \
+        }                                                                                                              \
+                                                                                                                       \
+        check(dst, ref_##FUNC, src0, src1, count);                                                                     \
+        aligned_free_helper(src0);                                                                                     \
+        aligned_free_helper(src1);                                                                                     \
+        aligned_free_helper(dst);                                                                                      \
+        state.SetComplexityN(state.range(0));                                                                          \
+    }                                                                                                                  \
+    BENCHMARK(FUNC##_##VERSION)->ARGS;
+
+#define DOUBLE_MATH_UNARY(FUNC)                                                                                        \
+    DOUBLE_MATH(FUNC, vector, src0)                                                                                    \
+    DOUBLE_MATH(FUNC, scalar, src0)
+
+#define DOUBLE_MATH_BINARY(FUNC)                                                                                       \
+    DOUBLE_MATH(FUNC, vector, src0, src1)                                                                              \
+    DOUBLE_MATH(FUNC, scalar, src0, src1)
+
+DOUBLE_MATH_UNARY(exp)
+DOUBLE_MATH_UNARY(log)
+DOUBLE_MATH_UNARY(sin)
+DOUBLE_MATH_UNARY(cos)
+DOUBLE_MATH_UNARY(tan)
+DOUBLE_MATH_BINARY(pow)
+DOUBLE_MATH_BINARY(atan2)
+
+BENCHMARK_MAIN();
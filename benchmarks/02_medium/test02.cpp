@@ -0,0 +1,71 @@
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <stdio.h>
+
+#include "test02_ispc.h"
+
+const float eps = 0.00001f;
+// Number of elements and number of elements per task
+#define ARGS Args({1 << 20, 64})->Args({1 << 20, 1024})->UseRealTime()
+// Elements per task of the inner launches in the nested case
+#define BLOCK_SIZE(chunkSize) ((chunkSize)*64)
+
+using namespace ispc;
+
+static void init(float *dst, float *src, int count) {
+    for (int i = 0; i < count; i++) {
+        src[i] = (float)i;
+        dst[i] = 0;
+    }
+}
+
+static void check(float *dst, float *src, int count) {
+    for (int i = 0; i < count; i++) {
+        if (std::abs(dst[i] - (src[i] * 2.0f + 1.0f)) > eps * std::abs(dst[i])) {
+            printf("Error i=%d\n", i);
+            return;
+        }
+    }
+}
+
+static void test02_flat(benchmark::State &state) {
+    int count = static_cast<int>(state.range(0));
+    int chunkSize = static_cast<int>(state.range(1));
+    float *src = new float[count];
+    float *dst = new float[count];
+    init(dst, src, count);
+
+    for (auto _ : state) {
+        LaunchFlat(dst, src, count, chunkSize);
+    }
+
+    check(dst, src, count);
+    // Report the number of tasks run per second.
+    state.SetItemsProcessed(state.iterations() * (count / chunkSize));
+    delete[] src;
+    delete[] dst;
+}
+BENCHMARK(test02_flat)->ARGS;
+
+static void test02_nested(benchmark::State &state) {
+    int count = static_cast<int>(state.range(0));
+    int chunkSize = static_cast<int>(state.range(1));
+    int blockSize = BLOCK_SIZE(chunkSize);
+    float *src = new float[count];
+    float *dst = new float[count];
+    init(dst, src, count);
+
+    for (auto _ : state) {
+        LaunchNested(dst, src, count, chunkSize, blockSize);
+    }
+
+    check(dst, src, count);
+    // Report the number of tasks run per second, counting both the outer
+    // and the inner tasks.
+    state.SetItemsProcessed(state.iterations() * (count / blockSize + count / chunkSize));
+    delete[] src;
+    delete[] dst;
+}
+BENCHMARK(test02_nested)->ARGS;
+
+BENCHMARK_MAIN();
@@ -0,0 +1,171 @@
+#include <benchmark/benchmark.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "test03_ispc.h"
+
+// Number of elements
+#define ARGS Arg(1 << 16)->Arg(1 << 20)->Arg(1 << 24)->UseRealTime()
+
+using namespace ispc;
+
+static void init(int *src, int count, unsigned int seed) {
+    for (int i = 0; i < count; i++) {
+        seed = seed * 1103515245u + 12345u;
+        src[i] = (int)(seed >> 1);
+    }
+}
+
+static void test03_scan(benchmark::State &state) {
+    int count = static_cast<int>(state.range(0));
+    int *src = new int[count];
+    int *dst = new int[count];
+    for (int i = 0; i < count; i++) {
+        src[i] = i & 7;
+    }
+
+    for (auto _ : state) {
+        ScanAdd(src, dst, count);
+    }
+
+    int sum = 0;
+    for (int i = 0; i < count; i++) {
+        if (dst[i] != sum) {
+            printf("Error i=%d\n", i);
+            break;
+        }
+        sum += src[i];
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+    delete[] src;
+    delete[] dst;
+}
+BENCHMARK(test03_scan)->ARGS;
+
+static void test03_histogram(benchmark::State &state) {
+    int count = static_cast<int>(state.range(0));
+    int nbins = static_cast<int>(state.range(1));
+    int *src = new int[count];
+    int *bins = new int[nbins];
+    init(src, count, 1);
+    for (int i = 0; i < count; i++) {
+        src[i] %= nbins;
+    }
+
+    for (auto _ : state) {
+        Histogram(src, count, bins, nbins);
+    }
+
+    int total = 0;
+    for (int i = 0; i < nbins; i++) {
+        total += bins[i];
+    }
+    if (total != count) {
+        printf("Error: %d values in the bins, expected %d\n", total, count);
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+    delete[] src;
+    delete[] bins;
+}
+BENCHMARK(test03_histogram)
+    ->Args({1 << 20, 256})
+    ->Args({1 << 20, 65536})
+    ->Args({1 << 24, 256})
+    ->Args({1 << 24, 65536})
+    ->UseRealTime();
+
+static void test03_compact(benchmark::State &state) {
+    int count = static_cast<int>(state.range(0));
+    int *rnd = new int[count];
+    float *src = new float[count];
+    bool *flags = new bool[count];
+    float *dst = new float[count];
+    init(rnd, count, 2);
+    int expected = 0;
+    for (int i = 0; i < count; i++) {
+        src[i] = (float)i;
+        flags[i] = (rnd[i] & 1) != 0;
+        expected += flags[i] ? 1 : 0;
+    }
+
+    int n = 0;
+    for (auto _ : state) {
+        n = Compact(src, flags, dst, count);
+    }
+
+    if (n != expected) {
+        printf("Error: %d values kept, expected %d\n", n, expected);
+    }
+    for (int i = 1; i < n; i++) {
+        if (dst[i] <= dst[i - 1]) {
+            printf("Error i=%d\n", i);
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+    delete[] rnd;
+    delete[] src;
+    delete[] flags;
+    delete[] dst;
+}
+BENCHMARK(test03_compact)->ARGS;
+
+static void test03_sort_keys(benchmark::State &state) {
+    int count = static_cast<int>(state.range(0));
+    int *src = new int[count];
+    unsigned int *keys = new unsigned int[count];
+    init(src, count, 3);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (int i = 0; i < count; i++) {
+            keys[i] = (unsigned int)src[i] * 2u;
+        }
+        state.ResumeTiming();
+        SortKeys(keys, count);
+    }
+
+    for (int i = 1; i < count; i++) {
+        if (keys[i] < keys[i - 1]) {
+            printf("Error i=%d\n", i);
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+    delete[] src;
+    delete[] keys;
+}
+BENCHMARK(test03_sort_keys)->ARGS;
+
+static void test03_sort_pairs(benchmark::State &state) {
+    int count = static_cast<int>(state.range(0));
+    int *src = new int[count];
+    int64_t *keys = new int64_t[count];
+    int *values = new int[count];
+    init(src, count, 4);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (int i = 0; i < count; i++) {
+            keys[i] = (int64_t)src[i] - (1 << 30);
+            values[i] = i;
+        }
+        state.ResumeTiming();
+        SortPairs(keys, values, count);
+    }
+
+    for (int i = 1; i < count; i++) {
+        if (keys[i] < keys[i - 1] || (keys[i] == keys[i - 1] && values[i] < values[i - 1]) ||
+            keys[i] != (int64_t)src[values[i]] - (1 << 30)) {
+            printf("Error i=%d\n", i);
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+    delete[] src;
+    delete[] keys;
+    delete[] values;
+}
+BENCHMARK(test03_sort_pairs)->ARGS;
+
+BENCHMARK_MAIN();
@@ -59,6 +59,9 @@ else()
     endif()
 endif()
 
+# Task system implementation used by the tasking benchmarks
+set(BENCHMARKS_TASKSYS_SOURCE "${CMAKE_CURRENT_LIST_DIR}/../../ispcrt/ispc_tasking.cpp")
+
 # Suffixes for multi-target compilation (x86 only)
 set(ISPC_KNOWN_TARGETS "sse2" "sse4" "avx1" "avx2" "avx512knl" "avx512skx")
 
@@ -71,6 +74,10 @@ set(ISPC_KNOWN_TARGETS "sse2" "sse4" "avx1" "avx2" "avx512knl" "avx512skx")
 #
 #  TARGET : Name of the target to add ISPC to.
 #  CPP_MAIN_FILE : Main cpp file which includes ispc headers
+#  DST_SUBDIR : Optional subdirectory for the generated files, for building
+#               the same ISPC sources for several targets.
+#  ISPC_TARGETS : Optional ISPC targets to compile for, instead of
+#                 BENCHMARKS_ISPC_TARGETS.
 #  SOURCES : List of ISPC source files.
 #
 function(add_ispc_to_target)
@@ -78,6 +85,8 @@ function(add_ispc_to_target)
     set(one_value_args
         TARGET
         CPP_MAIN_FILE
+        DST_SUBDIR
+        ISPC_TARGETS
     )
     set(multi_value_args
         SOURCES
@@ -89,11 +98,18 @@ function(add_ispc_to_target)
         ${ARGN}
     )
 
+    if(NOT ADD_ISPC_ISPC_TARGETS)
+        set(ADD_ISPC_ISPC_TARGETS ${BENCHMARKS_ISPC_TARGETS})
+    endif()
+
     set(ISPC_DST_DIR "${CMAKE_CURRENT_BINARY_DIR}/${CMAKE_CFG_INTDIR}/CMakeFiles/ispc/")
+    if(ADD_ISPC_DST_SUBDIR)
+        set(ISPC_DST_DIR "${ISPC_DST_DIR}${ADD_ISPC_DST_SUBDIR}/")
+    endif()
     file(TO_NATIVE_PATH "${ISPC_DST_DIR}" ISPC_DST_DIR)
     file(MAKE_DIRECTORY ${ISPC_DST_DIR})
 
-    string(FIND ${BENCHMARKS_ISPC_TARGETS} "," MULTI_TARGET)
+    string(FIND ${ADD_ISPC_ISPC_TARGETS} "," MULTI_TARGET)
 
     foreach(ISPC_SRC_FILE ${ADD_ISPC_SOURCES})
         set(ISPC_TARGET_HEADERS "")
@@ -113,7 +129,7 @@ function(add_ispc_to_target)
         # Collect list of expected outputs in case of multiple targets
         if(${MULTI_TARGET} GREATER -1)
             foreach (ISPC_TARGET ${ISPC_KNOWN_TARGETS})
-                string(FIND ${BENCHMARKS_ISPC_TARGETS} ${ISPC_TARGET} FOUND_TARGET)
+                string(FIND ${ADD_ISPC_ISPC_TARGETS} ${ISPC_TARGET} FOUND_TARGET)
                 if(${FOUND_TARGET} GREATER -1)
                     set(OUTPUT_TARGET ${ISPC_TARGET})
                     if (${ISPC_TARGET} STREQUAL "avx1")
@@ -139,8 +155,8 @@ function(add_ispc_to_target)
 
         add_custom_command(
             OUTPUT ${ISPC_TARGET_OBJS} ${ISPC_TARGET_HEADERS}
-            COMMENT "Compiling ${ISPC_SRC_FILE} for ${BENCHMARKS_ISPC_TARGETS} target(s)"
-            COMMAND           ${ISPC_EXECUTABLE} ${SRC_LOCATION} -o ${ISPC_OBJ} -h ${ISPC_HEADER} --arch=${ISPC_ARCH} --target=${BENCHMARKS_ISPC_TARGETS} ${ISPC_PIC} "$<JOIN:${FLAGS},;>"
+            COMMENT "Compiling ${ISPC_SRC_FILE} for ${ADD_ISPC_ISPC_TARGETS} target(s)"
+            COMMAND           ${ISPC_EXECUTABLE} ${SRC_LOCATION} -o ${ISPC_OBJ} -h ${ISPC_HEADER} --arch=${ISPC_ARCH} --target=${ADD_ISPC_ISPC_TARGETS} ${ISPC_PIC} "$<JOIN:${FLAGS},;>"
             DEPENDS ${ISPC_EXECUTABLE}
             DEPENDS ${ISPC_SRC_FILE}
             COMMAND_EXPAND_LISTS
@@ -166,6 +182,82 @@ function(add_ispc_to_target)
     target_link_libraries(${ADD_ISPC_TARGET} PRIVATE ${ISPC_OBJS_LIST})
 endfunction()
 
+#######################
+#  add_benchmark_to_harness
+#######################
+#
+#  Registers a benchmark executable with the check-benchmarks harness, which
+#  runs every benchmark once for each ISA in BENCHMARKS_ISPC_TARGETS.  The
+#  multi-target executable only runs the best ISA that the CPU supports, so
+#  when there are several, a copy of the benchmark is built for each ISA.
+#  The copies are only built for the harness.
+#
+#  TARGET : The benchmark executable.
+#  NAME : Name of the benchmark sources (NAME.cpp and NAME.ispc).
+#  SOURCES : Other sources of TARGET.
+#  DEFINITIONS : Compile definitions of TARGET.
+#  LIBRARIES : Libraries that TARGET links with, besides Google Benchmark.
+#
+function(add_benchmark_to_harness)
+    set(options)
+    set(one_value_args
+        TARGET
+        NAME
+    )
+    set(multi_value_args
+        SOURCES
+        DEFINITIONS
+        LIBRARIES
+    )
+    cmake_parse_arguments("HARNESS"
+        "${options}"
+        "${one_value_args}"
+        "${multi_value_args}"
+        ${ARGN}
+    )
+
+    string(REPLACE "," ";" ISPC_TARGET_LIST "${BENCHMARKS_ISPC_TARGETS}")
+    list(LENGTH ISPC_TARGET_LIST ISPC_TARGET_COUNT)
+    if(${ISPC_TARGET_COUNT} EQUAL 1)
+        set_property(GLOBAL APPEND PROPERTY BENCHMARKS_HARNESS_RUNS
+                     "${BENCHMARKS_ISPC_TARGETS}\t${HARNESS_TARGET}\t$<TARGET_FILE:${HARNESS_TARGET}>")
+        set_property(GLOBAL APPEND PROPERTY BENCHMARKS_HARNESS_TARGETS ${HARNESS_TARGET})
+        return()
+    endif()
+
+    foreach(ISPC_TARGET ${ISPC_TARGET_LIST})
+        set(ISA_TARGET ${HARNESS_TARGET}-${ISPC_TARGET})
+        add_executable(${ISA_TARGET} EXCLUDE_FROM_ALL "")
+
+        set_target_properties(${ISA_TARGET} PROPERTIES
+            CXX_STANDARD 17
+            CXX_STANDARD_REQUIRED YES)
+
+        set(ISA_MAIN_FILE "${CMAKE_CURRENT_BINARY_DIR}/${ISA_TARGET}.cpp")
+        file(GENERATE OUTPUT ${ISA_MAIN_FILE}
+             CONTENT "#include \"${CMAKE_CURRENT_SOURCE_DIR}/${HARNESS_NAME}.cpp\"\n")
+
+        add_ispc_to_target(
+            TARGET ${ISA_TARGET}
+            CPP_MAIN_FILE ${ISA_MAIN_FILE}
+            DST_SUBDIR ${ISA_TARGET}
+            ISPC_TARGETS ${ISPC_TARGET}
+            SOURCES ${HARNESS_NAME}.ispc)
+
+        target_sources(
+            ${ISA_TARGET}
+            PRIVATE ${ISA_MAIN_FILE} ${HARNESS_SOURCES})
+        if(HARNESS_DEFINITIONS)
+            target_compile_definitions(${ISA_TARGET} PRIVATE ${HARNESS_DEFINITIONS})
+        endif()
+        target_link_libraries(${ISA_TARGET} PRIVATE benchmark ${HARNESS_LIBRARIES})
+
+        set_property(GLOBAL APPEND PROPERTY BENCHMARKS_HARNESS_RUNS
+                     "${ISPC_TARGET}\t${HARNESS_TARGET}\t$<TARGET_FILE:${ISA_TARGET}>")
+        set_property(GLOBAL APPEND PROPERTY BENCHMARKS_HARNESS_TARGETS ${ISA_TARGET})
+    endforeach()
+endfunction()
+
 # A macro to add a benchmark
 macro(compile_benchmark_test name)
     add_executable(${name} "")
@@ -204,4 +296,70 @@ macro(compile_benchmark_test name)
 
     add_test(NAME ${name}_test COMMAND ${name} --benchmark_min_time=0.01)
     add_dependencies(${BENCHMARKS_PROJECT_NAME} ${name})
+
+    add_benchmark_to_harness(TARGET ${name} NAME ${name})
 endmacro(compile_benchmark_test)
+
+# A macro to add a benchmark of the task system.  The benchmark is built once
+# for each task system in BENCHMARKS_TASKING_MODELS (the ISPC_USE_* variants
+# of ispcrt/ispc_tasking.cpp), so that their throughput can be compared.
+macro(compile_tasking_benchmark_test name)
+    find_package(Threads REQUIRED)
+
+    foreach(model ${BENCHMARKS_TASKING_MODELS})
+        string(TOLOWER ${model} model_name)
+        set(model_target ${name}_${model_name})
+        add_executable(${model_target} "")
+
+        set_target_properties(${model_target} PROPERTIES
+            CXX_STANDARD 17
+            CXX_STANDARD_REQUIRED YES)
+
+        # Every variant needs a main file of its own to carry the dependency
+        # on its ISPC header.
+        set(model_main_file "${CMAKE_CURRENT_BINARY_DIR}/${model_target}.cpp")
+        file(GENERATE OUTPUT ${model_main_file}
+             CONTENT "#include \"${CMAKE_CURRENT_SOURCE_DIR}/${name}.cpp\"\n")
+
+        add_ispc_to_target(
+            TARGET ${model_target}
+            CPP_MAIN_FILE ${model_main_file}
+            DST_SUBDIR ${model_name}
+            SOURCES ${name}.ispc)
+
+        target_sources(
+            ${model_target}
+            PRIVATE ${model_main_file} ${BENCHMARKS_TASKSYS_SOURCE})
+        target_compile_definitions(${model_target} PRIVATE ISPC_USE_${model})
+
+        target_link_libraries(${model_target} PRIVATE benchmark Threads::Threads)
+        if(${model} STREQUAL "OMP")
+            find_package(OpenMP REQUIRED)
+            target_link_libraries(${model_target} PRIVATE OpenMP::OpenMP_CXX)
+        elseif(${model} MATCHES "^TBB_")
+            target_link_libraries(${model_target} PRIVATE tbb)
+        endif()
+
+        get_filename_component(INSTALL_SUBFOLDER "${CMAKE_CURRENT_SOURCE_DIR}" NAME)
+
+        install(
+            TARGETS ${model_target}
+            RUNTIME DESTINATION "benchmarks/${INSTALL_SUBFOLDER}")
+
+        add_test(NAME ${model_target}_test COMMAND ${model_target} --benchmark_min_time=0.01)
+        add_dependencies(${BENCHMARKS_PROJECT_NAME} ${model_target})
+
+        set(model_libraries Threads::Threads)
+        if(${model} STREQUAL "OMP")
+            list(APPEND model_libraries OpenMP::OpenMP_CXX)
+        elseif(${model} MATCHES "^TBB_")
+            list(APPEND model_libraries tbb)
+        endif()
+        add_benchmark_to_harness(
+            TARGET ${model_target}
+            NAME ${name}
+            SOURCES ${BENCHMARKS_TASKSYS_SOURCE}
+            DEFINITIONS ISPC_USE_${model}
+            LIBRARIES ${model_libraries})
+    endforeach()
+endmacro(compile_tasking_benchmark_test)
@@ -0,0 +1,247 @@
+#!/usr/bin/env python3
+#
+#  Copyright (c) 2020, Intel Corporation
+#  All rights reserved.
+#
+#  Redistribution and use in source and binary forms, with or without
+#  modification, are permitted provided that the following conditions are
+#  met:
+#
+#    * Redistributions of source code must retain the above copyright
+#      notice, this list of conditions and the following disclaimer.
+#
+#    * Redistributions in binary form must reproduce the above copyright
+#      notice, this list of conditions and the following disclaimer in the
+#      documentation and/or other materials provided with the distribution.
+#
+#    * Neither the name of Intel Corporation nor the names of its
+#      contributors may be used to endorse or promote products derived from
+#      this software without specific prior written permission.
+#
+#
+#   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+#   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+#   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+#   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+#   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+#   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+#   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+#   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+#   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+#   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+#   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+# Runs the Google Benchmark executables of the benchmarks/ suite, records the
+# time of every repetition of every benchmark together with its mean and 95%
+# confidence interval as JSON, and compares the results with a baseline that
+# was recorded the same way.  A benchmark has regressed if Welch's t-test
+# says that it got slower with a p-value below --alpha and the slowdown is
+# larger than --threshold percent.  The script exits with 1 if any benchmark
+# regressed, so it can be used as a performance gate; it's run by the
+# check-benchmarks target of the benchmarks build.
+#
+# The executables are listed in the --runs file, one per line, as the ISA,
+# the name of the benchmark executable and its path, separated by tabs.
+# Results that were recorded earlier can be compared without running
+# anything with "run_benchmarks.py --baseline=old.json new.json".
+
+from optparse import OptionParser
+import json, math, os, platform, subprocess, sys, tempfile, time
+
+TIME_UNITS = {'ns': 1.0, 'us': 1e3, 'ms': 1e6, 's': 1e9}
+
+# Regularized incomplete beta function I_x(a, b), evaluated with the
+# continued fraction from "Numerical Recipes".
+def incomplete_beta(a, b, x):
+    if x <= 0.0:
+        return 0.0
+    if x >= 1.0:
+        return 1.0
+    front = math.exp(math.lgamma(a + b) - math.lgamma(a) - math.lgamma(b) + a * math.log(x) + b * math.log(1.0 - x))
+    if x > (a + 1.0) / (a + b + 2.0):
+        return 1.0 - incomplete_beta(b, a, 1.0 - x)
+
+    tiny = 1e-300
+    c = 1.0
+    d = 1.0 - (a + b) * x / (a + 1.0)
+    d = 1.0 / (d if abs(d) > tiny else tiny)
+    f = d
+    for m in range(1, 300):
+        for numerator in (m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m)),
+                          -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1))):
+            d = 1.0 + numerator * d
+            d = 1.0 / (d if abs(d) > tiny else tiny)
+            c = 1.0 + numerator / c
+            c = c if abs(c) > tiny else tiny
+            f *= c * d
+        if abs(c * d - 1.0) < 1e-12:
+            break
+    return front * f / a
+
+# P(T > t) for Student's t distribution with df degrees of freedom.
+def t_sf(t, df):
+    tail = 0.5 * incomplete_beta(df / 2.0, 0.5, df / (df + t * t))
+    return tail if t >= 0 else 1.0 - tail
+
+# The t such that P(T > t) = p, for p < 0.5.
+def t_isf(p, df):
+    low, high = 0.0, 1e3
+    for i in range(100):
+        mid = (low + high) / 2.0
+        if t_sf(mid, df) > p:
+            low = mid
+        else:
+            high = mid
+    return (low + high) / 2.0
+
+def summarize(samples):
+    n = len(samples)
+    mean = sum(samples) / n
+    stddev = math.sqrt(sum((x - mean) ** 2 for x in samples) / (n - 1)) if n > 1 else 0.0
+    half_width = t_isf(0.025, n - 1) * stddev / math.sqrt(n) if n > 1 else 0.0
+    return {'mean': mean, 'stddev': stddev, 'ci95': [mean - half_width, mean + half_width]}
+
+# One-sided p-value of the hypothesis that new is slower than old, using
+# Welch's t-test.
+def slowdown_p_value(old, new):
+    n1, n2 = len(old['samples']), len(new['samples'])
+    v1 = old['stddev'] ** 2 / n1
+    v2 = new['stddev'] ** 2 / n2
+    if v1 + v2 == 0.0:
+        return 0.0 if new['mean'] > old['mean'] else 1.0
+    t = (new['mean'] - old['mean']) / math.sqrt(v1 + v2)
+    df = (v1 + v2) ** 2 / ((v1 ** 2 / (n1 - 1) if n1 > 1 else 0.0) + (v2 ** 2 / (n2 - 1) if n2 > 1 else 0.0))
+    return t_sf(t, df)
+
+def run_benchmark(isa, name, path, options):
+    fd, out_file = tempfile.mkstemp(suffix='.json')
+    os.close(fd)
+    command = [path, '--benchmark_repetitions=%d' % options.repetitions,
+               '--benchmark_out=' + out_file, '--benchmark_out_format=json']
+    if options.min_time != None:
+        command.append('--benchmark_min_time=%s' % options.min_time)
+    if options.filter != None:
+        command.append('--benchmark_filter=' + options.filter)
+    try:
+        if subprocess.call(command, stdout=subprocess.DEVNULL) != 0:
+            sys.stderr.write("Error: %s failed\n" % path)
+            return None, []
+        with open(out_file, 'r') as fp:
+            output = json.load(fp)
+    finally:
+        os.remove(out_file)
+
+    # Collect the individual repetitions; the aggregates are computed here.
+    samples = {}
+    units = {}
+    for run in output['benchmarks']:
+        if run.get('run_type', 'iteration') != 'iteration' or run.get('error_occurred', False):
+            continue
+        run_name = run.get('run_name', run['name'])
+        samples.setdefault(run_name, []).append(run['real_time'] * TIME_UNITS[run['time_unit']])
+    results = []
+    for run_name in sorted(samples.keys()):
+        result = {'isa': isa, 'executable': name, 'name': run_name, 'time_unit': 'ns',
+                  'samples': samples[run_name]}
+        result.update(summarize(samples[run_name]))
+        results.append(result)
+    return output.get('context', {}), results
+
+def run_all(options):
+    runs = []
+    with open(options.runs, 'r') as fp:
+        for line in fp:
+            if line.strip() != '':
+                runs.append(line.rstrip('\n').split('\t'))
+
+    context = {'date': time.strftime('%Y-%m-%d %H:%M:%S'), 'host': platform.node(),
+               'repetitions': options.repetitions}
+    results = []
+    failed = False
+    for isa, name, path in runs:
+        print("Running %s for %s" % (name, isa))
+        sys.stdout.flush()
+        run_context, run_results = run_benchmark(isa, name, path, options)
+        if run_context == None:
+            failed = True
+            continue
+        for key in ['num_cpus', 'mhz_per_cpu', 'cpu_scaling_enabled', 'library_build_type']:
+            if key in run_context:
+                context[key] = run_context[key]
+        results += run_results
+    if context.get('cpu_scaling_enabled', False):
+        print("Warning: CPU frequency scaling is enabled, the results may be noisy")
+    return {'context': context, 'benchmarks': results}, failed
+
+def key(result):
+    return (result['isa'], result['executable'], result['name'])
+
+def compare(baseline, results, options):
+    old_results = dict((key(r), r) for r in baseline['benchmarks'])
+    regressions = 0
+    print("%-10s %9s %9s  %s" % ("status", "change", "p-value", "benchmark"))
+    for new in results['benchmarks']:
+        name = "%s %s/%s" % (new['isa'], new['executable'], new['name'])
+        old = old_results.pop(key(new), None)
+        if old == None:
+            print("%-10s %9s %9s  %s" % ("new", "", "", name))
+            continue
+        change = (new['mean'] / old['mean'] - 1.0) * 100.0 if old['mean'] > 0 else 0.0
+        p_slower = slowdown_p_value(old, new)
+        p_faster = slowdown_p_value(new, old)
+        if p_slower < options.alpha and change > options.threshold:
+            status, p = "SLOWER", p_slower
+            regressions += 1
+        elif p_faster < options.alpha and -change > options.threshold:
+            status, p = "faster", p_faster
+        else:
+            status, p = "same", min(p_slower, p_faster)
+        print("%-10s %+8.1f%% %9.4f  %s" % (status, change, p, name))
+    for old in sorted(old_results.values(), key=key):
+        print("%-10s %9s %9s  %s %s/%s" % ("missing", "", "", old['isa'], old['executable'], old['name']))
+    if regressions > 0:
+        print("%d benchmark%s got slower" % (regressions, "s" if regressions > 1 else ""))
+    return regressions == 0
+
+if __name__ == '__main__':
+    parser = OptionParser(usage="Usage: run_benchmarks.py --runs=<file> [options]\n"
+                                "       run_benchmarks.py --baseline=<results.json> <results.json>")
+    parser.add_option('-r', '--runs', dest='runs',
+        help='file that lists the benchmark executables to run', default=None)
+    parser.add_option('-n', '--repetitions', dest='repetitions', type='int',
+        help='number of times to run each benchmark (default: 10)', default=10)
+    parser.add_option('--min-time', dest='min_time',
+        help='minimum time in seconds of each repetition (Google Benchmark default if unset)', default=None)
+    parser.add_option('-f', '--filter', dest='filter',
+        help='only run the benchmarks that match this regular expression', default=None)
+    parser.add_option('-o', '--output', dest='output',
+        help='write the results to this file', default=None)
+    parser.add_option('-b', '--baseline', dest='baseline',
+        help='compare the results with the ones in this file', default=None)
+    parser.add_option('-a', '--alpha', dest='alpha', type='float',
+        help='p-value below which a difference is significant (default: 0.01)', default=0.01)
+    parser.add_option('-t', '--threshold', dest='threshold', type='float',
+        help='slowdown in percent below which differences are ignored (default: 5)', default=5.0)
+    (options, args) = parser.parse_args()
+    args = [arg for arg in args if arg != '']
+
+    if options.runs != None and len(args) == 0:
+        results, failed = run_all(options)
+        if options.output != None:
+            with open(options.output, 'w') as fp:
+                json.dump(results, fp, indent=1, sort_keys=True)
+                fp.write('\n')
+    elif options.runs == None and len(args) == 1 and options.baseline != None:
+        with open(args[0], 'r') as fp:
+            results = json.load(fp)
+        failed = False
+    else:
+        parser.print_help()
+        sys.exit(1)
+
+    if options.baseline != None:
+        with open(options.baseline, 'r') as fp:
+            baseline = json.load(fp)
+        if not compare(baseline, results, options):
+            failed = True
+    sys.exit(1 if failed else 0)
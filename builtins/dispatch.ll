@@ -240,3 +240,89 @@ done:
   ret void
 }
 
+
+;; Stores the vendor, family and model of the system's CPU, as returned by
+;; __get_system_cpu_model().  -1 represents "uninitialized".
+
+@__system_cpu_model = internal global i32 -1
+
+;; Returns the vendor, family and model of the CPU that we're running on,
+;; encoded as (vendor << 20) | (family << 8) | model.  The vendor is 1 for
+;; Intel, 2 for AMD and 0 otherwise; the family and model already include
+;; the extended family and model fields.  The values must match the ones
+;; used by AllCPUs::GetCPUModels() in ispc.cpp.  This corresponds to the
+;; following code:
+;;
+;; int32_t __get_system_cpu_model() {
+;;     int info[4];
+;;     __cpuid(info, 0);
+;;     int vendor = 0;
+;;     if (info[1] == 0x756e6547) // "Genu"ineIntel
+;;         vendor = 1;
+;;     else if (info[1] == 0x68747541) // "Auth"enticAMD
+;;         vendor = 2;
+;;
+;;     __cpuid(info, 1);
+;;     int family = (info[0] >> 8) & 0xf;
+;;     int model = (info[0] >> 4) & 0xf;
+;;     if (family == 0xf)
+;;         family += (info[0] >> 20) & 0xff;
+;;     if (family == 0x6 || family >= 0xf)
+;;         model += ((info[0] >> 16) & 0xf) << 4;
+;;     return (vendor << 20) | (family << 8) | model;
+;; }
+
+define i32 @__get_system_cpu_model() nounwind uwtable {
+entry:
+  %0 = tail call { i32, i32, i32, i32 } asm sideeffect "cpuid", "={ax},={bx},={cx},={dx},0,~{dirflag},~{fpsr},~{flags}"(i32 0) nounwind
+  %ebx0 = extractvalue { i32, i32, i32, i32 } %0, 1
+  %is_intel = icmp eq i32 %ebx0, 1970169159
+  %is_amd = icmp eq i32 %ebx0, 1752462657
+  %amd_or_other = select i1 %is_amd, i32 2, i32 0
+  %vendor = select i1 %is_intel, i32 1, i32 %amd_or_other
+
+  %1 = tail call { i32, i32, i32, i32 } asm sideeffect "cpuid", "={ax},={bx},={cx},={dx},0,~{dirflag},~{fpsr},~{flags}"(i32 1) nounwind
+  %eax1 = extractvalue { i32, i32, i32, i32 } %1, 0
+  %fam_shift = lshr i32 %eax1, 8
+  %base_family = and i32 %fam_shift, 15
+  %model_shift = lshr i32 %eax1, 4
+  %base_model = and i32 %model_shift, 15
+  %extfam_shift = lshr i32 %eax1, 20
+  %ext_family = and i32 %extfam_shift, 255
+  %extmodel_shift = lshr i32 %eax1, 12
+  %ext_model = and i32 %extmodel_shift, 240
+
+  %is_fam_f = icmp eq i32 %base_family, 15
+  %fam_plus_ext = add i32 %base_family, %ext_family
+  %family = select i1 %is_fam_f, i32 %fam_plus_ext, i32 %base_family
+
+  %is_fam_6 = icmp eq i32 %base_family, 6
+  %use_ext_model = or i1 %is_fam_6, %is_fam_f
+  %model_plus_ext = add i32 %base_model, %ext_model
+  %model = select i1 %use_ext_model, i32 %model_plus_ext, i32 %base_model
+
+  %vendor_bits = shl i32 %vendor, 20
+  %family_bits = shl i32 %family, 8
+  %vf = or i32 %vendor_bits, %family_bits
+  %result = or i32 %vf, %model
+  ret i32 %result
+}
+
+;; This function is called by the dispatch functions that select between
+;; CPU-specific variants of a target; it sets @__system_cpu_model if it is
+;; unset.
+
+define void @__set_system_cpu_model() {
+entry:
+  %cm = load PTR_OP_ARGS(`i32 ')  @__system_cpu_model
+  %unset = icmp eq i32 %cm, -1
+  br i1 %unset, label %set_system_cpu_model, label %done
+
+set_system_cpu_model:
+  %cmval = call i32 @__get_system_cpu_model()
+  store i32 %cmval, i32* @__system_cpu_model
+  ret void
+
+done:
+  ret void
+}
@@ -1659,6 +1659,41 @@ define $2 @__atomic_swap_uniform_$3_global($2* %ptr, $2 %val) nounwind alwaysinl
 }
 ')
 
+;; The SVM atomics have no memory order operand, so the uniform atomics with
+;; weaker memory orders just call the default ones.  Takes four parameters:
+;; $1: llvm type of the atomic (e.g. i32)
+;; $2: operation being performed (add, sub, ..., swap)
+;; $3: type of the atomic, in ispc naming paralance (e.g. int32)
+;; $4: memory order (relaxed, acquire, release or acq_rel)
+
+define(`global_atomic_uniform_alias', `
+define $1 @__atomic_$2_uniform_$3_global_$4($1 * %ptr, $1 %val) nounwind alwaysinline {
+  %r = call $1 @__atomic_$2_uniform_$3_global($1 * %ptr, $1 %val)
+  ret $1 %r
+}
+')
+
+;; Defines the uniform atomics and the swap of one integer type with the
+;; given memory order.  Takes five parameters:
+;; $1: vector width of the target
+;; $2: llvm integer type (i32 or i64)
+;; $3: ispc type of the integer (int32 or int64)
+;; $4: unsigned ispc type of the integer (uint32 or uint64)
+;; $5: memory order (relaxed, acquire, release or acq_rel)
+
+define(`global_atomic_uniform_ordered', `
+global_atomic_uniform_alias($2, add, $3, $5)
+global_atomic_uniform_alias($2, sub, $3, $5)
+global_atomic_uniform_alias($2, and, $3, $5)
+global_atomic_uniform_alias($2, or, $3, $5)
+global_atomic_uniform_alias($2, xor, $3, $5)
+global_atomic_uniform_alias($2, min, $3, $5)
+global_atomic_uniform_alias($2, max, $3, $5)
+global_atomic_uniform_alias($2, umin, $4, $5)
+global_atomic_uniform_alias($2, umax, $4, $5)
+global_atomic_uniform_alias($2, swap, $3, $5)
+')
+
 ;; Similarly, macro to declare the function that implements the compare/exchange
 ;; atomic.  Takes three parameters:
 ;; $1: vector width of the target
@@ -3207,7 +3242,7 @@ declare i32 @__fast_masked_vload()
 declare i8* @ISPCAlloc(i8**, i64, i32) nounwind
 declare void @ISPCLaunch(i8**, i8*, i8*, i32, i32, i32) nounwind
 declare void @ISPCSync(i8*) nounwind
-declare void @ISPCInstrument(i8*, i8*, i32, i64) nounwind
+declare void @ISPCInstrumentSite(i8*, i32, i64) nounwind
 
 declare i1 @__is_compile_time_constant_mask(<WIDTH x MASK> %mask)
 declare i1 @__is_compile_time_constant_uniform_int32(i32)
@@ -4888,6 +4923,24 @@ define double @__atomic_swap_uniform_double_global(double * %ptr, double %val) n
   ret double %ret
 }
 
+;; the same atomics with weaker memory orders
+global_atomic_uniform_ordered(WIDTH, i32, int32, uint32, relaxed)
+global_atomic_uniform_ordered(WIDTH, i32, int32, uint32, acquire)
+global_atomic_uniform_ordered(WIDTH, i32, int32, uint32, release)
+global_atomic_uniform_ordered(WIDTH, i32, int32, uint32, acq_rel)
+global_atomic_uniform_ordered(WIDTH, i64, int64, uint64, relaxed)
+global_atomic_uniform_ordered(WIDTH, i64, int64, uint64, acquire)
+global_atomic_uniform_ordered(WIDTH, i64, int64, uint64, release)
+global_atomic_uniform_ordered(WIDTH, i64, int64, uint64, acq_rel)
+global_atomic_uniform_alias(float, swap, float, relaxed)
+global_atomic_uniform_alias(float, swap, float, acquire)
+global_atomic_uniform_alias(float, swap, float, release)
+global_atomic_uniform_alias(float, swap, float, acq_rel)
+global_atomic_uniform_alias(double, swap, double, relaxed)
+global_atomic_uniform_alias(double, swap, double, acquire)
+global_atomic_uniform_alias(double, swap, double, release)
+global_atomic_uniform_alias(double, swap, double, acq_rel)
+
 global_atomic_exchange(WIDTH, i32, int32)
 global_atomic_exchange(WIDTH, i64, int64)
 
@@ -1843,33 +1843,77 @@ define <$1 x $3> @__atomic_$2_$4_global($3 * %ptr, <$1 x $3> %val,
 ;; an ispc atomic function to the underlying LLVM intrinsics.  This variant
 ;; just calls the atomic once, for the given uniform value
 ;;
-;; Takes four parameters:
+;; Takes five parameters:
 ;; $1: vector width of the target
 ;; $2: operation being performed (w.r.t. LLVM atomic intrinsic names)
 ;;     (add, sub...)
 ;; $3: return type of the LLVM atomic (e.g. i32)
 ;; $4: return type of the LLVM atomic type, in ispc naming paralance (e.g. int32)
+;; $5: optional memory order of the atomic (relaxed, acquire, release or
+;;     acq_rel), which is appended to the function name; seq_cst if empty
+
+define(`atomic_order_suffix', `ifelse($1, `', `', `_$1')')
+define(`atomic_order_llvm', `ifelse($1, `', `seq_cst', $1, `relaxed', `monotonic', `$1')')
 
 define(`global_atomic_uniform', `
-define $3 @__atomic_$2_uniform_$4_global($3 * %ptr, $3 %val) nounwind alwaysinline {
-  %r = atomicrmw $2 $3 * %ptr, $3 %val seq_cst
+define $3 @__atomic_$2_uniform_$4_global`'atomic_order_suffix($5)($3 * %ptr, $3 %val) nounwind alwaysinline {
+  %r = atomicrmw $2 $3 * %ptr, $3 %val atomic_order_llvm($5)
   ret $3 %r
 }
 ')
 
 ;; Macro to declare the function that implements the swap atomic.  
-;; Takes three parameters:
+;; Takes four parameters:
 ;; $1: vector width of the target
 ;; $2: llvm type of the vector elements (e.g. i32)
 ;; $3: ispc type of the elements (e.g. int32)
+;; $4: optional memory order (relaxed, acquire, release or acq_rel)
 
 define(`global_swap', `
-define $2 @__atomic_swap_uniform_$3_global($2* %ptr, $2 %val) nounwind alwaysinline {
- %r = atomicrmw xchg $2 * %ptr, $2 %val seq_cst
+define $2 @__atomic_swap_uniform_$3_global`'atomic_order_suffix($4)($2* %ptr, $2 %val) nounwind alwaysinline {
+ %r = atomicrmw xchg $2 * %ptr, $2 %val atomic_order_llvm($4)
  ret $2 %r
 }
 ')
 
+;; Swap of floating-point values, implemented with the integer swap of the
+;; same size.  Takes four parameters:
+;; $1: floating-point type (float or double)
+;; $2: integer type of the same size (i32 or i64)
+;; $3: ispc type of the integer (int32 or int64)
+;; $4: optional memory order (relaxed, acquire, release or acq_rel)
+
+define(`global_swap_fp', `
+define $1 @__atomic_swap_uniform_$1_global`'atomic_order_suffix($4)($1 * %ptr, $1 %val) nounwind alwaysinline {
+  %iptr = bitcast $1 * %ptr to $2 *
+  %ival = bitcast $1 %val to $2
+  %iret = call $2 @__atomic_swap_uniform_$3_global`'atomic_order_suffix($4)($2 * %iptr, $2 %ival)
+  %ret = bitcast $2 %iret to $1
+  ret $1 %ret
+}
+')
+
+;; Defines the uniform atomics and the swap of one integer type with the
+;; given memory order.  Takes five parameters:
+;; $1: vector width of the target
+;; $2: llvm integer type (i32 or i64)
+;; $3: ispc type of the integer (int32 or int64)
+;; $4: unsigned ispc type of the integer (uint32 or uint64)
+;; $5: memory order (relaxed, acquire, release or acq_rel)
+
+define(`global_atomic_uniform_ordered', `
+global_atomic_uniform($1, add, $2, $3, $5)
+global_atomic_uniform($1, sub, $2, $3, $5)
+global_atomic_uniform($1, and, $2, $3, $5)
+global_atomic_uniform($1, or, $2, $3, $5)
+global_atomic_uniform($1, xor, $2, $3, $5)
+global_atomic_uniform($1, min, $2, $3, $5)
+global_atomic_uniform($1, max, $2, $3, $5)
+global_atomic_uniform($1, umin, $2, $4, $5)
+global_atomic_uniform($1, umax, $2, $4, $5)
+global_swap($1, $2, $3, $5)
+')
+
 
 ;; Similarly, macro to declare the function that implements the compare/exchange
 ;; atomic.  Takes three parameters:
@@ -4667,7 +4711,7 @@ declare i32 @__fast_masked_vload()
 declare i8* @ISPCAlloc(i8**, i64, i32) nounwind
 declare void @ISPCLaunch(i8**, i8*, i8*, i32, i32, i32) nounwind
 declare void @ISPCSync(i8*) nounwind
-declare void @ISPCInstrument(i8*, i8*, i32, i64) nounwind
+declare void @ISPCInstrumentSite(i8*, i32, i64) nounwind
 
 declare_gen()
 
@@ -6220,22 +6264,26 @@ global_atomic_uniform(WIDTH, umax, i64, uint64)
 
 global_swap(WIDTH, i32, int32)
 global_swap(WIDTH, i64, int64)
-
-define float @__atomic_swap_uniform_float_global(float * %ptr, float %val) nounwind alwaysinline {
-  %iptr = bitcast float * %ptr to i32 *
-  %ival = bitcast float %val to i32
-  %iret = call i32 @__atomic_swap_uniform_int32_global(i32 * %iptr, i32 %ival)
-  %ret = bitcast i32 %iret to float
-  ret float %ret
-}
-
-define double @__atomic_swap_uniform_double_global(double * %ptr, double %val) nounwind alwaysinline {
-  %iptr = bitcast double * %ptr to i64 *
-  %ival = bitcast double %val to i64
-  %iret = call i64 @__atomic_swap_uniform_int64_global(i64 * %iptr, i64 %ival)
-  %ret = bitcast i64 %iret to double
-  ret double %ret
-}
+global_swap_fp(float, i32, int32)
+global_swap_fp(double, i64, int64)
+
+;; the same atomics with weaker memory orders
+global_atomic_uniform_ordered(WIDTH, i32, int32, uint32, relaxed)
+global_atomic_uniform_ordered(WIDTH, i32, int32, uint32, acquire)
+global_atomic_uniform_ordered(WIDTH, i32, int32, uint32, release)
+global_atomic_uniform_ordered(WIDTH, i32, int32, uint32, acq_rel)
+global_atomic_uniform_ordered(WIDTH, i64, int64, uint64, relaxed)
+global_atomic_uniform_ordered(WIDTH, i64, int64, uint64, acquire)
+global_atomic_uniform_ordered(WIDTH, i64, int64, uint64, release)
+global_atomic_uniform_ordered(WIDTH, i64, int64, uint64, acq_rel)
+global_swap_fp(float, i32, int32, relaxed)
+global_swap_fp(float, i32, int32, acquire)
+global_swap_fp(float, i32, int32, release)
+global_swap_fp(float, i32, int32, acq_rel)
+global_swap_fp(double, i64, int64, relaxed)
+global_swap_fp(double, i64, int64, acquire)
+global_swap_fp(double, i64, int64, release)
+global_swap_fp(double, i64, int64, acq_rel)
 
 global_atomic_exchange(WIDTH, i32, int32)
 global_atomic_exchange(WIDTH, i64, int64)
@@ -44,6 +44,7 @@
     - Microsoft's Concurrency Runtime (ISPC_USE_CONCRT)
     - Apple's Grand Central Dispatch (ISPC_USE_GCD)
     - bare pthreads (ISPC_USE_PTHREADS, ISPC_USE_PTHREADS_FULLY_SUBSCRIBED)
+    - a work-stealing scheduler built on pthreads (ISPC_USE_WORK_STEALING)
     - TBB (ISPC_USE_TBB_TASK_GROUP, ISPC_USE_TBB_PARALLEL_FOR)
     - OpenMP (ISPC_USE_OMP)
     - HPX (ISPC_USE_HPX)
@@ -58,6 +59,7 @@
 #define ISPC_USE_CONCRT
 #define ISPC_USE_PTHREADS
 #define ISPC_USE_PTHREADS_FULLY_SUBSCRIBED
+#define ISPC_USE_WORK_STEALING
 #define ISPC_USE_OMP
 #define ISPC_USE_TBB_TASK_GROUP
 #define ISPC_USE_TBB_PARALLEL_FOR
@@ -67,6 +69,34 @@
   for task management.  This model is useful for KNC where tasks can take over
   the machine, but less so when there are other tasks that need running on the machine.
 
+  The ISPC_USE_WORK_STEALING model runs one worker thread per core, each of which
+  has its own lock-free (Chase-Lev) deque of ranges of tasks.  A launch adds a single
+  range that covers the whole launch grid; workers split ranges in halves as they
+  run them and idle workers steal the larger halves from the other workers' deques,
+  so that neither launching nor running tasks takes a lock in the common case.  Idle
+  workers sleep on a condition variable.  It isn't available on Windows.
+
+  With ISPC_USE_PTHREADS and ISPC_USE_WORK_STEALING, the number of threads that run
+  tasks defaults to the number of CPUs the process may run on.  It can be changed with
+  the ISPC_NUM_THREADS environment variable or by calling ISPCSetNumThreads() before
+  the first task is launched.  Setting ISPC_PIN_THREADS=1 or calling
+  ISPCSetThreadPinning(1) pins the worker threads to CPUs, placing them node by node
+  on NUMA systems (Linux only); the work-stealing scheduler then prefers to run tasks
+  on workers on the NUMA node that launched them.
+
+  With all models but ISPC_USE_PTHREADS_FULLY_SUBSCRIBED, each task description covers
+  a range of consecutive tasks of a launch, so that launching many small tasks doesn't
+  cost a task description (and a trip through the scheduler) per task.  By default
+  each thread gets about eight ranges per launch; ISPC_TASK_GRAIN_SIZE or
+  ISPCSetTaskGrainSize() set the number of tasks per range instead.  taskIndex and the
+  other task builtins are the same either way.
+
+  With all models but ISPC_USE_PTHREADS_FULLY_SUBSCRIBED, task groups and the memory
+  they use for ISPCAlloc() and for their task descriptions are reused rather than
+  allocated anew for each launching function call.  If the ISPC_ALLOC_STATS
+  environment variable is set, how often that worked is counted, returned by
+  ISPCGetAllocatorStats() and printed at exit.
+
 #define ISPC_USE_CREW
 #define ISPC_USE_HPX
   The HPX model requires the HPX runtime environment to be set up. This can be
@@ -78,8 +108,9 @@
 */
 
 #if !(defined ISPC_USE_CONCRT || defined ISPC_USE_GCD || defined ISPC_USE_PTHREADS ||                                  \
-      defined ISPC_USE_PTHREADS_FULLY_SUBSCRIBED || defined ISPC_USE_TBB_TASK_GROUP ||                                 \
-      defined ISPC_USE_TBB_PARALLEL_FOR || defined ISPC_USE_OMP || defined ISPC_USE_HPX)
+      defined ISPC_USE_PTHREADS_FULLY_SUBSCRIBED || defined ISPC_USE_WORK_STEALING ||                                  \
+      defined ISPC_USE_TBB_TASK_GROUP || defined ISPC_USE_TBB_PARALLEL_FOR || defined ISPC_USE_OMP ||                  \
+      defined ISPC_USE_HPX)
 
 // If no task model chosen from the compiler cmdline, pick a reasonable default
 #if defined(_WIN32) || defined(_WIN64)
@@ -139,6 +170,15 @@ using namespace Concurrency;
 //#include <stdexcept>
 #include <stack>
 #endif // ISPC_USE_PTHREADS_FULLY_SUBSCRIBED
+#ifdef ISPC_USE_WORK_STEALING
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <vector>
+#endif // ISPC_USE_WORK_STEALING
+#if defined(__linux__) && (defined(ISPC_USE_PTHREADS) || defined(ISPC_USE_WORK_STEALING))
+#include <sched.h>
+#endif
 #ifdef ISPC_USE_TBB_PARALLEL_FOR
 #include <tbb/parallel_for.h>
 #endif // ISPC_USE_TBB_PARALLEL_FOR
@@ -162,28 +202,41 @@ using namespace Concurrency;
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <thread>
 
 // Signature of ispc-generated 'task' functions
 typedef void (*TaskFuncType)(void *data, int threadIndex, int threadCount, int taskIndex, int taskCount, int taskIndex0,
                              int taskIndex1, int taskIndex2, int taskCount0, int taskCount1, int taskCount2);
 
-// Small structure used to hold the data for each task
+// Small structure used to hold the data for each task.  It covers
+// numTasks consecutive task indices of the launch grid, starting at
+// taskIndex, which are run one after the other (see lGetGrainSize()).
 struct TaskInfo {
     TaskFuncType func;
     void *data;
     int taskIndex;
+    int numTasks;
     int taskCount3d[3];
 #if defined(ISPC_USE_CONCRT)
     event taskEvent;
 #endif
     int taskCount() const { return taskCount3d[0] * taskCount3d[1] * taskCount3d[2]; }
-    int taskIndex0() const { return taskIndex % taskCount3d[0]; }
-    int taskIndex1() const { return (taskIndex / taskCount3d[0]) % taskCount3d[1]; }
-    int taskIndex2() const { return taskIndex / (taskCount3d[0] * taskCount3d[1]); }
     int taskCount0() const { return taskCount3d[0]; }
     int taskCount1() const { return taskCount3d[1]; }
     int taskCount2() const { return taskCount3d[2]; }
     TaskInfo() = default;
+
+    // Runs the task function for each of the task indices.
+    void Run(int threadIndex, int threadCount) const {
+        const int count = taskCount();
+        for (int index = taskIndex; index < taskIndex + numTasks; ++index) {
+            int index0 = index % taskCount3d[0];
+            int index1 = (index / taskCount3d[0]) % taskCount3d[1];
+            int index2 = index / (taskCount3d[0] * taskCount3d[1]);
+            func(data, threadIndex, threadCount, index, count, index0, index1, index2, taskCount3d[0], taskCount3d[1],
+                 taskCount3d[2]);
+        }
+    }
 };
 
 // ispc expects these functions to have C linkage / not be mangled
@@ -191,6 +244,15 @@ extern "C" {
 void ISPCLaunch(void **handlePtr, void *f, void *data, int countx, int county, int countz);
 void *ISPCAlloc(void **handlePtr, int64_t size, int32_t alignment);
 void ISPCSync(void *handle);
+#if defined(ISPC_USE_PTHREADS) || defined(ISPC_USE_WORK_STEALING)
+void ISPCSetNumThreads(int count);
+void ISPCSetThreadPinning(int enable);
+#endif
+#ifndef ISPC_USE_PTHREADS_FULLY_SUBSCRIBED
+void ISPCSetTaskGrainSize(int grainSize);
+#endif
+void ISPCGetAllocatorStats(int64_t *memChunkRequests, int64_t *memChunkHits, int64_t *taskInfoChunkRequests,
+                           int64_t *taskInfoChunkHits, int64_t *taskGroupRequests, int64_t *taskGroupHits);
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -204,6 +266,36 @@ void ISPCSync(void *handle);
 
 #define NUM_MEM_BUFFERS 16
 
+// Size classes of the chunks of memory that serve ISPCAlloc() calls: 4kB,
+// 8kB, ..., 128MB.  Larger chunks are allocated with exactly the size needed.
+#define LOG_MIN_MEM_CHUNK_SIZE 12
+#define NUM_MEM_CHUNK_SIZE_CLASSES 16
+
+// How many chunks of each size class, and how many TaskInfo arrays, each
+// thread keeps for reuse.
+#define MAX_CACHED_MEM_CHUNKS 4
+#define MAX_CACHED_TASK_INFO_CHUNKS 4
+
+/* How often the memory that task groups need came from a cache instead of
+   the system allocator: for ISPCAlloc() chunks (either kept by the group
+   from an earlier use or taken from the per-thread cache), for TaskInfo
+   arrays and for task groups themselves.  They are only counted if the
+   ISPC_ALLOC_STATS environment variable is set, since the atomic updates of
+   the counters would add traffic between the cores to every allocation;
+   otherwise ISPCGetAllocatorStats() returns zeros. */
+struct AllocStats {
+    volatile int64_t memChunkRequests, memChunkHits;
+    volatile int64_t taskInfoChunkRequests, taskInfoChunkHits;
+    volatile int64_t taskGroupRequests, taskGroupHits;
+};
+static AllocStats allocStats;
+
+static void lCountAllocation(volatile int64_t *requests, volatile int64_t *hits, bool hit);
+static char *lAllocMemChunk(int minSize, int *chunkSize);
+static void lFreeMemChunk(char *chunk, int chunkSize);
+static TaskInfo *lAllocTaskInfoChunk();
+static void lFreeTaskInfoChunk(TaskInfo *chunk);
+
 class TaskGroup;
 
 /** The TaskGroupBase structure provides common functionality for "task
@@ -237,7 +329,9 @@ class TaskGroupBase {
     /* We also allocate chunks of memory to service ISPCAlloc() calls.  The
        memBuffers[] array holds pointers to this memory.  The first element
        of this array is initialized to point to mem and then any subsequent
-       elements required are initialized with dynamic allocation.
+       elements required are initialized with dynamic allocation.  Both
+       kinds of chunks are kept when the group is Reset() and go to the
+       per-thread cache (see lAllocMemChunk()) when it is destroyed.
      */
     int curMemBuffer, curMemBufferOffset;
     int memBufferSize[NUM_MEM_BUFFERS];
@@ -262,10 +356,13 @@ inline TaskGroupBase::TaskGroupBase() {
 }
 
 inline TaskGroupBase::~TaskGroupBase() {
-    // Note: don't delete memBuffers[0], since it points to the start of
+    // Note: don't free memBuffers[0], since it points to the start of
     // the "mem" member!
     for (int i = 1; i < NUM_MEM_BUFFERS; ++i)
-        delete[](memBuffers[i]);
+        lFreeMemChunk(memBuffers[i], memBufferSize[i]);
+
+    for (int i = 0; i < MAX_TASK_QUEUE_CHUNKS; ++i)
+        lFreeTaskInfoChunk(taskInfo[i]);
 }
 
 inline void TaskGroupBase::Reset() {
@@ -296,7 +393,7 @@ inline TaskInfo *TaskGroupBase::GetTaskInfo(int index) {
     }
 
     if (taskInfo[chunk] == NULL)
-        taskInfo[chunk] = new TaskInfo[TASK_QUEUE_CHUNK_SIZE];
+        taskInfo[chunk] = lAllocTaskInfoChunk();
     return &taskInfo[chunk][offset];
 }
 
@@ -315,11 +412,15 @@ inline void *TaskGroupBase::AllocMemory(int64_t size, int32_t alignment) {
     curMemBufferOffset = 0;
     assert(curMemBuffer < NUM_MEM_BUFFERS);
 
-    int allocSize = 1 << (12 + curMemBuffer);
+    // The chunk from an earlier use of this group may still be there; it's
+    // only replaced if it's too small.
+    int allocSize = 1 << (LOG_MIN_MEM_CHUNK_SIZE + curMemBuffer);
     allocSize = std::max(int(size + alignment), allocSize);
-    char *newBuf = new char[allocSize];
-    memBufferSize[curMemBuffer] = allocSize;
-    memBuffers[curMemBuffer] = newBuf;
+    if (memBufferSize[curMemBuffer] < allocSize) {
+        lFreeMemChunk(memBuffers[curMemBuffer], memBufferSize[curMemBuffer]);
+        memBuffers[curMemBuffer] = lAllocMemChunk(allocSize, &memBufferSize[curMemBuffer]);
+    } else
+        lCountAllocation(&allocStats.memChunkRequests, &allocStats.memChunkHits, true);
     return AllocMemory(size, alignment);
 }
 
@@ -361,6 +462,261 @@ static inline int32_t lAtomicAdd(volatile int32_t *v, int32_t delta) {
 #endif
 }
 
+static inline int64_t lAtomicAdd64(volatile int64_t *v, int64_t delta) {
+#ifdef ISPC_IS_WINDOWS
+    return InterlockedExchangeAdd64((volatile LONGLONG *)v, delta) + delta;
+#else
+    return __sync_fetch_and_add(v, delta);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Memory for task groups
+
+/* Chunks of memory for ISPCAlloc() and TaskInfo arrays that task groups
+   don't need any more are kept for reuse by the thread that destroyed the
+   group, up to a few of each size. */
+class ChunkCache {
+  public:
+    ChunkCache() {
+        for (int i = 0; i < NUM_MEM_CHUNK_SIZE_CLASSES; ++i)
+            numMemChunks[i] = 0;
+        numTaskInfoChunks = 0;
+    }
+
+    ~ChunkCache() {
+        for (int i = 0; i < NUM_MEM_CHUNK_SIZE_CLASSES; ++i)
+            for (int j = 0; j < numMemChunks[i]; ++j)
+                delete[] memChunks[i][j];
+        for (int j = 0; j < numTaskInfoChunks; ++j)
+            delete[] taskInfoChunks[j];
+    }
+
+    char *memChunks[NUM_MEM_CHUNK_SIZE_CLASSES][MAX_CACHED_MEM_CHUNKS];
+    int numMemChunks[NUM_MEM_CHUNK_SIZE_CLASSES];
+    TaskInfo *taskInfoChunks[MAX_CACHED_TASK_INFO_CHUNKS];
+    int numTaskInfoChunks;
+};
+
+static thread_local ChunkCache chunkCache;
+
+// Returns true if ISPC_ALLOC_STATS is set.  The environment is only read
+// once.
+static bool lAllocStatsEnabled() {
+    static const bool enabled = getenv("ISPC_ALLOC_STATS") != NULL;
+    return enabled;
+}
+
+static void lCountAllocation(volatile int64_t *requests, volatile int64_t *hits, bool hit) {
+    if (!lAllocStatsEnabled())
+        return;
+    lAtomicAdd64(requests, 1);
+    if (hit)
+        lAtomicAdd64(hits, 1);
+}
+
+// Returns the size class of chunks of the given size, or -1 if chunks of
+// that size aren't cached.
+static int lMemChunkSizeClass(int chunkSize) {
+    for (int i = 0; i < NUM_MEM_CHUNK_SIZE_CLASSES; ++i)
+        if (chunkSize == (1 << (LOG_MIN_MEM_CHUNK_SIZE + i)))
+            return i;
+    return -1;
+}
+
+static char *lAllocMemChunk(int minSize, int *chunkSize) {
+    int sizeClass = 0;
+    while (sizeClass < NUM_MEM_CHUNK_SIZE_CLASSES && (1 << (LOG_MIN_MEM_CHUNK_SIZE + sizeClass)) < minSize)
+        ++sizeClass;
+    if (sizeClass == NUM_MEM_CHUNK_SIZE_CLASSES) {
+        lCountAllocation(&allocStats.memChunkRequests, &allocStats.memChunkHits, false);
+        *chunkSize = minSize;
+        return new char[minSize];
+    }
+
+    *chunkSize = 1 << (LOG_MIN_MEM_CHUNK_SIZE + sizeClass);
+    bool hit = chunkCache.numMemChunks[sizeClass] > 0;
+    lCountAllocation(&allocStats.memChunkRequests, &allocStats.memChunkHits, hit);
+    if (hit)
+        return chunkCache.memChunks[sizeClass][--chunkCache.numMemChunks[sizeClass]];
+    return new char[*chunkSize];
+}
+
+static void lFreeMemChunk(char *chunk, int chunkSize) {
+    if (chunk == NULL)
+        return;
+
+    int sizeClass = lMemChunkSizeClass(chunkSize);
+    if (sizeClass >= 0 && chunkCache.numMemChunks[sizeClass] < MAX_CACHED_MEM_CHUNKS)
+        chunkCache.memChunks[sizeClass][chunkCache.numMemChunks[sizeClass]++] = chunk;
+    else
+        delete[] chunk;
+}
+
+static TaskInfo *lAllocTaskInfoChunk() {
+    bool hit = chunkCache.numTaskInfoChunks > 0;
+    lCountAllocation(&allocStats.taskInfoChunkRequests, &allocStats.taskInfoChunkHits, hit);
+    if (hit)
+        return chunkCache.taskInfoChunks[--chunkCache.numTaskInfoChunks];
+    return new TaskInfo[TASK_QUEUE_CHUNK_SIZE];
+}
+
+static void lFreeTaskInfoChunk(TaskInfo *chunk) {
+    if (chunk == NULL)
+        return;
+
+    if (chunkCache.numTaskInfoChunks < MAX_CACHED_TASK_INFO_CHUNKS)
+        chunkCache.taskInfoChunks[chunkCache.numTaskInfoChunks++] = chunk;
+    else
+        delete[] chunk;
+}
+
+void ISPCGetAllocatorStats(int64_t *memChunkRequests, int64_t *memChunkHits, int64_t *taskInfoChunkRequests,
+                           int64_t *taskInfoChunkHits, int64_t *taskGroupRequests, int64_t *taskGroupHits) {
+    lMemFence();
+    *memChunkRequests = allocStats.memChunkRequests;
+    *memChunkHits = allocStats.memChunkHits;
+    *taskInfoChunkRequests = allocStats.taskInfoChunkRequests;
+    *taskInfoChunkHits = allocStats.taskInfoChunkHits;
+    *taskGroupRequests = allocStats.taskGroupRequests;
+    *taskGroupHits = allocStats.taskGroupHits;
+}
+
+static void lPrintAllocStat(const char *what, int64_t requests, int64_t hits) {
+    fprintf(stderr, "  %-16s %10lld requests, %10lld from a cache (%.1f%%)\n", what, (long long)requests,
+            (long long)hits, requests > 0 ? 100. * hits / requests : 0.);
+}
+
+static struct AllocStatsReport {
+    ~AllocStatsReport() {
+        if (!lAllocStatsEnabled())
+            return;
+
+        fprintf(stderr, "ISPC task system allocations:\n");
+        lPrintAllocStat("ISPCAlloc chunks", allocStats.memChunkRequests, allocStats.memChunkHits);
+        lPrintAllocStat("TaskInfo arrays", allocStats.taskInfoChunkRequests, allocStats.taskInfoChunkHits);
+        lPrintAllocStat("task groups", allocStats.taskGroupRequests, allocStats.taskGroupHits);
+    }
+} allocStatsReport;
+
+///////////////////////////////////////////////////////////////////////////
+// Worker threads: how many there are and where they run
+
+#if defined(ISPC_USE_PTHREADS) || defined(ISPC_USE_WORK_STEALING)
+
+static int requestedNumThreads = 0;
+static int requestedThreadPinning = -1;
+
+void ISPCSetNumThreads(int count) { requestedNumThreads = count; }
+
+void ISPCSetThreadPinning(int enable) { requestedThreadPinning = enable ? 1 : 0; }
+
+/* The CPUs that the process may run on, sorted by NUMA node, and the NUMA
+   node of each of them. */
+struct CPUTopology {
+    std::vector<int> cpus;
+    std::vector<int> nodes;
+};
+
+#ifdef __linux__
+// Reads a list of CPUs in the format of /sys/devices/system/node/node*/cpulist
+// (e.g. "0-3,8-11") and marks them in the given set.
+static bool lReadCPUList(const char *fn, cpu_set_t *set) {
+    FILE *f = fopen(fn, "r");
+    if (f == NULL)
+        return false;
+
+    CPU_ZERO(set);
+    int first, last;
+    while (fscanf(f, "%d", &first) == 1) {
+        last = first;
+        int c = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%d", &last) != 1)
+                break;
+            c = fgetc(f);
+        }
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+            CPU_SET(cpu, set);
+        if (c != ',')
+            break;
+    }
+    fclose(f);
+    return true;
+}
+#endif // __linux__
+
+static void lGetCPUTopology(CPUTopology *topology) {
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        // Walk the NUMA nodes in order and add the allowed CPUs of each.
+        cpu_set_t added;
+        CPU_ZERO(&added);
+        for (int node = 0;; ++node) {
+            char fn[64];
+            snprintf(fn, sizeof(fn), "/sys/devices/system/node/node%d/cpulist", node);
+            cpu_set_t nodeCPUs;
+            if (!lReadCPUList(fn, &nodeCPUs))
+                break;
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+                if (CPU_ISSET(cpu, &nodeCPUs) && CPU_ISSET(cpu, &allowed) && !CPU_ISSET(cpu, &added)) {
+                    topology->cpus.push_back(cpu);
+                    topology->nodes.push_back(node);
+                    CPU_SET(cpu, &added);
+                }
+        }
+        // Without NUMA information in sysfs, everything is on node 0.
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &allowed) && !CPU_ISSET(cpu, &added)) {
+                topology->cpus.push_back(cpu);
+                topology->nodes.push_back(0);
+            }
+    }
+#endif // __linux__
+    if (topology->cpus.size() == 0) {
+        int numCPUs = std::max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+        for (int cpu = 0; cpu < numCPUs; ++cpu) {
+            topology->cpus.push_back(cpu);
+            topology->nodes.push_back(0);
+        }
+    }
+}
+
+// Returns the number of threads that should run tasks: ISPC_NUM_THREADS if
+// set, otherwise the count passed to ISPCSetNumThreads(), otherwise one per
+// CPU.
+static int lGetNumTaskThreads(const CPUTopology &topology) {
+    const char *env = getenv("ISPC_NUM_THREADS");
+    if (env != NULL && atoi(env) > 0)
+        return atoi(env);
+    if (requestedNumThreads > 0)
+        return requestedNumThreads;
+    return (int)topology.cpus.size();
+}
+
+static bool lPinThreads() {
+    const char *env = getenv("ISPC_PIN_THREADS");
+    if (env != NULL)
+        return atoi(env) != 0;
+    return requestedThreadPinning == 1;
+}
+
+// Pins the given thread to the index'th CPU of the topology (wrapping
+// around if there are more threads than CPUs).
+static void lPinThread(pthread_t thread, const CPUTopology &topology, int index) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(topology.cpus[index % topology.cpus.size()], &set);
+    int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (err != 0)
+        fprintf(stderr, "Warning: unable to pin worker thread to CPU: %s\n", strerror(err));
+#endif // __linux__
+}
+
+#endif // ISPC_USE_PTHREADS || ISPC_USE_WORK_STEALING
+
 ///////////////////////////////////////////////////////////////////////////
 
 #ifdef ISPC_USE_CONCRT
@@ -421,6 +777,33 @@ class TaskGroup : public TaskGroupBase {
 
 #endif // ISPC_USE_PTHREADS
 
+#ifdef ISPC_USE_WORK_STEALING
+
+class TaskGroup : public TaskGroupBase {
+  public:
+    TaskGroup() { numUnfinishedTasks = 0; }
+
+    void Reset() {
+        TaskGroupBase::Reset();
+        numUnfinishedTasks = 0;
+    }
+
+    void Launch(int baseIndex, int count);
+    void Sync();
+
+    /* Called by the workers after they've run the given number of tasks
+       from this group. */
+    void FinishTasks(int count);
+
+  private:
+    /* Number of tasks launched from the group that haven't finished yet,
+       plus SYNC_WAITER_BIT if a thread that isn't a worker is sleeping in
+       Sync() until they have. */
+    int32_t numUnfinishedTasks;
+};
+
+#endif // ISPC_USE_WORK_STEALING
+
 #ifdef ISPC_USE_OMP
 
 class TaskGroup : public TaskGroupBase {
@@ -505,9 +888,7 @@ static void lRunTask(void *ti) {
     int threadCount = 1;
 
     // Actually run the task
-    taskInfo->func(taskInfo->data, threadIndex, threadCount, taskInfo->taskIndex, taskInfo->taskCount(),
-                   taskInfo->taskIndex0(), taskInfo->taskIndex1(), taskInfo->taskIndex2(), taskInfo->taskCount0(),
-                   taskInfo->taskCount1(), taskInfo->taskCount2());
+    taskInfo->Run(threadIndex, threadCount);
 }
 
 inline void TaskGroup::Launch(int baseIndex, int count) {
@@ -539,8 +920,7 @@ static void __cdecl lRunTask(LPVOID param) {
     // will cause bugs in code that uses those.
     int threadIndex = 0;
     int threadCount = 1;
-    ti->func(ti->data, threadIndex, threadCount, ti->taskIndex, ti->taskCount(), ti->taskIndex0(), ti->taskIndex1(),
-             ti->taskIndex2(), ti->taskCount0(), ti->taskCount1(), ti->taskCount2());
+    ti->Run(threadIndex, threadCount);
 
     // Signal the event that this task is done
     ti->taskEvent.set();
@@ -575,9 +955,19 @@ static pthread_mutex_t taskSysMutex;
 static std::vector<TaskGroup *> activeTaskGroups;
 static sem_t *workerSemaphore;
 
+// The workers use thread indices 0 to nThreads-1.  Threads that aren't
+// workers run tasks while they wait in TaskGroup::Sync(); index nThreads is
+// reserved for them, and helperIndexInUse makes sure that only one of them
+// uses it at a time.  (holdsHelperIndex is set for that thread, which may
+// sync again in one of the tasks it runs.)
+static __thread int workerIndex = -1;
+static __thread bool holdsHelperIndex = false;
+static volatile int32_t helperIndexInUse = 0;
+
 static void *lTaskEntry(void *arg) {
     int threadIndex = (int)((int64_t)arg);
-    int threadCount = nThreads;
+    int threadCount = nThreads + 1;
+    workerIndex = threadIndex;
 
     while (1) {
         int err;
@@ -635,9 +1025,7 @@ static void *lTaskEntry(void *arg) {
         //
         DBG(fprintf(stderr, "running task %d from group %p\n", taskNumber, tg));
         TaskInfo *myTask = tg->GetTaskInfo(taskNumber);
-        myTask->func(myTask->data, threadIndex, threadCount, myTask->taskIndex, myTask->taskCount(),
-                     myTask->taskIndex0(), myTask->taskIndex1(), myTask->taskIndex2(), myTask->taskCount0(),
-                     myTask->taskCount1(), myTask->taskCount2());
+        myTask->Run(threadIndex, threadCount);
 
         //
         // Decrement the "number of unfinished tasks" counter in the task
@@ -656,10 +1044,13 @@ static void InitTaskSystem() {
         while (1) {
             if (lAtomicCompareAndSwap32(&lock, 1, 0) == 0) {
                 if (threads == NULL) {
-                    // We launch one fewer thread than there are cores,
-                    // since the main thread here will also grab jobs from
-                    // the task queue itself.
-                    nThreads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+                    // We launch one fewer thread than there are threads
+                    // to run tasks, since the main thread here will also
+                    // grab jobs from the task queue itself.
+                    CPUTopology topology;
+                    lGetCPUTopology(&topology);
+                    nThreads = lGetNumTaskThreads(topology) - 1;
+                    bool pinThreads = lPinThreads();
 
                     int err;
                     if ((err = pthread_mutex_init(&taskSysMutex, NULL)) != 0) {
@@ -686,7 +1077,7 @@ static void InitTaskSystem() {
                         exit(1);
                     }
 
-                    threads = (pthread_t *)malloc(nThreads * sizeof(pthread_t));
+                    threads = (pthread_t *)malloc(std::max(nThreads, 1) * sizeof(pthread_t));
                     if (threads == NULL) {
                         fprintf(stderr, "Error creating pthreads: %s\n", strerror(err));
                         exit(1);
@@ -698,6 +1089,9 @@ static void InitTaskSystem() {
                             fprintf(stderr, "Error creating pthread %d: %s\n", i, strerror(err));
                             exit(1);
                         }
+                        // Leave the first CPU to the main thread.
+                        if (pinThreads)
+                            lPinThread(threads[i], topology, i + 1);
                     }
 
                     activeTaskGroups.reserve(64);
@@ -766,12 +1160,31 @@ inline void TaskGroup::Launch(int baseCoord, int count) {
 inline void TaskGroup::Sync() {
     DBG(fprintf(stderr, "syncing %p - %d unfinished\n", tg, numUnfinishedTasks));
 
+    // The thread index that the tasks we run here get: a worker (syncing
+    // on tasks launched from one of its tasks) has its own.
+    int threadIndex = workerIndex;
+    bool acquiredHelperIndex = false;
+    if (threadIndex < 0 && holdsHelperIndex)
+        threadIndex = nThreads;
+
     while (numUnfinishedTasks > 0) {
         // All of the tasks in this group aren't finished yet.  We'll try
         // to help out here since we don't have anything else to do...
 
         DBG(fprintf(stderr, "while syncing %p - %d unfinished\n", tg, numUnfinishedTasks));
 
+        if (threadIndex < 0) {
+            // We can only run tasks if no other thread that isn't a worker
+            // is using the extra thread index; otherwise just wait.
+            if (lAtomicCompareAndSwap32(&helperIndexInUse, 1, 0) != 0) {
+                usleep(1);
+                continue;
+            }
+            threadIndex = nThreads;
+            holdsHelperIndex = true;
+            acquiredHelperIndex = true;
+        }
+
         //
         // Acquire the global task system mutex to grab a task to work on
         //
@@ -839,10 +1252,7 @@ inline void TaskGroup::Sync() {
         //
         // Do work for _myTask_
         //
-        // FIXME: bogus values for thread index/thread count here as well..
-        myTask->func(myTask->data, 0, 1, myTask->taskIndex, myTask->taskCount(), myTask->taskIndex0(),
-                     myTask->taskIndex1(), myTask->taskIndex2(), myTask->taskCount0(), myTask->taskCount1(),
-                     myTask->taskCount2());
+        myTask->Run(threadIndex, nThreads + 1);
 
         //
         // Decrement the number of unfinished tasks counter
@@ -850,11 +1260,469 @@ inline void TaskGroup::Sync() {
         lMemFence();
         lAtomicAdd(&runtg->numUnfinishedTasks, -1);
     }
+
+    if (acquiredHelperIndex) {
+        // Let other threads use the extra thread index again.
+        holdsHelperIndex = false;
+        lMemFence();
+        helperIndexInUse = 0;
+    }
     DBG(fprintf(stderr, "sync for %p done!n", tg));
 }
 
 #endif // ISPC_USE_PTHREADS
 
+///////////////////////////////////////////////////////////////////////////
+// Work stealing
+
+#ifdef ISPC_USE_WORK_STEALING
+
+/* A range [begin, end) of task indices (as returned by
+   TaskGroupBase::AllocTaskInfo()) of a task group. */
+struct WorkRange {
+    TaskGroup *taskGroup;
+    int begin, end;
+    WorkRange *nextFree;
+};
+
+#define LOG_WORK_DEQUE_SIZE 12
+#define WORK_DEQUE_SIZE (1 << LOG_WORK_DEQUE_SIZE)
+#define MAX_FREE_WORK_RANGES 1024
+#define WORK_STEALING_SPIN_ROUNDS 64
+#define SYNC_WAITER_BIT (1 << 30)
+
+/* The work-stealing deque of Chase and Lev ("Dynamic Circular
+   Work-Stealing Deque", SPAA 2005), with the memory orderings from Le et
+   al. ("Correct and Efficient Work-Stealing for Weak Memory Models", PPoPP
+   2013).  Only the worker that owns the deque calls Push() and Pop(),
+   which work on its bottom end; any thread may Steal() from the top end,
+   which holds the oldest and, since ranges are split in halves, largest
+   ranges.  The capacity is fixed; if Push() fails, the worker just keeps
+   the work to itself.
+ */
+class WorkDeque {
+  public:
+    WorkDeque() : top(0), bottom(0) {}
+
+    bool Push(WorkRange *range);
+    WorkRange *Pop();
+    WorkRange *Steal();
+    bool IsEmpty() const;
+
+  private:
+    // Thieves modify top and the owner modifies bottom; keep them on
+    // separate cache lines.
+    volatile int64_t top;
+    char pad0[64 - sizeof(int64_t)];
+    volatile int64_t bottom;
+    char pad1[64 - sizeof(int64_t)];
+    WorkRange *buffer[WORK_DEQUE_SIZE];
+};
+
+inline bool WorkDeque::Push(WorkRange *range) {
+    int64_t b = __atomic_load_n(&bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n(&top, __ATOMIC_ACQUIRE);
+    if (b - t >= WORK_DEQUE_SIZE)
+        return false;
+
+    __atomic_store_n(&buffer[b & (WORK_DEQUE_SIZE - 1)], range, __ATOMIC_RELAXED);
+    __atomic_store_n(&bottom, b + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+inline WorkRange *WorkDeque::Pop() {
+    int64_t b = __atomic_load_n(&bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&top, __ATOMIC_RELAXED);
+
+    if (t > b) {
+        // The deque was empty.
+        __atomic_store_n(&bottom, b + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    WorkRange *range = __atomic_load_n(&buffer[b & (WORK_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    if (t == b) {
+        // This is the last range in the deque; race the thieves for it.
+        if (!__atomic_compare_exchange_n(&top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            range = NULL;
+        __atomic_store_n(&bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return range;
+}
+
+inline WorkRange *WorkDeque::Steal() {
+    int64_t t = __atomic_load_n(&top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t b = __atomic_load_n(&bottom, __ATOMIC_ACQUIRE);
+    if (t >= b)
+        return NULL;
+
+    // Only look at the range once we own it; until then, the owner may
+    // have reused its slot.
+    WorkRange *range = __atomic_load_n(&buffer[t & (WORK_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+    return range;
+}
+
+inline bool WorkDeque::IsEmpty() const {
+    int64_t t = __atomic_load_n(&top, __ATOMIC_SEQ_CST);
+    int64_t b = __atomic_load_n(&bottom, __ATOMIC_SEQ_CST);
+    return t >= b;
+}
+
+static volatile int32_t lock = 0;
+
+static int nThreads;
+static pthread_t *threads = NULL;
+static WorkDeque *workDeques = NULL;
+
+// Index of the worker running on the current thread, or -1 if the current
+// thread isn't one of the workers.
+static __thread int workerIndex = -1;
+static __thread uint32_t stealSeed;
+
+// Each thread keeps the ranges that it's done with around for reuse.
+static __thread WorkRange *freeRanges = NULL;
+static __thread int numFreeRanges = 0;
+
+// NUMA node of each worker and the workers on each node.  Unless the
+// workers are pinned to CPUs, everything is on node 0.
+static int *workerNodes = NULL;
+static std::vector<std::vector<int>> nodeWorkers;
+// NUMA node of each CPU that a worker is pinned to (-1 for the others),
+// indexed by CPU number.
+static std::vector<int> cpuNodes;
+
+// Threads that aren't workers don't have a deque; the ranges that they
+// launch go here instead, into the list for their NUMA node.
+static pthread_mutex_t injectMutex;
+static std::vector<std::vector<WorkRange *>> injectedRanges;
+static volatile int32_t numInjectedRanges = 0;
+
+// Workers that run out of work sleep on parkCond.
+static pthread_mutex_t parkMutex;
+static pthread_cond_t parkCond;
+static volatile int32_t numParkedWorkers = 0;
+
+// Threads that aren't workers sleep on syncCond in TaskGroup::Sync().
+static pthread_mutex_t syncMutex;
+static pthread_cond_t syncCond;
+
+static WorkRange *lAllocRange(TaskGroup *taskGroup, int begin, int end) {
+    WorkRange *range = freeRanges;
+    if (range != NULL) {
+        freeRanges = range->nextFree;
+        --numFreeRanges;
+    } else
+        range = new WorkRange;
+
+    range->taskGroup = taskGroup;
+    range->begin = begin;
+    range->end = end;
+    return range;
+}
+
+static void lFreeRange(WorkRange *range) {
+    if (numFreeRanges == MAX_FREE_WORK_RANGES) {
+        delete range;
+        return;
+    }
+    range->nextFree = freeRanges;
+    freeRanges = range;
+    ++numFreeRanges;
+}
+
+// Wakes up one or all of the parked workers, if there are any, after new
+// work has been made available.
+static void lWakeWorkers(bool all) {
+    // Pairs with the increment of numParkedWorkers in lParkWorker(): either
+    // the worker sees the new work or we see the worker.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&numParkedWorkers, __ATOMIC_RELAXED) == 0)
+        return;
+
+    pthread_mutex_lock(&parkMutex);
+    if (all)
+        pthread_cond_broadcast(&parkCond);
+    else
+        pthread_cond_signal(&parkCond);
+    pthread_mutex_unlock(&parkMutex);
+}
+
+static bool lWorkAvailable() {
+    for (int i = 0; i < nThreads; ++i)
+        if (!workDeques[i].IsEmpty())
+            return true;
+    return __atomic_load_n(&numInjectedRanges, __ATOMIC_SEQ_CST) > 0;
+}
+
+static void lParkWorker() {
+    pthread_mutex_lock(&parkMutex);
+    __atomic_add_fetch(&numParkedWorkers, 1, __ATOMIC_SEQ_CST);
+    if (!lWorkAvailable())
+        pthread_cond_wait(&parkCond, &parkMutex);
+    __atomic_sub_fetch(&numParkedWorkers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&parkMutex);
+}
+
+// Returns the NUMA node that the current thread is on, as far as the
+// placement of the workers is concerned.
+static int lCurrentNode() {
+    if (workerIndex >= 0)
+        return workerNodes[workerIndex];
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if (cpu >= 0 && cpu < (int)cpuNodes.size() && cpuNodes[cpu] >= 0)
+        return cpuNodes[cpu];
+#endif // __linux__
+    return 0;
+}
+
+// Tries to steal a range from one of the given workers.
+static WorkRange *lStealFrom(const std::vector<int> &victims) {
+    int numVictims = (int)victims.size();
+    if (numVictims == 0)
+        return NULL;
+
+    // Start at a random victim, so that the thieves spread out.
+    stealSeed = stealSeed * 1103515245u + 12345u;
+    int first = (stealSeed >> 16) % numVictims;
+    for (int i = 0; i < numVictims; ++i) {
+        int victim = victims[(first + i) % numVictims];
+        if (victim == workerIndex)
+            continue;
+        WorkRange *range = workDeques[victim].Steal();
+        if (range != NULL)
+            return range;
+    }
+    return NULL;
+}
+
+// Returns a range of tasks to run: from the current worker's own deque if
+// possible, then from another worker's deque (preferring the workers on
+// the same NUMA node) and finally from the ranges launched by threads that
+// aren't workers.
+static WorkRange *lFindWork() {
+    if (workerIndex >= 0) {
+        WorkRange *range = workDeques[workerIndex].Pop();
+        if (range != NULL)
+            return range;
+    }
+
+    int node = lCurrentNode();
+    int numNodes = (int)nodeWorkers.size();
+    for (int i = 0; i < numNodes; ++i) {
+        WorkRange *range = lStealFrom(nodeWorkers[(node + i) % numNodes]);
+        if (range != NULL)
+            return range;
+    }
+
+    if (__atomic_load_n(&numInjectedRanges, __ATOMIC_ACQUIRE) == 0)
+        return NULL;
+
+    WorkRange *range = NULL;
+    pthread_mutex_lock(&injectMutex);
+    for (int i = 0; i < numNodes && range == NULL; ++i) {
+        std::vector<WorkRange *> &ranges = injectedRanges[(node + i) % numNodes];
+        if (ranges.size() > 0) {
+            range = ranges.back();
+            ranges.pop_back();
+            __atomic_sub_fetch(&numInjectedRanges, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+    pthread_mutex_unlock(&injectMutex);
+    return range;
+}
+
+// Runs the given range of tasks on the current worker.
+static void lRunRange(WorkRange *range) {
+    TaskGroup *tg = range->taskGroup;
+    int begin = range->begin, end = range->end;
+    lFreeRange(range);
+
+    // Keep splitting off the upper half of the range for other workers to
+    // steal until there's a single task left for us to run.
+    WorkDeque &deque = workDeques[workerIndex];
+    while (end - begin > 1) {
+        int mid = begin + (end - begin) / 2;
+        WorkRange *upper = lAllocRange(tg, mid, end);
+        if (!deque.Push(upper)) {
+            lFreeRange(upper);
+            break;
+        }
+        lWakeWorkers(false);
+        end = mid;
+    }
+
+    for (int i = begin; i < end; ++i) {
+        DBG(fprintf(stderr, "running task %d from group %p on worker %d\n", i, tg, workerIndex));
+        tg->GetTaskInfo(i)->Run(workerIndex, nThreads);
+    }
+    tg->FinishTasks(end - begin);
+}
+
+static void *lWorkerEntry(void *arg) {
+    workerIndex = (int)((int64_t)arg);
+    stealSeed = workerIndex + 1;
+
+    while (1) {
+        // Look for work for a little while before going to sleep.
+        WorkRange *range = NULL;
+        for (int i = 0; i < WORK_STEALING_SPIN_ROUNDS && range == NULL; ++i) {
+            range = lFindWork();
+            if (range == NULL)
+                sched_yield();
+        }
+
+        if (range != NULL)
+            lRunRange(range);
+        else
+            lParkWorker();
+    }
+
+    pthread_exit(NULL);
+    return 0;
+}
+
+static void InitTaskSystem() {
+    if (threads == NULL) {
+        while (1) {
+            if (lAtomicCompareAndSwap32(&lock, 1, 0) == 0) {
+                if (threads == NULL) {
+                    // Threads that launch tasks don't run any of them
+                    // (they sleep in Sync() instead), so all of the
+                    // threads that run tasks are workers.
+                    CPUTopology topology;
+                    lGetCPUTopology(&topology);
+                    nThreads = lGetNumTaskThreads(topology);
+                    bool pinThreads = lPinThreads();
+
+                    workerNodes = new int[nThreads];
+                    int numNodes = 1;
+                    for (int i = 0; i < nThreads; ++i) {
+                        workerNodes[i] = pinThreads ? topology.nodes[i % topology.cpus.size()] : 0;
+                        numNodes = std::max(numNodes, workerNodes[i] + 1);
+                    }
+                    nodeWorkers.resize(numNodes);
+                    for (int i = 0; i < nThreads; ++i)
+                        nodeWorkers[workerNodes[i]].push_back(i);
+                    if (pinThreads) {
+                        for (int i = 0; i < nThreads && i < (int)topology.cpus.size(); ++i) {
+                            int cpu = topology.cpus[i];
+                            if (cpu >= (int)cpuNodes.size())
+                                cpuNodes.resize(cpu + 1, -1);
+                            cpuNodes[cpu] = topology.nodes[i];
+                        }
+                    }
+
+                    int err;
+                    if ((err = pthread_mutex_init(&injectMutex, NULL)) != 0 ||
+                        (err = pthread_mutex_init(&parkMutex, NULL)) != 0 ||
+                        (err = pthread_mutex_init(&syncMutex, NULL)) != 0) {
+                        fprintf(stderr, "Error creating mutex: %s\n", strerror(err));
+                        exit(1);
+                    }
+                    if ((err = pthread_cond_init(&parkCond, NULL)) != 0 ||
+                        (err = pthread_cond_init(&syncCond, NULL)) != 0) {
+                        fprintf(stderr, "Error creating condition variable: %s\n", strerror(err));
+                        exit(1);
+                    }
+
+                    injectedRanges.resize(numNodes);
+                    workDeques = new WorkDeque[nThreads];
+
+                    pthread_t *newThreads = (pthread_t *)malloc(nThreads * sizeof(pthread_t));
+                    if (newThreads == NULL) {
+                        fprintf(stderr, "Error creating pthreads: out of memory\n");
+                        exit(1);
+                    }
+
+                    for (int i = 0; i < nThreads; ++i) {
+                        err = pthread_create(&newThreads[i], NULL, &lWorkerEntry, (void *)((long long)i));
+                        if (err != 0) {
+                            fprintf(stderr, "Error creating pthread %d: %s\n", i, strerror(err));
+                            exit(1);
+                        }
+                        if (pinThreads)
+                            lPinThread(newThreads[i], topology, i);
+                    }
+
+                    // Only let other threads past the check above once
+                    // everything is set up.
+                    lMemFence();
+                    threads = newThreads;
+                }
+
+                // Make sure all of the above goes to memory before we
+                // clear the lock.
+                lMemFence();
+                lock = 0;
+                break;
+            }
+        }
+    }
+}
+
+inline void TaskGroup::Launch(int baseIndex, int count) {
+    __atomic_add_fetch(&numUnfinishedTasks, count, __ATOMIC_SEQ_CST);
+
+    // The whole launch grid goes in as a single range; the workers split
+    // it up as they go.
+    WorkRange *range = lAllocRange(this, baseIndex, baseIndex + count);
+    if (workerIndex < 0 || !workDeques[workerIndex].Push(range)) {
+        int node = lCurrentNode();
+        pthread_mutex_lock(&injectMutex);
+        injectedRanges[node].push_back(range);
+        __atomic_add_fetch(&numInjectedRanges, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&injectMutex);
+    }
+
+    lWakeWorkers(count > 1);
+}
+
+inline void TaskGroup::FinishTasks(int count) {
+    // Once the count drops to zero, the group may be reused or freed at
+    // any time, so the group mustn't be touched after this.
+    if (__atomic_sub_fetch(&numUnfinishedTasks, count, __ATOMIC_ACQ_REL) == SYNC_WAITER_BIT) {
+        pthread_mutex_lock(&syncMutex);
+        pthread_cond_broadcast(&syncCond);
+        pthread_mutex_unlock(&syncMutex);
+    }
+}
+
+inline void TaskGroup::Sync() {
+    DBG(fprintf(stderr, "syncing %p - %d unfinished\n", this, numUnfinishedTasks));
+
+    if (workerIndex >= 0) {
+        // A task that launched tasks of its own; help running tasks (from
+        // this group or any other one) until this group is done.
+        while (__atomic_load_n(&numUnfinishedTasks, __ATOMIC_ACQUIRE) > 0) {
+            WorkRange *range = lFindWork();
+            if (range != NULL)
+                lRunRange(range);
+            else
+                sched_yield();
+        }
+        return;
+    }
+
+    // Otherwise, sleep until the worker that finishes the last task of the
+    // group wakes us up.
+    if (__atomic_fetch_or(&numUnfinishedTasks, SYNC_WAITER_BIT, __ATOMIC_SEQ_CST) == 0)
+        return;
+
+    pthread_mutex_lock(&syncMutex);
+    while (__atomic_load_n(&numUnfinishedTasks, __ATOMIC_ACQUIRE) != SYNC_WAITER_BIT)
+        pthread_cond_wait(&syncCond, &syncMutex);
+    pthread_mutex_unlock(&syncMutex);
+    DBG(fprintf(stderr, "sync for %p done!n", this));
+}
+
+#endif // ISPC_USE_WORK_STEALING
+
 ///////////////////////////////////////////////////////////////////////////
 // OpenMP
 
@@ -875,8 +1743,7 @@ inline void TaskGroup::Launch(int baseIndex, int count) {
             TaskInfo *ti = GetTaskInfo(baseIndex + i);
 
             // Actually run the task.
-            ti->func(ti->data, threadIndex, threadCount, ti->taskIndex, ti->taskCount(), ti->taskIndex0(),
-                     ti->taskIndex1(), ti->taskIndex2(), ti->taskCount0(), ti->taskCount1(), ti->taskCount2());
+            ti->Run(threadIndex, threadCount);
         }
     }
 }
@@ -904,8 +1771,7 @@ inline void TaskGroup::Launch(int baseIndex, int count) {
         int threadIndex = ti->taskIndex;
         int threadCount = ti->taskCount();
 
-        ti->func(ti->data, threadIndex, threadCount, ti->taskIndex, ti->taskCount(), ti->taskIndex0(), ti->taskIndex1(),
-                 ti->taskIndex2(), ti->taskCount0(), ti->taskCount1(), ti->taskCount2());
+        ti->Run(threadIndex, threadCount);
     });
 }
 
@@ -928,8 +1794,7 @@ inline void TaskGroup::Launch(int baseIndex, int count) {
             // TBB does not expose the task -> thread mapping so we pretend it's 1:1
             int threadIndex = ti->taskIndex;
             int threadCount = ti->taskCount();
-            ti->func(ti->data, threadIndex, threadCount, ti->taskIndex, ti->taskCount(), ti->taskIndex0(),
-                     ti->taskIndex1(), ti->taskIndex2(), ti->taskCount0(), ti->taskCount1(), ti->taskCount2());
+            ti->Run(threadIndex, threadCount);
         });
     }
 }
@@ -950,9 +1815,7 @@ inline void TaskGroup::Launch(int baseIndex, int count) {
         TaskInfo *ti = GetTaskInfo(baseIndex + i);
         int threadIndex = i;
         int threadCount = count;
-        futures.push_back(hpx::async(ti->func, ti->data, threadIndex, threadCount, ti->taskIndex, ti->taskCount(),
-                                     ti->taskIndex0(), ti->taskIndex1(), ti->taskIndex2(), ti->taskCount0(),
-                                     ti->taskCount1(), ti->taskCount2()));
+        futures.push_back(hpx::async([=]() { ti->Run(threadIndex, threadCount); }));
     }
 }
 
@@ -974,11 +1837,13 @@ static inline TaskGroup *AllocTaskGroup() {
         if (tg != NULL) {
             void *ptr = lAtomicCompareAndSwapPointer((void **)(&freeTaskGroups[i]), NULL, tg);
             if (ptr != NULL) {
+                lCountAllocation(&allocStats.taskGroupRequests, &allocStats.taskGroupHits, true);
                 return (TaskGroup *)ptr;
             }
         }
     }
 
+    lCountAllocation(&allocStats.taskGroupRequests, &allocStats.taskGroupHits, false);
     return new TaskGroup;
 }
 
@@ -996,6 +1861,45 @@ static inline void FreeTaskGroup(TaskGroup *tg) {
     delete tg;
 }
 
+///////////////////////////////////////////////////////////////////////////
+// Grain size
+
+// With the automatic grain size, launches are split into about this many
+// ranges of tasks per thread, which leaves enough of them to balance the
+// load.
+#define AUTO_GRAIN_RANGES_PER_THREAD 8
+
+static int requestedGrainSize = 0;
+
+void ISPCSetTaskGrainSize(int grainSize) { requestedGrainSize = std::max(grainSize, 0); }
+
+static int lNumTaskThreads() {
+#if defined(ISPC_USE_PTHREADS)
+    return nThreads + 1;
+#elif defined(ISPC_USE_WORK_STEALING)
+    return nThreads;
+#elif defined(ISPC_USE_OMP)
+    return omp_get_max_threads();
+#else
+    return std::max(1, (int)std::thread::hardware_concurrency());
+#endif
+}
+
+// Returns how many consecutive task indices of a launch of count tasks
+// each TaskInfo covers: ISPC_TASK_GRAIN_SIZE if set, otherwise the size
+// passed to ISPCSetTaskGrainSize(), otherwise a size that gives each
+// thread AUTO_GRAIN_RANGES_PER_THREAD ranges.  Launches that are small
+// compared to the number of threads get one TaskInfo per task, as before.
+static int lGetGrainSize(int count) {
+    static const int envGrainSize =
+        getenv("ISPC_TASK_GRAIN_SIZE") != NULL ? std::max(atoi(getenv("ISPC_TASK_GRAIN_SIZE")), 0) : 0;
+    if (envGrainSize > 0)
+        return envGrainSize;
+    if (requestedGrainSize > 0)
+        return requestedGrainSize;
+    return std::max(1, count / (lNumTaskThreads() * AUTO_GRAIN_RANGES_PER_THREAD));
+}
+
 ///////////////////////////////////////////////////////////////////////////
 
 void ISPCLaunch(void **taskGroupPtr, void *func, void *data, int count0, int count1, int count2) {
@@ -1008,17 +1912,22 @@ void ISPCLaunch(void **taskGroupPtr, void *func, void *data, int count0, int cou
     } else
         taskGroup = (TaskGroup *)(*taskGroupPtr);
 
-    int baseIndex = taskGroup->AllocTaskInfo(count);
-    for (int i = 0; i < count; ++i) {
+    // The tasks see the same taskIndex values however many of them each
+    // TaskInfo runs.
+    const int grainSize = lGetGrainSize(count);
+    const int numRanges = (count + grainSize - 1) / grainSize;
+    int baseIndex = taskGroup->AllocTaskInfo(numRanges);
+    for (int i = 0; i < numRanges; ++i) {
         TaskInfo *ti = taskGroup->GetTaskInfo(baseIndex + i);
         ti->func = (TaskFuncType)func;
         ti->data = data;
-        ti->taskIndex = i;
+        ti->taskIndex = i * grainSize;
+        ti->numTasks = std::min(grainSize, count - i * grainSize);
         ti->taskCount3d[0] = count0;
         ti->taskCount3d[1] = count1;
         ti->taskCount3d[2] = count2;
     }
-    taskGroup->Launch(baseIndex, count);
+    taskGroup->Launch(baseIndex, numRanges);
 }
 
 void ISPCSync(void *h) {
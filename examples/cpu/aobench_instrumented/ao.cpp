@@ -56,7 +56,6 @@
 using namespace ispc;
 
 #include "../../common/timing.h"
-#include "instrument.h"
 
 #define NSUBSAMPLES 2
 
@@ -119,7 +118,7 @@ int main(int argc, char **argv) {
 
     savePPM("ao-ispc.ppm", width, height);
 
-    ISPCPrintInstrument();
+    ISPCInstrumentReport(NULL);
 
     return 0;
 }
@@ -9,10 +9,17 @@
 #include <dlfcn.h>
 #endif
 // std
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <exception>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace ispcrt {
 namespace cpu {
@@ -21,14 +28,61 @@ struct Future : public ispcrt::base::Future {
     Future() = default;
     virtual ~Future() = default;
 
-    bool valid() override { return m_valid; }
+    bool valid() override { return m_valid.load(std::memory_order_acquire); }
     uint64_t time() override { return m_time; }
 
     friend class TaskQueue;
 
   private:
     uint64_t m_time{0};
-    bool m_valid{false};
+    // Set by the thread that ran the kernel once m_time has been written.
+    std::atomic<bool> m_valid{false};
+};
+
+// Threads that run the kernels launched on all CPU task queues.
+class ThreadPool {
+  public:
+    static ThreadPool &instance() {
+        // Never destroyed: the threads may still be waiting for jobs while
+        // the process exits, and joining them from a static destructor
+        // (or while a DLL is being unloaded) can deadlock.
+        static ThreadPool *pool = new ThreadPool;
+        return *pool;
+    }
+
+    void submit(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back(std::move(job));
+        }
+        m_cond.notify_one();
+    }
+
+  private:
+    ThreadPool() {
+        unsigned numThreads = std::thread::hardware_concurrency();
+        if (numThreads == 0)
+            numThreads = 1;
+        for (unsigned i = 0; i < numThreads; ++i)
+            std::thread([this]() { run(); }).detach();
+    }
+
+    void run() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond.wait(lock, [this]() { return !m_jobs.empty(); });
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<std::function<void()>> m_jobs;
 };
 
 using CPUKernelEntryPoint = void (*)(void *, size_t, size_t, size_t);
@@ -116,13 +170,24 @@ struct Kernel : public ispcrt::base::Kernel {
     const ispcrt::base::Module *m_module{nullptr};
 };
 
+// Kernels launched on a queue run asynchronously on the thread pool.  The
+// kernels launched between two barriers may run concurrently; the ones
+// launched after a barrier start once all of those launched before it have
+// finished.  Different queues don't wait for each other.
 struct TaskQueue : public ispcrt::base::TaskQueue {
-    TaskQueue() {
-        // no-op
+    TaskQueue() = default;
+
+    ~TaskQueue() {
+        // The kernels that are running or waiting refer to this queue.
+        sync();
     }
 
     void barrier() override {
-        // no-op
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // Nothing to wait for if nothing has been launched since the last
+        // time the queue was empty.
+        if (m_running > 0 || !m_waiting.empty())
+            m_barrierPending = true;
     }
 
     void copyToHost(ispcrt::base::MemoryView &) override {
@@ -138,28 +203,103 @@ struct TaskQueue : public ispcrt::base::TaskQueue {
         auto &kernel = (cpu::Kernel &)k;
         auto *parameters = (cpu::MemoryView *)params;
 
-        auto *fcn = kernel.entryPoint();
-
         auto *future = new cpu::Future;
         assert(future);
 
-        auto start = std::chrono::high_resolution_clock::now();
-        fcn(parameters ? parameters->devicePtr() : nullptr, dim0, dim1, dim2);
-        auto end = std::chrono::high_resolution_clock::now();
-
-        future->m_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-        future->m_valid = true;
+        // The queue holds on to the kernel and its parameters until the
+        // kernel has run.  As with the GPU queues, the reference to the
+        // future that is returned is only dropped by sync(): the kernel may
+        // finish before the caller has taken a reference of its own.
+        Launch launch{&kernel, parameters, dim0, dim1, dim2, future};
+        kernel.refInc();
+        if (parameters)
+            parameters->refInc();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_waiting.empty() && !m_barrierPending) {
+            ++m_running;
+            submit(launch);
+        } else {
+            if (m_waiting.empty() || m_barrierPending)
+                m_waiting.emplace_back();
+            m_barrierPending = false;
+            m_waiting.back().push_back(launch);
+        }
 
         return future;
     }
 
     void sync() override {
-        // no-op
+        std::vector<cpu::Future *> finished;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_idle.wait(lock, [this]() { return m_running == 0 && m_waiting.empty(); });
+            finished.swap(m_finished);
+        }
+        for (auto *future : finished)
+            future->refDec();
     }
 
     void* taskQueueNativeHandle() const override {
         return nullptr;
     }
+
+  private:
+    struct Launch {
+        cpu::Kernel *kernel;
+        cpu::MemoryView *params;
+        size_t dim0, dim1, dim2;
+        cpu::Future *future;
+    };
+
+    // Called with m_mutex held.
+    void submit(const Launch &launch) {
+        ThreadPool::instance().submit([this, launch]() { run(launch); });
+    }
+
+    void run(const Launch &launch) {
+        auto *fcn = launch.kernel->entryPoint();
+
+        auto start = std::chrono::high_resolution_clock::now();
+        fcn(launch.params ? launch.params->devicePtr() : nullptr, launch.dim0, launch.dim1, launch.dim2);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        launch.future->m_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        launch.future->m_valid.store(true, std::memory_order_release);
+        if (launch.params)
+            launch.params->refDec();
+        launch.kernel->refDec();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finished.push_back(launch.future);
+        if (--m_running > 0)
+            return;
+
+        if (m_waiting.empty()) {
+            m_barrierPending = false;
+            m_idle.notify_all();
+            return;
+        }
+
+        // Everything before the next barrier has finished: start the kernels
+        // launched after it.
+        std::vector<Launch> next = std::move(m_waiting.front());
+        m_waiting.pop_front();
+        m_running = next.size();
+        for (const auto &l : next)
+            submit(l);
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_idle;
+    // Number of kernels submitted to the thread pool that haven't finished.
+    size_t m_running{0};
+    // Kernels that wait for earlier ones to finish: one group per barrier.
+    std::deque<std::vector<Launch>> m_waiting;
+    // Whether the next launch has to wait for everything launched so far.
+    bool m_barrierPending{false};
+    // Futures of the kernels that have run, released by the next sync().
+    std::vector<cpu::Future *> m_finished;
 };
 } // namespace cpu
 
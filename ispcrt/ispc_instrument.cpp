@@ -0,0 +1,448 @@
+/*
+  Copyright (c) 2021, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+  This file implements the runtime for programs compiled with
+  --instrument.  The compiler gives every instrumentation point of a module
+  (one per target of each compiled file) an ID and emits a table that
+  describes them; the points call ISPCInstrumentSite() with the table, the
+  ID and the current mask.
+
+  The counters of each thread live in buffers of their own, which are
+  allocated the first time the thread reaches a site of a module and are
+  padded to whole cache lines, so counting doesn't synchronize with or
+  false-share with other threads.  The counts of threads that exit are
+  added to a set of retired counters.
+
+  ISPCInstrumentReport() prints, for each site that was reached, how often
+  it was, the average number of active program instances, how often none
+  was active, and the target and gang size that the site was compiled for.
+  If the ISPC_INSTRUMENT_REPORT environment variable is set, the report is
+  also written at exit, to the named file or to stderr if it is empty or
+  "-".
+
+  Programs compiled with --profile-generate call ISPCInstrumentSite() at
+  profile sites, whose counts ISPCInstrumentWriteProfile() writes to a
+  file that ispc reads with --profile-use.  If the ISPC_PROFILE_FILE
+  environment variable is set, the profile is also written to the named
+  file at exit.
+
+  The counters of other threads are read without synchronization, so the
+  report and the profile should be written when no ISPC code is running.
+*/
+
+#include <algorithm>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+// Version of the site tables that the compiler emits.
+#define ISPC_INSTRUMENT_TABLE_VERSION 1
+// Maximum number of modules whose sites are counted.
+#define ISPC_INSTRUMENT_MAX_TABLES 1024
+#define ISPC_INSTRUMENT_CACHE_LINE_SIZE 64
+
+// These have to match the tables that Module::emitInstrumentationTable()
+// emits.
+struct SiteInfo {
+    const char *file;
+    const char *function;
+    const char *note;
+    int32_t line;
+    int32_t column;
+};
+
+struct SiteTable {
+    int32_t version;
+    int32_t numSites;
+    int32_t maskWidth;
+    // Index of the table in tables[], assigned when a site of the module is
+    // first reached; -1 until then.
+    int32_t id;
+    const char *target;
+    const SiteInfo *sites;
+};
+
+struct SiteCounters {
+    uint64_t calls;
+    uint64_t activeLanes;
+    uint64_t allOff;
+    uint64_t allOn;
+};
+
+// The counters of one thread: counters[id] has the counters for the sites
+// of the table with the given id, or is NULL if the thread hasn't reached
+// any of them yet.
+struct ThreadCounters {
+    SiteCounters *counters[ISPC_INSTRUMENT_MAX_TABLES];
+};
+
+static std::mutex registryMutex;
+static std::vector<SiteTable *> tables;
+static std::vector<ThreadCounters *> liveThreads;
+static ThreadCounters retiredThreads;
+
+static thread_local ThreadCounters *threadCounters = NULL;
+
+// Retires the counters of the thread when it exits.
+struct ThreadCountersOwner {
+    ~ThreadCountersOwner();
+    ThreadCounters *counters = NULL;
+};
+static thread_local ThreadCountersOwner threadCountersOwner;
+
+static inline int32_t lLoadTableId(const SiteTable *table) {
+#ifdef _MSC_VER
+    return *(const volatile int32_t *)&table->id;
+#else
+    return __atomic_load_n(&table->id, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void lStoreTableId(SiteTable *table, int32_t id) {
+#ifdef _MSC_VER
+    *(volatile int32_t *)&table->id = id;
+#else
+    __atomic_store_n(&table->id, id, __ATOMIC_RELEASE);
+#endif
+}
+
+static inline uint64_t lPopcount(uint64_t v) {
+#if defined(__POPCNT__) && !defined(_MSC_VER)
+    return __builtin_popcountll(v);
+#else
+    // Without the popcnt instruction, __builtin_popcountll() is a library
+    // call.
+    v = v - ((v >> 1) & 0x5555555555555555ull);
+    v = (v & 0x3333333333333333ull) + ((v >> 2) & 0x3333333333333333ull);
+    v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (v * 0x0101010101010101ull) >> 56;
+#endif
+}
+
+static void *lAllocCacheLines(size_t size) {
+    size = (size + ISPC_INSTRUMENT_CACHE_LINE_SIZE - 1) & ~(size_t)(ISPC_INSTRUMENT_CACHE_LINE_SIZE - 1);
+#ifdef _MSC_VER
+    void *ptr = _aligned_malloc(size, ISPC_INSTRUMENT_CACHE_LINE_SIZE);
+#else
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, ISPC_INSTRUMENT_CACHE_LINE_SIZE, size) != 0)
+        ptr = NULL;
+#endif
+    if (ptr == NULL) {
+        fprintf(stderr, "ISPC instrumentation: out of memory\n");
+        abort();
+    }
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+static void lFreeCacheLines(void *ptr) {
+#ifdef _MSC_VER
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+// Returns the ID of the table, registering it if it's the first time
+// that one of its sites is reached.  Returns ISPC_INSTRUMENT_MAX_TABLES if
+// the sites of the table aren't counted.
+static int32_t lRegisterTable(SiteTable *table);
+
+// Allocates the counters for the sites of the table with the given ID in
+// the calling thread.
+static SiteCounters *lAllocThreadCounters(const SiteTable *table, int32_t id);
+
+static inline uint64_t lFullMask(const SiteTable *table) {
+    return table->maskWidth >= 64 ? ~0ull : (1ull << table->maskWidth) - 1;
+}
+
+static inline void lCount(SiteCounters &c, uint64_t mask, uint64_t fullMask) {
+    ++c.calls;
+    c.activeLanes += lPopcount(mask);
+    c.allOff += (mask == 0);
+    c.allOn += (mask == fullMask);
+}
+
+// Called for the first visit of the calling thread to a site of the table;
+// kept out of ISPCInstrumentSite() so that the common case stays cheap.
+#ifdef _MSC_VER
+static __declspec(noinline) void lCountFirstVisit(SiteTable *table, int32_t site, uint64_t mask);
+#else
+static __attribute__((noinline)) void lCountFirstVisit(SiteTable *table, int32_t site, uint64_t mask);
+#endif
+
+static void lWriteReport(FILE *f);
+static void lWriteProfile(FILE *f);
+static void lWriteReportAtExit();
+
+extern "C" {
+void ISPCInstrumentSite(void *tablePtr, int32_t site, uint64_t mask);
+void ISPCInstrumentReport(const char *fileName);
+void ISPCInstrumentReset(void);
+void ISPCInstrumentWriteProfile(const char *fileName);
+}
+
+void ISPCInstrumentSite(void *tablePtr, int32_t site, uint64_t mask) {
+    SiteTable *table = (SiteTable *)tablePtr;
+    int32_t id = lLoadTableId(table);
+    ThreadCounters *thread = threadCounters;
+    if (id >= 0 && id < ISPC_INSTRUMENT_MAX_TABLES && thread != NULL && thread->counters[id] != NULL)
+        lCount(thread->counters[id][site], mask, lFullMask(table));
+    else
+        lCountFirstVisit(table, site, mask);
+}
+
+static void lCountFirstVisit(SiteTable *table, int32_t site, uint64_t mask) {
+    int32_t id = lLoadTableId(table);
+    if (id < 0)
+        id = lRegisterTable(table);
+    if (id >= ISPC_INSTRUMENT_MAX_TABLES)
+        return;
+    lCount(lAllocThreadCounters(table, id)[site], mask, lFullMask(table));
+}
+
+static int32_t lRegisterTable(SiteTable *table) {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    int32_t id = lLoadTableId(table);
+    if (id >= 0)
+        return id;
+
+    if (table->version != ISPC_INSTRUMENT_TABLE_VERSION) {
+        fprintf(stderr,
+                "ISPC instrumentation: ignoring the sites of %s, which were compiled for another version of "
+                "the runtime\n",
+                table->numSites > 0 ? table->sites[0].file : "a module");
+        id = ISPC_INSTRUMENT_MAX_TABLES;
+    } else if (tables.size() == ISPC_INSTRUMENT_MAX_TABLES) {
+        fprintf(stderr, "ISPC instrumentation: too many modules, ignoring the sites of %s\n",
+                table->numSites > 0 ? table->sites[0].file : "a module");
+        id = ISPC_INSTRUMENT_MAX_TABLES;
+    } else {
+        if (tables.empty())
+            atexit(lWriteReportAtExit);
+        id = (int32_t)tables.size();
+        tables.push_back(table);
+    }
+    lStoreTableId(table, id);
+    return id;
+}
+
+static SiteCounters *lAllocThreadCounters(const SiteTable *table, int32_t id) {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    if (threadCounters == NULL) {
+        threadCounters = (ThreadCounters *)lAllocCacheLines(sizeof(ThreadCounters));
+        threadCountersOwner.counters = threadCounters;
+        liveThreads.push_back(threadCounters);
+    }
+    if (threadCounters->counters[id] == NULL)
+        threadCounters->counters[id] = (SiteCounters *)lAllocCacheLines(table->numSites * sizeof(SiteCounters));
+    return threadCounters->counters[id];
+}
+
+// Adds the counters of the given thread to the given totals, which have
+// one entry per site for each table.
+static void lAddCounters(const ThreadCounters *thread, std::vector<std::vector<SiteCounters>> *totals) {
+    for (size_t id = 0; id < tables.size(); ++id) {
+        const SiteCounters *counters = thread->counters[id];
+        if (counters == NULL)
+            continue;
+        for (int32_t site = 0; site < tables[id]->numSites; ++site) {
+            (*totals)[id][site].calls += counters[site].calls;
+            (*totals)[id][site].activeLanes += counters[site].activeLanes;
+            (*totals)[id][site].allOff += counters[site].allOff;
+            (*totals)[id][site].allOn += counters[site].allOn;
+        }
+    }
+}
+
+ThreadCountersOwner::~ThreadCountersOwner() {
+    if (counters == NULL)
+        return;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (size_t id = 0; id < tables.size(); ++id) {
+        SiteCounters *siteCounters = counters->counters[id];
+        if (siteCounters == NULL)
+            continue;
+        SiteCounters *&retired = retiredThreads.counters[id];
+        if (retired == NULL)
+            retired = (SiteCounters *)lAllocCacheLines(tables[id]->numSites * sizeof(SiteCounters));
+        for (int32_t site = 0; site < tables[id]->numSites; ++site) {
+            retired[site].calls += siteCounters[site].calls;
+            retired[site].activeLanes += siteCounters[site].activeLanes;
+            retired[site].allOff += siteCounters[site].allOff;
+            retired[site].allOn += siteCounters[site].allOn;
+        }
+        lFreeCacheLines(siteCounters);
+    }
+    liveThreads.erase(std::find(liveThreads.begin(), liveThreads.end(), counters));
+    lFreeCacheLines(counters);
+    threadCounters = NULL;
+    counters = NULL;
+}
+
+struct ReportEntry {
+    const SiteTable *table;
+    const SiteInfo *site;
+    SiteCounters counters;
+};
+
+static bool lReportOrder(const ReportEntry &a, const ReportEntry &b) {
+    int cmp = strcmp(a.site->file, b.site->file);
+    if (cmp != 0)
+        return cmp < 0;
+    if (a.site->line != b.site->line)
+        return a.site->line < b.site->line;
+    if (a.site->column != b.site->column)
+        return a.site->column < b.site->column;
+    cmp = strcmp(a.site->note, b.site->note);
+    if (cmp != 0)
+        return cmp < 0;
+    return strcmp(a.table->target, b.table->target) < 0;
+}
+
+// Returns the counts of all threads for the sites of all tables; if
+// reachedOnly is true, only for the sites that were reached.
+static std::vector<ReportEntry> lGetEntries(bool reachedOnly) {
+    std::vector<ReportEntry> entries;
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::vector<std::vector<SiteCounters>> totals;
+    for (size_t id = 0; id < tables.size(); ++id)
+        totals.push_back(std::vector<SiteCounters>(tables[id]->numSites, SiteCounters()));
+    lAddCounters(&retiredThreads, &totals);
+    for (const ThreadCounters *thread : liveThreads)
+        lAddCounters(thread, &totals);
+
+    for (size_t id = 0; id < tables.size(); ++id)
+        for (int32_t site = 0; site < tables[id]->numSites; ++site)
+            if (totals[id][site].calls > 0 || !reachedOnly) {
+                ReportEntry entry = {tables[id], &tables[id]->sites[site], totals[id][site]};
+                entries.push_back(entry);
+            }
+    return entries;
+}
+
+static void lWriteReport(FILE *f) {
+    std::vector<ReportEntry> entries = lGetEntries(true);
+    std::sort(entries.begin(), entries.end(), lReportOrder);
+
+    fprintf(f, "%14s  %-21s %8s  %-20s %s\n", "calls", "avg active lanes", "all off", "target", "site");
+    for (const ReportEntry &entry : entries) {
+        const SiteCounters &c = entry.counters;
+        double active = (double)c.activeLanes / (double)c.calls;
+        char width[64];
+        snprintf(width, sizeof(width), "%.2f / %d (%.1f%%)", active, entry.table->maskWidth,
+                 100. * active / entry.table->maskWidth);
+        fprintf(f, "%14llu  %-21s %7.2f%%  %-20s %s:%d:%d %s: %s\n", (unsigned long long)c.calls, width,
+                100. * (double)c.allOff / (double)c.calls, entry.table->target, entry.site->file, entry.site->line,
+                entry.site->column, entry.site->function, entry.site->note);
+    }
+}
+
+// The profile has the sites of every module that was run, including the
+// ones that weren't reached: that they weren't is what --profile-use
+// learns from them.  It has to match what ProfileData::Read() in ispc's
+// src/profile.cpp reads.
+static void lWriteProfile(FILE *f) {
+    std::vector<ReportEntry> entries = lGetEntries(false);
+    std::sort(entries.begin(), entries.end(), lReportOrder);
+
+    fprintf(f, "# ispc profile 1\n");
+    fprintf(f, "# calls, active lanes, lanes, all off, all on, line, column, file<tab>note\n");
+    for (const ReportEntry &entry : entries) {
+        const SiteCounters &c = entry.counters;
+        fprintf(f, "%llu %llu %llu %llu %llu %d %d %s\t%s\n", (unsigned long long)c.calls,
+                (unsigned long long)c.activeLanes, (unsigned long long)c.calls * entry.table->maskWidth,
+                (unsigned long long)c.allOff, (unsigned long long)c.allOn, entry.site->line, entry.site->column,
+                entry.site->file, entry.site->note);
+    }
+}
+
+static void lWriteReportAtExit() {
+    const char *fileName = getenv("ISPC_INSTRUMENT_REPORT");
+    if (fileName != NULL) {
+        if (fileName[0] == '\0' || !strcmp(fileName, "-")) {
+            fflush(stdout);
+            lWriteReport(stderr);
+        } else
+            ISPCInstrumentReport(fileName);
+    }
+
+    fileName = getenv("ISPC_PROFILE_FILE");
+    if (fileName != NULL && fileName[0] != '\0')
+        ISPCInstrumentWriteProfile(fileName);
+}
+
+void ISPCInstrumentReport(const char *fileName) {
+    if (fileName == NULL) {
+        lWriteReport(stdout);
+        return;
+    }
+    FILE *f = fopen(fileName, "w");
+    if (f == NULL) {
+        perror(fileName);
+        return;
+    }
+    lWriteReport(f);
+    fclose(f);
+}
+
+void ISPCInstrumentReset(void) {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (size_t id = 0; id < tables.size(); ++id) {
+        size_t size = tables[id]->numSites * sizeof(SiteCounters);
+        if (retiredThreads.counters[id] != NULL)
+            memset(retiredThreads.counters[id], 0, size);
+        for (ThreadCounters *thread : liveThreads)
+            if (thread->counters[id] != NULL)
+                memset(thread->counters[id], 0, size);
+    }
+}
+
+void ISPCInstrumentWriteProfile(const char *fileName) {
+    FILE *f = fopen(fileName, "w");
+    if (f == NULL) {
+        perror(fileName);
+        return;
+    }
+    lWriteProfile(f);
+    fclose(f);
+}
@@ -0,0 +1,159 @@
+// Copyright 2021 Intel Corporation
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "ispcrt.hpp"
+
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace ispcrt {
+namespace testing {
+namespace cpu {
+
+// State shared by the test and the kernels it launches
+struct KernelParams {
+    std::atomic<int> arrived{0};
+    std::atomic<int> met{0};
+    std::atomic<bool> release{false};
+    std::atomic<int> value{0};
+    int result{0};
+};
+
+// Waits until pred() is true, for at most a few seconds so that a broken
+// queue fails the test instead of hanging it.
+template <typename PRED> static bool waitFor(PRED pred) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!pred()) {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+} // namespace cpu
+} // namespace testing
+} // namespace ispcrt
+
+using ispcrt::testing::cpu::KernelParams;
+using ispcrt::testing::cpu::waitFor;
+
+// Kernels, found by the CPU device with dlsym() as <name>_cpu_entry_point
+
+// Only returns once another instance has started too.
+extern "C" void rendezvous_cpu_entry_point(void *p, size_t, size_t, size_t) {
+    auto *params = (KernelParams *)p;
+    params->arrived++;
+    if (waitFor([params]() { return params->arrived.load() >= 2; }))
+        params->met++;
+}
+
+extern "C" void slow_write_cpu_entry_point(void *p, size_t, size_t, size_t) {
+    auto *params = (KernelParams *)p;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    params->value = 42;
+}
+
+extern "C" void read_value_cpu_entry_point(void *p, size_t, size_t, size_t) {
+    auto *params = (KernelParams *)p;
+    params->result = params->value;
+}
+
+extern "C" void wait_for_release_cpu_entry_point(void *p, size_t, size_t, size_t) {
+    auto *params = (KernelParams *)p;
+    waitFor([params]() { return params->release.load(); });
+}
+
+namespace ispcrt {
+namespace testing {
+namespace cpu {
+
+class CPUTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        sm_rt_error = ISPCRT_NO_ERROR;
+        ispcrtSetErrorFunc([](ISPCRTError e, const char *m) { sm_rt_error = e; });
+        m_device = Device(ISPCRT_DEVICE_TYPE_CPU);
+        ASSERT_EQ(sm_rt_error, ISPCRT_NO_ERROR);
+        // An empty module name makes the device look the kernels up in the
+        // executable itself.
+        m_module = Module(m_device, "");
+        ASSERT_EQ(sm_rt_error, ISPCRT_NO_ERROR);
+        m_task_queue = TaskQueue(m_device);
+        ASSERT_EQ(sm_rt_error, ISPCRT_NO_ERROR);
+        m_params_dev = Array<KernelParams>(m_device, m_params);
+        ASSERT_EQ(sm_rt_error, ISPCRT_NO_ERROR);
+    }
+
+    void TearDown() override {
+        // Don't leave kernels running that refer to m_params.
+        m_task_queue.sync();
+        ASSERT_EQ(sm_rt_error, ISPCRT_NO_ERROR);
+    }
+
+    Kernel kernel(const char *name) {
+        Kernel k(m_device, m_module, name);
+        EXPECT_EQ(sm_rt_error, ISPCRT_NO_ERROR);
+        return k;
+    }
+
+    ispcrt::Device m_device;
+    ispcrt::Module m_module;
+    ispcrt::TaskQueue m_task_queue;
+    KernelParams m_params;
+    ispcrt::Array<KernelParams> m_params_dev;
+    // Same as for the mock tests: the ISPCRT error function has no context.
+    static ISPCRTError sm_rt_error;
+};
+
+ISPCRTError CPUTest::sm_rt_error;
+
+// The kernels launched between two barriers run at the same time: each of
+// them waits for the other one to start.
+TEST_F(CPUTest, TaskQueue_LaunchesRunConcurrently) {
+    if (std::thread::hardware_concurrency() < 2)
+        GTEST_SKIP() << "a single thread runs the CPU kernels";
+    auto k = kernel("rendezvous");
+    m_task_queue.barrier();
+    m_task_queue.launch(k, m_params_dev, 1);
+    m_task_queue.launch(k, m_params_dev, 1);
+    m_task_queue.barrier();
+    m_task_queue.sync();
+    ASSERT_EQ(sm_rt_error, ISPCRT_NO_ERROR);
+    EXPECT_EQ(m_params.arrived, 2);
+    EXPECT_EQ(m_params.met, 2);
+}
+
+// A kernel launched after a barrier sees what the kernels launched before it
+// have written, even if they take a while.
+TEST_F(CPUTest, TaskQueue_BarrierOrdersLaunches) {
+    auto writer = kernel("slow_write");
+    auto reader = kernel("read_value");
+    m_task_queue.launch(writer, m_params_dev, 1);
+    m_task_queue.barrier();
+    m_task_queue.launch(reader, m_params_dev, 1);
+    m_task_queue.sync();
+    ASSERT_EQ(sm_rt_error, ISPCRT_NO_ERROR);
+    EXPECT_EQ(m_params.result, 42);
+}
+
+// launch() returns before the kernel has run, and its future only becomes
+// valid once the kernel has finished.
+TEST_F(CPUTest, TaskQueue_FutureValidAfterSync) {
+    auto k = kernel("wait_for_release");
+    auto f = m_task_queue.launch(k, m_params_dev, 1);
+    ASSERT_EQ(sm_rt_error, ISPCRT_NO_ERROR);
+    ASSERT_TRUE(f);
+    EXPECT_FALSE(f.valid());
+    m_params.release = true;
+    m_task_queue.sync();
+    ASSERT_EQ(sm_rt_error, ISPCRT_NO_ERROR);
+    EXPECT_TRUE(f.valid());
+}
+
+} // namespace cpu
+} // namespace testing
+} // namespace ispcrt
@@ -0,0 +1,321 @@
+/*
+  Copyright (c) 2021, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** @file libispc.cpp
+    @brief Compiling ispc programs in the process with the regular front
+           end and optimizer and running them with LLVM's ORC JIT.
+*/
+
+#include "libispc.h"
+
+#include "ispc.h"
+#include "module.h"
+#include "target_enums.h"
+#include "util.h"
+
+#include <list>
+#include <mutex>
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetMachine.h>
+
+struct ispc::JITModule::Impl {
+    std::unique_ptr<llvm::orc::LLJIT> jit;
+    std::map<std::string, void *> functions;
+};
+
+ispc::JITModule::JITModule(std::unique_ptr<Impl> i, const std::string &t) : impl(std::move(i)), target(t) {}
+
+ispc::JITModule::~JITModule() {}
+
+void *ispc::JITModule::GetFunction(const std::string &name) const {
+    auto iter = impl->functions.find(name);
+    return iter != impl->functions.end() ? iter->second : NULL;
+}
+
+// The compiler keeps its state in globals, so compilations run one at a
+// time; this lock also protects the cache.
+static std::mutex lJITMutex;
+
+// All modules are compiled in the one LLVMContext of the compiler (which
+// also holds the parsed builtins), so the JIT shares it with them.
+static llvm::orc::ThreadSafeContext *lJITContext = NULL;
+
+static size_t lJITCacheMaxSize = 256;
+typedef std::list<std::pair<std::string, std::shared_ptr<ispc::JITModule>>> JITCacheList;
+static JITCacheList lJITCache;
+static std::map<std::string, JITCacheList::iterator> lJITCacheIndex;
+
+static void lInitJIT() {
+    if (lJITContext != NULL)
+        return;
+
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+
+    g = new Globals;
+    lJITContext = new llvm::orc::ThreadSafeContext(std::unique_ptr<llvm::LLVMContext>(g->ctx));
+}
+
+/** Resets the options in g to the defaults and then applies the given
+    ones, mirroring what main() does for the command line.  Returns false
+    if an option is invalid. */
+static bool lSetOptions(const ispc::JITOptions &options, std::string *errorMessage) {
+    llvm::LLVMContext *ctx = g->ctx;
+    *g = Globals();
+    delete g->ctx;
+    g->ctx = ctx;
+
+    g->calling_conv = CallingConv::defaultcall;
+    if (options.optLevel == 0) {
+        g->opt.level = 0;
+        g->codegenOptLevel = Globals::CodegenOptLevel::None;
+    } else {
+        g->opt.level = 1;
+        g->codegenOptLevel = Globals::CodegenOptLevel::Aggressive;
+    }
+    for (const std::string &define : options.defines)
+        g->cppArgs.push_back("-D" + define);
+    g->includePath = options.includePaths;
+
+    if (options.mathLib == "default")
+        g->mathLib = Globals::Math_ISPC;
+    else if (options.mathLib == "fast")
+        g->mathLib = Globals::Math_ISPCFast;
+    else if (options.mathLib == "svml")
+        g->mathLib = Globals::Math_SVML;
+    else if (options.mathLib == "system")
+        g->mathLib = Globals::Math_System;
+    else {
+        *errorMessage = "Unknown math library \"" + options.mathLib + "\".";
+        return false;
+    }
+
+    g->opt.fastMath = options.fastMath;
+    g->opt.disableAsserts = options.disableAsserts;
+    g->emitPerfWarnings = options.emitPerfWarnings;
+    g->disableWarnings = options.disableWarnings;
+    return true;
+}
+
+/** Returns the key of a compilation in the cache: a hash of everything that
+    determines the compiled code. */
+static std::string lGetCacheKey(const std::string &source, const ispc::JITOptions &options, const std::string &name) {
+    llvm::SHA1 hash;
+    auto add = [&](const std::string &str) {
+        hash.update(str);
+        // Separate the strings, so that their boundaries count too.
+        hash.update(llvm::StringRef("", 1));
+    };
+    add(name);
+    add(source);
+    add(options.target);
+    add(options.cpu);
+    add(std::to_string(options.optLevel));
+    for (const std::string &define : options.defines)
+        add("-D" + define);
+    for (const std::string &path : options.includePaths)
+        add("-I" + path);
+    add(options.mathLib);
+    add(std::to_string(options.fastMath) + std::to_string(options.disableAsserts) +
+        std::to_string(options.emitPerfWarnings) + std::to_string(options.disableWarnings));
+    for (const auto &symbol : options.symbols)
+        add(symbol.first + "=" + llvm::utohexstr((uint64_t)(uintptr_t)symbol.second));
+    return llvm::toHex(hash.final(), true /* lower case */);
+}
+
+static std::shared_ptr<ispc::JITModule> lCacheLookup(const std::string &key) {
+    auto iter = lJITCacheIndex.find(key);
+    if (iter == lJITCacheIndex.end())
+        return NULL;
+    // Move the entry to the front: it's now the most recently used one.
+    lJITCache.splice(lJITCache.begin(), lJITCache, iter->second);
+    return iter->second->second;
+}
+
+static void lCacheTrim() {
+    while (lJITCache.size() > lJITCacheMaxSize) {
+        lJITCacheIndex.erase(lJITCache.back().first);
+        lJITCache.pop_back();
+    }
+}
+
+static void lCacheInsert(const std::string &key, std::shared_ptr<ispc::JITModule> module) {
+    if (lJITCacheMaxSize == 0)
+        return;
+    lJITCache.push_front(std::make_pair(key, module));
+    lJITCacheIndex[key] = lJITCache.begin();
+    lCacheTrim();
+}
+
+/** Creates a JIT for code for the current target, with the given symbols
+    and those of the process available to the code. */
+static llvm::Expected<std::unique_ptr<llvm::orc::LLJIT>> lCreateJIT(const ispc::JITOptions &options) {
+    llvm::TargetMachine *targetMachine = g->target->GetTargetMachine();
+    llvm::orc::JITTargetMachineBuilder jtmb((llvm::Triple(g->target->GetTripleString())));
+    jtmb.setCPU(targetMachine->getTargetCPU().str());
+    jtmb.addFeatures(llvm::SubtargetFeatures(targetMachine->getTargetFeatureString()).getFeatures());
+    jtmb.setOptions(targetMachine->Options);
+    jtmb.setCodeGenOptLevel(g->codegenOptLevel == Globals::CodegenOptLevel::None ? llvm::CodeGenOpt::None
+                                                                                 : llvm::CodeGenOpt::Aggressive);
+
+    auto jit = llvm::orc::LLJITBuilder().setJITTargetMachineBuilder(std::move(jtmb)).create();
+    if (!jit)
+        return jit.takeError();
+
+    llvm::orc::JITDylib &dylib = (*jit)->getMainJITDylib();
+    if (!options.symbols.empty()) {
+        llvm::orc::MangleAndInterner mangle((*jit)->getExecutionSession(), (*jit)->getDataLayout());
+        llvm::orc::SymbolMap symbols;
+        for (const auto &symbol : options.symbols)
+            symbols[mangle(symbol.first)] = llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(symbol.second),
+                                                                     llvm::JITSymbolFlags::Exported);
+        if (llvm::Error err = dylib.define(llvm::orc::absoluteSymbols(std::move(symbols))))
+            return std::move(err);
+    }
+
+    auto processSymbols =
+        llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess((*jit)->getDataLayout().getGlobalPrefix());
+    if (!processSymbols)
+        return processSymbols.takeError();
+    dylib.addGenerator(std::move(*processSymbols));
+    return jit;
+}
+
+/** Compiles the source for the current target in g and JIT-compiles the
+    result.  Returns NULL (after setting errorMessage) on errors. */
+static std::unique_ptr<ispc::JITModule::Impl> lCompile(const std::string &source, const ispc::JITOptions &options,
+                                                       const std::string &name, std::string *errorMessage) {
+    m = new Module(name.c_str(), &source);
+    int errorCount = m->CompileFile();
+    std::unique_ptr<llvm::Module> module(m->module);
+    m->module = NULL;
+    delete m;
+    m = NULL;
+    if (errorCount > 0) {
+        *errorMessage =
+            std::to_string(errorCount) + " error" + (errorCount > 1 ? "s" : "") + " compiling " + name + ".";
+        return NULL;
+    }
+
+    // The functions that the module defines, which are compiled (all at
+    // once) and looked up below.
+    std::vector<std::string> functionNames;
+    for (llvm::Function &func : *module)
+        if (!func.isDeclaration() && !func.hasLocalLinkage())
+            functionNames.push_back(func.getName().str());
+
+    auto jit = lCreateJIT(options);
+    if (!jit) {
+        *errorMessage = llvm::toString(jit.takeError());
+        return NULL;
+    }
+    if (llvm::Error err = (*jit)->addIRModule(llvm::orc::ThreadSafeModule(std::move(module), *lJITContext))) {
+        *errorMessage = llvm::toString(std::move(err));
+        return NULL;
+    }
+
+    std::unique_ptr<ispc::JITModule::Impl> impl(new ispc::JITModule::Impl);
+    for (const std::string &functionName : functionNames) {
+        auto symbol = (*jit)->lookup(functionName);
+        if (!symbol) {
+            *errorMessage = llvm::toString(symbol.takeError());
+            return NULL;
+        }
+        impl->functions[functionName] = llvm::jitTargetAddressToPointer<void *>(symbol->getAddress());
+    }
+    impl->jit = std::move(*jit);
+    return impl;
+}
+
+std::shared_ptr<ispc::JITModule> ispc::JITCompile(const std::string &source, const JITOptions &options,
+                                                  const std::string &name, std::string *errorMessage) {
+    std::string localErrorMessage;
+    if (errorMessage == nullptr)
+        errorMessage = &localErrorMessage;
+
+    std::lock_guard<std::mutex> lock(lJITMutex);
+    std::string key = lGetCacheKey(source, options, name);
+    std::shared_ptr<JITModule> module = lCacheLookup(key);
+    if (module)
+        return module;
+
+    lInitJIT();
+    if (!lSetOptions(options, errorMessage))
+        return NULL;
+
+    ISPCTarget target = ISPCTarget::none;
+    if (!options.target.empty()) {
+        target = ParseISPCTarget(options.target);
+        if (target == ISPCTarget::error) {
+            *errorMessage = "Unknown target \"" + options.target + "\".";
+            return NULL;
+        }
+    }
+
+    // The JIT compiles with the context locked as well.
+    llvm::orc::ThreadSafeContext::Lock contextLock = lJITContext->getLock();
+    g->target = new Target(Arch::none, options.cpu.empty() ? NULL : options.cpu.c_str(), target, true /* PIC */, false);
+    if (g->target->isValid()) {
+        std::unique_ptr<JITModule::Impl> impl = lCompile(source, options, name, errorMessage);
+        if (impl)
+            module.reset(new JITModule(std::move(impl), ISPCTargetToString(g->target->getISPCTarget())));
+    } else
+        *errorMessage = "Target \"" + options.target + "\" isn't supported on this system.";
+    delete g->target;
+    g->target = NULL;
+
+    if (module)
+        lCacheInsert(key, module);
+    return module;
+}
+
+void ispc::SetJITCacheSize(size_t maxModules) {
+    std::lock_guard<std::mutex> lock(lJITMutex);
+    lJITCacheMaxSize = maxModules;
+    lCacheTrim();
+}
+
+void ispc::ClearJITCache() {
+    std::lock_guard<std::mutex> lock(lJITMutex);
+    lJITCache.clear();
+    lJITCacheIndex.clear();
+}
@@ -0,0 +1,142 @@
+/*
+  Copyright (c) 2021, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** @file libispc.h
+    @brief Compiling ispc programs at run time and calling them in the
+           same process.
+*/
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ispc {
+
+/** Options of a compilation with JITCompile().  They correspond to the
+    ispc command line options of the same names. */
+struct JITOptions {
+    /** Target ISA and width, as with --target (e.g. "avx2-i32x8").  By
+        default, the best one that the host supports. */
+    std::string target;
+
+    /** CPU to generate code for, as with --cpu.  By default, the CPU that
+        the target implies. */
+    std::string cpu;
+
+    /** Optimization level: 0 for -O0, anything else for -O2.  -O1 isn't
+        distinguished. */
+    int optLevel = 2;
+
+    /** Preprocessor definitions, as "NAME" or "NAME=VALUE" (-D). */
+    std::vector<std::string> defines;
+
+    /** Directories that #include searches (-I). */
+    std::vector<std::string> includePaths;
+
+    /** --math-lib: "default", "fast", "svml" or "system". */
+    std::string mathLib = "default";
+
+    /** --opt=fast-math. */
+    bool fastMath = false;
+
+    /** --opt=disable-assertions. */
+    bool disableAsserts = false;
+
+    /** --wno-perf and --woff. */
+    bool emitPerfWarnings = true;
+    bool disableWarnings = false;
+
+    /** Addresses of symbols that the program refers to but doesn't
+        define.  Symbols that aren't found here are looked up in the
+        process, which includes the task system (ISPCLaunch() and friends)
+        if the application links one in and exports it dynamically. */
+    std::map<std::string, void *> symbols;
+};
+
+/** A program that JITCompile() has compiled.  The code stays valid as
+    long as there's a reference to the module, including the one that the
+    cache of compiled modules holds. */
+class JITModule {
+  public:
+    ~JITModule();
+
+    /** Returns the address of the function with the given name, or NULL
+        if the module doesn't define it.  For 'export'ed functions, this
+        is their name in the ispc source.  The kernels of an ispcrt CPU
+        module are found as "<kernel>_cpu_entry_point". */
+    void *GetFunction(const std::string &name) const;
+
+    template <typename T> T *GetFunction(const std::string &name) const {
+        return reinterpret_cast<T *>(GetFunction(name));
+    }
+
+    /** The target that the module was compiled for. */
+    const std::string &GetTarget() const { return target; }
+
+    /** The JIT and compiled code; only libispc knows what's in it. */
+    struct Impl;
+
+  private:
+    friend std::shared_ptr<JITModule> JITCompile(const std::string &, const JITOptions &, const std::string &,
+                                                 std::string *);
+    JITModule(std::unique_ptr<Impl> impl, const std::string &target);
+
+    std::unique_ptr<Impl> impl;
+    std::string target;
+};
+
+/** Compiles the given ispc source and returns the module with its code,
+    ready to call.  The name is used in diagnostics and debug information.
+    Returns NULL if there were errors; they are printed to stderr like
+    those of the ispc executable and, if errorMessage is non-NULL, a
+    summary is stored there.
+
+    Compiled modules are cached in the process: compiling the same source
+    with the same options again returns the same module without compiling
+    anything.  Compilations may be started from any thread, but they run
+    one at a time. */
+std::shared_ptr<JITModule> JITCompile(const std::string &source, const JITOptions &options,
+                                      const std::string &name = "<jit>", std::string *errorMessage = nullptr);
+
+/** Sets how many modules the cache of compiled modules keeps; the least
+    recently used ones are dropped beyond that.  0 disables the cache.  The
+    default is 256. */
+void SetJITCacheSize(size_t maxModules);
+
+/** Drops all modules from the cache of compiled modules. */
+void ClearJITCache();
+
+} // namespace ispc
@@ -0,0 +1,176 @@
+/*
+  Copyright (c) 2021, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** @file libispc_tests.cpp
+    @brief Smoke test of libispc: compiles the ispc file given on the
+           command line with JITCompile(), calls the result and checks the
+           cache of compiled modules.  Exits with a non-zero status if a
+           check fails.
+*/
+
+#include "libispc.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+static int lFailures = 0;
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);                                   \
+            ++lFailures;                                                                                               \
+        }                                                                                                              \
+    } while (0)
+
+typedef int (*AddFunc)(int, int);
+typedef void (*ScaleFunc)(float *, int, float);
+
+// Compiles the source with the given value of OFFSET, which the add()
+// function adds to its result.
+static std::shared_ptr<ispc::JITModule> lCompile(const std::string &source, int offset) {
+    ispc::JITOptions options;
+    options.defines.push_back("OFFSET=" + std::to_string(offset));
+    std::string errorMessage;
+    std::shared_ptr<ispc::JITModule> module = ispc::JITCompile(source, options, "libispc_tests.ispc", &errorMessage);
+    if (!module)
+        fprintf(stderr, "compilation failed: %s\n", errorMessage.c_str());
+    return module;
+}
+
+static void lTestCall(const std::string &source) {
+    std::shared_ptr<ispc::JITModule> module = lCompile(source, 0);
+    CHECK(module != NULL);
+    if (!module)
+        return;
+
+    AddFunc add = module->GetFunction<int(int, int)>("add");
+    CHECK(add != NULL);
+    if (add != NULL)
+        CHECK(add(2, 3) == 5);
+
+    ScaleFunc scale = module->GetFunction<void(float *, int, float)>("scale");
+    CHECK(scale != NULL);
+    if (scale != NULL) {
+        // More elements than any target's width, and not a multiple of it.
+        std::vector<float> a(37);
+        for (int i = 0; i < (int)a.size(); ++i)
+            a[i] = (float)i;
+        scale(a.data(), (int)a.size(), 2.f);
+        for (int i = 0; i < (int)a.size(); ++i)
+            CHECK(a[i] == 2.f * i);
+    }
+
+    CHECK(module->GetFunction("no_such_function") == NULL);
+}
+
+static void lTestCache(const std::string &source) {
+    ispc::ClearJITCache();
+    ispc::SetJITCacheSize(1);
+
+    // The same source and options give the same module.
+    std::shared_ptr<ispc::JITModule> first = lCompile(source, 1);
+    CHECK(first != NULL);
+    CHECK(lCompile(source, 1) == first);
+
+    // With room for one module, another compilation evicts the first one,
+    // so compiling it again gives a new module.  The first one stays valid
+    // while it's referenced here.
+    std::shared_ptr<ispc::JITModule> second = lCompile(source, 2);
+    CHECK(second != NULL && second != first);
+    CHECK(lCompile(source, 2) == second);
+    std::shared_ptr<ispc::JITModule> again = lCompile(source, 1);
+    CHECK(again != NULL && again != first);
+    if (first != NULL && again != NULL) {
+        CHECK(first->GetFunction<int(int, int)>("add")(2, 3) == 6);
+        CHECK(again->GetFunction<int(int, int)>("add")(2, 3) == 6);
+    }
+
+    // Without a cache, every compilation gives a new module.
+    ispc::SetJITCacheSize(0);
+    std::shared_ptr<ispc::JITModule> uncached = lCompile(source, 1);
+    CHECK(uncached != NULL && uncached != again && lCompile(source, 1) != uncached);
+
+    ispc::SetJITCacheSize(256);
+    ispc::ClearJITCache();
+}
+
+static void lTestThreads(const std::string &source) {
+    // Threads compile a few different variants at the same time; all of
+    // them have to get working code, and the same module for the same
+    // variant.
+    const int numThreads = 8, numVariants = 3;
+    std::vector<std::shared_ptr<ispc::JITModule>> modules(numThreads);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i)
+        threads.push_back(std::thread([&, i]() { modules[i] = lCompile(source, i % numVariants); }));
+    for (std::thread &thread : threads)
+        thread.join();
+
+    for (int i = 0; i < numThreads; ++i) {
+        CHECK(modules[i] != NULL);
+        if (modules[i] == NULL)
+            continue;
+        CHECK(modules[i] == modules[i % numVariants]);
+        AddFunc add = modules[i]->GetFunction<int(int, int)>("add");
+        CHECK(add != NULL && add(2, 3) == 5 + i % numVariants);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: libispc_tests <file.ispc>\n");
+        return 1;
+    }
+    std::ifstream in(argv[1]);
+    if (!in) {
+        perror(argv[1]);
+        return 1;
+    }
+    std::stringstream source;
+    source << in.rdbuf();
+
+    lTestCall(source.str());
+    lTestCache(source.str());
+    lTestThreads(source.str());
+
+    if (lFailures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", lFailures);
+        return 1;
+    }
+    printf("PASSED\n");
+    return 0;
+}
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+#
+#  Copyright (c) 2021, Intel Corporation
+#  All rights reserved.
+#
+#  Redistribution and use in source and binary forms, with or without
+#  modification, are permitted provided that the following conditions are
+#  met:
+#
+#    * Redistributions of source code must retain the above copyright
+#      notice, this list of conditions and the following disclaimer.
+#
+#    * Redistributions in binary form must reproduce the above copyright
+#      notice, this list of conditions and the following disclaimer in the
+#      documentation and/or other materials provided with the distribution.
+#
+#    * Neither the name of Intel Corporation nor the names of its
+#      contributors may be used to endorse or promote products derived from
+#      this software without specific prior written permission.
+#
+#
+#   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+#   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+#   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+#   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+#   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+#   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+#   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+#   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+#   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+#   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+#   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+# Merges the JSON files written by "ispc --pass-stats=<file>" and prints the
+# optimization passes (or functions) that took the most time.  The records
+# of all files are added up, so the statistics of a whole build can be
+# combined with e.g. "pass_stats.py -o build.json $(find . -name '*.stats.json')".
+
+from optparse import OptionParser
+import json, sys
+
+COUNTERS = ['runs', 'changed', 'time_ns', 'instructions_before', 'instructions_after']
+
+def merge(file_names):
+    merged = {}
+    for file_name in file_names:
+        with open(file_name, 'r') as fp:
+            stats = json.load(fp)
+        for record in stats['passes']:
+            key = (record['target'], record['stage'], record['pass'], record['function'])
+            if key not in merged:
+                merged[key] = dict(record)
+            else:
+                for counter in COUNTERS:
+                    merged[key][counter] += record[counter]
+    return [merged[key] for key in sorted(merged.keys())]
+
+def summarize(records, field):
+    totals = {}
+    for record in records:
+        total = totals.setdefault(record[field], dict.fromkeys(COUNTERS, 0))
+        for counter in COUNTERS:
+            total[counter] += record[counter]
+    return sorted(totals.items(), key=lambda item: item[1]['time_ns'], reverse=True)
+
+if __name__ == '__main__':
+    parser = OptionParser(usage="Usage: pass_stats.py [options] <stats.json>...")
+    parser.add_option('-o', '--output', dest='output',
+        help='write the merged statistics to this file', default=None)
+    parser.add_option('-f', '--by-function', dest='by_function', action='store_true',
+        help='summarize by function rather than by pass', default=False)
+    parser.add_option('-n', '--top', dest='top', type='int',
+        help='number of passes or functions to print (default: 20)', default=20)
+    (options, args) = parser.parse_args()
+    if len(args) == 0:
+        parser.print_help()
+        sys.exit(1)
+
+    records = merge(args)
+    if options.output != None:
+        with open(options.output, 'w') as fp:
+            fp.write('{\n"source": "merged",\n"passes": [\n')
+            fp.write(',\n'.join(json.dumps(r, sort_keys=True, separators=(',', ':')) for r in records))
+            fp.write('\n]\n}\n')
+
+    field = 'function' if options.by_function else 'pass'
+    print("%12s %8s %8s %10s  %s" % ("time (ms)", "runs", "changed", "insts +/-", field))
+    for name, total in summarize(records, field)[:options.top]:
+        print("%12.3f %8d %8d %10d  %s" % (total['time_ns'] / 1e6, total['runs'], total['changed'],
+              total['instructions_after'] - total['instructions_before'], name))
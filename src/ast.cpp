@@ -44,7 +44,10 @@
 #include "sym.h"
 #include "util.h"
 
+#include <llvm/IR/Function.h>
 #include <llvm/Support/TimeProfiler.h>
+
+#include <set>
 ///////////////////////////////////////////////////////////////////////////
 // ASTNode
 
@@ -61,8 +64,44 @@ void AST::AddFunction(Symbol *sym, Stmt *code) {
 
 void AST::GenerateIR() {
     llvm::TimeTraceScope TimeScope("GenerateIR");
+
+    // The standard library defines several hundred functions, of which a
+    // typical program only calls a handful.  Rather than emitting IR for
+    // all of them (and then having the optimizer throw most of it away),
+    // we first emit everything else and then only materialize the stdlib
+    // functions that end up being referenced, iterating until no more new
+    // references show up.  If the user provided a definition for the same
+    // LLVM function, the stdlib one is emitted in order so that the
+    // redefinition is diagnosed as before.
+    std::set<llvm::Function *> eagerFunctions;
     for (unsigned int i = 0; i < functions.size(); ++i)
-        functions[i]->GenerateIR();
+        if (!functions[i]->IsLazilyMaterialized())
+            eagerFunctions.insert(functions[i]->GetLLVMFunction());
+
+    std::vector<Function *> deferred;
+    for (unsigned int i = 0; i < functions.size(); ++i) {
+        if (functions[i]->IsLazilyMaterialized() &&
+            eagerFunctions.find(functions[i]->GetLLVMFunction()) == eagerFunctions.end())
+            deferred.push_back(functions[i]);
+        else
+            functions[i]->GenerateIR();
+    }
+
+    bool emittedAny = true;
+    while (emittedAny) {
+        emittedAny = false;
+        for (unsigned int i = 0; i < deferred.size(); ++i) {
+            if (deferred[i] != NULL && deferred[i]->IsReferenced()) {
+                deferred[i]->GenerateIR();
+                deferred[i] = NULL;
+                emittedAny = true;
+            }
+        }
+    }
+
+    for (unsigned int i = 0; i < deferred.size(); ++i)
+        if (deferred[i] != NULL)
+            deferred[i]->Discard();
 }
 
 ///////////////////////////////////////////////////////////////////////////
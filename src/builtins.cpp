@@ -45,7 +45,10 @@
 #include "type.h"
 #include "util.h"
 
+#include <map>
 #include <math.h>
+#include <memory>
+#include <set>
 #include <stdlib.h>
 
 #include <llvm/ADT/Triple.h>
@@ -60,6 +63,8 @@
 #include <llvm/Linker/Linker.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
 
 #ifdef ISPC_GENX_ENABLED
 #include <llvm/GenXIntrinsics/GenXIntrinsics.h>
@@ -311,548 +316,644 @@ static void lCheckModuleIntrinsics(llvm::Module *module) {
     but instead mark them as internal after they've been linked in.  This
     is admittedly a kludge.
  */
-static void lSetInternalFunctions(llvm::Module *module) {
-    // clang-format off
-    const char *names[] = {
-        "__add_float",
-        "__add_int32",
-        "__add_uniform_double",
-        "__add_uniform_int32",
-        "__add_uniform_int64",
-        "__add_varying_double",
-        "__add_varying_int32",
-        "__add_varying_int64",
-        "__all",
-        "__any",
-        "__aos_to_soa2_double",
-        "__aos_to_soa2_double1",
-        "__aos_to_soa2_double16",
-        "__aos_to_soa2_double32",
-        "__aos_to_soa2_double4",
-        "__aos_to_soa2_double64",
-        "__aos_to_soa2_double8",
-        "__aos_to_soa2_float",
-        "__aos_to_soa2_float1",
-        "__aos_to_soa2_float16",
-        "__aos_to_soa2_float32",
-        "__aos_to_soa2_float4",
-        "__aos_to_soa2_float64",
-        "__aos_to_soa2_float8",
-        "__aos_to_soa3_double",
-        "__aos_to_soa3_double1",
-        "__aos_to_soa3_double16",
-        "__aos_to_soa3_double32",
-        "__aos_to_soa3_double4",
-        "__aos_to_soa3_double64",
-        "__aos_to_soa3_double8",
-        "__aos_to_soa3_float",
-        "__aos_to_soa3_float1",
-        "__aos_to_soa3_float16",
-        "__aos_to_soa3_float32",
-        "__aos_to_soa3_float4",
-        "__aos_to_soa3_float64",
-        "__aos_to_soa3_float8",
-        "__aos_to_soa4_double",
-        "__aos_to_soa4_double1",
-        "__aos_to_soa4_double16",
-        "__aos_to_soa4_double32",
-        "__aos_to_soa4_double4",
-        "__aos_to_soa4_double64",
-        "__aos_to_soa4_double8",
-        "__aos_to_soa4_float",
-        "__aos_to_soa4_float1",
-        "__aos_to_soa4_float16",
-        "__aos_to_soa4_float32",
-        "__aos_to_soa4_float4",
-        "__aos_to_soa4_float64",
-        "__aos_to_soa4_float8",
-        "__atomic_add_int32_global",
-        "__atomic_add_int64_global",
-        "__atomic_add_uniform_int32_global",
-        "__atomic_add_uniform_int64_global",
-        "__atomic_and_int32_global",
-        "__atomic_and_int64_global",
-        "__atomic_and_uniform_int32_global",
-        "__atomic_and_uniform_int64_global",
-        "__atomic_compare_exchange_double_global",
-        "__atomic_compare_exchange_float_global",
-        "__atomic_compare_exchange_int32_global",
-        "__atomic_compare_exchange_int64_global",
-        "__atomic_compare_exchange_uniform_double_global",
-        "__atomic_compare_exchange_uniform_float_global",
-        "__atomic_compare_exchange_uniform_int32_global",
-        "__atomic_compare_exchange_uniform_int64_global",
-        "__atomic_max_uniform_int32_global",
-        "__atomic_max_uniform_int64_global",
-        "__atomic_min_uniform_int32_global",
-        "__atomic_min_uniform_int64_global",
-        "__atomic_or_int32_global",
-        "__atomic_or_int64_global",
-        "__atomic_or_uniform_int32_global",
-        "__atomic_or_uniform_int64_global",
-        "__atomic_sub_int32_global",
-        "__atomic_sub_int64_global",
-        "__atomic_sub_uniform_int32_global",
-        "__atomic_sub_uniform_int64_global",
-        "__atomic_swap_double_global",
-        "__atomic_swap_float_global",
-        "__atomic_swap_int32_global",
-        "__atomic_swap_int64_global",
-        "__atomic_swap_uniform_double_global",
-        "__atomic_swap_uniform_float_global",
-        "__atomic_swap_uniform_int32_global",
-        "__atomic_swap_uniform_int64_global",
-        "__atomic_umax_uniform_uint32_global",
-        "__atomic_umax_uniform_uint64_global",
-        "__atomic_umin_uniform_uint32_global",
-        "__atomic_umin_uniform_uint64_global",
-        "__atomic_xor_int32_global",
-        "__atomic_xor_int64_global",
-        "__atomic_xor_uniform_int32_global",
-        "__atomic_xor_uniform_int64_global",
-        "__broadcast_double",
-        "__broadcast_float",
-        "__broadcast_i16",
-        "__broadcast_i32",
-        "__broadcast_i64",
-        "__broadcast_i8",
-        "__cast_mask_to_i1",
-        "__cast_mask_to_i8",
-        "__cast_mask_to_i16",
-        "__ceil_uniform_double",
-        "__ceil_uniform_float",
-        "__ceil_varying_double",
-        "__ceil_varying_float",
-        "__clock",
-        "__count_trailing_zeros_i32",
-        "__count_trailing_zeros_i64",
-        "__count_leading_zeros_i32",
-        "__count_leading_zeros_i64",
-        "__delete_uniform_32rt",
-        "__delete_uniform_64rt",
-        "__delete_varying_32rt",
-        "__delete_varying_64rt",
-        "__divs_ui64",
-        "__divs_vi64",
-        "__divus_ui64",
-        "__divus_vi64",
-        "__do_assume_uniform",
-        "__do_assert_uniform",
-        "__do_assert_varying",
-        "__do_print",
+// clang-format off
+static const char *lInternalFunctionNames[] = {
+    "__add_float",
+    "__add_int32",
+    "__add_uniform_double",
+    "__add_uniform_int32",
+    "__add_uniform_int64",
+    "__add_varying_double",
+    "__add_varying_int32",
+    "__add_varying_int64",
+    "__all",
+    "__any",
+    "__aos_to_soa2_double",
+    "__aos_to_soa2_double1",
+    "__aos_to_soa2_double16",
+    "__aos_to_soa2_double32",
+    "__aos_to_soa2_double4",
+    "__aos_to_soa2_double64",
+    "__aos_to_soa2_double8",
+    "__aos_to_soa2_float",
+    "__aos_to_soa2_float1",
+    "__aos_to_soa2_float16",
+    "__aos_to_soa2_float32",
+    "__aos_to_soa2_float4",
+    "__aos_to_soa2_float64",
+    "__aos_to_soa2_float8",
+    "__aos_to_soa3_double",
+    "__aos_to_soa3_double1",
+    "__aos_to_soa3_double16",
+    "__aos_to_soa3_double32",
+    "__aos_to_soa3_double4",
+    "__aos_to_soa3_double64",
+    "__aos_to_soa3_double8",
+    "__aos_to_soa3_float",
+    "__aos_to_soa3_float1",
+    "__aos_to_soa3_float16",
+    "__aos_to_soa3_float32",
+    "__aos_to_soa3_float4",
+    "__aos_to_soa3_float64",
+    "__aos_to_soa3_float8",
+    "__aos_to_soa4_double",
+    "__aos_to_soa4_double1",
+    "__aos_to_soa4_double16",
+    "__aos_to_soa4_double32",
+    "__aos_to_soa4_double4",
+    "__aos_to_soa4_double64",
+    "__aos_to_soa4_double8",
+    "__aos_to_soa4_float",
+    "__aos_to_soa4_float1",
+    "__aos_to_soa4_float16",
+    "__aos_to_soa4_float32",
+    "__aos_to_soa4_float4",
+    "__aos_to_soa4_float64",
+    "__aos_to_soa4_float8",
+    "__atomic_add_int32_global",
+    "__atomic_add_int64_global",
+    "__atomic_add_uniform_int32_global",
+    "__atomic_add_uniform_int32_global_acq_rel",
+    "__atomic_add_uniform_int32_global_acquire",
+    "__atomic_add_uniform_int32_global_relaxed",
+    "__atomic_add_uniform_int32_global_release",
+    "__atomic_add_uniform_int64_global",
+    "__atomic_add_uniform_int64_global_acq_rel",
+    "__atomic_add_uniform_int64_global_acquire",
+    "__atomic_add_uniform_int64_global_relaxed",
+    "__atomic_add_uniform_int64_global_release",
+    "__atomic_and_int32_global",
+    "__atomic_and_int64_global",
+    "__atomic_and_uniform_int32_global",
+    "__atomic_and_uniform_int32_global_acq_rel",
+    "__atomic_and_uniform_int32_global_acquire",
+    "__atomic_and_uniform_int32_global_relaxed",
+    "__atomic_and_uniform_int32_global_release",
+    "__atomic_and_uniform_int64_global",
+    "__atomic_and_uniform_int64_global_acq_rel",
+    "__atomic_and_uniform_int64_global_acquire",
+    "__atomic_and_uniform_int64_global_relaxed",
+    "__atomic_and_uniform_int64_global_release",
+    "__atomic_compare_exchange_double_global",
+    "__atomic_compare_exchange_float_global",
+    "__atomic_compare_exchange_int32_global",
+    "__atomic_compare_exchange_int64_global",
+    "__atomic_compare_exchange_uniform_double_global",
+    "__atomic_compare_exchange_uniform_float_global",
+    "__atomic_compare_exchange_uniform_int32_global",
+    "__atomic_compare_exchange_uniform_int64_global",
+    "__atomic_max_uniform_int32_global",
+    "__atomic_max_uniform_int32_global_acq_rel",
+    "__atomic_max_uniform_int32_global_acquire",
+    "__atomic_max_uniform_int32_global_relaxed",
+    "__atomic_max_uniform_int32_global_release",
+    "__atomic_max_uniform_int64_global",
+    "__atomic_max_uniform_int64_global_acq_rel",
+    "__atomic_max_uniform_int64_global_acquire",
+    "__atomic_max_uniform_int64_global_relaxed",
+    "__atomic_max_uniform_int64_global_release",
+    "__atomic_min_uniform_int32_global",
+    "__atomic_min_uniform_int32_global_acq_rel",
+    "__atomic_min_uniform_int32_global_acquire",
+    "__atomic_min_uniform_int32_global_relaxed",
+    "__atomic_min_uniform_int32_global_release",
+    "__atomic_min_uniform_int64_global",
+    "__atomic_min_uniform_int64_global_acq_rel",
+    "__atomic_min_uniform_int64_global_acquire",
+    "__atomic_min_uniform_int64_global_relaxed",
+    "__atomic_min_uniform_int64_global_release",
+    "__atomic_or_int32_global",
+    "__atomic_or_int64_global",
+    "__atomic_or_uniform_int32_global",
+    "__atomic_or_uniform_int32_global_acq_rel",
+    "__atomic_or_uniform_int32_global_acquire",
+    "__atomic_or_uniform_int32_global_relaxed",
+    "__atomic_or_uniform_int32_global_release",
+    "__atomic_or_uniform_int64_global",
+    "__atomic_or_uniform_int64_global_acq_rel",
+    "__atomic_or_uniform_int64_global_acquire",
+    "__atomic_or_uniform_int64_global_relaxed",
+    "__atomic_or_uniform_int64_global_release",
+    "__atomic_sub_int32_global",
+    "__atomic_sub_int64_global",
+    "__atomic_sub_uniform_int32_global",
+    "__atomic_sub_uniform_int32_global_acq_rel",
+    "__atomic_sub_uniform_int32_global_acquire",
+    "__atomic_sub_uniform_int32_global_relaxed",
+    "__atomic_sub_uniform_int32_global_release",
+    "__atomic_sub_uniform_int64_global",
+    "__atomic_sub_uniform_int64_global_acq_rel",
+    "__atomic_sub_uniform_int64_global_acquire",
+    "__atomic_sub_uniform_int64_global_relaxed",
+    "__atomic_sub_uniform_int64_global_release",
+    "__atomic_swap_double_global",
+    "__atomic_swap_float_global",
+    "__atomic_swap_int32_global",
+    "__atomic_swap_int64_global",
+    "__atomic_swap_uniform_double_global",
+    "__atomic_swap_uniform_double_global_acq_rel",
+    "__atomic_swap_uniform_double_global_acquire",
+    "__atomic_swap_uniform_double_global_relaxed",
+    "__atomic_swap_uniform_double_global_release",
+    "__atomic_swap_uniform_float_global",
+    "__atomic_swap_uniform_float_global_acq_rel",
+    "__atomic_swap_uniform_float_global_acquire",
+    "__atomic_swap_uniform_float_global_relaxed",
+    "__atomic_swap_uniform_float_global_release",
+    "__atomic_swap_uniform_int32_global",
+    "__atomic_swap_uniform_int32_global_acq_rel",
+    "__atomic_swap_uniform_int32_global_acquire",
+    "__atomic_swap_uniform_int32_global_relaxed",
+    "__atomic_swap_uniform_int32_global_release",
+    "__atomic_swap_uniform_int64_global",
+    "__atomic_swap_uniform_int64_global_acq_rel",
+    "__atomic_swap_uniform_int64_global_acquire",
+    "__atomic_swap_uniform_int64_global_relaxed",
+    "__atomic_swap_uniform_int64_global_release",
+    "__atomic_umax_uniform_uint32_global",
+    "__atomic_umax_uniform_uint32_global_acq_rel",
+    "__atomic_umax_uniform_uint32_global_acquire",
+    "__atomic_umax_uniform_uint32_global_relaxed",
+    "__atomic_umax_uniform_uint32_global_release",
+    "__atomic_umax_uniform_uint64_global",
+    "__atomic_umax_uniform_uint64_global_acq_rel",
+    "__atomic_umax_uniform_uint64_global_acquire",
+    "__atomic_umax_uniform_uint64_global_relaxed",
+    "__atomic_umax_uniform_uint64_global_release",
+    "__atomic_umin_uniform_uint32_global",
+    "__atomic_umin_uniform_uint32_global_acq_rel",
+    "__atomic_umin_uniform_uint32_global_acquire",
+    "__atomic_umin_uniform_uint32_global_relaxed",
+    "__atomic_umin_uniform_uint32_global_release",
+    "__atomic_umin_uniform_uint64_global",
+    "__atomic_umin_uniform_uint64_global_acq_rel",
+    "__atomic_umin_uniform_uint64_global_acquire",
+    "__atomic_umin_uniform_uint64_global_relaxed",
+    "__atomic_umin_uniform_uint64_global_release",
+    "__atomic_xor_int32_global",
+    "__atomic_xor_int64_global",
+    "__atomic_xor_uniform_int32_global",
+    "__atomic_xor_uniform_int32_global_acq_rel",
+    "__atomic_xor_uniform_int32_global_acquire",
+    "__atomic_xor_uniform_int32_global_relaxed",
+    "__atomic_xor_uniform_int32_global_release",
+    "__atomic_xor_uniform_int64_global",
+    "__atomic_xor_uniform_int64_global_acq_rel",
+    "__atomic_xor_uniform_int64_global_acquire",
+    "__atomic_xor_uniform_int64_global_relaxed",
+    "__atomic_xor_uniform_int64_global_release",
+    "__broadcast_double",
+    "__broadcast_float",
+    "__broadcast_i16",
+    "__broadcast_i32",
+    "__broadcast_i64",
+    "__broadcast_i8",
+    "__cast_mask_to_i1",
+    "__cast_mask_to_i8",
+    "__cast_mask_to_i16",
+    "__ceil_uniform_double",
+    "__ceil_uniform_float",
+    "__ceil_varying_double",
+    "__ceil_varying_float",
+    "__clock",
+    "__count_trailing_zeros_i32",
+    "__count_trailing_zeros_i64",
+    "__count_leading_zeros_i32",
+    "__count_leading_zeros_i64",
+    "__delete_uniform_32rt",
+    "__delete_uniform_64rt",
+    "__delete_varying_32rt",
+    "__delete_varying_64rt",
+    "__divs_ui64",
+    "__divs_vi64",
+    "__divus_ui64",
+    "__divus_vi64",
+    "__do_assume_uniform",
+    "__do_assert_uniform",
+    "__do_assert_varying",
+    "__do_print",
 #ifdef ISPC_GENX_ENABLED
-        "__do_print_cm",
-        "__do_print_lz",
-        "__do_print_cm_str",
-        "__send_eot",
+    "__do_print_cm",
+    "__do_print_lz",
+    "__do_print_cm_str",
+    "__send_eot",
 #endif //ISPC_GENX_ENABLED
-        "__doublebits_uniform_int64",
-        "__doublebits_varying_int64",
-        "__exclusive_scan_add_double",
-        "__exclusive_scan_add_float",
-        "__exclusive_scan_add_i32",
-        "__exclusive_scan_add_i64",
-        "__exclusive_scan_and_i32",
-        "__exclusive_scan_and_i64",
-        "__exclusive_scan_or_i32",
-        "__exclusive_scan_or_i64",
-        "__extract_bool",
-        "__extract_int16",
-        "__extract_int32",
-        "__extract_int64",
-        "__extract_int8",
-        "__extract_mask_low",
-        "__extract_mask_hi",
-        "__fastmath",
-        "__float_to_half_uniform",
-        "__float_to_half_varying",
-        "__floatbits_uniform_int32",
-        "__floatbits_varying_int32",
-        "__floor_uniform_double",
-        "__floor_uniform_float",
-        "__floor_varying_double",
-        "__floor_varying_float",
-        "__get_system_isa",
-        "__half_to_float_uniform",
-        "__half_to_float_varying",
-        "__idiv_uint8",
-        "__idiv_uint16",
-        "__idiv_uint32",
-        "__idiv_int8",
-        "__idiv_int16",
-        "__idiv_int32",
-        "__insert_bool",
-        "__insert_int16",
-        "__insert_int32",
-        "__insert_int64",
-        "__insert_int8",
-        "__intbits_uniform_double",
-        "__intbits_uniform_float",
-        "__intbits_varying_double",
-        "__intbits_varying_float",
-        "__max_uniform_double",
-        "__max_uniform_float",
-        "__max_uniform_int32",
-        "__max_uniform_int64",
-        "__max_uniform_uint32",
-        "__max_uniform_uint64",
-        "__max_varying_double",
-        "__max_varying_float",
-        "__max_varying_int32",
-        "__max_varying_int64",
-        "__max_varying_uint32",
-        "__max_varying_uint64",
-        "__memory_barrier",
-        "__memcpy32",
-        "__memcpy64",
-        "__memmove32",
-        "__memmove64",
-        "__memset32",
-        "__memset64",
-        "__min_uniform_double",
-        "__min_uniform_float",
-        "__min_uniform_int32",
-        "__min_uniform_int64",
-        "__min_uniform_uint32",
-        "__min_uniform_uint64",
-        "__min_varying_double",
-        "__min_varying_float",
-        "__min_varying_int32",
-        "__min_varying_int64",
-        "__min_varying_uint32",
-        "__min_varying_uint64",
-        "__movmsk",
-        "__new_uniform_32rt",
-        "__new_uniform_64rt",
-        "__new_varying32_32rt",
-        "__new_varying32_64rt",
-        "__new_varying64_64rt",
-        "__none",
-        "__num_cores",
-        "__packed_load_activei32",
-        "__packed_load_activei64",
-        "__packed_store_activei32",
-        "__packed_store_activei64",
-        "__packed_store_active2i32",
-        "__packed_store_active2i64",
-        "__padds_ui8",
-        "__padds_ui16",
-        "__padds_ui32",
-        "__padds_ui64",
-        "__padds_vi8",
-        "__padds_vi16",
-        "__padds_vi32",
-        "__padds_vi64",
-        "__paddus_ui8",
-        "__paddus_ui16",
-        "__paddus_ui32",
-        "__paddus_ui64",
-        "__paddus_vi8",
-        "__paddus_vi16",
-        "__paddus_vi32",
-        "__paddus_vi64",
-        "__pmuls_ui8",
-        "__pmuls_ui16",
-        "__pmuls_ui32",
-        "__pmuls_vi8",
-        "__pmuls_vi16",
-        "__pmuls_vi32",
-        "__pmulus_ui8",
-        "__pmulus_ui16",
-        "__pmulus_ui32",
-        "__pmulus_vi8",
-        "__pmulus_vi16",
-        "__pmulus_vi32",
-        "__popcnt_int32",
-        "__popcnt_int64",
-        "__prefetch_read_uniform_1",
-        "__prefetch_read_uniform_2",
-        "__prefetch_read_uniform_3",
-        "__prefetch_read_uniform_nt",
-        "__pseudo_prefetch_read_varying_1",
-        "__pseudo_prefetch_read_varying_2",
-        "__pseudo_prefetch_read_varying_3",
-        "__pseudo_prefetch_read_varying_nt",
-        "__psubs_ui8",
-        "__psubs_ui16",
-        "__psubs_ui32",
-        "__psubs_ui64",
-        "__psubs_vi8",
-        "__psubs_vi16",
-        "__psubs_vi32",
-        "__psubs_vi64",
-        "__psubus_ui8",
-        "__psubus_ui16",
-        "__psubus_ui32",
-        "__psubus_ui64",
-        "__psubus_vi8",
-        "__psubus_vi16",
-        "__psubus_vi32",
-        "__psubus_vi64",
-        "__rcp_fast_uniform_float",
-        "__rcp_uniform_float",
-        "__rcp_fast_varying_float",
-        "__rcp_varying_float",
-        "__rcp_uniform_double",
-        "__rcp_varying_double",
-        "__rdrand_i16",
-        "__rdrand_i32",
-        "__rdrand_i64",
-        "__reduce_add_double",
-        "__reduce_add_float",
-        "__reduce_add_int8",
-        "__reduce_add_int16",
-        "__reduce_add_int32",
-        "__reduce_add_int64",
-        "__reduce_equal_double",
-        "__reduce_equal_float",
-        "__reduce_equal_int32",
-        "__reduce_equal_int64",
-        "__reduce_max_double",
-        "__reduce_max_float",
-        "__reduce_max_int32",
-        "__reduce_max_int64",
-        "__reduce_max_uint32",
-        "__reduce_max_uint64",
-        "__reduce_min_double",
-        "__reduce_min_float",
-        "__reduce_min_int32",
-        "__reduce_min_int64",
-        "__reduce_min_uint32",
-        "__reduce_min_uint64",
-        "__rems_ui64",
-        "__rems_vi64",
-        "__remus_ui64",
-        "__remus_vi64",
-        "__rotate_double",
-        "__rotate_float",
-        "__rotate_i16",
-        "__rotate_i32",
-        "__rotate_i64",
-        "__rotate_i8",
-        "__round_uniform_double",
-        "__round_uniform_float",
-        "__round_varying_double",
-        "__round_varying_float",
-        "__rsqrt_fast_varying_float",
-        "__rsqrt_uniform_float",
-        "__rsqrt_fast_uniform_float",
-        "__rsqrt_varying_float",
-        "__rsqrt_uniform_double",
-        "__rsqrt_varying_double",
-        "__saturating_add_i8",
-        "__saturating_add_i16",
-        "__saturating_add_i32",
-        "__saturating_add_i64",
-        "__saturating_add_ui8",
-        "__saturating_add_ui16",
-        "__saturating_add_ui32",
-        "__saturating_add_ui64",
-        "__saturating_mul_i8",
-        "__saturating_mul_i16",
-        "__saturating_mul_i32",
-        "__saturating_mul_ui8",
-        "__saturating_mul_ui16",
-        "__saturating_mul_ui32",
-        "__set_system_isa",
-        "__sext_uniform_bool",
-        "__sext_varying_bool",
-        "__shift_double",
-        "__shift_float",
-        "__shift_i16",
-        "__shift_i32",
-        "__shift_i64",
-        "__shift_i8",
-        "__shuffle2_double",
-        "__shuffle2_float",
-        "__shuffle2_i16",
-        "__shuffle2_i32",
-        "__shuffle2_i64",
-        "__shuffle2_i8",
-        "__shuffle_double",
-        "__shuffle_float",
-        "__shuffle_i16",
-        "__shuffle_i32",
-        "__shuffle_i64",
-        "__shuffle_i8",
-        "__soa_to_aos2_double",
-        "__soa_to_aos2_double1",
-        "__soa_to_aos2_double16",
-        "__soa_to_aos2_double32",
-        "__soa_to_aos2_double4",
-        "__soa_to_aos2_double64",
-        "__soa_to_aos2_double8",
-        "__soa_to_aos2_float",
-        "__soa_to_aos2_float1",
-        "__soa_to_aos2_float16",
-        "__soa_to_aos2_float32",
-        "__soa_to_aos2_float4",
-        "__soa_to_aos2_float64",
-        "__soa_to_aos2_float8",
-        "__soa_to_aos3_double",
-        "__soa_to_aos3_double1",
-        "__soa_to_aos3_double16",
-        "__soa_to_aos3_double32",
-        "__soa_to_aos3_double4",
-        "__soa_to_aos3_double64",
-        "__soa_to_aos3_double8",
-        "__soa_to_aos3_float",
-        "__soa_to_aos3_float1",
-        "__soa_to_aos3_float16",
-        "__soa_to_aos3_float32",
-        "__soa_to_aos3_float4",
-        "__soa_to_aos3_float64",
-        "__soa_to_aos3_float8",
-        "__soa_to_aos4_double",
-        "__soa_to_aos4_double1",
-        "__soa_to_aos4_double16",
-        "__soa_to_aos4_double32",
-        "__soa_to_aos4_double4",
-        "__soa_to_aos4_double64",
-        "__soa_to_aos4_double8",
-        "__soa_to_aos4_float",
-        "__soa_to_aos4_float1",
-        "__soa_to_aos4_float16",
-        "__soa_to_aos4_float32",
-        "__soa_to_aos4_float4",
-        "__soa_to_aos4_float64",
-        "__soa_to_aos4_float8",
-        "__sqrt_uniform_double",
-        "__sqrt_uniform_float",
-        "__sqrt_varying_double",
-        "__sqrt_varying_float",
-        "__stdlib_acosf",
-        "__stdlib_asinf",
-        "__stdlib_atan",
-        "__stdlib_atan2",
-        "__stdlib_atan2f",
-        "__stdlib_atanf",
-        "__stdlib_cos",
-        "__stdlib_cosf",
-        "__stdlib_exp",
-        "__stdlib_expf",
-        "__stdlib_log",
-        "__stdlib_logf",
-        "__stdlib_pow",
-        "__stdlib_powf",
-        "__stdlib_sin",
-        "__stdlib_asin",
-        "__stdlib_sincos",
-        "__stdlib_sincosf",
-        "__stdlib_sinf",
-        "__stdlib_tan",
-        "__stdlib_tanf",
-        "__streaming_load_uniform_double",
-        "__streaming_load_uniform_float",
-        "__streaming_load_uniform_i8",
-        "__streaming_load_uniform_i16",
-        "__streaming_load_uniform_i32",
-        "__streaming_load_uniform_i64",
-        "__streaming_load_varying_double",
-        "__streaming_load_varying_float",
-        "__streaming_load_varying_i8",
-        "__streaming_load_varying_i16",
-        "__streaming_load_varying_i32",
-        "__streaming_load_varying_i64",
-        "__streaming_store_uniform_double",
-        "__streaming_store_uniform_float",
-        "__streaming_store_uniform_i8",
-        "__streaming_store_uniform_i16",
-        "__streaming_store_uniform_i32",
-        "__streaming_store_uniform_i64",
-        "__streaming_store_varying_double",
-        "__streaming_store_varying_float",
-        "__streaming_store_varying_i8",
-        "__streaming_store_varying_i16",
-        "__streaming_store_varying_i32",
-        "__streaming_store_varying_i64",
-        "__svml_sind",
-        "__svml_asind",
-        "__svml_cosd",
-        "__svml_acosd",
-        "__svml_sincosd",
-        "__svml_tand",
-        "__svml_atand",
-        "__svml_atan2d",
-        "__svml_expd",
-        "__svml_logd",
-        "__svml_powd",
-        "__svml_sinf",
-        "__svml_asinf",
-        "__svml_cosf",
-        "__svml_acosf",
-        "__svml_sincosf",
-        "__svml_tanf",
-        "__svml_atanf",
-        "__svml_atan2f",
-        "__svml_expf",
-        "__svml_logf",
-        "__svml_powf",
-        "__log_uniform_float",
-        "__log_varying_float",
-        "__exp_uniform_float",
-        "__exp_varying_float",
-        "__pow_uniform_float",
-        "__pow_varying_float",
-        "__log_uniform_double",
-        "__log_varying_double",
-        "__exp_uniform_double",
-        "__exp_varying_double",
-        "__pow_uniform_double",
-        "__pow_varying_double",
-        "__sin_varying_float",
-        "__asin_varying_float",
-        "__cos_varying_float",
-        "__acos_varying_float",
-        "__sincos_varying_float",
-        "__tan_varying_float",
-        "__atan_varying_float",
-        "__atan2_varying_float",
-        "__sin_uniform_float",
-        "__asin_uniform_float",
-        "__cos_uniform_float",
-        "__acos_uniform_float",
-        "__sincos_uniform_float",
-        "__tan_uniform_float",
-        "__atan_uniform_float",
-        "__atan2_uniform_float",
-        "__sin_varying_double",
-        "__asin_varying_double",
-        "__cos_varying_double",
-        "__acos_varying_double",
-        "__sincos_varying_double",
-        "__tan_varying_double",
-        "__atan_varying_double",
-        "__atan2_varying_double",
-        "__sin_uniform_double",
-        "__asin_uniform_double",
-        "__cos_uniform_double",
-        "__acos_uniform_double",
-        "__sincos_uniform_double",
-        "__tan_uniform_double",
-        "__atan_uniform_double",
-        "__atan2_uniform_double",
-        "__undef_uniform",
-        "__undef_varying",
-        "__vec4_add_float",
-        "__vec4_add_int32",
-        "__vselect_float",
-        "__vselect_i32",
-        "ISPCAlloc",
-        "ISPCLaunch",
-        "ISPCSync",
+    "__doublebits_uniform_int64",
+    "__doublebits_varying_int64",
+    "__exclusive_scan_add_double",
+    "__exclusive_scan_add_float",
+    "__exclusive_scan_add_i32",
+    "__exclusive_scan_add_i64",
+    "__exclusive_scan_and_i32",
+    "__exclusive_scan_and_i64",
+    "__exclusive_scan_or_i32",
+    "__exclusive_scan_or_i64",
+    "__extract_bool",
+    "__extract_int16",
+    "__extract_int32",
+    "__extract_int64",
+    "__extract_int8",
+    "__extract_mask_low",
+    "__extract_mask_hi",
+    "__fastmath",
+    "__float_to_half_uniform",
+    "__float_to_half_varying",
+    "__floatbits_uniform_int32",
+    "__floatbits_varying_int32",
+    "__floor_uniform_double",
+    "__floor_uniform_float",
+    "__floor_varying_double",
+    "__floor_varying_float",
+    "__get_system_cpu_model",
+    "__get_system_isa",
+    "__half_to_float_uniform",
+    "__half_to_float_varying",
+    "__idiv_uint8",
+    "__idiv_uint16",
+    "__idiv_uint32",
+    "__idiv_int8",
+    "__idiv_int16",
+    "__idiv_int32",
+    "__insert_bool",
+    "__insert_int16",
+    "__insert_int32",
+    "__insert_int64",
+    "__insert_int8",
+    "__intbits_uniform_double",
+    "__intbits_uniform_float",
+    "__intbits_varying_double",
+    "__intbits_varying_float",
+    "__max_uniform_double",
+    "__max_uniform_float",
+    "__max_uniform_int32",
+    "__max_uniform_int64",
+    "__max_uniform_uint32",
+    "__max_uniform_uint64",
+    "__max_varying_double",
+    "__max_varying_float",
+    "__max_varying_int32",
+    "__max_varying_int64",
+    "__max_varying_uint32",
+    "__max_varying_uint64",
+    "__memory_barrier",
+    "__memcpy32",
+    "__memcpy64",
+    "__memmove32",
+    "__memmove64",
+    "__memset32",
+    "__memset64",
+    "__min_uniform_double",
+    "__min_uniform_float",
+    "__min_uniform_int32",
+    "__min_uniform_int64",
+    "__min_uniform_uint32",
+    "__min_uniform_uint64",
+    "__min_varying_double",
+    "__min_varying_float",
+    "__min_varying_int32",
+    "__min_varying_int64",
+    "__min_varying_uint32",
+    "__min_varying_uint64",
+    "__movmsk",
+    "__new_uniform_32rt",
+    "__new_uniform_64rt",
+    "__new_varying32_32rt",
+    "__new_varying32_64rt",
+    "__new_varying64_64rt",
+    "__none",
+    "__num_cores",
+    "__packed_load_activei32",
+    "__packed_load_activei64",
+    "__packed_store_activei32",
+    "__packed_store_activei64",
+    "__packed_store_active2i32",
+    "__packed_store_active2i64",
+    "__padds_ui8",
+    "__padds_ui16",
+    "__padds_ui32",
+    "__padds_ui64",
+    "__padds_vi8",
+    "__padds_vi16",
+    "__padds_vi32",
+    "__padds_vi64",
+    "__paddus_ui8",
+    "__paddus_ui16",
+    "__paddus_ui32",
+    "__paddus_ui64",
+    "__paddus_vi8",
+    "__paddus_vi16",
+    "__paddus_vi32",
+    "__paddus_vi64",
+    "__pmuls_ui8",
+    "__pmuls_ui16",
+    "__pmuls_ui32",
+    "__pmuls_vi8",
+    "__pmuls_vi16",
+    "__pmuls_vi32",
+    "__pmulus_ui8",
+    "__pmulus_ui16",
+    "__pmulus_ui32",
+    "__pmulus_vi8",
+    "__pmulus_vi16",
+    "__pmulus_vi32",
+    "__popcnt_int32",
+    "__popcnt_int64",
+    "__prefetch_read_uniform_1",
+    "__prefetch_read_uniform_2",
+    "__prefetch_read_uniform_3",
+    "__prefetch_read_uniform_nt",
+    "__pseudo_prefetch_read_varying_1",
+    "__pseudo_prefetch_read_varying_2",
+    "__pseudo_prefetch_read_varying_3",
+    "__pseudo_prefetch_read_varying_nt",
+    "__psubs_ui8",
+    "__psubs_ui16",
+    "__psubs_ui32",
+    "__psubs_ui64",
+    "__psubs_vi8",
+    "__psubs_vi16",
+    "__psubs_vi32",
+    "__psubs_vi64",
+    "__psubus_ui8",
+    "__psubus_ui16",
+    "__psubus_ui32",
+    "__psubus_ui64",
+    "__psubus_vi8",
+    "__psubus_vi16",
+    "__psubus_vi32",
+    "__psubus_vi64",
+    "__rcp_fast_uniform_float",
+    "__rcp_uniform_float",
+    "__rcp_fast_varying_float",
+    "__rcp_varying_float",
+    "__rcp_uniform_double",
+    "__rcp_varying_double",
+    "__rdrand_i16",
+    "__rdrand_i32",
+    "__rdrand_i64",
+    "__reduce_add_double",
+    "__reduce_add_float",
+    "__reduce_add_int8",
+    "__reduce_add_int16",
+    "__reduce_add_int32",
+    "__reduce_add_int64",
+    "__reduce_equal_double",
+    "__reduce_equal_float",
+    "__reduce_equal_int32",
+    "__reduce_equal_int64",
+    "__reduce_max_double",
+    "__reduce_max_float",
+    "__reduce_max_int32",
+    "__reduce_max_int64",
+    "__reduce_max_uint32",
+    "__reduce_max_uint64",
+    "__reduce_min_double",
+    "__reduce_min_float",
+    "__reduce_min_int32",
+    "__reduce_min_int64",
+    "__reduce_min_uint32",
+    "__reduce_min_uint64",
+    "__rems_ui64",
+    "__rems_vi64",
+    "__remus_ui64",
+    "__remus_vi64",
+    "__rotate_double",
+    "__rotate_float",
+    "__rotate_i16",
+    "__rotate_i32",
+    "__rotate_i64",
+    "__rotate_i8",
+    "__round_uniform_double",
+    "__round_uniform_float",
+    "__round_varying_double",
+    "__round_varying_float",
+    "__rsqrt_fast_varying_float",
+    "__rsqrt_uniform_float",
+    "__rsqrt_fast_uniform_float",
+    "__rsqrt_varying_float",
+    "__rsqrt_uniform_double",
+    "__rsqrt_varying_double",
+    "__saturating_add_i8",
+    "__saturating_add_i16",
+    "__saturating_add_i32",
+    "__saturating_add_i64",
+    "__saturating_add_ui8",
+    "__saturating_add_ui16",
+    "__saturating_add_ui32",
+    "__saturating_add_ui64",
+    "__saturating_mul_i8",
+    "__saturating_mul_i16",
+    "__saturating_mul_i32",
+    "__saturating_mul_ui8",
+    "__saturating_mul_ui16",
+    "__saturating_mul_ui32",
+    "__set_system_cpu_model",
+    "__set_system_isa",
+    "__sext_uniform_bool",
+    "__sext_varying_bool",
+    "__shift_double",
+    "__shift_float",
+    "__shift_i16",
+    "__shift_i32",
+    "__shift_i64",
+    "__shift_i8",
+    "__shuffle2_double",
+    "__shuffle2_float",
+    "__shuffle2_i16",
+    "__shuffle2_i32",
+    "__shuffle2_i64",
+    "__shuffle2_i8",
+    "__shuffle_double",
+    "__shuffle_float",
+    "__shuffle_i16",
+    "__shuffle_i32",
+    "__shuffle_i64",
+    "__shuffle_i8",
+    "__soa_to_aos2_double",
+    "__soa_to_aos2_double1",
+    "__soa_to_aos2_double16",
+    "__soa_to_aos2_double32",
+    "__soa_to_aos2_double4",
+    "__soa_to_aos2_double64",
+    "__soa_to_aos2_double8",
+    "__soa_to_aos2_float",
+    "__soa_to_aos2_float1",
+    "__soa_to_aos2_float16",
+    "__soa_to_aos2_float32",
+    "__soa_to_aos2_float4",
+    "__soa_to_aos2_float64",
+    "__soa_to_aos2_float8",
+    "__soa_to_aos3_double",
+    "__soa_to_aos3_double1",
+    "__soa_to_aos3_double16",
+    "__soa_to_aos3_double32",
+    "__soa_to_aos3_double4",
+    "__soa_to_aos3_double64",
+    "__soa_to_aos3_double8",
+    "__soa_to_aos3_float",
+    "__soa_to_aos3_float1",
+    "__soa_to_aos3_float16",
+    "__soa_to_aos3_float32",
+    "__soa_to_aos3_float4",
+    "__soa_to_aos3_float64",
+    "__soa_to_aos3_float8",
+    "__soa_to_aos4_double",
+    "__soa_to_aos4_double1",
+    "__soa_to_aos4_double16",
+    "__soa_to_aos4_double32",
+    "__soa_to_aos4_double4",
+    "__soa_to_aos4_double64",
+    "__soa_to_aos4_double8",
+    "__soa_to_aos4_float",
+    "__soa_to_aos4_float1",
+    "__soa_to_aos4_float16",
+    "__soa_to_aos4_float32",
+    "__soa_to_aos4_float4",
+    "__soa_to_aos4_float64",
+    "__soa_to_aos4_float8",
+    "__sqrt_uniform_double",
+    "__sqrt_uniform_float",
+    "__sqrt_varying_double",
+    "__sqrt_varying_float",
+    "__stdlib_acosf",
+    "__stdlib_asinf",
+    "__stdlib_atan",
+    "__stdlib_atan2",
+    "__stdlib_atan2f",
+    "__stdlib_atanf",
+    "__stdlib_cos",
+    "__stdlib_cosf",
+    "__stdlib_exp",
+    "__stdlib_expf",
+    "__stdlib_log",
+    "__stdlib_logf",
+    "__stdlib_pow",
+    "__stdlib_powf",
+    "__stdlib_sin",
+    "__stdlib_asin",
+    "__stdlib_sincos",
+    "__stdlib_sincosf",
+    "__stdlib_sinf",
+    "__stdlib_tan",
+    "__stdlib_tanf",
+    "__streaming_load_uniform_double",
+    "__streaming_load_uniform_float",
+    "__streaming_load_uniform_i8",
+    "__streaming_load_uniform_i16",
+    "__streaming_load_uniform_i32",
+    "__streaming_load_uniform_i64",
+    "__streaming_load_varying_double",
+    "__streaming_load_varying_float",
+    "__streaming_load_varying_i8",
+    "__streaming_load_varying_i16",
+    "__streaming_load_varying_i32",
+    "__streaming_load_varying_i64",
+    "__streaming_store_uniform_double",
+    "__streaming_store_uniform_float",
+    "__streaming_store_uniform_i8",
+    "__streaming_store_uniform_i16",
+    "__streaming_store_uniform_i32",
+    "__streaming_store_uniform_i64",
+    "__streaming_store_varying_double",
+    "__streaming_store_varying_float",
+    "__streaming_store_varying_i8",
+    "__streaming_store_varying_i16",
+    "__streaming_store_varying_i32",
+    "__streaming_store_varying_i64",
+    "__svml_sind",
+    "__svml_asind",
+    "__svml_cosd",
+    "__svml_acosd",
+    "__svml_sincosd",
+    "__svml_tand",
+    "__svml_atand",
+    "__svml_atan2d",
+    "__svml_expd",
+    "__svml_logd",
+    "__svml_powd",
+    "__svml_sinf",
+    "__svml_asinf",
+    "__svml_cosf",
+    "__svml_acosf",
+    "__svml_sincosf",
+    "__svml_tanf",
+    "__svml_atanf",
+    "__svml_atan2f",
+    "__svml_expf",
+    "__svml_logf",
+    "__svml_powf",
+    "__log_uniform_float",
+    "__log_varying_float",
+    "__exp_uniform_float",
+    "__exp_varying_float",
+    "__pow_uniform_float",
+    "__pow_varying_float",
+    "__log_uniform_double",
+    "__log_varying_double",
+    "__exp_uniform_double",
+    "__exp_varying_double",
+    "__pow_uniform_double",
+    "__pow_varying_double",
+    "__sin_varying_float",
+    "__asin_varying_float",
+    "__cos_varying_float",
+    "__acos_varying_float",
+    "__sincos_varying_float",
+    "__tan_varying_float",
+    "__atan_varying_float",
+    "__atan2_varying_float",
+    "__sin_uniform_float",
+    "__asin_uniform_float",
+    "__cos_uniform_float",
+    "__acos_uniform_float",
+    "__sincos_uniform_float",
+    "__tan_uniform_float",
+    "__atan_uniform_float",
+    "__atan2_uniform_float",
+    "__sin_varying_double",
+    "__asin_varying_double",
+    "__cos_varying_double",
+    "__acos_varying_double",
+    "__sincos_varying_double",
+    "__tan_varying_double",
+    "__atan_varying_double",
+    "__atan2_varying_double",
+    "__sin_uniform_double",
+    "__asin_uniform_double",
+    "__cos_uniform_double",
+    "__acos_uniform_double",
+    "__sincos_uniform_double",
+    "__tan_uniform_double",
+    "__atan_uniform_double",
+    "__atan2_uniform_double",
+    "__undef_uniform",
+    "__undef_varying",
+    "__vec4_add_float",
+    "__vec4_add_int32",
+    "__vselect_float",
+    "__vselect_i32",
+    "ISPCAlloc",
+    "ISPCLaunch",
+    "ISPCSync",
 // ISPC_GENX_ENABLED
-        "__task_index0",
-        "__task_index1",
-        "__task_index2",
-        "__task_index",
-        "__task_count0",
-        "__task_count1",
-        "__task_count2",
-        "__task_count",
-    };
-    // clang-format on
-    for (auto name : names) {
+    "__task_index0",
+    "__task_index1",
+    "__task_index2",
+    "__task_index",
+    "__task_count0",
+    "__task_count1",
+    "__task_count2",
+    "__task_count",
+};
+// clang-format on
+
+static bool lIsInternalFunction(llvm::StringRef name) {
+    static std::set<std::string> names(std::begin(lInternalFunctionNames), std::end(lInternalFunctionNames));
+    return names.find(name.str()) != names.end();
+}
+
+static void lSetInternalFunctions(llvm::Module *module) {
+    for (auto name : lInternalFunctionNames) {
         llvm::Function *f = module->getFunction(name);
         if (f != NULL && f->empty() == false) {
             f->setLinkage(llvm::GlobalValue::InternalLinkage);
@@ -973,6 +1074,222 @@ void AddBitcodeToModule(const BitcodeLib *lib, llvm::Module *module, SymbolTable
     }
 }
 
+/** Builtins libraries that have been read with getLazyBitcodeModule().
+    Only the module's symbol table is read up front; function bodies are
+    read from the bitcode the first time that they are needed.  The
+    modules are kept for the lifetime of the process and shared by the
+    compilations for all targets.
+ */
+static std::map<const BitcodeLib *, llvm::Module *> lLazyBitcodeModules;
+
+/** Libraries that have been declared in a module with
+    AddLazyBitcodeToModule() but whose definitions haven't been linked yet.
+    The value map takes the library's functions and globals to their
+    counterparts in the module.
+ */
+struct PendingBitcodeLib {
+    llvm::Module *lib;
+    std::shared_ptr<llvm::ValueToValueMapTy> vmap;
+};
+static std::map<llvm::Module *, std::vector<PendingBitcodeLib>> lPendingBitcodeLibs;
+
+static llvm::Module *lGetLazyBitcodeModule(const BitcodeLib *lib) {
+    auto iter = lLazyBitcodeModules.find(lib);
+    if (iter != lLazyBitcodeModules.end())
+        return iter->second;
+
+    llvm::StringRef sb = llvm::StringRef((const char *)lib->getLib(), lib->getSize());
+    llvm::Expected<std::unique_ptr<llvm::Module>> ModuleOrErr =
+        llvm::getLazyBitcodeModule(llvm::MemoryBufferRef(sb, "builtins"), *g->ctx);
+    if (!ModuleOrErr) {
+        Error(SourcePos(), "Error parsing stdlib bitcode: %s", toString(ModuleOrErr.takeError()).c_str());
+        return NULL;
+    }
+    llvm::Module *bcModule = ModuleOrErr.get().release();
+    if (g->target->isGenXTarget())
+        lUpdateIntrinsicsAttributes(bcModule);
+    lLazyBitcodeModules[lib] = bcModule;
+    return bcModule;
+}
+
+/** Returns true if the library can't be linked function by function and
+    has to go through AddBitcodeToModule() instead.
+ */
+static bool lNeedsEagerLink(llvm::Module *bcModule) {
+    if (!bcModule->alias_empty() || !bcModule->ifunc_empty() || !bcModule->getModuleInlineAsm().empty())
+        return true;
+    for (llvm::GlobalVariable &gv : bcModule->globals())
+        if (gv.hasAppendingLinkage())
+            return true;
+    return false;
+}
+
+static void lSetComdat(llvm::GlobalObject *dest, const llvm::GlobalObject *src) {
+    if (const llvm::Comdat *c = src->getComdat()) {
+        llvm::Comdat *destComdat = dest->getParent()->getOrInsertComdat(c->getName());
+        destComdat->setSelectionKind(c->getSelectionKind());
+        dest->setComdat(destComdat);
+    }
+}
+
+/** Like AddBitcodeToModule(), but only adds declarations of the library's
+    functions to the module, along with its global variables.  The
+    definitions that the module ends up using are added by
+    LinkBitcodeDefinitions() once the module's IR has been generated.
+
+    @param lib         Pointer to BitcodeLib class representing LLVM bitcode (e.g. the contents of a *.bc file)
+    @param module      Module to add the declarations to
+    @param symbolTable Symbol table to add definitions to
+ */
+void AddLazyBitcodeToModule(const BitcodeLib *lib, llvm::Module *module, SymbolTable *symbolTable) {
+    llvm::Module *bcModule = lGetLazyBitcodeModule(lib);
+    if (bcModule == NULL)
+        return;
+    if (lNeedsEagerLink(bcModule)) {
+        AddBitcodeToModule(lib, module, symbolTable);
+        return;
+    }
+
+    std::shared_ptr<llvm::ValueToValueMapTy> vmap(new llvm::ValueToValueMapTy);
+    for (llvm::Function &f : *bcModule) {
+        // Functions with local linkage get their own declaration even if the
+        // module already has a function with the same name; it's renamed,
+        // just like the linker would do.
+        llvm::Function *dest = f.hasLocalLinkage() ? NULL : module->getFunction(f.getName());
+        if (dest == NULL) {
+            dest = llvm::Function::Create(f.getFunctionType(), llvm::GlobalValue::ExternalLinkage, f.getName(), module);
+            dest->setCallingConv(f.getCallingConv());
+            dest->setAttributes(f.getAttributes());
+            dest->setVisibility(f.getVisibility());
+            dest->setUnnamedAddr(f.getUnnamedAddr());
+            dest->setDLLStorageClass(f.getDLLStorageClass());
+        }
+        if (dest->getType() == f.getType())
+            (*vmap)[&f] = dest;
+        else
+            (*vmap)[&f] = llvm::ConstantExpr::getBitCast(dest, f.getType());
+    }
+
+    std::vector<std::pair<llvm::GlobalVariable *, llvm::GlobalVariable *>> newGlobals;
+    for (llvm::GlobalVariable &gv : bcModule->globals()) {
+        llvm::GlobalVariable *dest = gv.hasLocalLinkage() ? NULL : module->getGlobalVariable(gv.getName());
+        if (dest == NULL) {
+            dest =
+                new llvm::GlobalVariable(*module, gv.getValueType(), gv.isConstant(), gv.getLinkage(), NULL,
+                                         gv.getName(), NULL, gv.getThreadLocalMode(), gv.getType()->getAddressSpace());
+            dest->copyAttributesFrom(&gv);
+            lSetComdat(dest, &gv);
+            newGlobals.push_back(std::make_pair(&gv, dest));
+        }
+        if (dest->getType() == gv.getType())
+            (*vmap)[&gv] = dest;
+        else
+            (*vmap)[&gv] = llvm::ConstantExpr::getBitCast(dest, gv.getType());
+    }
+    for (auto &p : newGlobals)
+        if (p.first->hasInitializer())
+            p.second->setInitializer(llvm::MapValue(p.first->getInitializer(), *vmap));
+
+    lPendingBitcodeLibs[module].push_back({bcModule, vmap});
+
+    if (symbolTable != NULL)
+        lAddModuleSymbols(module, symbolTable);
+    lCheckModuleIntrinsics(module);
+}
+
+/** Removes the functions with local linkage that nothing refers to, so
+    that the library functions that only they call aren't linked.
+ */
+static void lRemoveDeadLocalFunctions(llvm::Module *module) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (llvm::Module::iterator iter = module->begin(); iter != module->end();) {
+            llvm::Function *f = &*iter++;
+            if (!f->hasLocalLinkage() || f->isDeclaration())
+                continue;
+            f->removeDeadConstantUsers();
+            if (f->use_empty()) {
+                f->eraseFromParent();
+                changed = true;
+            }
+        }
+    }
+}
+
+/** Reads the body of the library function from the bitcode and clones it
+    into its declaration in the module.
+ */
+static void lLinkFunction(llvm::Function *src, llvm::Function *dest, llvm::ValueToValueMapTy &vmap) {
+    if (llvm::Error err = src->materialize()) {
+        Error(SourcePos(), "Error parsing stdlib bitcode: %s", toString(std::move(err)).c_str());
+        return;
+    }
+
+    llvm::Function::arg_iterator destArg = dest->arg_begin();
+    for (llvm::Argument &arg : src->args()) {
+        destArg->setName(arg.getName());
+        vmap[&arg] = &*destArg++;
+    }
+    llvm::SmallVector<llvm::ReturnInst *, 8> returns;
+#if ISPC_LLVM_VERSION >= ISPC_LLVM_13_0
+    llvm::CloneFunctionInto(dest, src, vmap, llvm::CloneFunctionChangeType::DifferentModule, returns);
+#else
+    llvm::CloneFunctionInto(dest, src, vmap, true, returns);
+#endif
+    dest->setLinkage(src->getLinkage());
+    lSetComdat(dest, src);
+
+    if (g->NoOmitFramePointer)
+        dest->addFnAttr("no-frame-pointer-elim", "true");
+    g->target->markFuncWithTargetAttr(dest);
+}
+
+/** Adds the definitions of the library functions that the module uses to
+    it.  A library function is linked if the module calls it or refers to
+    it otherwise, or if it is visible outside of the module: the latter
+    include the functions that the optimization passes introduce calls to,
+    which are kept live by __keep_funcs_live().  This repeats until the
+    definitions that were linked don't need anything else.
+
+    @param module      Module that AddLazyBitcodeToModule() was called for
+ */
+void LinkBitcodeDefinitions(llvm::Module *module) {
+    auto pending = lPendingBitcodeLibs.find(module);
+    if (pending == lPendingBitcodeLibs.end())
+        return;
+
+    if (!g->generateDebuggingSymbols)
+        lRemoveDeadLocalFunctions(module);
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (PendingBitcodeLib &lib : pending->second) {
+            for (llvm::Function &src : *lib.lib) {
+                // Functions whose body hasn't been read yet aren't declarations.
+                if (src.isDeclaration())
+                    continue;
+                llvm::Function *dest = llvm::dyn_cast_or_null<llvm::Function>(lib.vmap->lookup(&src));
+                if (dest == NULL || !dest->isDeclaration() || dest->getFunctionType() != src.getFunctionType())
+                    continue;
+                if (dest->use_empty() && (src.hasLocalLinkage() || lIsInternalFunction(src.getName())))
+                    continue;
+                lLinkFunction(&src, dest, *lib.vmap);
+                changed = true;
+            }
+        }
+    }
+    lPendingBitcodeLibs.erase(pending);
+
+    lSetInternalFunctions(module);
+    if (g->target->isGenXTarget()) {
+        // For now this function is used for gen target only
+        // TODO: check if its usage affects CPU targets
+        lSetAlwaysInlineFunctions(module);
+    }
+}
+
 /** Utility routine that defines a constant int32 with given value, adding
     the symbol to both the ispc symbol table and the given LLVM module.
  */
@@ -1082,19 +1399,22 @@ void DefineStdlib(SymbolTable *symbolTable, llvm::LLVMContext *ctx, llvm::Module
     // the object file.
     std::vector<llvm::Constant *> debug_symbols;
 
+    // A module that was never linked may have had the same address.
+    lPendingBitcodeLibs.erase(module);
+
     // Unlike regular builtins and dispatch module, which don't care about mangling of external functions,
     // so they only differentiate Windows/Unix and 32/64 bit, builtins-c need to take care about mangling.
     // Hence, different version for all potentially supported OSes.
     const BitcodeLib *builtins = g->target_registry->getBuiltinsCLib(g->target_os, g->target->getArch());
     Assert(builtins);
-    AddBitcodeToModule(builtins, module, symbolTable);
+    AddLazyBitcodeToModule(builtins, module, symbolTable);
 
     // Next, add the target's custom implementations of the various needed
     // builtin functions (e.g. __masked_store_32(), etc).
     const BitcodeLib *target =
         g->target_registry->getISPCTargetLib(g->target->getISPCTarget(), g->target_os, g->target->getArch());
     Assert(target);
-    AddBitcodeToModule(target, module, symbolTable);
+    AddLazyBitcodeToModule(target, module, symbolTable);
 
     // define the 'programCount' builtin variable
     lDefineConstantInt("programCount", g->target->getVectorWidth(), module, symbolTable, debug_symbols);
@@ -0,0 +1,235 @@
+/*
+  Copyright (c) 2021, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** @file cache.cpp
+    @brief On-disk cache of the outputs of compilations (--cache-dir).
+*/
+
+#include "cache.h"
+#include "ispc.h"
+#include "ispc_version.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA1.h>
+
+// Name of the file in each cache entry whose modification time records
+// when the entry was last used.
+static const char *lUsedFileName = "used";
+
+// Name of the file in the cache directory that records the total size of
+// the entries.
+static const char *lSizeFileName = "size";
+
+// Returns the total size of the files in directory dir.
+static uint64_t lGetDirectorySize(const std::string &dir) {
+    uint64_t size = 0;
+    std::error_code ec;
+    for (llvm::sys::fs::directory_iterator f(dir, ec), end; f != end && !ec; f.increment(ec)) {
+        llvm::sys::fs::file_status status;
+        if (!llvm::sys::fs::status(f->path(), status))
+            size += status.getSize();
+    }
+    return size;
+}
+
+static void lMarkUsed(const std::string &entryDir) {
+    llvm::SmallString<256> fn(entryDir);
+    llvm::sys::path::append(fn, lUsedFileName);
+    std::ofstream used(fn.c_str(), std::ios::out | std::ios::trunc);
+}
+
+CompilationCache::CompilationCache(const std::string &d, uint64_t ms, const std::string &preprocessedSource,
+                                   const std::vector<std::string> &embeddedNames)
+    : dir(d), maxSize(ms) {
+    llvm::SHA1 hash;
+#if defined(BUILD_VERSION) && defined(BUILD_DATE)
+    hash.update(ISPC_VERSION " " BUILD_VERSION " " BUILD_DATE "\n");
+#else
+    hash.update(ISPC_VERSION " " __DATE__ "\n");
+#endif
+    hash.update(ISPC_LLVM_VERSION_STRING "\n");
+    // Debug information records the directory of the compilation.
+    if (g->generateDebuggingSymbols) {
+        hash.update(g->currentDirectory);
+        hash.update("\n");
+    }
+    hash.update(g->cacheKeyArgs);
+    for (const std::string &name : embeddedNames)
+        hash.update(name + "\n");
+    hash.update(g->target->GetTripleString() + "\n");
+    hash.update(std::string(g->target->GetISAString()) + "\n");
+    hash.update(g->target->getCPU() + "\n");
+    hash.update(preprocessedSource);
+    // --profile-use names the profile, but what's generated depends on
+    // what's in it.
+    if (g->profile != NULL)
+        hash.update(g->profile->GetContents());
+    key = llvm::toHex(hash.final(), true /* lower case */);
+
+    llvm::SmallString<256> path(dir);
+    llvm::sys::path::append(path, key.substr(0, 2), key);
+    entryDir = path.str().str();
+}
+
+bool CompilationCache::Fetch(const std::vector<Output> &outputs) {
+    if (!llvm::sys::fs::is_directory(entryDir))
+        return false;
+
+    for (const Output &output : outputs) {
+        llvm::SmallString<256> fn(entryDir);
+        llvm::sys::path::append(fn, output.name);
+        // This fails if another process is removing the entry; the caller
+        // then compiles the file and overwrites anything copied so far.
+        if (llvm::sys::fs::copy_file(fn, output.fileName))
+            return false;
+    }
+
+    lMarkUsed(entryDir);
+    return true;
+}
+
+void CompilationCache::Store(const std::vector<Output> &outputs) {
+    llvm::SmallString<256> parentDir(dir);
+    llvm::sys::path::append(parentDir, key.substr(0, 2));
+    if (llvm::sys::fs::create_directories(parentDir))
+        return;
+
+    llvm::SmallString<256> tmpPrefix(dir);
+    llvm::sys::path::append(tmpPrefix, "tmp-" + key);
+    llvm::SmallString<256> tmpDir;
+    if (llvm::sys::fs::createUniqueDirectory(tmpPrefix, tmpDir))
+        return;
+
+    bool ok = true;
+    for (const Output &output : outputs) {
+        llvm::SmallString<256> fn(tmpDir);
+        llvm::sys::path::append(fn, output.name);
+        if (llvm::sys::fs::copy_file(output.fileName, fn)) {
+            ok = false;
+            break;
+        }
+    }
+    if (ok)
+        lMarkUsed(tmpDir.str().str());
+
+    // Renaming fails if another process has added the same entry in the
+    // meantime, which is fine.
+    if (!ok || llvm::sys::fs::rename(tmpDir, entryDir)) {
+        llvm::sys::fs::remove_directories(tmpDir);
+        return;
+    }
+
+    if (addToSize(lGetDirectorySize(entryDir)) > maxSize)
+        trim();
+}
+
+static void lWriteSize(const std::string &dir, uint64_t size) {
+    llvm::SmallString<256> fn(dir);
+    llvm::sys::path::append(fn, lSizeFileName);
+    std::ofstream out(fn.c_str(), std::ios::out | std::ios::trunc);
+    out << size << "\n";
+}
+
+// Adds the size of a new entry to the recorded size of the cache and
+// returns the result.
+uint64_t CompilationCache::addToSize(uint64_t entrySize) {
+    llvm::SmallString<256> fn(dir);
+    llvm::sys::path::append(fn, lSizeFileName);
+
+    uint64_t size = 0;
+    {
+        std::ifstream in(fn.c_str());
+        in >> size;
+    }
+    size += entrySize;
+    lWriteSize(dir, size);
+    return size;
+}
+
+void CompilationCache::trim() {
+    struct Entry {
+        std::string path;
+        uint64_t size;
+        llvm::sys::TimePoint<> lastUsed;
+    };
+    std::vector<Entry> entries;
+    uint64_t totalSize = 0;
+
+    std::error_code ec;
+    for (llvm::sys::fs::directory_iterator sub(dir, ec), end; sub != end && !ec; sub.increment(ec)) {
+        // Skip temporary directories of entries that are being stored.
+        if (llvm::sys::path::filename(sub->path()).startswith("tmp-"))
+            continue;
+
+        std::error_code subEC;
+        for (llvm::sys::fs::directory_iterator e(sub->path(), subEC); e != end && !subEC; e.increment(subEC)) {
+            Entry entry = {e->path(), 0, llvm::sys::TimePoint<>()};
+            std::error_code fileEC;
+            for (llvm::sys::fs::directory_iterator f(e->path(), fileEC); f != end && !fileEC; f.increment(fileEC)) {
+                llvm::sys::fs::file_status status;
+                if (llvm::sys::fs::status(f->path(), status))
+                    continue;
+                entry.size += status.getSize();
+                if (llvm::sys::path::filename(f->path()) == lUsedFileName)
+                    entry.lastUsed = status.getLastModificationTime();
+            }
+            totalSize += entry.size;
+            entries.push_back(entry);
+        }
+    }
+
+    if (totalSize <= maxSize) {
+        lWriteSize(dir, totalSize);
+        return;
+    }
+
+    // Remove the least recently used entries until the cache is a bit
+    // smaller than the maximum, so that it isn't scanned and trimmed again
+    // by the next few compilations.
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.lastUsed < b.lastUsed; });
+    uint64_t targetSize = maxSize / 10 * 9;
+    for (const Entry &entry : entries) {
+        if (totalSize <= targetSize)
+            break;
+        // Another process may be removing it as well.
+        llvm::sys::fs::remove_directories(entry.path);
+        totalSize -= entry.size;
+    }
+    lWriteSize(dir, totalSize);
+}
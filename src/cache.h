@@ -0,0 +1,92 @@
+/*
+  Copyright (c) 2021, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** @file cache.h
+    @brief On-disk cache of the outputs of compilations (--cache-dir).
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** The compilation cache stores the files that a compilation produced in
+    a directory named by a hash of everything that determines them: the
+    ispc version, the preprocessed source, the command line and the target.
+    A later compilation with the same hash copies them from there instead
+    of compiling again.
+
+    Entries are written to a temporary directory and renamed into place,
+    so that concurrent ispc processes see either a complete entry or none;
+    files in an entry are never modified afterwards.  When the cache grows
+    larger than its maximum size, the entries that were used least
+    recently are removed.  Its size is kept in a file in the directory so
+    that the entries don't have to be scanned on every store; updates of
+    it by concurrent processes may get lost, which just delays trimming
+    until a later store, where the actual size is recorded again.
+ */
+class CompilationCache {
+  public:
+    /** An output of the compilation: the name of its file in a cache
+        entry and the file it's written to. */
+    struct Output {
+        std::string name;
+        std::string fileName;
+    };
+
+    /** Sets up the cache in directory dir for a compilation of the given
+        preprocessed source with the current options and target.
+        embeddedNames are the file names that end up in the contents of
+        the outputs. */
+    CompilationCache(const std::string &dir, uint64_t maxSize, const std::string &preprocessedSource,
+                     const std::vector<std::string> &embeddedNames);
+
+    /** Copies the outputs from the cache entry if there is one.  Returns
+        false (and the outputs then have to be generated) otherwise. */
+    bool Fetch(const std::vector<Output> &outputs);
+
+    /** Adds an entry with the given outputs, which have just been written,
+        to the cache and then trims it to its maximum size.  Failures are
+        ignored: the outputs just aren't cached then. */
+    void Store(const std::vector<Output> &outputs);
+
+  private:
+    uint64_t addToSize(uint64_t entrySize);
+    void trim();
+
+    std::string dir;
+    uint64_t maxSize;
+    std::string key;
+    std::string entryDir;
+};
@@ -45,11 +45,13 @@
 #include "type.h"
 #include "util.h"
 
+#include <algorithm>
 #include <map>
 
 #include <llvm/BinaryFormat/Dwarf.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Metadata.h>
 #include <llvm/IR/Module.h>
 
@@ -227,6 +229,7 @@ FunctionEmitContext::FunctionEmitContext(Function *func, Symbol *funSym, llvm::F
     llvm::BranchInst::Create(bblock, allocaBlock);
 
     funcStartPos = funSym->pos;
+    funcName = funSym->name;
 
     internalMaskPointer = AllocaInst(LLVMTypes::MaskType, "internal_mask_memory");
     StoreInst(LLVMMaskAllOn, internalMaskPointer);
@@ -434,13 +437,14 @@ llvm::Instruction *FunctionEmitContext::BranchIfMaskAny(llvm::BasicBlock *btrue,
     return bInst;
 }
 
-void FunctionEmitContext::BranchIfMaskAll(llvm::BasicBlock *btrue, llvm::BasicBlock *bfalse) {
+llvm::Instruction *FunctionEmitContext::BranchIfMaskAll(llvm::BasicBlock *btrue, llvm::BasicBlock *bfalse) {
     AssertPos(currentPos, bblock != NULL);
     llvm::Value *all = All(GetFullMask());
-    BranchInst(btrue, bfalse, all);
+    llvm::Instruction *bInst = BranchInst(btrue, bfalse, all);
     // It's illegal to add any additional instructions to the basic block
     // now that it's terminated, so set bblock to NULL to be safe
     bblock = NULL;
+    return bInst;
 }
 
 void FunctionEmitContext::BranchIfMaskNone(llvm::BasicBlock *btrue, llvm::BasicBlock *bfalse) {
@@ -1428,36 +1432,53 @@ llvm::Value *FunctionEmitContext::I1VecToBoolVec(llvm::Value *b) {
     }
 }
 
-static llvm::Value *lGetStringAsValue(llvm::BasicBlock *bblock, const char *s) {
-    llvm::Constant *sConstant = llvm::ConstantDataArray::getString(*g->ctx, s, true);
-    std::string var_name = "_";
-    var_name = var_name + s;
-    llvm::Value *sPtr = new llvm::GlobalVariable(*m->module, sConstant->getType(), true /* const */,
-                                                 llvm::GlobalValue::InternalLinkage, sConstant, var_name.c_str());
-    llvm::Value *indices[2] = {LLVMInt32(0), LLVMInt32(0)};
-    llvm::ArrayRef<llvm::Value *> arrayRef(&indices[0], &indices[2]);
-    return llvm::GetElementPtrInst::Create(PTYPE(sPtr), sPtr, arrayRef, "sptr", bblock);
-}
-
 void FunctionEmitContext::AddInstrumentationPoint(const char *note) {
     AssertPos(currentPos, note != NULL);
     if (!g->emitInstrumentation)
         return;
 
     std::vector<llvm::Value *> args;
-    // arg 1: filename as string
-    args.push_back(lGetStringAsValue(bblock, currentPos.name));
-    // arg 2: provided note
-    args.push_back(lGetStringAsValue(bblock, note));
-    // arg 3: line number
-    args.push_back(LLVMInt32(currentPos.first_line));
-    // arg 4: current mask, movmsk'ed down to an int64
+    // arg 1: the module's table of instrumentation sites
+    args.push_back(m->GetInstrumentationTable());
+    // arg 2: index of this site in the table, which records the file,
+    // function, line and note
+    args.push_back(LLVMInt32(m->AddInstrumentationSite(currentPos, funcName, note)));
+    // arg 3: current mask, movmsk'ed down to an int64
     args.push_back(LaneMask(GetFullMask()));
 
-    llvm::Function *finst = m->module->getFunction("ISPCInstrument");
+    llvm::Function *finst = m->module->getFunction("ISPCInstrumentSite");
     CallInst(finst, NULL, args, "");
 }
 
+void FunctionEmitContext::AddProfileSite(const SourcePos &pos, const char *note, llvm::Value *mask) {
+    AssertPos(currentPos, note != NULL);
+    if (!g->profileGenerate)
+        return;
+
+    // Profile sites are counted by the --instrument runtime, so they share
+    // the module's table of instrumentation sites.
+    std::vector<llvm::Value *> args;
+    args.push_back(m->GetInstrumentationTable());
+    args.push_back(LLVMInt32(m->AddInstrumentationSite(pos, funcName, note)));
+    args.push_back(LaneMask(mask != NULL ? mask : GetFullMask()));
+
+    llvm::Function *finst = m->module->getFunction("ISPCInstrumentSite");
+    CallInst(finst, NULL, args, "");
+}
+
+void FunctionEmitContext::SetBranchWeights(llvm::Instruction *branch, uint64_t trueCount, uint64_t falseCount) {
+    llvm::BranchInst *br = llvm::dyn_cast_or_null<llvm::BranchInst>(branch);
+    if (br == NULL || !br->isConditional() || trueCount + falseCount == 0)
+        return;
+
+    // Weights are 32 bits wide; scale the counts down to fit, and add one
+    // so that a branch that was never taken isn't taken to be impossible.
+    uint64_t scale = std::max(trueCount, falseCount) / UINT32_MAX + 1;
+    llvm::MDBuilder mdBuilder(*g->ctx);
+    br->setMetadata(llvm::LLVMContext::MD_prof, mdBuilder.createBranchWeights((uint32_t)(trueCount / scale + 1),
+                                                                              (uint32_t)(falseCount / scale + 1)));
+}
+
 void FunctionEmitContext::SetDebugPos(SourcePos pos) { currentPos = pos; }
 
 SourcePos FunctionEmitContext::GetDebugPos() const { return currentPos; }
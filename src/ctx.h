@@ -120,7 +120,7 @@ class FunctionEmitContext {
 
     /** Emits a branch instruction to the basic block btrue if all of the
         lanes of current mask are on and bfalse if none are on. */
-    void BranchIfMaskAll(llvm::BasicBlock *btrue, llvm::BasicBlock *bfalse);
+    llvm::Instruction *BranchIfMaskAll(llvm::BasicBlock *btrue, llvm::BasicBlock *bfalse);
 
     /** Emits a branch instruction to the basic block btrue if none of the
         lanes of current mask are on and bfalse if none are on. */
@@ -314,6 +314,17 @@ class FunctionEmitContext {
         this inserts a callback to the user-supplied instrumentation
         function at the current point in the code. */
     void AddInstrumentationPoint(const char *note);
+
+    /** With --profile-generate, inserts a call that records that the
+        profile site of the statement at the given position with the given
+        note was reached, and with which mask: the given one or, if it's
+        NULL, the current one. */
+    void AddProfileSite(const SourcePos &pos, const char *note, llvm::Value *mask = NULL);
+
+    /** Attaches branch weights to the given conditional branch, from the
+        number of times that --profile-use found that it went to its first
+        and second successors. */
+    void SetBranchWeights(llvm::Instruction *branch, uint64_t trueCount, uint64_t falseCount);
     /** @} */
 
     /** @name Debugging support
@@ -592,6 +603,10 @@ class FunctionEmitContext {
     /** Pointer to the Function for which we're currently generating code. */
     Function *function;
 
+    /** Name of that function in the source, for the instrumentation site
+        table. */
+    std::string funcName;
+
     /** LLVM function representation for the current function. */
     llvm::Function *llvmFunction;
 
@@ -324,6 +324,57 @@ void Declarator::Print(int indent) const {
     printf("]\n");
 }
 
+/** Parses the arguments of a __declspec(specialize(name=value, ...)) on
+    a function with the given parameters and adds the variant that it
+    describes to the function type. */
+static void lAddSpecialization(FunctionType *functionType, const std::string &arguments,
+                               const llvm::SmallVector<std::string, 8> &argNames,
+                               const llvm::SmallVector<const Type *, 8> &args, SourcePos pos) {
+    if (!functionType->isExported) {
+        Error(pos, "__declspec(specialize) is only allowed for \"export\" functions.");
+        return;
+    }
+
+    std::vector<std::pair<int, int64_t>> specialization;
+    size_t start = 0;
+    while (start < arguments.size()) {
+        size_t end = arguments.find(',', start);
+        if (end == std::string::npos)
+            end = arguments.size();
+        std::string argument = arguments.substr(start, end - start);
+        start = end + 1;
+
+        // The parser has already checked that it's "name=value".
+        size_t equals = argument.find('=');
+        std::string name = argument.substr(0, equals);
+        int64_t value = strtoll(argument.c_str() + equals + 1, NULL, 10);
+
+        int index = -1;
+        for (int i = 0; i < (int)argNames.size(); ++i)
+            if (argNames[i] == name)
+                index = i;
+        if (index == -1) {
+            Error(pos, "Function has no parameter \"%s\" to specialize.", name.c_str());
+            return;
+        }
+        const Type *type = args[index];
+        if (type == NULL || CastType<AtomicType>(type) == NULL || !type->IsIntType() || !type->IsUniformType()) {
+            Error(pos,
+                  "Parameter \"%s\" can't be specialized: only \"uniform\" integer "
+                  "parameters can.",
+                  name.c_str());
+            return;
+        }
+        for (const auto &param : specialization)
+            if (param.first == index) {
+                Error(pos, "Parameter \"%s\" is specialized more than once.", name.c_str());
+                return;
+            }
+        specialization.push_back(std::make_pair(index, value));
+    }
+    functionType->specializations.push_back(specialization);
+}
+
 void Declarator::InitFromType(const Type *baseType, DeclSpecs *ds) {
     bool hasUniformQual = ((typeQualifiers & TYPEQUAL_UNIFORM) != 0);
     bool hasVaryingQual = ((typeQualifiers & TYPEQUAL_VARYING) != 0);
@@ -580,7 +631,10 @@ void Declarator::InitFromType(const Type *baseType, DeclSpecs *ds) {
                     if (cost < 0)
                         Error(ds_spec_pos, "Negative function cost %d is illegal.", cost);
                     (const_cast<FunctionType *>(functionType))->costOverride = cost;
-                } else
+                } else if (!strncmp(str.c_str(), "specialize(", 11) && str.back() == ')')
+                    lAddSpecialization(const_cast<FunctionType *>(functionType), str.substr(11, str.size() - 12),
+                                       argNames, args, ds_spec_pos);
+                else
                     Error(ds_spec_pos, "__declspec parameter \"%s\" unknown.", str.c_str());
             }
         }
@@ -49,6 +49,7 @@
 
 #include <llvm/IR/CFG.h>
 #include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/IRPrintingPasses.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Intrinsics.h>
@@ -64,6 +65,7 @@
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Target/TargetOptions.h>
 #include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 
 #ifdef ISPC_GENX_ENABLED
 #include <llvm/GenXIntrinsics/GenXMetadata.h>
@@ -160,6 +162,37 @@ const FunctionType *Function::GetType() const {
     return type;
 }
 
+bool Function::IsLazilyMaterialized() const {
+    if (sym == NULL || sym->function == NULL)
+        return false;
+
+    // Only functions from stdlib.ispc are candidates; anything that the
+    // user wrote is always emitted, so that errors and warnings in it are
+    // reported even if it's never called.
+    if (sym->pos.name == NULL || strcmp(sym->pos.name, "stdlib.ispc") != 0)
+        return false;
+
+    // Static tasks are only emitted once something launches them; that
+    // keeps the ones in stdlib.ispc out of genx modules, where tasks are
+    // kernels.
+    const FunctionType *type = GetType();
+    if (type->isExported || type->isExternC)
+        return false;
+
+    return sym->function->hasInternalLinkage();
+}
+
+bool Function::IsReferenced() const { return sym != NULL && sym->function != NULL && !sym->function->use_empty(); }
+
+void Function::Discard() {
+    Assert(sym != NULL && sym->function != NULL);
+    Assert(sym->function->empty() && sym->function->use_empty());
+    sym->function->eraseFromParent();
+    sym->function = NULL;
+}
+
+llvm::Function *Function::GetLLVMFunction() const { return sym != NULL ? sym->function : NULL; }
+
 /** Parameters for tasks are stored in a big structure; this utility
     function emits code to copy those values out of the task structure into
     local stack-allocated variables.  (Which we expect that LLVM's
@@ -498,6 +531,75 @@ void Function::emitCode(FunctionEmitContext *ctx, llvm::Function *function, Sour
 #endif
 }
 
+/** Emits the variants of an exported function that were requested with
+    __declspec(specialize(...)).  Each one is a copy of appFunction in which
+    the specialized parameters are replaced by their values, so that the
+    optimizer can fold them (e.g. unroll loops over them completely).
+    appFunction itself becomes a dispatcher that compares the arguments with
+    the values of each variant and calls the first one that matches, or a
+    copy of the original function if none does. */
+static void lEmitSpecializations(llvm::Function *appFunction, const FunctionType *type) {
+    std::string name = appFunction->getName().str();
+
+    llvm::ValueToValueMapTy genericMap;
+    llvm::Function *generic = llvm::CloneFunction(appFunction, genericMap);
+    generic->setName(name + "___generic");
+    generic->setLinkage(llvm::GlobalValue::InternalLinkage);
+
+    std::vector<llvm::Function *> variants;
+    for (int i = 0; i < (int)type->specializations.size(); ++i) {
+        llvm::ValueToValueMapTy variantMap;
+        // Mapped arguments are removed from the copy's signature.
+        for (const auto &param : type->specializations[i]) {
+            llvm::Argument *arg = appFunction->getArg(param.first);
+            variantMap[arg] = llvm::ConstantInt::get(arg->getType(), param.second, true /* signed */);
+        }
+        llvm::Function *variant = llvm::CloneFunction(appFunction, variantMap);
+        variant->setName(name + "___spec" + std::to_string(i));
+        variant->setLinkage(llvm::GlobalValue::InternalLinkage);
+        variants.push_back(variant);
+    }
+
+    appFunction->deleteBody();
+    llvm::IRBuilder<> builder(llvm::BasicBlock::Create(*g->ctx, "entry", appFunction));
+    auto emitCall = [&](llvm::Function *callee, const std::vector<llvm::Value *> &args) {
+        llvm::CallInst *call = builder.CreateCall(callee, args);
+        call->setCallingConv(callee->getCallingConv());
+        call->setTailCall();
+        if (appFunction->getReturnType()->isVoidTy())
+            builder.CreateRetVoid();
+        else
+            builder.CreateRet(call);
+    };
+
+    for (int i = 0; i < (int)variants.size(); ++i) {
+        const std::vector<std::pair<int, int64_t>> &specialization = type->specializations[i];
+        llvm::Value *matches = builder.getTrue();
+        std::vector<llvm::Value *> args;
+        for (llvm::Argument &arg : appFunction->args()) {
+            auto param = std::find_if(specialization.begin(), specialization.end(),
+                                      [&](const std::pair<int, int64_t> &p) { return p.first == (int)arg.getArgNo(); });
+            if (param == specialization.end())
+                args.push_back(&arg);
+            else
+                matches = builder.CreateAnd(
+                    matches, builder.CreateICmpEQ(&arg, llvm::ConstantInt::get(arg.getType(), param->second, true)));
+        }
+
+        llvm::BasicBlock *variantBlock = llvm::BasicBlock::Create(*g->ctx, "specialized", appFunction);
+        llvm::BasicBlock *nextBlock = llvm::BasicBlock::Create(*g->ctx, "not_specialized", appFunction);
+        builder.CreateCondBr(matches, variantBlock, nextBlock);
+        builder.SetInsertPoint(variantBlock);
+        emitCall(variants[i], args);
+        builder.SetInsertPoint(nextBlock);
+    }
+
+    std::vector<llvm::Value *> args;
+    for (llvm::Argument &arg : appFunction->args())
+        args.push_back(&arg);
+    emitCall(generic, args);
+}
+
 void Function::GenerateIR() {
     if (sym == NULL)
         // May be NULL due to error earlier in compilation
@@ -562,7 +664,7 @@ void Function::GenerateIR() {
                 llvm::GlobalValue::LinkageTypes linkage = llvm::GlobalValue::ExternalLinkage;
                 std::string functionName = sym->name;
                 if (g->mangleFunctionsWithTarget) {
-                    functionName += std::string("_") + g->target->GetISAString();
+                    functionName += std::string("_") + g->target->GetVariantString();
                 }
 
                 llvm::Function *appFunction = llvm::Function::Create(ftype, linkage, functionName.c_str(), m->module);
@@ -594,6 +696,8 @@ void Function::GenerateIR() {
                     FunctionEmitContext ec(this, sym, appFunction, firstStmtPos);
                     emitCode(&ec, appFunction, firstStmtPos);
                     if (m->errorCount == 0) {
+                        if (!type->specializations.empty() && !g->target->isGenXTarget())
+                            lEmitSpecializations(appFunction, type);
                         sym->exportedFunction = appFunction;
                     }
                 }
@@ -51,6 +51,23 @@ class Function {
     /** Generate LLVM IR for the function into the current module. */
     void GenerateIR();
 
+    /** Returns true if the function comes from the standard library and
+        is only visible inside the module, so that its body only needs to
+        be emitted if something in the module actually calls it. */
+    bool IsLazilyMaterialized() const;
+
+    /** Returns true if the LLVM function for this function has any uses
+        in the module. */
+    bool IsReferenced() const;
+
+    /** Removes the (still empty) LLVM function for a lazily materialized
+        function that nothing ended up referencing. */
+    void Discard();
+
+    /** Returns the LLVM function that the code for this function is
+        emitted into. */
+    llvm::Function *GetLLVMFunction() const;
+
   private:
     void emitCode(FunctionEmitContext *ctx, llvm::Function *function, SourcePos firstStmtPos);
 
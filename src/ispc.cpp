@@ -40,6 +40,7 @@
 #include "module.h"
 #include "util.h"
 
+#include <algorithm>
 #include <sstream>
 #include <stdarg.h> /* va_list, va_start, va_arg, va_end */
 #include <stdio.h>
@@ -273,9 +274,16 @@ typedef enum {
 
     CPU_ICX,
     CPU_TGL,
+
+    // AMD Zen and Zen 2. Support AVX 2.
+    CPU_ZNVER1,
+    CPU_ZNVER2,
 #if ISPC_LLVM_VERSION >= ISPC_LLVM_12_0
     CPU_ADL,
     CPU_SPR,
+
+    // AMD Zen 3. Supports AVX 2.
+    CPU_ZNVER3,
 #endif
 
 // FIXME: LLVM supports a ton of different ARM CPU variants--not just
@@ -300,10 +308,20 @@ typedef enum {
     sizeofCPUtype
 } CPUtype;
 
+// Vendors of the CPUs, as encoded by __get_system_cpu_model() in
+// builtins/dispatch.ll.
+enum CPUVendor { CPU_VENDOR_INTEL = 1, CPU_VENDOR_AMD = 2 };
+
+// Encodes a CPU model the same way as __get_system_cpu_model() does.
+static int lCPUModel(CPUVendor vendor, int family, int model) { return (vendor << 20) | (family << 8) | model; }
+
 class AllCPUs {
   private:
     std::vector<std::vector<std::string>> names;
     std::vector<std::set<CPUtype>> compat;
+    // Inclusive ranges of the CPU models that identify each CPU at run
+    // time; empty for CPUs that can't be told apart this way.
+    std::vector<std::vector<std::pair<int, int>>> models;
 
     std::set<CPUtype> Set(int type, ...) {
         std::set<CPUtype> retn;
@@ -318,10 +336,20 @@ class AllCPUs {
         return retn;
     }
 
+    void AddModels(CPUtype type, CPUVendor vendor, int family, std::vector<int> ids) {
+        for (int id : ids)
+            models[type].push_back(std::make_pair(lCPUModel(vendor, family, id), lCPUModel(vendor, family, id)));
+    }
+
+    void AddModelRange(CPUtype type, CPUVendor vendor, int family, int first, int last) {
+        models[type].push_back(std::make_pair(lCPUModel(vendor, family, first), lCPUModel(vendor, family, last)));
+    }
+
   public:
     AllCPUs() {
         names = std::vector<std::vector<std::string>>(sizeofCPUtype);
         compat = std::vector<std::set<CPUtype>>(sizeofCPUtype);
+        models = std::vector<std::vector<std::pair<int, int>>>(sizeofCPUtype);
 
         names[CPU_None].push_back("");
 
@@ -365,11 +393,16 @@ class AllCPUs {
         names[CPU_ICX].push_back("icx");
         names[CPU_TGL].push_back("tigerlake");
         names[CPU_TGL].push_back("tgl");
+
+        names[CPU_ZNVER1].push_back("znver1");
+        names[CPU_ZNVER2].push_back("znver2");
 #if ISPC_LLVM_VERSION >= ISPC_LLVM_12_0
         names[CPU_ADL].push_back("alderlake");
         names[CPU_ADL].push_back("adl");
         names[CPU_SPR].push_back("sapphirerapids");
         names[CPU_SPR].push_back("spr");
+
+        names[CPU_ZNVER3].push_back("znver3");
 #endif
 
 #ifdef ISPC_ARM_ENABLED
@@ -406,6 +439,9 @@ class AllCPUs {
                 CPU_IvyBridge, CPU_Haswell, CPU_Broadwell, CPU_SKX, CPU_ICL, CPU_ICX, CPU_TGL, CPU_ADL, CPU_None);
         compat[CPU_ADL] = Set(CPU_ADL, CPU_x86_64, CPU_Bonnell, CPU_Penryn, CPU_Core2, CPU_Nehalem, CPU_Silvermont,
                               CPU_SandyBridge, CPU_IvyBridge, CPU_Haswell, CPU_Broadwell, CPU_None);
+        compat[CPU_ZNVER3] =
+            Set(CPU_ZNVER3, CPU_ZNVER2, CPU_ZNVER1, CPU_x86_64, CPU_Bonnell, CPU_Penryn, CPU_Core2, CPU_Nehalem,
+                CPU_Silvermont, CPU_SandyBridge, CPU_IvyBridge, CPU_Haswell, CPU_Broadwell, CPU_None);
 #endif
         compat[CPU_TGL] =
             Set(CPU_TGL, CPU_x86_64, CPU_Bonnell, CPU_Penryn, CPU_Core2, CPU_Nehalem, CPU_Silvermont, CPU_SandyBridge,
@@ -416,6 +452,10 @@ class AllCPUs {
         compat[CPU_ICL] = Set(CPU_ICL, CPU_x86_64, CPU_Bonnell, CPU_Penryn, CPU_Core2, CPU_Nehalem, CPU_Silvermont,
                               CPU_SandyBridge, CPU_IvyBridge, CPU_Haswell, CPU_Broadwell, CPU_SKX, CPU_None);
 
+        compat[CPU_ZNVER2] = Set(CPU_ZNVER2, CPU_ZNVER1, CPU_x86_64, CPU_Bonnell, CPU_Penryn, CPU_Core2, CPU_Nehalem,
+                                 CPU_Silvermont, CPU_SandyBridge, CPU_IvyBridge, CPU_Haswell, CPU_Broadwell, CPU_None);
+        compat[CPU_ZNVER1] = Set(CPU_ZNVER1, CPU_x86_64, CPU_Bonnell, CPU_Penryn, CPU_Core2, CPU_Nehalem,
+                                 CPU_Silvermont, CPU_SandyBridge, CPU_IvyBridge, CPU_Haswell, CPU_Broadwell, CPU_None);
         compat[CPU_Broadwell] = Set(CPU_x86_64, CPU_Bonnell, CPU_Penryn, CPU_Core2, CPU_Nehalem, CPU_Silvermont,
                                     CPU_SandyBridge, CPU_IvyBridge, CPU_Haswell, CPU_Broadwell, CPU_None);
         compat[CPU_Haswell] = Set(CPU_x86_64, CPU_Bonnell, CPU_Penryn, CPU_Core2, CPU_Nehalem, CPU_Silvermont,
@@ -434,6 +474,36 @@ class AllCPUs {
 
         compat[CPU_x86_64] = Set(CPU_x86_64, CPU_None);
 
+        // Family 6 models of the Intel CPUs and family 0x16-0x19 models of
+        // the AMD ones, as reported by cpuid.
+        AddModels(CPU_Bonnell, CPU_VENDOR_INTEL, 0x6, {0x1C, 0x26, 0x27, 0x35, 0x36});
+        AddModels(CPU_Core2, CPU_VENDOR_INTEL, 0x6, {0x0F, 0x16});
+        AddModels(CPU_Penryn, CPU_VENDOR_INTEL, 0x6, {0x17, 0x1D});
+        AddModels(CPU_Nehalem, CPU_VENDOR_INTEL, 0x6, {0x1A, 0x1E, 0x1F, 0x2E, 0x25, 0x2C, 0x2F});
+        AddModels(CPU_Silvermont, CPU_VENDOR_INTEL, 0x6, {0x37, 0x4A, 0x4D, 0x5A, 0x5D});
+        AddModels(CPU_SandyBridge, CPU_VENDOR_INTEL, 0x6, {0x2A, 0x2D});
+        AddModels(CPU_IvyBridge, CPU_VENDOR_INTEL, 0x6, {0x3A, 0x3E});
+        AddModels(CPU_Haswell, CPU_VENDOR_INTEL, 0x6, {0x3C, 0x3F, 0x45, 0x46});
+        AddModels(CPU_Broadwell, CPU_VENDOR_INTEL, 0x6, {0x3D, 0x47, 0x4F, 0x56});
+        AddModels(CPU_KNL, CPU_VENDOR_INTEL, 0x6, {0x57, 0x85});
+        AddModels(CPU_SKX, CPU_VENDOR_INTEL, 0x6, {0x55});
+        AddModels(CPU_ICL, CPU_VENDOR_INTEL, 0x6, {0x7D, 0x7E});
+        AddModels(CPU_ICX, CPU_VENDOR_INTEL, 0x6, {0x6A, 0x6C});
+        AddModels(CPU_TGL, CPU_VENDOR_INTEL, 0x6, {0x8C, 0x8D});
+        AddModelRange(CPU_PS4, CPU_VENDOR_AMD, 0x16, 0x00, 0x0F);
+        AddModelRange(CPU_ZNVER1, CPU_VENDOR_AMD, 0x17, 0x00, 0x2F);
+        AddModelRange(CPU_ZNVER2, CPU_VENDOR_AMD, 0x17, 0x30, 0x3F);
+        AddModels(CPU_ZNVER2, CPU_VENDOR_AMD, 0x17, {0x47});
+        AddModelRange(CPU_ZNVER2, CPU_VENDOR_AMD, 0x17, 0x60, 0x7F);
+        AddModelRange(CPU_ZNVER2, CPU_VENDOR_AMD, 0x17, 0x84, 0x87);
+        AddModelRange(CPU_ZNVER2, CPU_VENDOR_AMD, 0x17, 0x90, 0xAF);
+#if ISPC_LLVM_VERSION >= ISPC_LLVM_12_0
+        AddModels(CPU_ADL, CPU_VENDOR_INTEL, 0x6, {0x97, 0x9A, 0xB7, 0xBA, 0xBF});
+        AddModels(CPU_SPR, CPU_VENDOR_INTEL, 0x6, {0x8F, 0xCF});
+        AddModelRange(CPU_ZNVER3, CPU_VENDOR_AMD, 0x19, 0x00, 0x0F);
+        AddModelRange(CPU_ZNVER3, CPU_VENDOR_AMD, 0x19, 0x20, 0x5F);
+#endif
+
 #ifdef ISPC_ARM_ENABLED
         compat[CPU_CortexA15] = Set(CPU_CortexA9, CPU_CortexA15, CPU_None);
         compat[CPU_CortexA9] = Set(CPU_CortexA9, CPU_None);
@@ -484,16 +554,21 @@ class AllCPUs {
         Assert((with > CPU_None) && (with < sizeofCPUtype));
         return compat[what].find(with) != compat[what].end();
     }
+
+    const std::vector<std::pair<int, int>> &GetCPUModels(CPUtype type) {
+        Assert((type > CPU_None) && (type < sizeofCPUtype));
+        return models[type];
+    }
 };
 
-Target::Target(Arch arch, const char *cpu, ISPCTarget ispc_target, bool pic, bool printTarget)
+Target::Target(Arch arch, const char *cpu, ISPCTarget ispc_target, bool pic, bool printTarget, bool cpuVariant)
     : m_target(NULL), m_targetMachine(NULL), m_dataLayout(NULL), m_valid(false), m_ispc_target(ispc_target),
-      m_isa(SSE2), m_arch(Arch::none), m_is32Bit(true), m_cpu(""), m_attributes(""), m_tf_attributes(NULL),
-      m_nativeVectorWidth(-1), m_nativeVectorAlignment(-1), m_dataTypeWidth(-1), m_vectorWidth(-1), m_generatePIC(pic),
-      m_maskingIsFree(false), m_maskBitCount(-1), m_hasHalf(false), m_hasRand(false), m_hasGather(false),
-      m_hasScatter(false), m_hasTranscendentals(false), m_hasTrigonometry(false), m_hasRsqrtd(false), m_hasRcpd(false),
-      m_hasVecPrefetch(false), m_hasSaturatingArithmetic(false), m_hasFp64Support(true),
-      m_warnFtoU32IsExpensive(false) {
+      m_isa(SSE2), m_arch(Arch::none), m_is32Bit(true), m_cpu(""), m_cpuVariant(cpuVariant), m_attributes(""),
+      m_tf_attributes(NULL), m_nativeVectorWidth(-1), m_nativeVectorAlignment(-1), m_dataTypeWidth(-1),
+      m_vectorWidth(-1), m_generatePIC(pic), m_maskingIsFree(false), m_maskBitCount(-1), m_hasHalf(false),
+      m_hasRand(false), m_hasGather(false), m_hasScatter(false), m_hasTranscendentals(false), m_hasTrigonometry(false),
+      m_hasRsqrtd(false), m_hasRcpd(false), m_hasVecPrefetch(false), m_hasSaturatingArithmetic(false),
+      m_hasFp64Support(true), m_warnFtoU32IsExpensive(false) {
     CPUtype CPUID = CPU_None, CPUfromISA = CPU_None;
     AllCPUs a;
     std::string featuresString;
@@ -560,7 +635,10 @@ Target::Target(Arch arch, const char *cpu, ISPCTarget ispc_target, bool pic, boo
 
 #if ISPC_LLVM_VERSION >= ISPC_LLVM_12_0
         case CPU_ADL:
+        case CPU_ZNVER3:
 #endif
+        case CPU_ZNVER2:
+        case CPU_ZNVER1:
         case CPU_Broadwell:
         case CPU_Haswell:
             m_ispc_target = ISPCTarget::avx2_i32x8;
@@ -1116,6 +1194,23 @@ Target::Target(Arch arch, const char *cpu, ISPCTarget ispc_target, bool pic, boo
     }
     this->m_cpu = cpu;
 
+    this->m_variantName = ISAToString(m_isa);
+    if (m_cpuVariant) {
+        // The dispatch code recognizes the CPU by its vendor, family and
+        // model, so that needs to be known for it.
+        Assert(CPUID != CPU_None);
+        m_cpuModels = a.GetCPUModels(CPUID);
+        if (m_cpuModels.empty()) {
+            std::string target_string = ISPCTargetToString(m_ispc_target);
+            Error(SourcePos(), "CPU \"%s\" can't be detected at run time, so it can't select a variant of %s target.",
+                  cpu, target_string.c_str());
+            return;
+        }
+        std::string suffix = m_cpu;
+        std::replace(suffix.begin(), suffix.end(), '-', '_');
+        m_variantName += "_" + suffix;
+    }
+
     if (!error) {
         // Create TargetMachine
         std::string triple = GetTripleString();
@@ -1636,6 +1731,7 @@ Globals::Globals() {
     target_registry = TargetLibRegistry::getTargetLibRegistry();
 
     mathLib = Globals::Math_ISPC;
+    dispatchMode = Globals::Dispatch_Check;
     codegenOptLevel = Globals::Aggressive;
 
     includeStdlib = true;
@@ -1652,6 +1748,8 @@ Globals::Globals() {
     disableLineWrap = false;
     emitPerfWarnings = true;
     emitInstrumentation = false;
+    profileGenerate = false;
+    profile = NULL;
     noPragmaOnce = false;
     generateDebuggingSymbols = false;
     generateDWARFVersion = 3;
@@ -1660,10 +1758,12 @@ Globals::Globals() {
     mangleFunctionsWithTarget = false;
     isMultiTargetCompilation = false;
     errorLimit = -1;
+    numJobs = 0;
 
     enableTimeTrace = false;
     // set default granularity to 500.
     timeTraceGranularity = 500;
+    cacheMaxSize = 1024ull * 1024 * 1024;
     target = NULL;
     ctx = new llvm::LLVMContext;
 
@@ -106,6 +106,7 @@ class Function;
 class FunctionType;
 class Module;
 class PointerType;
+class ProfileData;
 class Stmt;
 class Symbol;
 class SymbolTable;
@@ -188,8 +189,11 @@ class Target {
 
     /** Initializes the given Target pointer for a target of the given
         name, if the name is a known target.  Returns true if the
-        target was initialized and false if the name is unknown. */
-    Target(Arch arch, const char *cpu, ISPCTarget isa, bool pic, bool printTarget);
+        target was initialized and false if the name is unknown.  If
+        cpuVariant is true, the target is a variant of its ISA tuned for
+        the given CPU that the multi-target dispatch code only selects on
+        systems with that CPU. */
+    Target(Arch arch, const char *cpu, ISPCTarget isa, bool pic, bool printTarget, bool cpuVariant = false);
 
     /** Returns a comma-delimited string giving the names of the currently
         supported CPUs. */
@@ -209,6 +213,11 @@ class Target {
     /** Returns a string like "avx" encoding the target. Good for mangling. */
     const char *GetISAString() const;
 
+    /** Returns the string used to mangle the names of this target's
+        variant in multi-target mode: the ISA string, followed by the CPU
+        for CPU variants (e.g. "avx512skx_icelake_server"). */
+    const char *GetVariantString() const { return m_variantName.c_str(); }
+
     /** Convert ISA enum to string */
     static const char *ISAToTargetString(Target::ISA isa);
 
@@ -263,6 +272,12 @@ class Target {
 
     std::string getCPU() const { return m_cpu; }
 
+    bool isCPUVariant() const { return m_cpuVariant; }
+
+    /** Returns the inclusive ranges of the values returned by
+        __get_system_cpu_model() for which a CPU variant is selected. */
+    const std::vector<std::pair<int, int>> &getCPUModels() const { return m_cpuModels; }
+
     int getNativeVectorWidth() const { return m_nativeVectorWidth; }
 
     int getNativeVectorAlignment() const { return m_nativeVectorAlignment; }
@@ -331,6 +346,15 @@ class Target {
     /** Target CPU. (e.g. "corei7", "corei7-avx", ..) */
     std::string m_cpu;
 
+    /** Is this a variant of the ISA for a specific CPU in multi-target mode */
+    bool m_cpuVariant;
+
+    /** ISA name, qualified with the CPU for CPU variants. */
+    std::string m_variantName;
+
+    /** CPU models that a CPU variant is dispatched to. */
+    std::vector<std::pair<int, int>> m_cpuModels;
+
     /** Target-specific attribute string to pass along to the LLVM backend */
     std::string m_attributes;
 
@@ -574,6 +598,13 @@ struct Globals {
     enum MathLib { Math_ISPC, Math_ISPCFast, Math_SVML, Math_System };
     MathLib mathLib;
 
+    /** How the dispatch functions of multi-target compilations select the
+        target-specific variant to call: by checking the system's ISA on
+        every call, or once, through a function pointer that is set on the
+        first call or through a GNU indirect function (ELF only). */
+    enum DispatchMode { Dispatch_Check, Dispatch_Pointer, Dispatch_IFunc };
+    DispatchMode dispatchMode;
+
     /** Optimization level to be specified while creating TargetMachine. */
     enum CodegenOptLevel { None, Aggressive };
     CodegenOptLevel codegenOptLevel;
@@ -636,6 +667,16 @@ struct Globals {
         manual.) */
     bool emitInstrumentation;
 
+    /** Indicates whether profile sites should be emitted that record how
+        often branches are taken and how coherent the mask is at them
+        (--profile-generate), using the --instrument runtime. */
+    bool profileGenerate;
+
+    /** Profile that a program compiled with --profile-generate wrote,
+        which guides the code generated for branches and loops
+        (--profile-use); NULL if there's none. */
+    ProfileData *profile;
+
 #ifdef ISPC_GENX_ENABLED
     /** Arguments to pass to Vector Compiler backend for offline
     compilation to L0 binary */
@@ -701,11 +742,37 @@ struct Globals {
     /* Number of errors to show in ISPC. */
     int errorLimit;
 
+    /* Maximum number of targets that are optimized and compiled
+       concurrently when compiling for multiple targets.  Zero means one
+       per available CPU. */
+    int numJobs;
+
     /* When true, enable compile time tracing. */
     bool enableTimeTrace;
 
     /* When compile time tracing is enabled, set time granularity. */
     int timeTraceGranularity;
+
+    /* If not empty, the wall time and IR changes of each optimization pass
+       are written to this file (--pass-stats). */
+    std::string passStatsFile;
+
+    /* If not empty, a record of what the optimizer decided for each gather
+       and scatter is written to this file as YAML (--opt-remarks). */
+    std::string optRemarksFile;
+
+    /* Directory of the on-disk cache of compilation outputs; empty if the
+       cache isn't used. */
+    std::string cacheDir;
+
+    /* Size in bytes that the compilation cache is trimmed to when it grows
+       larger. */
+    uint64_t cacheMaxSize;
+
+    /* The command line arguments that affect the outputs of the
+       compilation, which are part of the key of compilation cache
+       entries. */
+    std::string cacheKeyArgs;
 };
 
 enum {
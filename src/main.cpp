@@ -37,6 +37,8 @@
 
 #include "ispc.h"
 #include "module.h"
+#include "opt.h"
+#include "profile.h"
 #include "target_registry.h"
 #include "type.h"
 #include "util.h"
@@ -97,6 +99,9 @@ static void lPrintVersion() {
     printf("                          \t\taddressing calculations are done by default, even\n");
     printf("                          \t\ton 64-bit target architectures.)\n");
     printf("    [--arch={%s}]\t\tSelect target architecture\n", g->target_registry->getSupportedArchs().c_str());
+    printf("    [--cache-dir=<dir>]\t\t\tReuse outputs of earlier identical compilations stored in <dir>, and store "
+           "new ones there (single-target compilations only)\n");
+    printf("    [--cache-max-size=<MB>]\t\tLimit the size of the --cache-dir directory (default: 1024)\n");
 #ifndef ISPC_HOST_IS_WINDOWS
     printf("    [--colored-output]\t\tAlways use terminal colors in error/warning messages\n");
 #endif
@@ -107,11 +112,17 @@ static void lPrintVersion() {
     PrintWithWordBreaks(cpuHelp, 16, TerminalWidth(), stdout);
     printf("    [-D<foo>]\t\t\t\t#define given value when running preprocessor\n");
     printf("    [--dev-stub <filename>]\t\tEmit device-side offload stub functions to file\n");
+    printf("    [--dispatch=<mode>]\t\tSelect how multi-target dispatch functions pick the variant to call\n");
+    printf("        check\t\t\t\tCheck the system's ISA on every call (default)\n");
+    printf("        pointer\t\t\t\tPick the variant on the first call and call it through a function pointer\n");
+    printf("        ifunc\t\t\t\tPick the variant when the symbol is bound, using GNU indirect functions (ELF "
+           "targets only)\n");
     printf("    [--dllexport]\t\t\tMake non-static functions DLL exported.  Windows target only\n");
     printf("    [--dwarf-version={2,3,4}]\t\tGenerate source-level debug information with given DWARF version "
            "(triggers -g).  Ignored for Windows target\n");
     printf("    [--emit-asm]\t\t\tGenerate assembly language file as output\n");
     printf("    [--emit-llvm]\t\t\tEmit LLVM bitcode file as output\n");
+    printf("    [--emit-llvm-lto]\t\t\tEmit LLVM bitcode file with a ThinLTO summary for link-time optimization\n");
     printf("    [--emit-llvm-text]\t\t\tEmit LLVM bitcode file as output in textual form\n");
     printf("    [--emit-obj]\t\t\tGenerate object file file as output (default)\n");
 #ifdef ISPC_GENX_ENABLED
@@ -127,6 +138,8 @@ static void lPrintVersion() {
     printf("    [-h <name>/--header-outfile=<name>]\tOutput filename for header\n");
     printf("    [-I <path>]\t\t\t\tAdd <path> to #include file search path\n");
     printf("    [--instrument]\t\t\tEmit instrumentation to gather performance data\n");
+    printf("    [--jobs=<value>]\t\t\tOptimize and compile up to <value> targets concurrently when compiling for "
+           "multiple targets (default: number of CPUs)\n");
     printf("    [--math-lib=<option>]\t\tSelect math library\n");
     printf("        default\t\t\t\tUse ispc's built-in math functions\n");
     printf("        fast\t\t\t\tUse high-performance but lower-accuracy math functions\n");
@@ -160,13 +173,20 @@ static void lPrintVersion() {
     printf("        fast-masked-vload\t\tFaster masked vector loads on SSE (may go past end of array)\n");
     printf("        fast-math\t\t\tPerform non-IEEE-compliant optimizations of numeric expressions\n");
     printf("        force-aligned-memory\t\tAlways issue \"aligned\" vector load and store instructions\n");
+    printf("    [--opt-remarks=<file>]\t\tWrite the optimizer's decision for each gather and scatter to <file> as "
+           "YAML\n");
+    printf("    [--pass-stats=<file>]\t\tWrite the time and IR changes of each optimization pass, per function, "
+           "to <file> as JSON\n");
     printf("    [--pic]\t\t\t\tGenerate position-independent code.  Ignored for Windows target\n");
+    printf("    [--profile-generate]\t\tEmit code that records a profile of the program's branches and loops\n");
+    printf("    [--profile-use=<file>]\t\tOptimize branches and loops for the profile in <file>\n");
     printf("    [--quiet]\t\t\t\tSuppress all output\n");
     printf("    [--support-matrix]\t\t\tPrint full matrix of supported targets, architectures and OSes\n");
     printf("    ");
     char targetHelp[2048];
     snprintf(targetHelp, sizeof(targetHelp),
-             "[--target=<t>]\t\t\tSelect target ISA and width.\n"
+             "[--target=<t>]\t\t\tSelect target ISA and width.  Each target may be qualified with a CPU, "
+             "as in avx512skx-i32x16:icelake-server, to dispatch to it only on that CPU.\n"
              "<t>={%s}",
              g->target_registry->getSupportedTargets().c_str());
     PrintWithWordBreaks(targetHelp, 24, TerminalWidth(), stdout);
@@ -574,6 +594,7 @@ int main(int Argc, char *Argv[]) {
     const char *depsTargetName = NULL;
     const char *hostStubFileName = NULL;
     const char *devStubFileName = NULL;
+    const char *profileFileName = NULL;
     // Initiailize globals early so that we can set various option values
     // as we're parsing below
     g = new Globals;
@@ -582,6 +603,7 @@ int main(int Argc, char *Argv[]) {
     Module::OutputFlags flags = Module::NoFlags;
     Arch arch = Arch::none;
     std::vector<ISPCTarget> targets;
+    std::vector<std::string> targetCPUs;
     const char *cpu = NULL, *intelAsmSyntax = NULL;
     VectorCallStatus vectorCall = VectorCallStatus::none;
 
@@ -631,6 +653,16 @@ int main(int Argc, char *Argv[]) {
                                       "only intel and att are allowed.",
                                       argv[i] + 17);
             }
+        } else if (!strncmp(argv[i], "--cache-dir=", 12)) {
+            g->cacheDir = argv[i] + 12;
+        } else if (!strncmp(argv[i], "--cache-max-size=", 17)) {
+            int size = atoi(argv[i] + 17);
+            if (size > 0)
+                g->cacheMaxSize = uint64_t(size) * 1024 * 1024;
+            else
+                errorHandler.AddError("Invalid value for --cache-max-size: \"%s\" -- "
+                                      "value must be a positive number of megabytes.",
+                                      argv[i] + 17);
         } else if (!strncmp(argv[i], "--cpu=", 6)) {
             cpu = argv[i] + 6;
         } else if (!strcmp(argv[i], "--fast-math")) {
@@ -660,6 +692,10 @@ int main(int Argc, char *Argv[]) {
             g->NoOmitFramePointer = true;
         else if (!strcmp(argv[i], "--instrument"))
             g->emitInstrumentation = true;
+        else if (!strcmp(argv[i], "--profile-generate"))
+            g->profileGenerate = true;
+        else if (!strncmp(argv[i], "--profile-use=", 14))
+            profileFileName = argv[i] + 14;
         else if (!strcmp(argv[i], "--no-pragma-once"))
             g->noPragmaOnce = true;
         else if (!strcmp(argv[i], "-g")) {
@@ -670,6 +706,8 @@ int main(int Argc, char *Argv[]) {
             ot = Module::Bitcode;
         else if (!strcmp(argv[i], "--emit-llvm-text"))
             ot = Module::BitcodeText;
+        else if (!strcmp(argv[i], "--emit-llvm-lto"))
+            ot = Module::LTOBitcode;
         else if (!strcmp(argv[i], "--emit-obj"))
             ot = Module::Object;
 #ifdef ISPC_GENX_ENABLED
@@ -694,7 +732,7 @@ int main(int Argc, char *Argv[]) {
         else if (!strcmp(argv[i], "--target")) {
             // FIXME: should remove this way of specifying the target...
             if (++i != argc) {
-                auto result = ParseISPCTargets(argv[i]);
+                auto result = ParseISPCTargets(argv[i], targetCPUs);
                 targets = result.first;
                 if (!result.second.empty()) {
                     errorHandler.AddError("Incorrect targets: %s.  Choices are: %s.", result.second.c_str(),
@@ -704,7 +742,7 @@ int main(int Argc, char *Argv[]) {
                 errorHandler.AddError("No target specified after --target option.");
             }
         } else if (!strncmp(argv[i], "--target=", 9)) {
-            auto result = ParseISPCTargets(argv[i] + 9);
+            auto result = ParseISPCTargets(argv[i] + 9, targetCPUs);
             targets = result.first;
             if (!result.second.empty()) {
                 errorHandler.AddError("Incorrect targets: %s.  Choices are: %s.", result.second.c_str(),
@@ -720,6 +758,17 @@ int main(int Argc, char *Argv[]) {
             vectorCall = VectorCallStatus::disabled;
         } else if (!strcmp(argv[i], "--vectorcall")) {
             vectorCall = VectorCallStatus::enabled;
+        } else if (!strncmp(argv[i], "--dispatch=", 11)) {
+            const char *mode = argv[i] + 11;
+            if (!strcmp(mode, "check"))
+                g->dispatchMode = Globals::Dispatch_Check;
+            else if (!strcmp(mode, "pointer"))
+                g->dispatchMode = Globals::Dispatch_Pointer;
+            else if (!strcmp(mode, "ifunc"))
+                g->dispatchMode = Globals::Dispatch_IFunc;
+            else {
+                errorHandler.AddError("Unknown --dispatch= option \"%s\".", mode);
+            }
         } else if (!strncmp(argv[i], "--math-lib=", 11)) {
             const char *lib = argv[i] + 11;
             if (!strcmp(lib, "default"))
@@ -785,6 +834,10 @@ int main(int Argc, char *Argv[]) {
             }
         } else if (!strncmp(argv[i], "--force-alignment=", 18)) {
             g->forceAlignment = atoi(argv[i] + 18);
+        } else if (!strncmp(argv[i], "--opt-remarks=", 14)) {
+            g->optRemarksFile = argv[i] + 14;
+        } else if (!strncmp(argv[i], "--pass-stats=", 13)) {
+            g->passStatsFile = argv[i] + 13;
         } else if (!strcmp(argv[i], "--time-trace")) {
             g->enableTimeTrace = true;
         } else if (!strncmp(argv[i], "--time-trace-granularity=", 25)) {
@@ -802,6 +855,14 @@ int main(int Argc, char *Argv[]) {
                 errorHandler.AddError("Invalid value for --error-limit: \"%d\" -- "
                                       "value cannot be a negative number.",
                                       errLimit);
+        } else if (!strncmp(argv[i], "--jobs=", 7)) {
+            int jobs = atoi(argv[i] + 7);
+            if (jobs > 0)
+                g->numJobs = jobs;
+            else
+                errorHandler.AddError("Invalid value for --jobs: \"%s\" -- "
+                                      "value must be a positive number.",
+                                      argv[i] + 7);
         } else if (!strcmp(argv[i], "--nowrap"))
             g->disableLineWrap = true;
         else if (!strcmp(argv[i], "--wno-perf") || !strcmp(argv[i], "-wno-perf"))
@@ -925,6 +986,40 @@ int main(int Argc, char *Argv[]) {
         exit(1);
     }
 
+    if (profileFileName != NULL) {
+        g->profile = new ProfileData;
+        if (!g->profile->Read(profileFileName))
+            exit(1);
+    }
+
+    // The options that may affect what's generated are part of the key of
+    // cache entries.  The source file and output file names aren't: the
+    // preprocessed source, which is hashed as well, starts with the source
+    // file name, and outputs are copied from an entry to wherever they're
+    // requested.  Neither are the options that control the cache itself,
+    // the number of jobs and the formatting of diagnostics.
+    if (!g->cacheDir.empty()) {
+        for (int i = 1; i < argc; ++i) {
+            if (argv[i] == file || !strncmp(argv[i], "--cache-", 8) || !strncmp(argv[i], "--jobs=", 7) ||
+                !strncmp(argv[i], "--outfile=", 10) || !strncmp(argv[i], "--header-outfile=", 17) ||
+                !strcmp(argv[i], "--nowrap") || !strcmp(argv[i], "--colored-output"))
+                continue;
+            if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "-h") || !strcmp(argv[i], "-MF") ||
+                !strcmp(argv[i], "-MT") || !strcmp(argv[i], "--dev-stub") || !strcmp(argv[i], "--host-stub")) {
+                ++i;
+                continue;
+            }
+            if (!strcmp(argv[i], "-MMM")) {
+                // It selects the format of the dependencies as well.
+                g->cacheKeyArgs += "-MMM\n";
+                ++i;
+                continue;
+            }
+            g->cacheKeyArgs += argv[i];
+            g->cacheKeyArgs += '\n';
+        }
+    }
+
     // Default settings for PS4
     if (g->target_os == TargetOS::ps4) {
         flags |= Module::GeneratePIC;
@@ -951,6 +1046,7 @@ int main(int Argc, char *Argv[]) {
         }
         if (targets.empty()) {
             targets.push_back(ISPCTarget::neon_i32x4);
+            targetCPUs.push_back("");
             std::string target_string = ISPCTargetToString(targets[0]);
             Warning(SourcePos(),
                     "No --target specified on command-line."
@@ -1009,6 +1105,13 @@ int main(int Argc, char *Argv[]) {
         Warning(SourcePos(), "--dllexport switch will be ignored, as the target OS is not Windows.");
     }
 
+    if (g->dispatchMode == Globals::Dispatch_IFunc &&
+        (g->target_os == TargetOS::windows || g->target_os == TargetOS::macos || g->target_os == TargetOS::ios ||
+         g->target_os == TargetOS::web)) {
+        Warning(SourcePos(), "--dispatch=ifunc is supported only for ELF targets, --dispatch=pointer will be used.");
+        g->dispatchMode = Globals::Dispatch_Pointer;
+    }
+
     if (vectorCall != VectorCallStatus::none &&
         (g->target_os != TargetOS::windows ||
          // This is a hacky check. Arch is properly set later, so we rely that default means x86_64.
@@ -1057,8 +1160,8 @@ int main(int Argc, char *Argv[]) {
     int ret = 0;
     {
         llvm::TimeTraceScope TimeScope("ExecuteCompiler");
-        ret = Module::CompileAndOutput(file, arch, cpu, targets, flags, ot, outFileName, headerFileName, depsFileName,
-                                       depsTargetName, hostStubFileName, devStubFileName);
+        ret = Module::CompileAndOutput(file, arch, cpu, targets, targetCPUs, flags, ot, outFileName, headerFileName,
+                                       depsFileName, depsTargetName, hostStubFileName, devStubFileName);
     }
 
     if (g->enableTimeTrace) {
@@ -1068,5 +1171,13 @@ int main(int Argc, char *Argv[]) {
         }
         llvm::timeTraceProfilerCleanup();
     }
+    if (!g->passStatsFile.empty() && ret == 0) {
+        if (!WritePassStats(g->passStatsFile.c_str(), file))
+            ret = 1;
+    }
+    if (!g->optRemarksFile.empty() && ret == 0) {
+        if (!WriteOptRemarks(g->optRemarksFile.c_str()))
+            ret = 1;
+    }
     return ret;
 }
@@ -38,6 +38,7 @@
 
 #include "module.h"
 #include "builtins.h"
+#include "cache.h"
 #include "ctx.h"
 #include "expr.h"
 #include "func.h"
@@ -51,6 +52,8 @@
 #include <algorithm>
 #include <ctype.h>
 #include <fcntl.h>
+#include <functional>
+#include <map>
 #include <set>
 #include <sstream>
 #include <stdarg.h>
@@ -61,6 +64,10 @@
 #include <io.h>
 #include <windows.h>
 #define strcasecmp stricmp
+#else
+#include <errno.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #endif
 
 #include <clang/Basic/TargetInfo.h>
@@ -145,7 +152,7 @@ static void lStripUnusedDebugInfo(llvm::Module *module) { return; }
 ///////////////////////////////////////////////////////////////////////////
 // Module
 
-Module::Module(const char *fn) {
+Module::Module(const char *fn, const std::string *text) {
     // It's a hack to do this here, but it must be done after the target
     // information has been set (so e.g. the vector width is known...)  In
     // particular, if we're compiling to multiple targets with different
@@ -153,7 +160,9 @@ Module::Module(const char *fn) {
     InitLLVMUtil(g->ctx, *g->target);
 
     filename = fn;
+    sourceText = text;
     errorCount = 0;
+    warningCount = 0;
     symbolTable = new SymbolTable;
     ast = new AST;
 
@@ -164,6 +173,7 @@ Module::Module(const char *fn) {
 
     diBuilder = NULL;
     diCompileUnit = NULL;
+    instrumentationTable = NULL;
 
     // DataLayout information supposed to be managed in single place in Target class.
     module->setDataLayout(g->target->getDataLayout()->getStringRepresentation());
@@ -222,9 +232,9 @@ extern YY_BUFFER_STATE yy_scan_string(const char *);
 extern YY_BUFFER_STATE yy_create_buffer(FILE *, int);
 extern void yy_delete_buffer(YY_BUFFER_STATE);
 
-int Module::CompileFile() {
+int Module::CompileFile(bool optimize) {
     llvm::TimeTraceScope CompileFileTimeScope(
-        "CompileFile", llvm::StringRef(filename + ("_" + std::string(g->target->GetISAString()))));
+        "CompileFile", llvm::StringRef(filename + ("_" + std::string(g->target->GetVariantString()))));
     extern void ParserInit();
     ParserInit();
 
@@ -241,21 +251,31 @@ int Module::CompileFile() {
 
     if (runPreprocessor) {
         llvm::TimeTraceScope TimeScope("Frontend parser");
-        if (!IsStdin(filename)) {
-            // Try to open the file first, since otherwise we crash in the
-            // preprocessor if the file doesn't exist.
-            FILE *f = fopen(filename, "r");
-            if (!f) {
-                perror(filename);
-                return 1;
+        std::string buffer;
+        if (!preprocessorOutput.empty())
+            buffer.swap(preprocessorOutput);
+        else {
+            if (sourceText == NULL && !IsStdin(filename)) {
+                // Try to open the file first, since otherwise we crash in the
+                // preprocessor if the file doesn't exist.
+                FILE *f = fopen(filename, "r");
+                if (!f) {
+                    perror(filename);
+                    return 1;
+                }
+                fclose(f);
             }
-            fclose(f);
-        }
 
-        std::string buffer;
-        llvm::raw_string_ostream os(buffer);
-        execPreprocessor(!IsStdin(filename) ? filename : "-", &os);
-        YY_BUFFER_STATE strbuf = yy_scan_string(os.str().c_str());
+            llvm::raw_string_ostream os(buffer);
+            execPreprocessor(!IsStdin(filename) ? filename : "-", &os);
+            os.flush();
+        }
+        YY_BUFFER_STATE strbuf = yy_scan_string(buffer.c_str());
+        yyparse();
+        yy_delete_buffer(strbuf);
+    } else if (sourceText != NULL) {
+        llvm::TimeTraceScope TimeScope("Frontend parser");
+        YY_BUFFER_STATE strbuf = yy_scan_string(sourceText->c_str());
         yyparse();
         yy_delete_buffer(strbuf);
     } else {
@@ -283,16 +303,103 @@ int Module::CompileFile() {
     for (llvm::Function &f : *module)
         g->target->markFuncWithTargetAttr(&f);
     ast->GenerateIR();
+    emitInstrumentationTable();
+    {
+        llvm::TimeTraceScope TimeScope("LinkBitcodeDefinitions");
+        LinkBitcodeDefinitions(module);
+    }
 
     if (diBuilder)
         diBuilder->finalize();
     llvm::TimeTraceScope TimeScope("Optimize");
-    if (errorCount == 0)
+    if (optimize && errorCount == 0)
         Optimize(module, g->opt.level);
 
     return errorCount;
 }
 
+int Module::AddInstrumentationSite(const SourcePos &pos, const std::string &function, const char *note) {
+    InstrumentationSite site;
+    site.pos = pos;
+    site.function = function;
+    site.note = note;
+    instrumentationSites.push_back(site);
+    return (int)instrumentationSites.size() - 1;
+}
+
+llvm::Constant *Module::GetInstrumentationTable() {
+    if (instrumentationTable == NULL)
+        instrumentationTable =
+            new llvm::GlobalVariable(*module, LLVMTypes::Int8Type, false, llvm::GlobalValue::InternalLinkage,
+                                     LLVMInt8(0), "__ispc_instrument_table");
+    return instrumentationTable;
+}
+
+/** Builds the table of instrumentation sites that --instrument passes to
+    ISPCInstrumentSite() and replaces the placeholder with it.  It has to
+    match SiteTable and SiteInfo in ispcrt/ispc_instrument.cpp:
+
+    struct SiteInfo {
+        const char *file, *function, *note;
+        int32_t line, column;
+    };
+    struct SiteTable {
+        int32_t version, numSites, maskWidth;
+        int32_t id; // assigned by the runtime, -1 until then
+        const char *target;
+        const SiteInfo *sites;
+    };
+ */
+void Module::emitInstrumentationTable() {
+    if (instrumentationTable == NULL)
+        return;
+
+    std::map<std::string, llvm::Constant *> strings;
+    auto getString = [&](const std::string &str) {
+        llvm::Constant *&ptr = strings[str];
+        if (ptr == NULL) {
+            llvm::Constant *sConstant = llvm::ConstantDataArray::getString(*g->ctx, str, true);
+            llvm::GlobalVariable *sGlobal =
+                new llvm::GlobalVariable(*module, sConstant->getType(), true /* const */,
+                                         llvm::GlobalValue::PrivateLinkage, sConstant, "__ispc_instrument_str");
+            sGlobal->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+            ptr = llvm::ConstantExpr::getPointerCast(sGlobal, LLVMTypes::Int8PointerType);
+        }
+        return ptr;
+    };
+
+    llvm::StructType *siteType =
+        llvm::StructType::get(*g->ctx, {LLVMTypes::Int8PointerType, LLVMTypes::Int8PointerType,
+                                        LLVMTypes::Int8PointerType, LLVMTypes::Int32Type, LLVMTypes::Int32Type});
+    std::vector<llvm::Constant *> sites;
+    for (const InstrumentationSite &site : instrumentationSites)
+        sites.push_back(llvm::ConstantStruct::get(siteType, {getString(site.pos.name), getString(site.function),
+                                                             getString(site.note), LLVMInt32(site.pos.first_line),
+                                                             LLVMInt32(site.pos.first_column)}));
+    llvm::ArrayType *sitesType = llvm::ArrayType::get(siteType, sites.size());
+    llvm::GlobalVariable *sitesGlobal =
+        new llvm::GlobalVariable(*module, sitesType, true /* const */, llvm::GlobalValue::InternalLinkage,
+                                 llvm::ConstantArray::get(sitesType, sites), "__ispc_instrument_sites");
+
+    llvm::StructType *tableType = llvm::StructType::get(
+        *g->ctx, {LLVMTypes::Int32Type, LLVMTypes::Int32Type, LLVMTypes::Int32Type, LLVMTypes::Int32Type,
+                  LLVMTypes::Int8PointerType, llvm::PointerType::get(siteType, 0)});
+    llvm::Constant *table = llvm::ConstantStruct::get(
+        tableType, {LLVMInt32(1), LLVMInt32((int32_t)sites.size()), LLVMInt32(g->target->getVectorWidth()),
+                    LLVMInt32(-1), getString(ISPCTargetToString(g->target->getISPCTarget())),
+                    llvm::ConstantExpr::getPointerCast(sitesGlobal, llvm::PointerType::get(siteType, 0))});
+    // The runtime stores the ID that it assigns to the table in it, so the
+    // table itself can't be constant.
+    llvm::GlobalVariable *tableGlobal = new llvm::GlobalVariable(*module, tableType, false /* not const */,
+                                                                 llvm::GlobalValue::InternalLinkage, table, "");
+
+    instrumentationTable->replaceAllUsesWith(
+        llvm::ConstantExpr::getPointerCast(tableGlobal, instrumentationTable->getType()));
+    tableGlobal->takeName(instrumentationTable);
+    instrumentationTable->eraseFromParent();
+    instrumentationTable = NULL;
+}
+
 void Module::AddTypeDef(const std::string &name, const Type *type, SourcePos pos) {
     // Typedefs are easy; just add the mapping between the given name and
     // the given type.
@@ -748,7 +855,7 @@ void Module::AddFunctionDeclaration(const std::string &name, const FunctionType
         functionName += functionType->Mangle();
         // If we treat generic as smth, we should have appropriate mangling
         if (g->mangleFunctionsWithTarget) {
-            functionName += g->target->GetISAString();
+            functionName += g->target->GetVariantString();
         }
     }
     llvm::Function *function = llvm::Function::Create(llvmFunctionType, linkage, functionName.c_str(), module);
@@ -972,6 +1079,12 @@ bool Module::writeOutput(OutputType outputType, OutputFlags flags, const char *o
                 if (strcasecmp(suffix, "ll"))
                     fileType = "LLVM assembly";
                 break;
+            case LTOBitcode:
+                // Compilers name bitcode for link-time optimization like
+                // object files.
+                if (strcasecmp(suffix, "bc") && strcasecmp(suffix, "o") && strcasecmp(suffix, "obj"))
+                    fileType = "LLVM bitcode";
+                break;
             case Object:
                 if (strcasecmp(suffix, "o") && strcasecmp(suffix, "obj"))
                     fileType = "object";
@@ -1026,6 +1139,10 @@ bool Module::writeOutput(OutputType outputType, OutputFlags flags, const char *o
         return writeDevStub(outFileName);
     else if ((outputType == Bitcode) || (outputType == BitcodeText))
         return writeBitcode(module, outFileName, outputType);
+    else if (outputType == LTOBitcode) {
+        addLTOFunctionAttributes(g->target->GetTargetMachine(), module);
+        return writeBitcode(module, outFileName, outputType);
+    }
 #ifdef ISPC_GENX_ENABLED
     else if (outputType == SPIRV)
         return writeSPIRV(module, outFileName);
@@ -1062,9 +1179,37 @@ bool Module::writeBitcode(llvm::Module *module, const char *outFileName, OutputT
         llvm::WriteBitcodeToFile(*module, fos);
     else if (outputType == BitcodeText)
         module->print(fos, nullptr);
+    else if (outputType == LTOBitcode) {
+        // This is what clang writes for -flto=thin: the bitcode with a
+        // summary of the module that the linker uses to decide what to
+        // import across modules.  Without a summary, the linker still
+        // does a regular (full) link-time optimization.
+        llvm::legacy::PassManager pm;
+        pm.add(llvm::createWriteThinLTOBitcodePass(fos));
+        pm.run(*module);
+    }
     return true;
 }
 
+/** With link-time optimization, the code of the module is generated by
+    the linker, for its own target machine.  So, like clang does, record
+    the CPU and features that each function was compiled for in its
+    attributes; they also let the inliner check that an ispc function is
+    only inlined into callers compiled for a compatible CPU.
+ */
+void Module::addLTOFunctionAttributes(llvm::TargetMachine *targetMachine, llvm::Module *module) {
+    std::string cpu = targetMachine->getTargetCPU().str();
+    std::string features = targetMachine->getTargetFeatureString().str();
+    for (llvm::Function &f : *module) {
+        if (f.isDeclaration())
+            continue;
+        if (!cpu.empty() && !f.hasFnAttribute("target-cpu"))
+            f.addFnAttr("target-cpu", cpu);
+        if (!features.empty() && !f.hasFnAttribute("target-features"))
+            f.addFnAttr("target-features", features);
+    }
+}
+
 #ifdef ISPC_GENX_ENABLED
 bool Module::translateToSPIRV(llvm::Module *module, std::stringstream &ss) {
     std::string err;
@@ -1973,11 +2118,13 @@ bool Module::writeHeader(const char *fn) {
 
     fprintf(f, "#include <stdint.h>\n\n");
 
-    if (g->emitInstrumentation) {
+    if (g->emitInstrumentation || g->profileGenerate) {
         fprintf(f, "#define ISPC_INSTRUMENTATION 1\n");
         fprintf(f, "#if defined(__cplusplus) && (! defined(__ISPC_NO_EXTERN_C) || !__ISPC_NO_EXTERN_C )\nextern \"C\" "
                    "{\n#endif // __cplusplus\n");
-        fprintf(f, "  void ISPCInstrument(const char *fn, const char *note, int line, uint64_t mask);\n");
+        fprintf(f, "  void ISPCInstrumentReport(const char *fileName);\n");
+        fprintf(f, "  void ISPCInstrumentReset(void);\n");
+        fprintf(f, "  void ISPCInstrumentWriteProfile(const char *fileName);\n");
         fprintf(f, "#if defined(__cplusplus) && (! defined(__ISPC_NO_EXTERN_C) || !__ISPC_NO_EXTERN_C )\n} /* end "
                    "extern C */\n#endif // __cplusplus\n");
     }
@@ -2087,11 +2234,13 @@ bool Module::writeDispatchHeader(DispatchHeaderInfo *DHI) {
 
         fprintf(f, "#include <stdint.h>\n\n");
 
-        if (g->emitInstrumentation) {
+        if (g->emitInstrumentation || g->profileGenerate) {
             fprintf(f, "#define ISPC_INSTRUMENTATION 1\n");
             fprintf(f, "#if defined(__cplusplus) && (! defined(__ISPC_NO_EXTERN_C) || !__ISPC_NO_EXTERN_C )\nextern "
                        "\"C\" {\n#endif // __cplusplus\n");
-            fprintf(f, "  void ISPCInstrument(const char *fn, const char *note, int line, uint64_t mask);\n");
+            fprintf(f, "  void ISPCInstrumentReport(const char *fileName);\n");
+            fprintf(f, "  void ISPCInstrumentReset(void);\n");
+            fprintf(f, "  void ISPCInstrumentWriteProfile(const char *fileName);\n");
             fprintf(f, "#if defined(__cplusplus) && (! defined(__ISPC_NO_EXTERN_C) || !__ISPC_NO_EXTERN_C )\n} /* end "
                        "extern C */\n#endif // __cplusplus\n");
         }
@@ -2203,9 +2352,14 @@ void Module::execPreprocessor(const char *infilename, llvm::raw_string_ostream *
     inst.setTarget(target);
     inst.createSourceManager(inst.getFileManager());
 
-    clang::FrontendInputFile inputFile(infilename, clang::InputKind());
-
-    inst.InitializeSourceManager(inputFile);
+    if (sourceText != NULL) {
+        clang::SourceManager &sourceManager = inst.getSourceManager();
+        sourceManager.setMainFileID(
+            sourceManager.createFileID(llvm::MemoryBuffer::getMemBufferCopy(*sourceText, infilename)));
+    } else {
+        clang::FrontendInputFile inputFile(infilename, clang::InputKind());
+        inst.InitializeSourceManager(inputFile);
+    }
 
     // Don't remove comments in the preprocessor, so that we can accurately
     // track the source file position by handling them ourselves.
@@ -2319,7 +2473,7 @@ void Module::execPreprocessor(const char *infilename, llvm::raw_string_ostream *
 // "avx", return a string with the ISA name inserted before the original
 // filename's suffix, like "foo_avx.obj".
 static std::string lGetTargetFileName(const char *outFileName, const char *isaString) {
-    int bufferSize = strlen(outFileName) + 16;
+    int bufferSize = strlen(outFileName) + strlen(isaString) + 2;
     char *targetOutFileName = new char[bufferSize];
     if (strrchr(outFileName, '.') != NULL) {
         // Copy everything up to the last '.'
@@ -2360,6 +2514,26 @@ struct FunctionTargetVariants {
     // compiled to the corresponding target ISA.
     llvm::Function *func[Target::NUM_ISAS];
     const FunctionType *FTs[Target::NUM_ISAS];
+
+    // Variants compiled for a specific CPU within an ISA (e.g. for
+    // "--target=avx2-i32x8:znver2"), which are preferred to the plain
+    // variant of the same ISA on systems with one of the CPU's models.
+    struct CPUVariant {
+        Target::ISA isa;
+        std::vector<std::pair<int, int>> models;
+        llvm::Function *func;
+        const FunctionType *FT;
+    };
+    std::vector<CPUVariant> cpuVariants;
+};
+
+// A variant of an exported function that a dispatch function may select:
+// it is selected on systems that support the given ISA and, if models is
+// non-NULL, have one of the given CPU models.
+struct DispatchCandidate {
+    int isa;
+    const std::vector<std::pair<int, int>> *models;
+    llvm::Function *func;
 };
 
 // Given the symbol table for a module, return a map from function names to
@@ -2370,6 +2544,11 @@ static void lGetExportedFunctions(SymbolTable *symbolTable, std::map<std::string
     symbolTable->GetMatchingFunctions(lSymbolIsExported, &syms);
     for (unsigned int i = 0; i < syms.size(); ++i) {
         FunctionTargetVariants &ftv = functions[syms[i]->name];
+        if (g->target->isCPUVariant()) {
+            ftv.cpuVariants.push_back({g->target->getISA(), g->target->getCPUModels(), syms[i]->exportedFunction,
+                                       CastType<FunctionType>(syms[i]->type)});
+            continue;
+        }
         ftv.func[g->target->getISA()] = syms[i]->exportedFunction;
         ftv.FTs[g->target->getISA()] = CastType<FunctionType>(syms[i]->type);
     }
@@ -2379,36 +2558,40 @@ static llvm::FunctionType *lGetVaryingDispatchType(FunctionTargetVariants &funcs
     llvm::Type *ptrToInt8Ty = llvm::Type::getInt8PtrTy(*g->ctx);
     llvm::FunctionType *resultFuncTy = NULL;
 
+    std::vector<std::pair<llvm::Function *, const FunctionType *>> variants;
     for (int i = 0; i < Target::NUM_ISAS; ++i) {
-        if (funcs.func[i] == NULL) {
-            continue;
-        } else {
-            bool foundVarying = false;
-            const FunctionType *ft = funcs.FTs[i];
-            resultFuncTy = funcs.func[i]->getFunctionType();
-
-            int numArgs = ft->GetNumParameters();
-            llvm::SmallVector<llvm::Type *, 8> ftype;
-            for (int j = 0; j < numArgs; ++j) {
-                ftype.push_back(resultFuncTy->getParamType(j));
-            }
+        if (funcs.func[i] != NULL)
+            variants.push_back(std::make_pair(funcs.func[i], funcs.FTs[i]));
+    }
+    for (const FunctionTargetVariants::CPUVariant &cv : funcs.cpuVariants)
+        variants.push_back(std::make_pair(cv.func, cv.FT));
+
+    for (const auto &variant : variants) {
+        bool foundVarying = false;
+        const FunctionType *ft = variant.second;
+        resultFuncTy = variant.first->getFunctionType();
+
+        int numArgs = ft->GetNumParameters();
+        llvm::SmallVector<llvm::Type *, 8> ftype;
+        for (int j = 0; j < numArgs; ++j) {
+            ftype.push_back(resultFuncTy->getParamType(j));
+        }
 
-            for (int j = 0; j < numArgs; ++j) {
-                const Type *arg = ft->GetParameterType(j);
-
-                if (arg->IsPointerType()) {
-                    const Type *baseType = CastType<PointerType>(arg)->GetBaseType();
-                    // For each varying type pointed to, swap the LLVM pointer type
-                    // with i8 * (as close as we can get to void *)
-                    if (baseType->IsVaryingType()) {
-                        ftype[j] = ptrToInt8Ty;
-                        foundVarying = true;
-                    }
+        for (int j = 0; j < numArgs; ++j) {
+            const Type *arg = ft->GetParameterType(j);
+
+            if (arg->IsPointerType()) {
+                const Type *baseType = CastType<PointerType>(arg)->GetBaseType();
+                // For each varying type pointed to, swap the LLVM pointer type
+                // with i8 * (as close as we can get to void *)
+                if (baseType->IsVaryingType()) {
+                    ftype[j] = ptrToInt8Ty;
+                    foundVarying = true;
                 }
             }
-            if (foundVarying) {
-                resultFuncTy = llvm::FunctionType::get(resultFuncTy->getReturnType(), ftype, false);
-            }
+        }
+        if (foundVarying) {
+            resultFuncTy = llvm::FunctionType::get(resultFuncTy->getReturnType(), ftype, false);
         }
     }
 
@@ -2419,6 +2602,207 @@ static llvm::FunctionType *lGetVaryingDispatchType(FunctionTargetVariants &funcs
     return resultFuncTy;
 }
 
+/** Returns whether any of the candidates is restricted to specific CPU
+    models, so that the dispatch code needs the system's CPU model. */
+static bool lNeedsCPUModel(const std::vector<DispatchCandidate> &candidates) {
+    for (const DispatchCandidate &candidate : candidates)
+        if (candidate.models != NULL)
+            return true;
+    return false;
+}
+
+/** Emits code at the end of the given basic block that loads the system's
+    CPU model, as returned by __get_system_cpu_model(), after calling
+    __set_system_cpu_model() to set it if it hasn't been set yet. */
+static llvm::Value *lEmitLoadSystemCPUModel(llvm::Module *module, llvm::BasicBlock *bblock) {
+    llvm::Function *setFunc = module->getFunction("__set_system_cpu_model");
+    Assert(setFunc != NULL);
+    llvm::GlobalVariable *systemCPUModelPtr = module->getGlobalVariable("__system_cpu_model", true);
+    Assert(systemCPUModelPtr != NULL);
+
+    llvm::CallInst::Create(setFunc, "", bblock);
+#if ISPC_LLVM_VERSION >= ISPC_LLVM_11_0
+    return new llvm::LoadInst(systemCPUModelPtr->getValueType(), systemCPUModelPtr, "system_cpu_model", bblock);
+#else
+    return new llvm::LoadInst(systemCPUModelPtr, "system_cpu_model", bblock);
+#endif
+}
+
+/** Emits code at the end of the given basic block that checks whether a
+    system with the given ISA enumerant and CPU model can run the given
+    candidate and returns the i1 result. */
+static llvm::Value *lEmitCandidateCheck(const DispatchCandidate &candidate, llvm::Value *systemISA,
+                                        llvm::Value *systemCPUModel, llvm::BasicBlock *bblock) {
+    llvm::Value *ok = llvm::CmpInst::Create(llvm::Instruction::ICmp, llvm::CmpInst::ICMP_SGE, systemISA,
+                                            LLVMInt32(candidate.isa), "isa_ok", bblock);
+    if (candidate.models == NULL)
+        return ok;
+
+    Assert(systemCPUModel != NULL);
+    llvm::Value *modelOk = LLVMFalse;
+    for (const std::pair<int, int> &range : *candidate.models) {
+        llvm::Value *inRange;
+        if (range.first == range.second)
+            inRange = llvm::CmpInst::Create(llvm::Instruction::ICmp, llvm::CmpInst::ICMP_EQ, systemCPUModel,
+                                            LLVMInt32(range.first), "model_eq", bblock);
+        else {
+            llvm::Value *geFirst = llvm::CmpInst::Create(llvm::Instruction::ICmp, llvm::CmpInst::ICMP_SGE,
+                                                         systemCPUModel, LLVMInt32(range.first), "model_ge", bblock);
+            llvm::Value *leLast = llvm::CmpInst::Create(llvm::Instruction::ICmp, llvm::CmpInst::ICMP_SLE,
+                                                        systemCPUModel, LLVMInt32(range.second), "model_le", bblock);
+            inRange = llvm::BinaryOperator::Create(llvm::Instruction::And, geFirst, leLast, "model_in_range", bblock);
+        }
+        modelOk = llvm::BinaryOperator::Create(llvm::Instruction::Or, modelOk, inRange, "model_ok", bblock);
+    }
+    return llvm::BinaryOperator::Create(llvm::Instruction::And, ok, modelOk, "cpu_ok", bblock);
+}
+
+/** Emits code at the end of the given basic block that selects the most
+    capable of the target-specific variants of a function that can run on a
+    system with the given ISA enumerant and CPU model and returns a pointer
+    to it.  If the system can't run any of them, the emitted code calls
+    abort().  On return, bblock is the basic block in which code emission
+    should continue. */
+static llvm::Value *lEmitSelectVariant(llvm::Module *module, llvm::FunctionType *ftype,
+                                       const std::vector<DispatchCandidate> &candidates, llvm::Value *systemISA,
+                                       llvm::Value *systemCPUModel, llvm::BasicBlock *&bblock) {
+    // The candidates are ordered from least to most capable, so each
+    // supported variant overrides the previous ones.
+    llvm::Constant *noVariant = llvm::ConstantPointerNull::get(llvm::PointerType::getUnqual(ftype));
+    llvm::Value *variant = noVariant;
+    for (const DispatchCandidate &candidate : candidates) {
+        llvm::Value *ok = lEmitCandidateCheck(candidate, systemISA, systemCPUModel, bblock);
+        variant = llvm::SelectInst::Create(ok, candidate.func, variant, "variant", bblock);
+    }
+
+    llvm::Value *none = llvm::CmpInst::Create(llvm::Instruction::ICmp, llvm::CmpInst::ICMP_EQ, variant, noVariant,
+                                              "no_variant", bblock);
+    llvm::Function *func = bblock->getParent();
+    llvm::BasicBlock *abortBBlock = llvm::BasicBlock::Create(*g->ctx, "no_variant", func);
+    llvm::BasicBlock *foundBBlock = llvm::BasicBlock::Create(*g->ctx, "found_variant", func);
+    llvm::BranchInst::Create(abortBBlock, foundBBlock, none, bblock);
+
+    llvm::Function *abortFunc = module->getFunction("abort");
+    Assert(abortFunc);
+    llvm::CallInst::Create(abortFunc, "", abortBBlock);
+    new llvm::UnreachableInst(*g->ctx, abortBBlock);
+
+    bblock = foundBBlock;
+    return variant;
+}
+
+/** Emits a tail call to the given function (or function pointer) at the
+    end of the given basic block that passes through all of the arguments
+    of the function that the basic block is in, followed by a return of the
+    call's result. */
+static void lEmitForwardingCall(llvm::FunctionType *ftype, llvm::Value *callee, llvm::BasicBlock *bblock) {
+    std::vector<llvm::Value *> args;
+    llvm::Function *func = bblock->getParent();
+    for (llvm::Function::arg_iterator argIter = func->arg_begin(); argIter != func->arg_end(); ++argIter)
+        args.push_back(&*argIter);
+
+    llvm::CallInst *callInst = llvm::CallInst::Create(ftype, callee, args, "", bblock);
+    callInst->setTailCall();
+    if (g->calling_conv == CallingConv::x86_vectorcall) {
+        callInst->setCallingConv(llvm::CallingConv::X86_VectorCall);
+    }
+    if (ftype->getReturnType()->isVoidTy())
+        llvm::ReturnInst::Create(*g->ctx, bblock);
+    else
+        llvm::ReturnInst::Create(*g->ctx, callInst, bblock);
+}
+
+/** Create a dispatch function for an exported ispc function that selects
+    the variant to call only once, for --dispatch=pointer and
+    --dispatch=ifunc.
+
+    With --dispatch=pointer, the dispatch function calls through a
+    module-local function pointer.  It initially points to a resolver with
+    the same signature that selects the variant, stores it in the pointer
+    and calls it, so that all later calls go straight to the variant.  With
+    --dispatch=ifunc, the dispatch function is a GNU indirect function whose
+    resolver is run by the dynamic loader when it binds the symbol.  Either
+    way, each call costs a single indirect call or jump.
+*/
+static void lCreateResolvedDispatchFunction(llvm::Module *module, llvm::Function *setISAFunc,
+                                            llvm::Value *systemBestISAPtr, const std::string &name,
+                                            llvm::FunctionType *ftype,
+                                            const std::vector<DispatchCandidate> &candidates) {
+    llvm::PointerType *variantPtrType = llvm::PointerType::getUnqual(ftype);
+
+    if (g->dispatchMode == Globals::Dispatch_IFunc) {
+        // The resolver calls __get_system_isa() directly rather than
+        // __set_system_isa(): it runs during relocation processing, so it
+        // shouldn't depend on anything but itself.
+        llvm::Function *getISAFunc = module->getFunction("__get_system_isa");
+        Assert(getISAFunc != NULL);
+        llvm::Function *resolverFunc =
+            llvm::Function::Create(llvm::FunctionType::get(variantPtrType, false), llvm::GlobalValue::InternalLinkage,
+                                   name + "___resolve", module);
+        llvm::BasicBlock *bblock = llvm::BasicBlock::Create(*g->ctx, "entry", resolverFunc);
+        llvm::Value *systemISA = llvm::CallInst::Create(getISAFunc, "system_isa", bblock);
+        llvm::Value *systemCPUModel = NULL;
+        if (lNeedsCPUModel(candidates)) {
+            llvm::Function *getCPUModelFunc = module->getFunction("__get_system_cpu_model");
+            Assert(getCPUModelFunc != NULL);
+            systemCPUModel = llvm::CallInst::Create(getCPUModelFunc, "system_cpu_model", bblock);
+        }
+        llvm::Value *variant = lEmitSelectVariant(module, ftype, candidates, systemISA, systemCPUModel, bblock);
+        llvm::ReturnInst::Create(*g->ctx, variant, bblock);
+
+        llvm::GlobalIFunc::create(ftype, 0, llvm::GlobalValue::ExternalLinkage, name, resolverFunc, module);
+        return;
+    }
+
+    Assert(g->dispatchMode == Globals::Dispatch_Pointer);
+    llvm::Function *resolveFunc =
+        llvm::Function::Create(ftype, llvm::GlobalValue::InternalLinkage, name + "___resolve", module);
+    g->target->markFuncWithCallingConv(resolveFunc);
+    llvm::GlobalVariable *variantPtr = new llvm::GlobalVariable(
+        *module, variantPtrType, false, llvm::GlobalValue::InternalLinkage, resolveFunc, name + "___variant");
+
+    // The pointer is read and written with monotonic atomics: concurrent
+    // first calls may all resolve and store the same variant, and the
+    // loads and stores compile to plain moves.
+    unsigned align = module->getDataLayout().getPointerABIAlignment(0).value();
+
+    llvm::BasicBlock *bblock = llvm::BasicBlock::Create(*g->ctx, "entry", resolveFunc);
+    llvm::CallInst::Create(setISAFunc, "", bblock);
+#if ISPC_LLVM_VERSION >= ISPC_LLVM_11_0
+    llvm::PointerType *ptr_type = llvm::dyn_cast<llvm::PointerType>(systemBestISAPtr->getType());
+    Assert(ptr_type);
+    llvm::Value *systemISA =
+        new llvm::LoadInst(ptr_type->getPointerElementType(), systemBestISAPtr, "system_isa", bblock);
+#else
+    llvm::Value *systemISA = new llvm::LoadInst(systemBestISAPtr, "system_isa", bblock);
+#endif
+    llvm::Value *systemCPUModel = lNeedsCPUModel(candidates) ? lEmitLoadSystemCPUModel(module, bblock) : NULL;
+    llvm::Value *variant = lEmitSelectVariant(module, ftype, candidates, systemISA, systemCPUModel, bblock);
+#if ISPC_LLVM_VERSION >= ISPC_LLVM_11_0
+    new llvm::StoreInst(variant, variantPtr, false /* not volatile */, llvm::MaybeAlign(align).valueOrOne(),
+                        llvm::AtomicOrdering::Monotonic, llvm::SyncScope::System, bblock);
+#else
+    new llvm::StoreInst(variant, variantPtr, false /* not volatile */, llvm::MaybeAlign(align),
+                        llvm::AtomicOrdering::Monotonic, llvm::SyncScope::System, bblock);
+#endif
+    lEmitForwardingCall(ftype, variant, bblock);
+
+    llvm::Function *dispatchFunc =
+        llvm::Function::Create(ftype, llvm::GlobalValue::ExternalLinkage, name.c_str(), module);
+    g->target->markFuncWithCallingConv(dispatchFunc);
+    bblock = llvm::BasicBlock::Create(*g->ctx, "entry", dispatchFunc);
+#if ISPC_LLVM_VERSION >= ISPC_LLVM_11_0
+    variant = new llvm::LoadInst(variantPtrType, variantPtr, "variant", false /* not volatile */,
+                                 llvm::MaybeAlign(align).valueOrOne(), llvm::AtomicOrdering::Monotonic,
+                                 llvm::SyncScope::System, bblock);
+#else
+    variant =
+        new llvm::LoadInst(variantPtrType, variantPtr, "variant", false /* not volatile */, llvm::MaybeAlign(align),
+                           llvm::AtomicOrdering::Monotonic, llvm::SyncScope::System, bblock);
+#endif
+    lEmitForwardingCall(ftype, variant, bblock);
+}
+
 /** Create the dispatch function for an exported ispc function.
     This function checks to see which vector ISAs the system the
     code is running on supports and calls out to the best available
@@ -2442,7 +2826,7 @@ static void lCreateDispatchFunction(llvm::Module *module, llvm::Function *setISA
     // different llvm::Modules, so we can't call them directly.  Therefore,
     // we'll start by generating an 'extern' declaration of each one that
     // we have in the current module so that we can then call out to that.
-    llvm::Function *targetFuncs[Target::NUM_ISAS];
+    std::vector<DispatchCandidate> candidates;
 
     // New helper function checks to see if we need to rewrite the
     // type for the dispatch function in case of pointers to varyings
@@ -2455,14 +2839,28 @@ static void lCreateDispatchFunction(llvm::Module *module, llvm::Function *setISA
     // modules it may have dissimilar names. The loop below works this
     // around.
 
+    // The candidates are ordered from least to most capable: by ISA, and
+    // within an ISA, the plain variant comes before the CPU variants.
     for (int i = 0; i < Target::NUM_ISAS; ++i) {
         if (funcs.func[i]) {
-
-            targetFuncs[i] =
+            llvm::Function *targetFunc =
                 llvm::Function::Create(ftype, llvm::GlobalValue::ExternalLinkage, funcs.func[i]->getName(), module);
-            g->target->markFuncWithCallingConv(targetFuncs[i]);
-        } else
-            targetFuncs[i] = NULL;
+            g->target->markFuncWithCallingConv(targetFunc);
+            candidates.push_back({i, NULL, targetFunc});
+        }
+        for (const FunctionTargetVariants::CPUVariant &cv : funcs.cpuVariants) {
+            if (cv.isa != i)
+                continue;
+            llvm::Function *targetFunc =
+                llvm::Function::Create(ftype, llvm::GlobalValue::ExternalLinkage, cv.func->getName(), module);
+            g->target->markFuncWithCallingConv(targetFunc);
+            candidates.push_back({i, &cv.models, targetFunc});
+        }
+    }
+
+    if (g->dispatchMode != Globals::Dispatch_Check) {
+        lCreateResolvedDispatchFunction(module, setISAFunc, systemBestISAPtr, name, ftype, candidates);
+        return;
     }
 
     bool voidReturn = ftype->getReturnType()->isVoidTy();
@@ -2486,23 +2884,21 @@ static void lCreateDispatchFunction(llvm::Module *module, llvm::Function *setISA
 #else
     llvm::Value *systemISA = new llvm::LoadInst(systemBestISAPtr, "system_isa", bblock);
 #endif
+    llvm::Value *systemCPUModel = lNeedsCPUModel(candidates) ? lEmitLoadSystemCPUModel(module, bblock) : NULL;
 
     // Now emit code that works backwards though the available variants of
     // the function.  We'll call out to the first one we find that will run
     // successfully on the system the code is running on.  In working
-    // through the candidate ISAs here backward, we're taking advantage of
-    // the expectation that they are ordered in the Target::ISA enumerant
-    // from least to most capable.
-    for (int i = Target::NUM_ISAS - 1; i >= 0; --i) {
-        if (targetFuncs[i] == NULL)
-            continue;
+    // through the candidates here backward, we're taking advantage of
+    // the expectation that they are ordered from least to most capable.
+    for (int i = (int)candidates.size() - 1; i >= 0; --i) {
+        llvm::Function *targetFunc = candidates[i].func;
 
         // Emit code to see if the system can run the current candidate
         // variant successfully--"is the system's ISA enumerant value >=
-        // the enumerant value of the current candidate?"
-
-        llvm::Value *ok = llvm::CmpInst::Create(llvm::Instruction::ICmp, llvm::CmpInst::ICMP_SGE, systemISA,
-                                                LLVMInt32(i), "isa_ok", bblock);
+        // the enumerant value of the current candidate, and is it one of
+        // the candidate's CPU models, if it has any?"
+        llvm::Value *ok = lEmitCandidateCheck(candidates[i], systemISA, systemCPUModel, bblock);
         llvm::BasicBlock *callBBlock = llvm::BasicBlock::Create(*g->ctx, "do_call", dispatchFunc);
         llvm::BasicBlock *nextBBlock = llvm::BasicBlock::Create(*g->ctx, "next_try", dispatchFunc);
         llvm::BranchInst::Create(callBBlock, nextBBlock, ok, bblock);
@@ -2512,7 +2908,7 @@ static void lCreateDispatchFunction(llvm::Module *module, llvm::Function *setISA
         // the target-specific function.
         std::vector<llvm::Value *> args;
         llvm::Function::arg_iterator argIter = dispatchFunc->arg_begin();
-        llvm::Function::arg_iterator targsIter = targetFuncs[i]->arg_begin();
+        llvm::Function::arg_iterator targsIter = targetFunc->arg_begin();
         for (; argIter != dispatchFunc->arg_end(); ++argIter, ++targsIter) {
             // Check to see if we rewrote any types in the dispatch function.
             // If so, create bitcasts for the appropriate pointer types.
@@ -2525,13 +2921,13 @@ static void lCreateDispatchFunction(llvm::Module *module, llvm::Function *setISA
             }
         }
         if (voidReturn) {
-            llvm::CallInst *callInst = llvm::CallInst::Create(targetFuncs[i], args, "", callBBlock);
+            llvm::CallInst *callInst = llvm::CallInst::Create(targetFunc, args, "", callBBlock);
             if (g->calling_conv == CallingConv::x86_vectorcall) {
                 callInst->setCallingConv(llvm::CallingConv::X86_VectorCall);
             }
             llvm::ReturnInst::Create(*g->ctx, callBBlock);
         } else {
-            llvm::CallInst *callInst = llvm::CallInst::Create(targetFuncs[i], args, "ret_value", callBBlock);
+            llvm::CallInst *callInst = llvm::CallInst::Create(targetFunc, args, "ret_value", callBBlock);
             if (g->calling_conv == CallingConv::x86_vectorcall) {
                 callInst->setCallingConv(llvm::CallingConv::X86_VectorCall);
             }
@@ -2634,11 +3030,12 @@ static bool lCompatibleTypes(llvm::Type *Ty1, llvm::Type *Ty2) {
     return false;
 }
 
-// Grab all of the global value definitions from the module and change them
-// to be declarations; we'll emit a single definition of each global in the
-// final module used with the dispatch functions, so that we don't have
-// multiple definitions of them, one in each of the target-specific output
-// files.
+// Grab all of the global value definitions from the module; we'll emit a
+// single definition of each global in the final module used with the
+// dispatch functions, so that we don't have multiple definitions of them,
+// one in each of the target-specific output files.  (The definitions in
+// the target modules are turned into declarations by
+// lClearGlobalInitializers() before they're written out.)
 static void lExtractOrCheckGlobals(llvm::Module *msrc, llvm::Module *mdst, bool check) {
     llvm::Module::global_iterator iter;
     llvm::ValueToValueMapTy VMap;
@@ -2679,29 +3076,231 @@ static void lExtractOrCheckGlobals(llvm::Module *msrc, llvm::Module *mdst, bool
                 newGlobal->setInitializer(llvm::MapValue(iter->getInitializer(), VMap));
                 newGlobal->copyAttributesFrom(gv);
             }
-            // Turn this into an 'extern' declaration by clearing its
-            // initializer.
-            gv->setInitializer(NULL);
         }
     }
 }
 
+// Turn the global variable definitions that lExtractOrCheckGlobals() moved
+// to the dispatch module into 'extern' declarations by clearing their
+// initializers.
+static void lClearGlobalInitializers(llvm::Module *module) {
+    for (llvm::GlobalVariable &gv : module->globals())
+        if (gv.getLinkage() == llvm::GlobalValue::ExternalLinkage && gv.hasInitializer())
+            gv.setInitializer(NULL);
+}
+
+/** When compiling for multiple targets, optimizing and generating code for
+    each target is independent of the other targets, but the compiler's
+    global state ('g', 'm', the LLVMContext, the parser, ...) can't be
+    shared between threads.  On POSIX hosts, BackendJobs therefore runs the
+    back end of each target in a child process that is forked once the
+    front end for the target has finished: the child gets a private copy of
+    all of that state, runs exactly the same code over exactly the same IR
+    as a serial compile would and writes the target's output file, while
+    the parent goes on with the next target.  Elsewhere, or with a single
+    job, the back end simply runs in-process.
+ */
+class BackendJobs {
+  public:
+    BackendJobs(int maxJobs);
+    ~BackendJobs();
+
+    /** Runs the given back end job, which returns true on success.  Returns
+        false if any job that has completed so far has failed. */
+    bool Run(const std::function<bool()> &job);
+
+    /** Waits for all of the outstanding jobs to finish.  Returns false if
+        any of the jobs failed. */
+    bool WaitAll();
+
+  private:
+    int maxJobs;
+    bool failed;
+#ifndef ISPC_HOST_IS_WINDOWS
+    std::vector<pid_t> running;
+
+    void waitOne();
+#endif
+};
+
+BackendJobs::BackendJobs(int n) : maxJobs(n), failed(false) {}
+
+BackendJobs::~BackendJobs() { WaitAll(); }
+
+bool BackendJobs::Run(const std::function<bool()> &job) {
+#ifndef ISPC_HOST_IS_WINDOWS
+    if (maxJobs > 1) {
+        while ((int)running.size() >= maxJobs)
+            waitOne();
+
+        // Don't let the child print anything that is still buffered in
+        // the parent a second time.
+        fflush(stdout);
+        fflush(stderr);
+        pid_t pid = fork();
+        if (pid == 0) {
+            bool ok = job();
+            fflush(stdout);
+            fflush(stderr);
+            _exit(ok ? 0 : 1);
+        }
+        if (pid > 0) {
+            running.push_back(pid);
+            return !failed;
+        }
+        // If fork() failed, just run the job here.
+    }
+#endif
+    if (!job())
+        failed = true;
+    return !failed;
+}
+
+bool BackendJobs::WaitAll() {
+#ifndef ISPC_HOST_IS_WINDOWS
+    while (!running.empty())
+        waitOne();
+#endif
+    return !failed;
+}
+
+#ifndef ISPC_HOST_IS_WINDOWS
+void BackendJobs::waitOne() {
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+        if (errno == EINTR)
+            return;
+        perror("waitpid");
+        running.clear();
+        failed = true;
+        return;
+    }
+
+    std::vector<pid_t>::iterator iter = std::find(running.begin(), running.end(), pid);
+    if (iter == running.end())
+        return;
+    running.erase(iter);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        failed = true;
+}
+#endif
+
+// Returns the number of targets whose back ends may run concurrently.
+static int lGetBackendJobCount(int numTargets) {
+    // Debug dumps, time traces, pass statistics and optimization remarks
+    // are collected by and printed from this process, so keep everything
+    // here when they're requested.
+    if (g->debugPrint || !g->debug_stages.empty() || g->enableTimeTrace || !g->passStatsFile.empty() ||
+        !g->optRemarksFile.empty())
+        return 1;
+
+    int numJobs = g->numJobs;
+#ifndef ISPC_HOST_IS_WINDOWS
+    if (numJobs == 0)
+        numJobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return std::max(1, std::min(numJobs, numTargets));
+}
+
+// Returns the target of the make rule for the dependencies: the one given
+// with -MT, the output file or an object file named after the source file.
+static std::string lGetDepsTargetName(const char *srcFile, const char *outFileName, const char *depsTargetName) {
+    if (depsTargetName)
+        return depsTargetName;
+    if (outFileName)
+        return outFileName;
+    if (IsStdin(srcFile))
+        return "a.out";
+    std::string targetName = srcFile;
+    size_t dot = targetName.find_last_of('.');
+    if (dot != std::string::npos)
+        targetName.erase(dot, std::string::npos);
+    return targetName + ".o";
+}
+
+// Returns the outputs of a single-target compilation as they are stored in
+// the compilation cache, or an empty vector if the cache isn't used for it:
+// when the source isn't preprocessed or comes from stdin, when an output
+// goes to stdout, or when debug dumps, a time trace, pass statistics or
+// optimization remarks are requested.
+static std::vector<CompilationCache::Output> lGetCachedOutputs(const char *srcFile, Module::OutputFlags outputFlags,
+                                                               const char *outFileName, const char *headerFileName,
+                                                               const char *depsFileName, const char *hostStubFileName,
+                                                               const char *devStubFileName) {
+    std::vector<CompilationCache::Output> outputs;
+    if (g->cacheDir.empty() || !g->runCPP || IsStdin(srcFile) || (outputFlags & Module::OutputDepsToStdout) ||
+        g->debugPrint || !g->debug_stages.empty() || g->enableTimeTrace || !g->passStatsFile.empty() ||
+        !g->optRemarksFile.empty())
+        return outputs;
+
+    const char *names[] = {"output", "header", "deps", "host-stub", "dev-stub"};
+    const char *fileNames[] = {outFileName, headerFileName, depsFileName, hostStubFileName, devStubFileName};
+    for (int i = 0; i < 5; ++i) {
+        if (fileNames[i] == NULL)
+            continue;
+        if (strcmp(fileNames[i], "-") == 0)
+            return std::vector<CompilationCache::Output>();
+        outputs.push_back({names[i], fileNames[i]});
+    }
+    return outputs;
+}
+
 int Module::CompileAndOutput(const char *srcFile, Arch arch, const char *cpu, std::vector<ISPCTarget> targets,
-                             OutputFlags outputFlags, OutputType outputType, const char *outFileName,
-                             const char *headerFileName, const char *depsFileName, const char *depsTargetName,
-                             const char *hostStubFileName, const char *devStubFileName) {
+                             std::vector<std::string> targetCPUs, OutputFlags outputFlags, OutputType outputType,
+                             const char *outFileName, const char *headerFileName, const char *depsFileName,
+                             const char *depsTargetName, const char *hostStubFileName, const char *devStubFileName) {
     if (targets.size() == 0 || targets.size() == 1) {
         // We're only compiling to a single target
         // TODO something wrong here
         ISPCTarget target = ISPCTarget::none;
         if (targets.size() == 1) {
             target = targets[0];
+            // With a single target, a CPU qualifying it is the same as --cpu.
+            if (targetCPUs.size() == 1 && !targetCPUs[0].empty()) {
+                if (cpu != NULL) {
+                    Error(SourcePos(), "Illegal to specify both --cpu and a CPU-qualified target.");
+                    return 1;
+                }
+                cpu = targetCPUs[0].c_str();
+            }
         }
         g->target = new Target(arch, cpu, target, 0 != (outputFlags & GeneratePIC), g->printTarget);
         if (!g->target->isValid())
             return 1;
 
         m = new Module(srcFile);
+
+        // With --cache-dir, the preprocessed source is needed for the key of
+        // the cache entry; CompileFile() then uses it rather than running
+        // the preprocessor again.
+        std::vector<CompilationCache::Output> cachedOutputs = lGetCachedOutputs(
+            srcFile, outputFlags, outFileName, headerFileName, depsFileName, hostStubFileName, devStubFileName);
+        std::unique_ptr<CompilationCache> cache;
+        FILE *srcFileHandle = cachedOutputs.empty() ? NULL : fopen(srcFile, "r");
+        if (srcFileHandle != NULL) {
+            fclose(srcFileHandle);
+            llvm::raw_string_ostream os(m->preprocessorOutput);
+            m->execPreprocessor(srcFile, &os);
+            os.flush();
+
+            // The header's include guard is made from its file name, and
+            // the dependencies name their target.
+            std::vector<std::string> embeddedNames;
+            if (headerFileName != NULL)
+                embeddedNames.push_back(headerFileName);
+            if (depsFileName != NULL)
+                embeddedNames.push_back(lGetDepsTargetName(srcFile, outFileName, depsTargetName));
+            cache.reset(new CompilationCache(g->cacheDir, g->cacheMaxSize, m->preprocessorOutput, embeddedNames));
+            if (cache->Fetch(cachedOutputs)) {
+                delete m;
+                m = NULL;
+                delete g->target;
+                g->target = NULL;
+                return 0;
+            }
+        }
+
         if (m->CompileFile() == 0) {
             llvm::TimeTraceScope TimeScope("Backend");
 #ifdef ISPC_GENX_ENABLED
@@ -2712,6 +3311,10 @@ int Module::CompileAndOutput(const char *srcFile, Arch arch, const char *cpu, st
                     return 1;
                 }
             }
+            if (g->target->isGenXTarget() && outputType == OutputType::LTOBitcode) {
+                Error(SourcePos(), "Bitcode for link-time optimization is not supported for \"genx-*\" targets.");
+                return 1;
+            }
             if (g->target->isGenXTarget() && outputType == OutputType::Object) {
                 outputType = OutputType::ZEBIN;
             }
@@ -2727,19 +3330,7 @@ int Module::CompileAndOutput(const char *srcFile, Arch arch, const char *cpu, st
                 if (!m->writeOutput(Module::Header, outputFlags, headerFileName))
                     return 1;
             if (depsFileName != NULL || (outputFlags & Module::OutputDepsToStdout)) {
-                std::string targetName;
-                if (depsTargetName)
-                    targetName = depsTargetName;
-                else if (outFileName)
-                    targetName = outFileName;
-                else if (!IsStdin(srcFile)) {
-                    targetName = srcFile;
-                    size_t dot = targetName.find_last_of('.');
-                    if (dot != std::string::npos)
-                        targetName.erase(dot, std::string::npos);
-                    targetName.append(".o");
-                } else
-                    targetName = "a.out";
+                std::string targetName = lGetDepsTargetName(srcFile, outFileName, depsTargetName);
                 if (!m->writeOutput(Module::Deps, outputFlags, depsFileName, targetName.c_str(), srcFile))
                     return 1;
             }
@@ -2749,6 +3340,11 @@ int Module::CompileAndOutput(const char *srcFile, Arch arch, const char *cpu, st
             if (devStubFileName != NULL)
                 if (!m->writeOutput(Module::DevStub, outputFlags, devStubFileName))
                     return 1;
+
+            // Entries are only added for compilations without warnings, so
+            // that they are still printed every time.
+            if (cache && m->errorCount == 0 && m->warningCount == 0)
+                cache->Store(cachedOutputs);
         } else
             ++m->errorCount;
 
@@ -2767,10 +3363,15 @@ int Module::CompileAndOutput(const char *srcFile, Arch arch, const char *cpu, st
                                "an intermediate temporary file.");
             return 1;
         }
+        // --cpu applies to all of the targets, so it can't be combined with
+        // CPU variants of them.
         if (cpu != NULL) {
-            Error(SourcePos(), "Illegal to specify cpu type when compiling "
-                               "for multiple targets.");
-            return 1;
+            for (const std::string &targetCPU : targetCPUs) {
+                if (!targetCPU.empty()) {
+                    Error(SourcePos(), "Illegal to specify both --cpu and a CPU-qualified target.");
+                    return 1;
+                }
+            }
         }
 
         // The user supplied multiple targets
@@ -2789,12 +3390,15 @@ int Module::CompileAndOutput(const char *srcFile, Arch arch, const char *cpu, st
         llvm::TargetMachine *targetMachines[Target::NUM_ISAS];
         for (int i = 0; i < Target::NUM_ISAS; ++i)
             targetMachines[i] = NULL;
+        std::set<std::string> compiledVariants;
 
         llvm::Module *dispatchModule = NULL;
 
         std::map<std::string, FunctionTargetVariants> exportedFunctions;
         int errorCount = 0;
 
+        BackendJobs backendJobs(lGetBackendJobCount(targets.size()));
+
         // Handle creating a "generic" header file for multiple targets
         // that use exported varyings
         DispatchHeaderInfo DHI;
@@ -2816,31 +3420,44 @@ int Module::CompileAndOutput(const char *srcFile, Arch arch, const char *cpu, st
         }
 
         for (unsigned int i = 0; i < targets.size(); ++i) {
-            g->target = new Target(arch, cpu, targets[i], 0 != (outputFlags & GeneratePIC), g->printTarget);
+            bool cpuVariant = i < targetCPUs.size() && !targetCPUs[i].empty();
+            const char *targetCPU = cpuVariant ? targetCPUs[i].c_str() : cpu;
+            g->target =
+                new Target(arch, targetCPU, targets[i], 0 != (outputFlags & GeneratePIC), g->printTarget, cpuVariant);
             if (!g->target->isValid())
                 return 1;
 
             // Issue an error if we've already compiled to a variant of
-            // this target ISA.  (It doesn't make sense to compile to both
+            // this target ISA for the same CPU, or for any CPU if it isn't
+            // qualified with one.  (It doesn't make sense to compile to both
             // avx and avx-x2, for example.)
-            if (targetMachines[g->target->getISA()] != NULL) {
+            if (!compiledVariants.insert(g->target->GetVariantString()).second) {
                 Error(SourcePos(),
                       "Can't compile to multiple variants of %s "
                       "target!\n",
-                      g->target->GetISAString());
+                      g->target->GetVariantString());
                 return 1;
             }
-            targetMachines[g->target->getISA()] = g->target->GetTargetMachine();
+            if (targetMachines[g->target->getISA()] == NULL)
+                targetMachines[g->target->getISA()] = g->target->GetTargetMachine();
 
             m = new Module(srcFile);
-            int compileFileError = m->CompileFile();
+            // The module is optimized by the back end job for the target
+            // below, so that it can run concurrently with the other targets.
+            int compileFileError = m->CompileFile(false);
             llvm::TimeTraceScope TimeScope("Backend");
             if (compileFileError == 0) {
                 // Create the dispatch module, unless already created;
                 // in the latter case, just do the checking
                 bool check = (dispatchModule != NULL);
-                if (!check)
+                if (!check) {
+                    // The definitions of the globals in the dispatch module
+                    // are taken from the optimized module of the first
+                    // target, so optimize that one right away.
+                    Optimize(m->module, g->opt.level);
                     dispatchModule = lInitDispatchModule();
+                }
+                bool optimized = !check;
                 lExtractOrCheckGlobals(m->module, dispatchModule, check);
 
                 // Grab pointers to the exported functions from the module we
@@ -2848,13 +3465,22 @@ int Module::CompileAndOutput(const char *srcFile, Arch arch, const char *cpu, st
                 // later.
                 lGetExportedFunctions(m->symbolTable, exportedFunctions);
 
-                if (outFileName != NULL) {
-                    std::string targetOutFileName;
-                    const char *isaName = g->target->GetISAString();
-                    targetOutFileName = lGetTargetFileName(outFileName, isaName);
-                    if (!m->writeOutput(outputType, outputFlags, targetOutFileName.c_str())) {
+                std::string targetOutFileName;
+                if (outFileName != NULL)
+                    targetOutFileName = lGetTargetFileName(outFileName, g->target->GetVariantString());
+
+                if (m->errorCount == 0) {
+                    bool jobsOk = backendJobs.Run([=]() {
+                        if (!optimized)
+                            Optimize(m->module, g->opt.level);
+                        if (m->errorCount > 0)
+                            return false;
+                        lClearGlobalInitializers(m->module);
+                        return outFileName == NULL ||
+                               m->writeOutput(outputType, outputFlags, targetOutFileName.c_str());
+                    });
+                    if (!jobsOk)
                         return 1;
-                    }
                 }
             } else {
                 ++m->errorCount;
@@ -2874,7 +3500,7 @@ int Module::CompileAndOutput(const char *srcFile, Arch arch, const char *cpu, st
                 }
 
                 const char *isaName;
-                isaName = g->target->GetISAString();
+                isaName = g->target->GetVariantString();
                 std::string targetHeaderFileName = lGetTargetFileName(headerFileName, isaName);
                 // write out a header w/o target name for the first target only
                 if (!m->writeOutput(Module::Header, outputFlags, headerFileName, nullptr, nullptr, &DHI)) {
@@ -2897,9 +3523,9 @@ int Module::CompileAndOutput(const char *srcFile, Arch arch, const char *cpu, st
         }
 
         // Find the first non-NULL target machine from the targets we
-        // compiled to above.  We'll use this as the target machine for
-        // compiling the dispatch module--this is safe in that it is the
-        // least-common-denominator of all of the targets we compiled to.
+        // compiled to above.  We'll use its ISA for compiling the dispatch
+        // module--this is safe in that it is the least-common-denominator
+        // of all of the targets we compiled to.
         llvm::TargetMachine *firstTargetMachine = NULL;
         int i = 0;
         const char *firstISA = "";
@@ -2913,7 +3539,9 @@ int Module::CompileAndOutput(const char *srcFile, Arch arch, const char *cpu, st
         Assert(firstTarget != ISPCTarget::none);
         Assert(firstTargetMachine != NULL);
 
-        g->target = new Target(arch, cpu, firstTarget, 0 != (outputFlags & GeneratePIC), false);
+        // The dispatch code has to run on any system, so it isn't tuned
+        // for the CPU given with --cpu.
+        g->target = new Target(arch, NULL, firstTarget, 0 != (outputFlags & GeneratePIC), false);
         if (!g->target->isValid()) {
             return 1;
         }
@@ -2923,29 +3551,27 @@ int Module::CompileAndOutput(const char *srcFile, Arch arch, const char *cpu, st
             return 1;
         }
 
+        if (!backendJobs.WaitAll())
+            return 1;
+
         lEmitDispatchModule(dispatchModule, exportedFunctions);
 
         if (outFileName != NULL) {
             if ((outputType == Bitcode) || (outputType == BitcodeText))
                 writeBitcode(dispatchModule, outFileName, outputType);
-            else
-                writeObjectFileOrAssembly(firstTargetMachine, dispatchModule, outputType, outFileName);
+            else if (outputType == LTOBitcode) {
+                // The dispatch functions have to run on any CPU that the
+                // lowest of the targets runs on.
+                addLTOFunctionAttributes(g->target->GetTargetMachine(), dispatchModule);
+                writeBitcode(dispatchModule, outFileName, outputType);
+            } else
+                // The target machine of the ISA without any CPU tuning,
+                // since the first variant may have been a CPU variant.
+                writeObjectFileOrAssembly(g->target->GetTargetMachine(), dispatchModule, outputType, outFileName);
         }
 
         if (depsFileName != NULL || (outputFlags & Module::OutputDepsToStdout)) {
-            std::string targetName;
-            if (depsTargetName)
-                targetName = depsTargetName;
-            else if (outFileName)
-                targetName = outFileName;
-            else if (!IsStdin(srcFile)) {
-                targetName = srcFile;
-                size_t dot = targetName.find_last_of('.');
-                if (dot != std::string::npos)
-                    targetName.erase(dot, std::string::npos);
-                targetName.append(".o");
-            } else
-                targetName = "a.out";
+            std::string targetName = lGetDepsTargetName(srcFile, outFileName, depsTargetName);
             if (!m->writeOutput(Module::Deps, outputFlags, depsFileName, targetName.c_str(), srcFile))
                 return 1;
         }
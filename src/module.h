@@ -73,13 +73,16 @@ const std::unordered_map<std::string, std::string> ISPCToNeoCPU{
 class Module {
   public:
     /** The name of the source file being compiled should be passed as the
-        module name. */
-    Module(const char *filename);
+        module name.  If sourceText is non-NULL, it's compiled instead of
+        the file's contents, and filename is only used in diagnostics. */
+    Module(const char *filename, const std::string *sourceText = NULL);
 
     /** Compiles the source file passed to the Module constructor, adding
         its global variables and functions to both the llvm::Module and
-        SymbolTable.  Returns the number of errors during compilation.  */
-    int CompileFile();
+        SymbolTable.  Returns the number of errors during compilation.  If
+        \c optimize is false, the optimization passes aren't run over the
+        resulting llvm::Module and it's up to the caller to do so.  */
+    int CompileFile(bool optimize = true);
 
     /** Add a named type definition to the module. */
     void AddTypeDef(const std::string &name, const Type *type, SourcePos pos);
@@ -103,12 +106,23 @@ class Module {
         included in automatically generated header files. */
     void AddExportedTypes(const std::vector<std::pair<const Type *, SourcePos>> &types);
 
+    /** Adds an --instrument point at the given position in the given
+        function to the module's table of instrumentation sites and returns
+        its ID, which is its index in the table. */
+    int AddInstrumentationSite(const SourcePos &pos, const std::string &function, const char *note);
+
+    /** Returns the module's table of instrumentation sites (as an i8 *),
+        which is passed to ISPCInstrumentSite() along with the site ID. */
+    llvm::Constant *GetInstrumentationTable();
+
     /** After a source file has been compiled, output can be generated in a
         number of different formats. */
     enum OutputType {
         Asm,         /** Generate text assembly language output */
         Bitcode,     /** Generate LLVM IR bitcode output */
         BitcodeText, /** Generate LLVM IR Text output */
+        LTOBitcode,  /** Generate LLVM IR bitcode with a ThinLTO summary,
+                         for link-time optimization */
         Object,      /** Generate a native object file */
         Header,      /** Generate a C/C++ header file with
                          declarations of 'export'ed functions, global
@@ -140,6 +154,10 @@ class Module {
         @param targets      %Target ISAs; this parameter may give a single target
                             ISA, or may give a comma-separated list of them in
                             case we are compiling to multiple ISAs.
+        @param targetCPUs   CPUs that qualify the corresponding targets, or
+                            empty strings for unqualified ones.  In multi-target
+                            mode, a qualified target is a variant that is
+                            only dispatched to on systems with that CPU.
         @param generatePIC  Indicates whether position-independent code should
                             be generated.
         @param outputType   %Type of output to generate (object files, assembly,
@@ -157,13 +175,16 @@ class Module {
                             srcFile.
      */
     static int CompileAndOutput(const char *srcFile, Arch arch, const char *cpu, std::vector<ISPCTarget> targets,
-                                OutputFlags outputFlags, OutputType outputType, const char *outFileName,
-                                const char *headerFileName, const char *depsFileName, const char *depsTargetName,
-                                const char *hostStubFileName, const char *devStubFileName);
+                                std::vector<std::string> targetCPUs, OutputFlags outputFlags, OutputType outputType,
+                                const char *outFileName, const char *headerFileName, const char *depsFileName,
+                                const char *depsTargetName, const char *hostStubFileName, const char *devStubFileName);
 
     /** Total number of errors encountered during compilation. */
     int errorCount;
 
+    /** Number of warnings printed during compilation. */
+    int warningCount;
+
     /** Symbol table to hold symbols visible in the current scope during
         compilation. */
     SymbolTable *symbolTable;
@@ -178,10 +199,24 @@ class Module {
 
   private:
     const char *filename;
+    const std::string *sourceText;
     AST *ast;
 
     std::vector<std::pair<const Type *, SourcePos>> exportedTypes;
 
+    struct InstrumentationSite {
+        SourcePos pos;
+        std::string function;
+        std::string note;
+    };
+    std::vector<InstrumentationSite> instrumentationSites;
+
+    /** Placeholder for the table of instrumentation sites, which is
+        replaced with the actual table by emitInstrumentationTable() once
+        all of the sites are known. */
+    llvm::GlobalVariable *instrumentationTable;
+    void emitInstrumentationTable();
+
     /** Write the corresponding output type to the given file.  Returns
         true on success, false if there has been an error.  The given
         filename may be NULL, indicating that output should go to standard
@@ -198,12 +233,18 @@ class Module {
     static bool writeObjectFileOrAssembly(llvm::TargetMachine *targetMachine, llvm::Module *module,
                                           OutputType outputType, const char *outFileName);
     static bool writeBitcode(llvm::Module *module, const char *outFileName, OutputType outputType);
+    static void addLTOFunctionAttributes(llvm::TargetMachine *targetMachine, llvm::Module *module);
 #ifdef ISPC_GENX_ENABLED
     static bool translateToSPIRV(llvm::Module *module, std::stringstream &outString);
     static bool writeSPIRV(llvm::Module *module, const char *outFileName);
     static bool writeZEBin(llvm::Module *module, const char *outFileName);
 #endif
     void execPreprocessor(const char *infilename, llvm::raw_string_ostream *ostream) const;
+
+    /** The output of the preprocessor if it has already been run before
+        CompileFile() is called (to look the compilation up in the
+        compilation cache). */
+    std::string preprocessorOutput;
 };
 
 inline Module::OutputFlags &operator|=(Module::OutputFlags &lhs, const __underlying_type(Module::OutputFlags) rhs) {
@@ -43,11 +43,15 @@
 #include "sym.h"
 #include "util.h"
 
+#include <algorithm>
+#include <chrono>
 #include <map>
 #include <regex>
 #include <set>
 #include <stdio.h>
+#include <tuple>
 
+#include <llvm/ADT/Hashing.h>
 #include <llvm/ADT/SmallSet.h>
 #include <llvm/ADT/Triple.h>
 #include <llvm/Analysis/BasicAliasAnalysis.h>
@@ -56,6 +60,7 @@
 #include <llvm/Analysis/TargetLibraryInfo.h>
 #include <llvm/Analysis/TargetTransformInfo.h>
 #include <llvm/Analysis/TypeBasedAliasAnalysis.h>
+#include <llvm/Analysis/ValueTracking.h>
 #include <llvm/BinaryFormat/Dwarf.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Constants.h>
@@ -74,6 +79,8 @@
 #include <llvm/InitializePasses.h>
 #include <llvm/Pass.h>
 #include <llvm/PassRegistry.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/ToolOutputFile.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Target/TargetOptions.h>
@@ -125,6 +132,7 @@ static llvm::Pass *CreatePeepholePass();
 
 static llvm::Pass *CreateImproveMemoryOpsPass();
 static llvm::Pass *CreateGatherCoalescePass();
+static llvm::Pass *CreateAoSToSoAPass();
 static llvm::Pass *CreateReplacePseudoMemoryOpsPass();
 
 static llvm::Pass *CreateIsCompileTimeConstantPass(bool isLastTry);
@@ -419,6 +427,251 @@ static MaskStatus lGetMaskStatus(llvm::Value *mask, int vecWidth = -1) {
     return MaskStatus::all_on;
 }
 
+///////////////////////////////////////////////////////////////////////////
+// Pass statistics
+
+/** With --pass-stats, DebugPassManager surrounds each function pass with a
+    pair of PassStatsMarker passes.  The first one takes a snapshot of the
+    function that the pass is about to run on and starts the clock; the
+    second one stops it and compares the IR with the snapshot.  The results
+    are accumulated per target, pass and function and written as JSON by
+    WritePassStats().
+
+    Loop, call graph and module passes aren't measured: the legacy pass
+    manager runs consecutive loop passes (and call graph passes) together,
+    loop by loop, and a marker between them would split the group and
+    change the pipeline being measured.  A marker next to a function pass
+    doesn't, since the function pass itself ends a group of loop passes
+    and joins a group of call graph passes the same way the marker does.
+ */
+struct IRSnapshot {
+    IRSnapshot() : hash(0), instructions(0) {}
+    // Hash of the opcodes and operands of all instructions; it changes when
+    // instructions are added, removed or have their operands replaced.
+    size_t hash;
+    int64_t instructions;
+};
+
+struct PassStatsEntry {
+    PassStatsEntry() : runs(0), changed(0), nanoseconds(0), instructionsBefore(0), instructionsAfter(0) {}
+    int64_t runs, changed, nanoseconds;
+    int64_t instructionsBefore, instructionsAfter;
+};
+
+// Target, pass number, pass name and function.
+typedef std::tuple<std::string, int, std::string, std::string> PassStatsKey;
+
+static std::map<PassStatsKey, PassStatsEntry> passStats;
+static IRSnapshot passStatsSnapshot;
+static std::chrono::steady_clock::time_point passStatsStartTime;
+
+static void lAddToSnapshot(const llvm::Function &func, IRSnapshot *snapshot) {
+    for (const llvm::BasicBlock &bb : func) {
+        for (const llvm::Instruction &inst : bb) {
+            ++snapshot->instructions;
+            snapshot->hash = llvm::hash_combine(snapshot->hash, inst.getOpcode(), &inst);
+            for (const llvm::Use &op : inst.operands())
+                snapshot->hash = llvm::hash_combine(snapshot->hash, op.get());
+        }
+    }
+}
+
+static void lStartPassStats(const IRSnapshot &snapshot) {
+    passStatsSnapshot = snapshot;
+    passStatsStartTime = std::chrono::steady_clock::now();
+}
+
+static void lFinishPassStats(const PassStatsKey &key, const llvm::Function &func) {
+    auto elapsed = std::chrono::steady_clock::now() - passStatsStartTime;
+
+    IRSnapshot after;
+    lAddToSnapshot(func, &after);
+
+    PassStatsEntry &entry = passStats[key];
+    ++entry.runs;
+    if (after.hash != passStatsSnapshot.hash || after.instructions != passStatsSnapshot.instructions)
+        ++entry.changed;
+    entry.nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    entry.instructionsBefore += passStatsSnapshot.instructions;
+    entry.instructionsAfter += after.instructions;
+}
+
+class PassStatsMarker : public llvm::FunctionPass {
+  public:
+    static char ID;
+    PassStatsMarker(bool isStart, int stage, llvm::StringRef passName)
+        : FunctionPass(ID), start(isStart), target(ISPCTargetToString(g->target->getISPCTarget())), number(stage),
+          name(passName.str()) {}
+
+    llvm::StringRef getPassName() const { return "Pass Statistics"; }
+    void getAnalysisUsage(llvm::AnalysisUsage &AU) const { AU.setPreservesAll(); }
+    bool runOnFunction(llvm::Function &F);
+
+  private:
+    bool start;
+    std::string target;
+    int number;
+    std::string name;
+};
+
+char PassStatsMarker::ID = 0;
+
+bool PassStatsMarker::runOnFunction(llvm::Function &F) {
+    if (start) {
+        IRSnapshot snapshot;
+        lAddToSnapshot(F, &snapshot);
+        lStartPassStats(snapshot);
+    } else
+        lFinishPassStats(PassStatsKey(target, number, name, F.getName().str()), F);
+    return false;
+}
+
+bool WritePassStats(const char *fileName, const char *srcFile) {
+    std::error_code error;
+    llvm::ToolOutputFile of(fileName, error, llvm::sys::fs::OF_Text);
+    if (error) {
+        Error(SourcePos(), "Cannot open pass statistics file \"%s\".\n", fileName);
+        return false;
+    }
+
+    // One record per line, so that the files are easy to grep, diff and
+    // merge.
+    llvm::raw_ostream &os = of.os();
+    os << "{\n\"source\": " << llvm::json::Value(srcFile) << ",\n\"passes\": [\n";
+    for (auto it = passStats.begin(); it != passStats.end(); ++it) {
+        const PassStatsEntry &entry = it->second;
+        os << llvm::json::Value(llvm::json::Object{
+            {"target", std::get<0>(it->first)},
+            {"stage", std::get<1>(it->first)},
+            {"pass", std::get<2>(it->first)},
+            {"function", std::get<3>(it->first)},
+            {"runs", entry.runs},
+            {"changed", entry.changed},
+            {"time_ns", entry.nanoseconds},
+            {"instructions_before", entry.instructionsBefore},
+            {"instructions_after", entry.instructionsAfter},
+        });
+        os << (std::next(it) != passStats.end() ? ",\n" : "\n");
+    }
+    os << "]\n}\n";
+    of.keep();
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Optimization remarks
+
+/** With --opt-remarks, the passes that decide how gathers and scatters are
+    implemented record what they did with each one: whether it was turned
+    into a regular load or store, coalesced with other gathers, or left as
+    a gather or scatter, and why.  The records are written as YAML by
+    WriteOptRemarks().
+ */
+struct OptRemark {
+    bool passed;
+    std::string pass, target, function;
+    bool hasPos;
+    SourcePos pos;
+    std::string kind;
+    int elementSize;
+    std::string decision, reason;
+
+    bool operator==(const OptRemark &o) const {
+        return passed == o.passed && pass == o.pass && target == o.target && function == o.function &&
+               hasPos == o.hasPos &&
+               (!hasPos || (!strcmp(pos.name, o.pos.name) && pos.first_line == o.pos.first_line &&
+                            pos.first_column == o.pos.first_column)) &&
+               kind == o.kind && elementSize == o.elementSize && decision == o.decision && reason == o.reason;
+    }
+};
+
+static std::vector<OptRemark> optRemarks;
+
+/** Records a remark for the given memory operation, if --opt-remarks was
+    given.  passed is true if the operation was improved and false if it
+    was left as a gather or scatter.
+ */
+static void lAddOptRemark(const char *pass, const llvm::Instruction *inst, bool passed, const char *kind,
+                          llvm::Type *elementType, const std::string &decision, const std::string &reason) {
+    if (g->optRemarksFile.empty())
+        return;
+
+    OptRemark remark;
+    remark.passed = passed;
+    remark.pass = pass;
+    remark.target = ISPCTargetToString(g->target->getISPCTarget());
+    remark.function = inst->getFunction()->getName().str();
+    remark.hasPos = lGetSourcePosFromMetadata(inst, &remark.pos);
+    remark.kind = kind;
+    remark.elementSize = (int)g->target->getDataLayout()->getTypeStoreSize(elementType->getScalarType());
+    remark.decision = decision;
+    remark.reason = reason;
+    optRemarks.push_back(remark);
+}
+
+// Returns the string as a single-quoted YAML scalar.
+static std::string lYAMLQuote(llvm::StringRef str) {
+    std::string ret = "'";
+    for (char c : str) {
+        if (c == '\'')
+            ret += "''";
+        else
+            ret += c;
+    }
+    return ret + "'";
+}
+
+bool WriteOptRemarks(const char *fileName) {
+    std::error_code error;
+    llvm::ToolOutputFile of(fileName, error, llvm::sys::fs::OF_Text);
+    if (error) {
+        Error(SourcePos(), "Cannot open optimization remarks file \"%s\".\n", fileName);
+        return false;
+    }
+
+    // Sort by source position so that the file reads in source order and
+    // doesn't depend on the order in which the passes visited functions.
+    std::vector<const OptRemark *> sorted;
+    for (const OptRemark &remark : optRemarks)
+        sorted.push_back(&remark);
+    std::stable_sort(sorted.begin(), sorted.end(), [](const OptRemark *a, const OptRemark *b) {
+        if (a->hasPos != b->hasPos)
+            return a->hasPos;
+        if (!a->hasPos)
+            return false;
+        int cmp = strcmp(a->pos.name, b->pos.name);
+        if (cmp != 0)
+            return cmp < 0;
+        return std::make_pair(a->pos.first_line, a->pos.first_column) <
+               std::make_pair(b->pos.first_line, b->pos.first_column);
+    });
+
+    // Passes that run more than once may report an operation they leave
+    // alone each time; so may copies of it made by unrolling or inlining.
+    // Only write one record for those.
+    sorted.erase(
+        std::unique(sorted.begin(), sorted.end(), [](const OptRemark *a, const OptRemark *b) { return *a == *b; }),
+        sorted.end());
+
+    llvm::raw_ostream &os = of.os();
+    for (const OptRemark *remark : sorted) {
+        os << "--- " << (remark->passed ? "!Passed" : "!Missed") << "\n";
+        os << "Pass:            " << lYAMLQuote(remark->pass) << "\n";
+        os << "Target:          " << remark->target << "\n";
+        os << "Function:        " << lYAMLQuote(remark->function) << "\n";
+        if (remark->hasPos)
+            os << "DebugLoc:        { File: " << lYAMLQuote(remark->pos.name) << ", Line: " << remark->pos.first_line
+               << ", Column: " << remark->pos.first_column << " }\n";
+        os << "Kind:            " << remark->kind << "\n";
+        os << "ElementSize:     " << remark->elementSize << "\n";
+        os << "Decision:        " << lYAMLQuote(remark->decision) << "\n";
+        os << "Reason:          " << lYAMLQuote(remark->reason) << "\n";
+        os << "...\n";
+    }
+    of.keep();
+    return true;
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // This is a wrap over class llvm::PassManager. This duplicates PassManager function run()
 //   and change PassManager function add by adding some checks and debug passes.
@@ -447,7 +700,14 @@ void DebugPassManager::add(llvm::Pass *P, int stage = -1) {
     }
     if (g->off_stages.find(number) == g->off_stages.end()) {
         // adding optimization (not switched off)
+        // Only function passes are measured with --pass-stats; see
+        // PassStatsMarker.
+        bool measure = !g->passStatsFile.empty() && P->getPassKind() == llvm::PT_Function;
+        if (measure)
+            PM.add(new PassStatsMarker(true, number, P->getPassName()));
         PM.add(P);
+        if (measure)
+            PM.add(new PassStatsMarker(false, number, P->getPassName()));
 #ifndef ISPC_NO_DUMPS
         if (g->debug_stages.find(number) != g->debug_stages.end()) {
             // adding dump of LLVM IR after optimization
@@ -709,6 +969,8 @@ void Optimize(llvm::Module *module, int optLevel) {
                 // It is important to run this here to make it easier to
                 // finding matching gathers we can coalesce..
                 optPM.add(llvm::createEarlyCSEPass(), 260);
+                if (!g->target->isGenXTarget())
+                    optPM.add(CreateAoSToSoAPass());
                 optPM.add(CreateGatherCoalescePass());
             }
         }
@@ -2771,6 +3033,8 @@ static bool lGSToLoadStore(llvm::CallInst *callInst) {
             // A gather with everyone going to the same location is
             // handled as a scalar load and broadcast across the lanes.
             Debug(pos, "Transformed gather to scalar load and broadcast!");
+            lAddOptRemark("Improve Memory Ops", callInst, true, "gather", scalarType, "scalar load and broadcast",
+                          "all program instances read the same location");
             llvm::Value *ptr;
             // For gen we need to cast the base first and only after that get common pointer otherwise
             // CM backend will be broken on bitcast i8* to T* instruction with following load.
@@ -2860,6 +3124,8 @@ static bool lGSToLoadStore(llvm::CallInst *callInst) {
                 }
                 lCopyMetadata(ptr, callInst);
                 Debug(pos, "Transformed gather to unaligned vector load!");
+                lAddOptRemark("Improve Memory Ops", callInst, true, "gather", scalarType, "vector load",
+                              "offsets are a linear sequence of consecutive elements");
                 llvm::Instruction *newCall =
                     lCallInst(gatherInfo->loadMaskedFunc, ptr, mask, llvm::Twine(ptr->getName()) + "_masked_load");
                 lCopyMetadata(newCall, callInst);
@@ -2867,6 +3133,8 @@ static bool lGSToLoadStore(llvm::CallInst *callInst) {
                 return true;
             } else {
                 Debug(pos, "Transformed scatter to unaligned vector store!");
+                lAddOptRemark("Improve Memory Ops", callInst, true, "scatter", scalarType, "vector store",
+                              "offsets are a linear sequence of consecutive elements");
                 ptr = lComputeCommonPointer(base, fullOffsets, callInst);
                 ptr = new llvm::BitCastInst(ptr, scatterInfo->vecPtrType, "ptrcast", callInst);
                 llvm::Instruction *newCall = lCallInst(scatterInfo->maskedStoreFunc, ptr, storeValue, mask, "");
@@ -3043,6 +3311,8 @@ static bool lImproveMaskedStore(llvm::CallInst *callInst) {
             if (gotPosition) {
                 PerformanceWarning(pos, "Scatter required to store value.");
             }
+            lAddOptRemark("Improve Memory Ops", callInst, false, "store", rvalue->getType(), "scatter",
+                          "masked stores to external memory are implemented with scatters");
         }
 #endif
     }
@@ -3199,6 +3469,12 @@ static llvm::Pass *CreateImproveMemoryOpsPass() { return new ImproveMemoryOpsPas
 //  it's specifically helpful when data with AOS layout is being accessed;
 //  in this case, we're often able to generate wide vector loads and
 //  appropriate shuffles automatically.
+//
+//  The series of gathers isn't limited to one basic block: it continues
+//  into blocks that execute whenever the first one does, past if and
+//  if/else statements that don't write to memory.  Gathers whose offsets
+//  differ by a constant, as with the iterations of an unrolled loop
+//  (e.g. a[i] and a[i+1], or a[(i+1)*4] and a[i*4]), are coalesced too.
 
 class GatherCoalescePass : public llvm::FunctionPass {
   public:
@@ -3449,6 +3725,21 @@ static void lCoalescePerfInfo(const std::vector<llvm::CallInst *> &coalesceGroup
                                (int)coalesceGroup.size(), otherPositions, (int)loadOps.size(),
                                (loadOps.size() > 1) ? "s" : "", loadOpsInfo);
     }
+
+    if (!g->optRemarksFile.empty()) {
+        char decision[640];
+        snprintf(decision, sizeof(decision), "coalesced into %d load%s (%s)", (int)loadOps.size(),
+                 (loadOps.size() > 1) ? "s" : "", loadOpsInfo);
+        char reason[128];
+        if (coalesceGroup.size() == 1)
+            snprintf(reason, sizeof(reason), "mask is all on and the varying offsets are uniform");
+        else
+            snprintf(reason, sizeof(reason),
+                     "mask is all on and %d gathers share the base pointer and uniform varying offsets",
+                     (int)coalesceGroup.size());
+        for (llvm::CallInst *gather : coalesceGroup)
+            lAddOptRemark("Gather Coalescing", gather, true, "gather", gather->getType(), decision, reason);
+    }
 }
 
 /** Utility routine that computes an offset from a base pointer and then
@@ -3902,7 +4193,8 @@ static llvm::Value *lComputeBasePtr(llvm::CallInst *gatherInst, llvm::Instructio
     have offsets like <0,4,16,20>, which would be transformed to <0,1,4,5>
     here.)
  */
-static void lExtractConstOffsets(const std::vector<llvm::CallInst *> &coalesceGroup, int elementSize,
+static void lExtractConstOffsets(const std::vector<llvm::CallInst *> &coalesceGroup,
+                                 const std::vector<int64_t> &byteDeltas, int elementSize,
                                  std::vector<int64_t> *constOffsets) {
     int width = g->target->getVectorWidth();
     *constOffsets = std::vector<int64_t>(coalesceGroup.size() * width, 0);
@@ -3913,6 +4205,8 @@ static void lExtractConstOffsets(const std::vector<llvm::CallInst *> &coalesceGr
         int nElts;
         bool ok = LLVMExtractVectorInts(offsets, endPtr, &nElts);
         Assert(ok && nElts == width);
+        for (int j = 0; j < width; ++j)
+            endPtr[j] += byteDeltas[i];
     }
 
     for (int i = 0; i < (int)constOffsets->size(); ++i)
@@ -3927,9 +4221,11 @@ static void lExtractConstOffsets(const std::vector<llvm::CallInst *> &coalesceGr
 
     where varyingOffset actually has the same value across all of the SIMD
     lanes and where the part in parenthesis has the same value for all of
-    the gathers in the group.
+    the gathers in the group, up to the constant byteDeltas[i] that is
+    added to it for the i'th gather.
  */
-static bool lCoalesceGathers(const std::vector<llvm::CallInst *> &coalesceGroup) {
+static bool lCoalesceGathers(const std::vector<llvm::CallInst *> &coalesceGroup,
+                             const std::vector<int64_t> &byteDeltas) {
     llvm::Instruction *insertBefore = coalesceGroup[0];
 
     // First, compute the shared base pointer for all of the gathers
@@ -3950,7 +4246,7 @@ static bool lCoalesceGathers(const std::vector<llvm::CallInst *> &coalesceGroup)
     // gather, the next vectorWidth those for the next gather, and so
     // forth.
     std::vector<int64_t> constOffsets;
-    lExtractConstOffsets(coalesceGroup, elementSize, &constOffsets);
+    lExtractConstOffsets(coalesceGroup, byteDeltas, elementSize, &constOffsets);
 
     // Determine a set of loads to perform to get all of the values we need
     // loaded.
@@ -3998,16 +4294,31 @@ static bool lCoalesceGathers(const std::vector<llvm::CallInst *> &coalesceGroup)
     return true;
 }
 
+/** Returns true if the two pointers are based on different identified
+    objects (allocas, globals, noalias arguments), and thus can't point to
+    the same memory.
+ */
+static bool lPointToDifferentObjects(llvm::Value *ptr0, llvm::Value *ptr1) {
+#if ISPC_LLVM_VERSION >= ISPC_LLVM_12_0
+    const llvm::Value *obj0 = llvm::getUnderlyingObject(ptr0);
+    const llvm::Value *obj1 = llvm::getUnderlyingObject(ptr1);
+#else
+    const llvm::DataLayout &dl = m->module->getDataLayout();
+    const llvm::Value *obj0 = llvm::GetUnderlyingObject(ptr0, dl);
+    const llvm::Value *obj1 = llvm::GetUnderlyingObject(ptr1, dl);
+#endif
+    return obj0 != obj1 && llvm::isIdentifiedObject(obj0) && llvm::isIdentifiedObject(obj1);
+}
+
 /** Given an instruction, returns true if the instructon may write to
-    memory.  This is a conservative test in that it may return true for
-    some instructions that don't actually end up writing to memory, but
-    should never return false for an instruction that does write to
-    memory. */
-static bool lInstructionMayWriteToMemory(llvm::Instruction *inst) {
-    if (llvm::isa<llvm::StoreInst>(inst) || llvm::isa<llvm::AtomicRMWInst>(inst) ||
-        llvm::isa<llvm::AtomicCmpXchgInst>(inst))
-        // FIXME: we could be less conservative and try to allow stores if
-        // we are sure that the pointers don't overlap..
+    memory that is read through the given base pointer.  This is a
+    conservative test in that it may return true for some instructions
+    that don't actually end up writing to that memory, but should never
+    return false for an instruction that does write to it. */
+static bool lInstructionMayWriteToMemory(llvm::Instruction *inst, llvm::Value *base) {
+    if (llvm::StoreInst *si = llvm::dyn_cast<llvm::StoreInst>(inst))
+        return !lPointToDifferentObjects(si->getPointerOperand(), base);
+    if (llvm::isa<llvm::AtomicRMWInst>(inst) || llvm::isa<llvm::AtomicCmpXchgInst>(inst))
         return true;
 
     // Otherwise, any call instruction that doesn't have an attribute
@@ -4021,12 +4332,149 @@ static bool lInstructionMayWriteToMemory(llvm::Instruction *inst) {
 
         if (calledFunc->onlyReadsMemory() || calledFunc->doesNotAccessMemory())
             return false;
+        // Masked stores only write through their pointer operand.
+        if (calledFunc->getName().startswith("__pseudo_masked_store_"))
+            return !lPointToDifferentObjects(ci->getArgOperand(0), base);
         return true;
     }
 
     return false;
 }
 
+/** Writes the given uniform offsets value, which is used for the variable
+    offsets of a gather, as root * multiplier + addend, where root is an
+    llvm::Value and multiplier and addend are constants.  This looks
+    through broadcasts of a scalar value, adds and multiplications by
+    constants (and shifts by them) and sign extensions of values that
+    can't overflow.
+ */
+static void lDecomposeOffsets(llvm::Value *v, llvm::Value **root, int64_t *multiplier, int64_t *addend) {
+    *multiplier = 1;
+    *addend = 0;
+    bool needNoSignedWrap = false;
+    while (true) {
+        // Broadcast of a scalar
+        if (llvm::ShuffleVectorInst *shuffle = llvm::dyn_cast<llvm::ShuffleVectorInst>(v)) {
+            llvm::InsertElementInst *ie = llvm::dyn_cast<llvm::InsertElementInst>(shuffle->getOperand(0));
+            if (shuffle->isZeroEltSplat() && ie != NULL && llvm::isa<llvm::ConstantInt>(ie->getOperand(2)) &&
+                llvm::cast<llvm::ConstantInt>(ie->getOperand(2))->isZero()) {
+                v = ie->getOperand(1);
+                continue;
+            }
+            break;
+        }
+
+        if (llvm::SExtInst *sext = llvm::dyn_cast<llvm::SExtInst>(v)) {
+            v = sext->getOperand(0);
+            needNoSignedWrap = true;
+            continue;
+        }
+
+        llvm::BinaryOperator *bop = llvm::dyn_cast<llvm::BinaryOperator>(v);
+        if (bop == NULL)
+            break;
+        if (needNoSignedWrap && !bop->hasNoSignedWrap())
+            break;
+
+        llvm::Value *op0 = bop->getOperand(0), *op1 = bop->getOperand(1);
+        llvm::ConstantInt *c0 = NULL, *c1 = NULL;
+        if (llvm::Constant *c = llvm::dyn_cast<llvm::Constant>(op0))
+            c0 = llvm::dyn_cast_or_null<llvm::ConstantInt>(c->getType()->isVectorTy() ? c->getSplatValue() : c);
+        if (llvm::Constant *c = llvm::dyn_cast<llvm::Constant>(op1))
+            c1 = llvm::dyn_cast_or_null<llvm::ConstantInt>(c->getType()->isVectorTy() ? c->getSplatValue() : c);
+
+        if (bop->getOpcode() == llvm::Instruction::Add && (c0 != NULL || c1 != NULL)) {
+            *addend += *multiplier * (c1 != NULL ? c1->getSExtValue() : c0->getSExtValue());
+            v = (c1 != NULL) ? op0 : op1;
+        } else if (bop->getOpcode() == llvm::Instruction::Sub && c1 != NULL) {
+            *addend -= *multiplier * c1->getSExtValue();
+            v = op0;
+        } else if (bop->getOpcode() == llvm::Instruction::Mul && (c0 != NULL || c1 != NULL)) {
+            *multiplier *= (c1 != NULL ? c1->getSExtValue() : c0->getSExtValue());
+            v = (c1 != NULL) ? op0 : op1;
+        } else if (bop->getOpcode() == llvm::Instruction::Shl && c1 != NULL && c1->getZExtValue() < 32) {
+            *multiplier *= (int64_t)1 << c1->getZExtValue();
+            v = op0;
+        } else
+            break;
+    }
+    *root = v;
+}
+
+/** If the uniform offsets values offsets0 and offsets1 are known to
+    differ by a constant, returns true and stores offsets1 - offsets0 in
+    delta.
+ */
+static bool lGetOffsetsDelta(llvm::Value *offsets0, llvm::Value *offsets1, int64_t *delta) {
+    if (offsets0 == offsets1) {
+        *delta = 0;
+        return true;
+    }
+
+    llvm::Value *root0, *root1;
+    int64_t multiplier0, multiplier1, addend0, addend1;
+    lDecomposeOffsets(offsets0, &root0, &multiplier0, &addend0);
+    lDecomposeOffsets(offsets1, &root1, &multiplier1, &addend1);
+    if (root0 != root1 || multiplier0 != multiplier1)
+        return false;
+    *delta = addend1 - addend0;
+    return true;
+}
+
+/** Returns the basic block where the search for gathers that can be
+    coalesced with the ones in the given block continues: its successor,
+    if the given block is the successor's only predecessor, or the block
+    where the if or if/else statement that ends the given block joins.
+    Either way, the returned block executes if and only if the given one
+    does.  Gathers in the arms of an if statement are left alone, since
+    they execute conditionally, but the arms mustn't write to the memory
+    that is read through the given base pointer.  Returns NULL if there's
+    no such block.
+ */
+static llvm::BasicBlock *lGetCoalescingSuccessor(llvm::BasicBlock *bb, llvm::Value *base) {
+    llvm::BranchInst *br = llvm::dyn_cast<llvm::BranchInst>(bb->getTerminator());
+    if (br == NULL)
+        return NULL;
+
+    if (br->isUnconditional()) {
+        llvm::BasicBlock *succ = br->getSuccessor(0);
+        return (succ != bb && succ->getSinglePredecessor() == bb) ? succ : NULL;
+    }
+
+    llvm::BasicBlock *trueBB = br->getSuccessor(0), *falseBB = br->getSuccessor(1);
+    std::vector<llvm::BasicBlock *> arms;
+    llvm::BasicBlock *join = NULL;
+    if (trueBB->getSinglePredecessor() == bb && trueBB->getSingleSuccessor() == falseBB) {
+        // if without else
+        arms.push_back(trueBB);
+        join = falseBB;
+    } else if (falseBB->getSinglePredecessor() == bb && falseBB->getSingleSuccessor() == trueBB) {
+        arms.push_back(falseBB);
+        join = trueBB;
+    } else if (trueBB != falseBB && trueBB->getSinglePredecessor() == bb && falseBB->getSinglePredecessor() == bb &&
+               trueBB->getSingleSuccessor() != NULL && trueBB->getSingleSuccessor() == falseBB->getSingleSuccessor()) {
+        arms.push_back(trueBB);
+        arms.push_back(falseBB);
+        join = trueBB->getSingleSuccessor();
+    }
+    if (join == NULL || join == bb)
+        return NULL;
+
+    // The given block has to dominate the join block.
+    for (llvm::BasicBlock *pred : llvm::predecessors(join))
+        if (pred != bb && std::find(arms.begin(), arms.end(), pred) == arms.end())
+            return NULL;
+
+    for (llvm::BasicBlock *arm : arms) {
+        if (arm == bb)
+            return NULL;
+        for (llvm::Instruction &inst : *arm)
+            if (lInstructionMayWriteToMemory(&inst, base))
+                return NULL;
+    }
+    return join;
+}
+
 bool GatherCoalescePass::runOnBasicBlock(llvm::BasicBlock &bb) {
     DEBUG_START_PASS("GatherCoalescePass");
 
@@ -4088,21 +4536,39 @@ restart:
             continue;
 
         // coalesceGroup stores the set of gathers that we're going to try to
-        // coalesce over
+        // coalesce over; byteDeltas has the constant that is added to the
+        // first gather's variable offsets times the offset scale to get
+        // the corresponding ones for each of them.
         std::vector<llvm::CallInst *> coalesceGroup;
+        std::vector<int64_t> byteDeltas;
         coalesceGroup.push_back(callInst);
+        byteDeltas.push_back(0);
+
+        llvm::ConstantInt *scaleConst = llvm::dyn_cast<llvm::ConstantInt>(offsetScale);
+        int elementSize =
+            (callInst->getType() == LLVMTypes::Int32VectorType || callInst->getType() == LLVMTypes::FloatVectorType)
+                ? 4
+                : 8;
 
         // Start iterating at the instruction after the initial gather;
-        // look at the remainder of instructions in the basic block (up
-        // until we reach a write to memory) to try to find any other
-        // gathers that can coalesce with this one.
+        // look at the remainder of instructions in the basic block and
+        // the ones that follow it (up until we reach a write to memory) to
+        // try to find any other gathers that can coalesce with this one.
+        llvm::BasicBlock *fwdBB = &bb;
         llvm::BasicBlock::iterator fwdIter = iter;
         ++fwdIter;
-        for (; fwdIter != bb.end(); ++fwdIter) {
+        for (;; ++fwdIter) {
+            if (fwdIter == fwdBB->end()) {
+                fwdBB = lGetCoalescingSuccessor(fwdBB, base);
+                if (fwdBB == NULL || fwdBB == &bb)
+                    break;
+                fwdIter = fwdBB->begin();
+            }
+
             // Must stop once we come to an instruction that may write to
             // memory; otherwise we could end up moving a read before this
             // write.
-            if (lInstructionMayWriteToMemory(&*fwdIter))
+            if (lInstructionMayWriteToMemory(&*fwdIter, base))
                 break;
 
             llvm::CallInst *fwdCall = llvm::dyn_cast<llvm::CallInst>(&*fwdIter);
@@ -4139,10 +4605,19 @@ restart:
             }
 #endif
 
-            if (base == fwdCall->getArgOperand(0) && variableOffsets == fwdCall->getArgOperand(1) &&
-                offsetScale == fwdCall->getArgOperand(2) && mask == fwdCall->getArgOperand(4)) {
+            // Variable offsets that differ by a constant are fine, as long
+            // as the difference in bytes is a multiple of the element size.
+            int64_t delta = 0;
+            bool offsetsMatch =
+                (variableOffsets == fwdCall->getArgOperand(1)) ||
+                (scaleConst != NULL && lGetOffsetsDelta(variableOffsets, fwdCall->getArgOperand(1), &delta) &&
+                 (delta * scaleConst->getSExtValue()) % elementSize == 0);
+
+            if (base == fwdCall->getArgOperand(0) && offsetsMatch && offsetScale == fwdCall->getArgOperand(2) &&
+                mask == fwdCall->getArgOperand(4)) {
                 Debug(fwdPos, "This gather can be coalesced.");
                 coalesceGroup.push_back(fwdCall);
+                byteDeltas.push_back(scaleConst != NULL ? delta * scaleConst->getSExtValue() : 0);
 
                 if (coalesceGroup.size() == 4)
                     // FIXME: untested heuristic: don't try to coalesce
@@ -4158,7 +4633,7 @@ restart:
 
         // Now that we have a group of gathers, see if we can coalesce them
         // into something more efficient than the original set of gathers.
-        if (lCoalesceGathers(coalesceGroup)) {
+        if (lCoalesceGathers(coalesceGroup, byteDeltas)) {
             modifiedAny = true;
             goto restart;
         }
@@ -4181,6 +4656,336 @@ bool GatherCoalescePass::runOnFunction(llvm::Function &F) {
 
 static llvm::Pass *CreateGatherCoalescePass() { return new GatherCoalescePass; }
 
+///////////////////////////////////////////////////////////////////////////
+// AoSToSoAPass
+
+/** When a program reads several fields of an array of structures at a
+    varying index, e.g.
+
+    struct Point { float x, y, z; };
+    uniform Point pts[];
+    foreach (i = 0 ... count)
+        ... pts[i].x ... pts[i].y ... pts[i].z ...
+
+    each field access turns into a gather where the offsets of the program
+    instances are a linear sequence with a stride of sizeof(Point) and the
+    gathers only differ by the offset of the field.  This pass replaces
+    such a group of gathers with a single load of the memory that all of
+    them read and shuffles that transpose it into a vector for each field,
+    which is what the aos_to_soa3() and aos_to_soa4() stdlib functions do
+    by hand.  A group of scatters that writes all of the fields of the
+    structures is turned into shuffles and a single store in the same way.
+
+    Only gathers and scatters of 32 and 64-bit values with the mask all on
+    are handled, so that the wider memory access doesn't touch memory that
+    the program instances wouldn't have accessed anyway.
+ */
+class AoSToSoAPass : public llvm::FunctionPass {
+  public:
+    static char ID;
+    AoSToSoAPass() : FunctionPass(ID) {}
+
+    llvm::StringRef getPassName() const { return "AoS to SoA"; }
+    bool runOnBasicBlock(llvm::BasicBlock &BB);
+    bool runOnFunction(llvm::Function &F);
+};
+
+char AoSToSoAPass::ID = 0;
+
+/** A gather or scatter that accesses base + scale * offsets + delta, where
+    the offsets vector is shared by all the accesses of a group and delta
+    is the (byte) offset of the field being accessed.
+ */
+struct AoSAccess {
+    llvm::CallInst *call;
+    bool isGather;
+    llvm::Value *base;
+    llvm::Value *offsets;
+    llvm::Value *scale;
+    llvm::Value *value;
+    llvm::Type *elementType;
+    int elementSize;
+    int64_t delta;
+};
+
+/** If the given instruction is a gather or scatter that the pass can
+    handle, fills in the AoSAccess for it and returns true.
+ */
+static bool lGetAoSAccess(llvm::Instruction *inst, AoSAccess *access) {
+    llvm::CallInst *callInst = llvm::dyn_cast<llvm::CallInst>(inst);
+    if (callInst == NULL || callInst->getCalledFunction() == NULL)
+        return false;
+    llvm::StringRef name = callInst->getCalledFunction()->getName();
+
+    bool isGather = name.startswith("__pseudo_gather_");
+    if (!isGather && !name.startswith("__pseudo_scatter_"))
+        return false;
+    bool isFactored;
+    if (name.startswith(isGather ? "__pseudo_gather_factored_base_offsets" : "__pseudo_scatter_factored_base_offsets"))
+        isFactored = true;
+    else if (name.startswith(isGather ? "__pseudo_gather_base_offsets" : "__pseudo_scatter_base_offsets"))
+        isFactored = false;
+    else
+        return false;
+
+    // The factored variants take (base, offsets, scale, constant offsets,
+    // [value,] mask), the others (base, scale, offsets, [value,] mask).
+    int valueIndex = isFactored ? 4 : 3;
+    llvm::Value *value = isGather ? (llvm::Value *)callInst : callInst->getArgOperand(valueIndex);
+    llvm::Value *mask = callInst->getArgOperand(isGather ? valueIndex : valueIndex + 1);
+    if (lGetMaskStatus(mask) != MaskStatus::all_on)
+        return false;
+
+    llvm::Type *elementType = value->getType()->getScalarType();
+    int elementSize = (int)g->target->getDataLayout()->getTypeStoreSize(elementType);
+    if (elementSize != 4 && elementSize != 8)
+        return false;
+
+    llvm::Value *offsets = callInst->getArgOperand(isFactored ? 1 : 2);
+    llvm::ConstantInt *scale = llvm::dyn_cast<llvm::ConstantInt>(callInst->getArgOperand(isFactored ? 2 : 1));
+    if (scale == NULL)
+        return false;
+
+    int64_t delta = 0;
+    if (isFactored) {
+        llvm::Constant *constOffsets = llvm::dyn_cast<llvm::Constant>(callInst->getArgOperand(3));
+        llvm::ConstantInt *splat =
+            constOffsets ? llvm::dyn_cast_or_null<llvm::ConstantInt>(constOffsets->getSplatValue()) : NULL;
+        if (splat == NULL)
+            return false;
+        delta = splat->getSExtValue();
+    } else {
+        // Split off a constant that is added to the offsets, if any.
+        llvm::BinaryOperator *bop = llvm::dyn_cast<llvm::BinaryOperator>(offsets);
+        if (bop != NULL && bop->getOpcode() == llvm::Instruction::Add) {
+            for (int i = 0; i < 2; ++i) {
+                llvm::Constant *c = llvm::dyn_cast<llvm::Constant>(bop->getOperand(i));
+                llvm::ConstantInt *splat = c ? llvm::dyn_cast_or_null<llvm::ConstantInt>(c->getSplatValue()) : NULL;
+                if (splat != NULL) {
+                    delta = splat->getSExtValue() * scale->getSExtValue();
+                    offsets = bop->getOperand(1 - i);
+                    break;
+                }
+            }
+        }
+    }
+    if (delta % elementSize != 0)
+        return false;
+
+    access->call = callInst;
+    access->isGather = isGather;
+    access->base = callInst->getArgOperand(0);
+    access->offsets = offsets;
+    access->scale = scale;
+    access->value = value;
+    access->elementType = elementType;
+    access->elementSize = elementSize;
+    access->delta = delta;
+    return true;
+}
+
+/** Returns the number of elements in the structures that the given access
+    strides over, i.e. the stride of its offsets divided by the element
+    size, or 0 if the offsets don't stride over small structures.
+ */
+static int lGetAoSStride(const AoSAccess &access) {
+    int64_t scale = llvm::cast<llvm::ConstantInt>(access.scale)->getSExtValue();
+    for (int stride = 2; stride <= 8; ++stride) {
+        int64_t strideBytes = stride * access.elementSize;
+        if (strideBytes % scale == 0 && LLVMVectorIsLinear(access.offsets, (int)(strideBytes / scale)))
+            return stride;
+    }
+    return 0;
+}
+
+/** Given a group of gathers that read fields first ... first + count - 1
+    of consecutive structures of stride elements, loads all of them at
+    once and shuffles the loaded values into the result of each gather.
+ */
+static void lTransposeGathers(const std::vector<AoSAccess> &group, int stride, int64_t first, int count) {
+    const AoSAccess &leader = group[0];
+    llvm::Instruction *insertBefore = leader.call;
+    int width = g->target->getVectorWidth();
+
+    // The pointer to the first field that is read by the first program
+    // instance: base + scale * offsets[0] + first * elementSize.
+    llvm::Value *offset = LLVMExtractFirstVectorElement(leader.offsets);
+    llvm::Value *scale = leader.scale;
+    if (offset->getType() == LLVMTypes::Int64Type)
+        scale = new llvm::ZExtInst(scale, LLVMTypes::Int64Type, "scale_to64", insertBefore);
+    offset = llvm::BinaryOperator::Create(llvm::Instruction::Mul, offset, scale, "aos_offset", insertBefore);
+    llvm::Value *ptr = lGEPInst(leader.base, offset, "aos_base", insertBefore);
+    ptr = lGEPInst(ptr, LLVMInt64(first * leader.elementSize), "aos_first", insertBefore);
+
+    // Only load up to the last field that the last program instance
+    // reads, so that the load stays within the memory the gathers access.
+    int nLoaded = (width - 1) * stride + count;
+    llvm::Type *loadType = LLVMVECTOR::get(leader.elementType, nLoaded);
+    ptr = new llvm::BitCastInst(ptr, llvm::PointerType::get(loadType, 0), "aos_ptr", insertBefore);
+#if ISPC_LLVM_VERSION < ISPC_LLVM_11_0
+    llvm::Value *loaded = new llvm::LoadInst(ptr, "aos_load", false /* not volatile */,
+                                             llvm::MaybeAlign(leader.elementSize), insertBefore);
+#else // LLVM 11.0+
+    llvm::Value *loaded = new llvm::LoadInst(loadType, ptr, "aos_load", false /* not volatile */,
+                                             llvm::MaybeAlign(leader.elementSize).valueOrOne(), insertBefore);
+#endif
+    lCopyMetadata(loaded, leader.call);
+
+    for (const AoSAccess &access : group) {
+        int field = (int)(access.delta / access.elementSize - first);
+        std::vector<int32_t> shuf(width);
+        for (int i = 0; i < width; ++i)
+            shuf[i] = i * stride + field;
+        llvm::Value *result = LLVMShuffleVectors(loaded, llvm::UndefValue::get(loadType), &shuf[0], width, access.call);
+        if (result->getType() != access.call->getType())
+            result = new llvm::BitCastInst(result, access.call->getType(), "aos_cast", access.call);
+        lCopyMetadata(result, access.call);
+        lAddOptRemark("AoS to SoA", access.call, true, "gather", access.elementType, "vector load and shuffles",
+                      "the gathers read fields of consecutive structures");
+        access.call->replaceAllUsesWith(result);
+        access.call->eraseFromParent();
+    }
+}
+
+/** Given a group of scatters that write all stride fields of consecutive
+    structures, interleaves the values with shuffles and writes all of
+    them with a single store.  group[i] writes field i, and the store is
+    emitted before insertBefore, the last scatter of the group.
+ */
+static void lTransposeScatters(const std::vector<AoSAccess> &group, int stride, int64_t first,
+                               llvm::Instruction *insertBefore) {
+    const AoSAccess &leader = group[0];
+    int width = g->target->getVectorWidth();
+
+    // Concatenate the values of all of the scatters, padding to a power of
+    // two number of vectors, so that field f of program instance i is
+    // element f * width + i of the result.
+    std::vector<llvm::Value *> values;
+    for (const AoSAccess &access : group)
+        values.push_back(access.value);
+    while (!llvm::isPowerOf2_32((uint32_t)values.size()))
+        values.push_back(llvm::UndefValue::get(leader.value->getType()));
+    while (values.size() > 1) {
+        std::vector<llvm::Value *> concatenated;
+        for (int i = 0; i < (int)values.size(); i += 2)
+            concatenated.push_back(LLVMConcatVectors(values[i], values[i + 1], insertBefore));
+        values.swap(concatenated);
+    }
+
+    int nStored = width * stride;
+    std::vector<int32_t> shuf(nStored);
+    for (int i = 0; i < width; ++i)
+        for (int f = 0; f < stride; ++f)
+            shuf[i * stride + f] = f * width + i;
+    llvm::Value *interleaved =
+        LLVMShuffleVectors(values[0], llvm::UndefValue::get(values[0]->getType()), &shuf[0], nStored, insertBefore);
+
+    llvm::Value *offset = LLVMExtractFirstVectorElement(leader.offsets);
+    llvm::Value *scale = leader.scale;
+    if (offset->getType() == LLVMTypes::Int64Type)
+        scale = new llvm::ZExtInst(scale, LLVMTypes::Int64Type, "scale_to64", insertBefore);
+    offset = llvm::BinaryOperator::Create(llvm::Instruction::Mul, offset, scale, "aos_offset", insertBefore);
+    llvm::Value *ptr = lGEPInst(leader.base, offset, "aos_base", insertBefore);
+    ptr = lGEPInst(ptr, LLVMInt64(first * leader.elementSize), "aos_first", insertBefore);
+    ptr = new llvm::BitCastInst(ptr, llvm::PointerType::get(interleaved->getType(), 0), "aos_ptr", insertBefore);
+    llvm::Instruction *store = new llvm::StoreInst(interleaved, ptr, false /* not volatile */,
+                                                   llvm::MaybeAlign(leader.elementSize).valueOrOne(), insertBefore);
+    lCopyMetadata(store, insertBefore);
+
+    for (const AoSAccess &access : group) {
+        lAddOptRemark("AoS to SoA", access.call, true, "scatter", access.elementType, "shuffles and vector store",
+                      "the scatters write all fields of consecutive structures");
+        access.call->eraseFromParent();
+    }
+}
+
+bool AoSToSoAPass::runOnBasicBlock(llvm::BasicBlock &bb) {
+    DEBUG_START_PASS("AoSToSoAPass");
+
+    bool modifiedAny = false;
+
+restart:
+    for (llvm::BasicBlock::iterator iter = bb.begin(), e = bb.end(); iter != e; ++iter) {
+        AoSAccess leader;
+        if (!lGetAoSAccess(&*iter, &leader))
+            continue;
+        int stride = lGetAoSStride(leader);
+        if (stride == 0)
+            continue;
+
+        // Look for the other accesses of the group in the rest of the basic
+        // block, stopping at any other instruction that may access the
+        // memory: the gathers are all moved to the first one and the
+        // scatters to the last one.
+        std::vector<AoSAccess> group(1, leader);
+        std::set<int64_t> fields;
+        fields.insert(leader.delta / leader.elementSize);
+        llvm::Instruction *last = leader.call;
+        llvm::BasicBlock::iterator fwdIter = iter;
+        for (++fwdIter; fwdIter != bb.end() && (int)fields.size() < stride; ++fwdIter) {
+            AoSAccess access;
+            if (lGetAoSAccess(&*fwdIter, &access) && access.isGather == leader.isGather &&
+                access.call->getCalledFunction() == leader.call->getCalledFunction() && access.base == leader.base &&
+                access.offsets == leader.offsets && access.scale == leader.scale) {
+                int64_t field = access.delta / access.elementSize;
+                int64_t lowest = std::min(*fields.begin(), field);
+                int64_t highest = std::max(*fields.rbegin(), field);
+                if (highest - lowest >= stride)
+                    break;
+                if (fields.count(field) && !leader.isGather)
+                    // Two scatters to the same field; keep them in order.
+                    break;
+                fields.insert(field);
+                group.push_back(access);
+                last = access.call;
+                continue;
+            }
+            if (leader.isGather ? lInstructionMayWriteToMemory(&*fwdIter, leader.base)
+                                : fwdIter->mayReadOrWriteMemory())
+                break;
+        }
+
+        // Only worth it if the group covers at least half of the fields;
+        // scatters have to write all of them, since the store writes whole
+        // structures.
+        int count = (int)(*fields.rbegin() - *fields.begin() + 1);
+        if (fields.size() < 2 || 2 * (int)fields.size() < stride)
+            continue;
+        if (!leader.isGather && (int)fields.size() != stride)
+            continue;
+
+        SourcePos pos;
+        lGetSourcePosFromMetadata(leader.call, &pos);
+        if (leader.isGather) {
+            Debug(pos, "Transformed %d gathers to a vector load and shuffles.", (int)group.size());
+            lTransposeGathers(group, stride, *fields.begin(), count);
+        } else {
+            Debug(pos, "Transformed %d scatters to shuffles and a vector store.", (int)group.size());
+            std::sort(group.begin(), group.end(),
+                      [](const AoSAccess &a, const AoSAccess &b) { return a.delta < b.delta; });
+            lTransposeScatters(group, stride, *fields.begin(), last);
+        }
+        modifiedAny = true;
+        goto restart;
+    }
+
+    DEBUG_END_PASS("AoSToSoAPass");
+
+    return modifiedAny;
+}
+
+bool AoSToSoAPass::runOnFunction(llvm::Function &F) {
+
+    llvm::TimeTraceScope FuncScope("AoSToSoAPass::runOnFunction", F.getName());
+    bool modifiedAny = false;
+    for (llvm::BasicBlock &BB : F) {
+        modifiedAny |= runOnBasicBlock(BB);
+    }
+    return modifiedAny;
+}
+
+static llvm::Pass *CreateAoSToSoAPass() { return new AoSToSoAPass; }
+
 ///////////////////////////////////////////////////////////////////////////
 // ReplacePseudoMemoryOpsPass
 
@@ -4463,6 +5268,14 @@ static bool lReplacePseudoGS(llvm::CallInst *callInst) {
     SourcePos pos;
     bool gotPosition = lGetSourcePosFromMetadata(callInst, &pos);
 
+    if (info->isGather)
+        lAddOptRemark("Replace Pseudo Memory Ops", callInst, false, "gather", callInst->getType(), "gather",
+                      "offsets are neither the same for all program instances nor a linear sequence");
+    else if (!info->isPrefetch)
+        lAddOptRemark("Replace Pseudo Memory Ops", callInst, false, "scatter",
+                      callInst->getArgOperand(callInst->arg_size() - 2)->getType(), "scatter",
+                      "offsets are not a linear sequence");
+
     callInst->setCalledFunction(info->actualFunc);
     // Check for alloca and if not alloca - generate __gather and change arguments
     if (gotPosition && (g->target->getVectorWidth() > 1) && (g->opt.level > 0)) {
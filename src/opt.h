@@ -45,3 +45,16 @@
     corresponds to full optimization.
 */
 void Optimize(llvm::Module *module, int optLevel);
+
+/** Writes the statistics about the optimization passes that were collected
+    with --pass-stats to the given file as JSON.  Returns false if the file
+    can't be written.
+*/
+bool WritePassStats(const char *fileName, const char *srcFile);
+
+/** Writes the optimization remarks that were collected with --opt-remarks
+    to the given file as YAML: one document per gather or scatter, with its
+    source position, kind, element size and what the optimizer did with it.
+    Returns false if the file can't be written.
+*/
+bool WriteOptRemarks(const char *fileName);
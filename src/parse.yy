@@ -261,7 +261,8 @@ struct ForeachDimension {
 
 %type <stringVal> string_constant
 %type <constCharPtr> struct_or_union_name enum_identifier goto_identifier
-%type <constCharPtr> foreach_unique_identifier
+%type <constCharPtr> foreach_unique_identifier declspec_name
+%type <stringVal> declspec_argument declspec_argument_list
 
 %type <intVal> int_constant soa_width_specifier rate_qualified_new
 
@@ -771,6 +772,36 @@ declspec_item
         p->second = @1;
         $$ = p;
     }
+    | declspec_name '(' declspec_argument_list ')'
+    {
+        std::pair<std::string, SourcePos> *p = new std::pair<std::string, SourcePos>;
+        p->first = std::string($1) + "(" + *$3 + ")";
+        p->second = Union(@1, @4);
+        $$ = p;
+    }
+    ;
+
+declspec_name
+    : TOKEN_IDENTIFIER { $$ = yylval.stringVal->c_str(); }
+    ;
+
+declspec_argument
+    : declspec_name '=' int_constant
+    {
+        $$ = new std::string(std::string($1) + "=" + std::to_string((int64_t)$3));
+    }
+    | declspec_name '=' '-' int_constant
+    {
+        $$ = new std::string(std::string($1) + "=" + std::to_string(-(int64_t)$4));
+    }
+    ;
+
+declspec_argument_list
+    : declspec_argument
+    | declspec_argument_list ',' declspec_argument
+    {
+        $$ = new std::string(*$1 + "," + *$3);
+    }
     ;
 
 declspec_list
@@ -0,0 +1,150 @@
+/*
+  Copyright (c) 2021, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** @file profile.cpp
+    @brief Execution profiles that guide code generation (--profile-use).
+*/
+
+#include "profile.h"
+#include "util.h"
+
+#include <vector>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/Twine.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+
+static const char *lProfileHeader = "# ispc profile 1";
+
+std::string ProfileData::getKey(int line, int column, llvm::StringRef note) {
+    return (llvm::Twine(line) + ":" + llvm::Twine(column) + ":" + note).str();
+}
+
+// Returns the number of path components at the end of a and b that are the
+// same.
+static int lCommonTailLength(llvm::StringRef a, llvm::StringRef b) {
+    int length = 0;
+    for (auto ia = llvm::sys::path::rbegin(a), ib = llvm::sys::path::rbegin(b);
+         ia != llvm::sys::path::rend(a) && ib != llvm::sys::path::rend(b) && *ia == *ib; ++ia, ++ib)
+        ++length;
+    return length;
+}
+
+bool ProfileData::Read(const char *fileName) {
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer = llvm::MemoryBuffer::getFile(fileName);
+    if (!buffer) {
+        Error(SourcePos(), "Unable to read profile \"%s\": %s.", fileName, buffer.getError().message().c_str());
+        return false;
+    }
+    this->fileName = fileName;
+    contents = (*buffer)->getBuffer().str();
+
+    llvm::SmallVector<llvm::StringRef, 64> lines;
+    llvm::StringRef(contents).split(lines, '\n', -1, false /* KeepEmpty */);
+    if (lines.empty() || lines[0].rtrim() != lProfileHeader) {
+        Error(SourcePos(), "\"%s\" isn't a profile written by a program compiled with --profile-generate.", fileName);
+        return false;
+    }
+
+    for (size_t i = 1; i < lines.size(); ++i) {
+        llvm::StringRef line = lines[i].rtrim("\r");
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        // Seven numbers separated by spaces, then the file and the note
+        // separated by a tab.
+        uint64_t numbers[7];
+        bool ok = true;
+        for (int n = 0; n < 7 && ok; ++n) {
+            std::pair<llvm::StringRef, llvm::StringRef> field = line.split(' ');
+            ok = !field.first.getAsInteger(10, numbers[n]);
+            line = field.second;
+        }
+        std::pair<llvm::StringRef, llvm::StringRef> site = line.split('\t');
+        if (!ok || site.first.empty() || site.second.empty()) {
+            Error(SourcePos(), "Malformed line %d in profile \"%s\".", (int)i + 1, fileName);
+            return false;
+        }
+
+        ProfileCounts &c = files[site.first.str()][getKey((int)numbers[5], (int)numbers[6], site.second)];
+        c.calls += numbers[0];
+        c.activeLanes += numbers[1];
+        c.lanes += numbers[2];
+        c.allOff += numbers[3];
+        c.allOn += numbers[4];
+    }
+    return true;
+}
+
+const ProfileData::FileCounts *ProfileData::getFileCounts(const char *sourceFile) const {
+    auto known = sourceFiles.find(sourceFile);
+    if (known != sourceFiles.end())
+        return known->second;
+
+    int bestLength = 0;
+    std::vector<const std::string *> best;
+    for (const auto &file : files) {
+        int length = lCommonTailLength(sourceFile, file.first);
+        if (length > 0 && length >= bestLength) {
+            if (length > bestLength)
+                best.clear();
+            bestLength = length;
+            best.push_back(&file.first);
+        }
+    }
+
+    const FileCounts *fileCounts = NULL;
+    if (best.size() == 1)
+        fileCounts = &files.find(*best[0])->second;
+    else if (best.size() > 1) {
+        std::string names;
+        for (const std::string *name : best)
+            names += (names.empty() ? "\"" : ", \"") + *name + "\"";
+        Warning(SourcePos(),
+                "Profile \"%s\" has sites of several files that match \"%s\" equally well (%s), so it isn't "
+                "used for it.",
+                fileName.c_str(), sourceFile, names.c_str());
+    }
+    sourceFiles[sourceFile] = fileCounts;
+    return fileCounts;
+}
+
+const ProfileCounts *ProfileData::Lookup(const SourcePos &pos, const char *note) const {
+    const FileCounts *fileCounts = getFileCounts(pos.name);
+    if (fileCounts == NULL)
+        return NULL;
+    auto iter = fileCounts->find(getKey(pos.first_line, pos.first_column, note));
+    return iter == fileCounts->end() ? NULL : &iter->second;
+}
@@ -0,0 +1,105 @@
+/*
+  Copyright (c) 2021, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    * Neither the name of Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+   TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** @file profile.h
+    @brief Execution profiles that guide code generation (--profile-use).
+*/
+
+#pragma once
+
+#include "ispc.h"
+
+#include <map>
+#include <stdint.h>
+#include <string>
+
+#include <llvm/ADT/StringRef.h>
+
+/** What a program compiled with --profile-generate recorded for one
+    profile site: how often it was reached, the total number of active
+    and of all program instances there, and how often none and all of them
+    were active. */
+struct ProfileCounts {
+    uint64_t calls = 0;
+    uint64_t activeLanes = 0;
+    uint64_t lanes = 0;
+    uint64_t allOff = 0;
+    uint64_t allOn = 0;
+};
+
+/** A profile written by the --instrument runtime (ISPCInstrumentWriteProfile()
+    or the ISPC_PROFILE_FILE environment variable).  After a header line,
+    it has a line for each site of each module that was run:
+
+    <calls> <active lanes> <lanes> <all off> <all on> <line> <column> <file>\t<note>
+
+    Sites are identified by their position and note within a file.  The
+    file names in the profile needn't be the same as those of the
+    compilation, so that the program that was profiled may have been built
+    in another directory: a source file uses the sites of the file in the
+    profile whose name has the longest common tail of path components with
+    its own (at least the file name).  If several files match equally well,
+    e.g. "a/util.ispc" and "b/util.ispc" for "util.ispc", a warning is
+    issued and none of them is used.  The counts of the same site, e.g. of
+    the variants of a function compiled for several targets, are added up.
+ */
+class ProfileData {
+  public:
+    /** Reads the profile from the given file.  Reports an error and
+        returns false if it can't be read or is malformed. */
+    bool Read(const char *fileName);
+
+    /** Returns the counts of the site with the given note at the given
+        position, or NULL if the profile has none: the code wasn't run or
+        the source changed after it was profiled. */
+    const ProfileCounts *Lookup(const SourcePos &pos, const char *note) const;
+
+    /** Returns the contents of the profile file, which are part of the key
+        of compilation cache entries. */
+    const std::string &GetContents() const { return contents; }
+
+  private:
+    /** The counts of the sites of a file, by line, column and note. */
+    typedef std::map<std::string, ProfileCounts> FileCounts;
+
+    static std::string getKey(int line, int column, llvm::StringRef note);
+    const FileCounts *getFileCounts(const char *sourceFile) const;
+
+    std::string fileName;
+    std::map<std::string, FileCounts> files;
+    std::string contents;
+
+    /** The counts that getFileCounts() chose for each source file, which
+        may be NULL. */
+    mutable std::map<std::string, const FileCounts *> sourceFiles;
+};
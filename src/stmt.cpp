@@ -42,6 +42,7 @@
 #include "func.h"
 #include "llvmutil.h"
 #include "module.h"
+#include "profile.h"
 #include "sym.h"
 #include "type.h"
 #include "util.h"
@@ -333,6 +334,101 @@ void DeclStmt::Print(int indent) const {
 
 int DeclStmt::EstimateCost() const { return 0; }
 
+///////////////////////////////////////////////////////////////////////////
+// Profile-guided code generation
+
+// Notes of the profile sites that --profile-generate emits and whose
+// counts --profile-use looks up.
+static const char *lProfileIfThen = "profile: if then";
+static const char *lProfileIfElse = "profile: if else";
+static const char *lProfileIfEntry = "profile: if entry";
+static const char *lProfileIfTestTrue = "profile: if test true";
+static const char *lProfileIfTestFalse = "profile: if test false";
+static const char *lProfileLoopBody = "profile: loop body";
+static const char *lProfileLoopExit = "profile: loop exit";
+static const char *lProfileForeachFullBody = "profile: foreach full body";
+static const char *lProfileForeachInnerEnd = "profile: foreach inner end";
+
+// A state of the mask that the profile saw in less than this fraction of
+// the executions of a statement isn't worth checking for, and one that it
+// saw in at least PROFILE_FREQUENT of them is worth code of its own.
+static const double PROFILE_RARE = 0.1;
+static const double PROFILE_FREQUENT = 0.9;
+// Loops over full vectors in foreach statements that run fewer times
+// than this in a row on average aren't unrolled, and the ones that run at
+// least PROFILE_UNROLL_TRIPS times are.
+static const double PROFILE_NO_UNROLL_TRIPS = 2.;
+static const double PROFILE_UNROLL_TRIPS = 16.;
+
+/** Returns the counts of the profile site with the given note of the
+    statement at the given position, or NULL if --profile-use wasn't given
+    or the profile doesn't have it. */
+static const ProfileCounts *lGetProfileCounts(SourcePos pos, const char *note) {
+    return g->profile != NULL ? g->profile->Lookup(pos, note) : NULL;
+}
+
+static double lFraction(uint64_t count, uint64_t total) { return total > 0 ? (double)count / (double)total : 0.; }
+
+static uint64_t lSubtract(uint64_t a, uint64_t b) { return a > b ? a - b : 0; }
+
+/** The counts of the profile sites of an 'if' with a varying test, which
+    see the mask going into the 'if' and the lanes of it for which the test
+    is true and false. */
+struct VaryingIfProfile {
+    VaryingIfProfile(SourcePos pos)
+        : entry(lGetProfileCounts(pos, lProfileIfEntry)), testTrue(lGetProfileCounts(pos, lProfileIfTestTrue)),
+          testFalse(lGetProfileCounts(pos, lProfileIfTestFalse)) {}
+
+    /** Returns true if the profile has the 'if' and it was run. */
+    bool IsValid() const { return entry != NULL && testTrue != NULL && testFalse != NULL && entry->calls > 0; }
+
+    /** Number of times the mask was all on going into the 'if'. */
+    uint64_t AllOn() const { return entry->allOn; }
+
+    /** Number of times the mask was all on and the test was true (false)
+        for all lanes. */
+    uint64_t AllOnAllTrue() const { return testTrue->allOn; }
+    uint64_t AllOnAllFalse() const { return testFalse->allOn; }
+
+    const ProfileCounts *entry, *testTrue, *testFalse;
+};
+
+/** With --profile-use, returns whether the body of a loop with a varying
+    test should be emitted twice, once for when the mask is all on and
+    once for when it's mixed.  'cfor', 'cwhile' and 'cdo' ask for that, but
+    it isn't worth it if the mask is rarely all on; and it's worth it for
+    other loops if the mask is nearly always all on. */
+static bool lUseCoherentLoopBody(bool doCoherentCheck, SourcePos pos) {
+    const ProfileCounts *body = lGetProfileCounts(pos, lProfileLoopBody);
+    if (body == NULL || body->calls == 0)
+        return doCoherentCheck;
+
+    double allOn = lFraction(body->allOn, body->calls);
+    if (doCoherentCheck && allOn < PROFILE_RARE) {
+        Debug(pos, "Loop body: mask all on in %.1f%% of iterations; not checking for it.", 100. * allOn);
+        return false;
+    }
+    if (!doCoherentCheck && !g->opt.disableCoherentControlFlow && allOn >= PROFILE_FREQUENT) {
+        Debug(pos, "Loop body: mask all on in %.1f%% of iterations; emitting code for it.", 100. * allOn);
+        return true;
+    }
+    return doCoherentCheck;
+}
+
+/** With --profile-use, attaches branch weights to the branch at the test
+    of a loop, which goes to the body or exits the loop.  If the body runs
+    before the test, as for 'do' loops, the first iteration of each run of
+    the loop isn't counted by the test. */
+static void lSetLoopTestWeights(FunctionEmitContext *ctx, llvm::Instruction *branch, SourcePos pos,
+                                bool bodyRunsFirst) {
+    const ProfileCounts *body = lGetProfileCounts(pos, lProfileLoopBody);
+    const ProfileCounts *exit = lGetProfileCounts(pos, lProfileLoopExit);
+    if (body == NULL || exit == NULL)
+        return;
+    uint64_t iterations = bodyRunsFirst ? lSubtract(body->calls, exit->calls) : body->calls;
+    ctx->SetBranchWeights(branch, iterations, exit->calls);
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // IfStmt
 
@@ -421,16 +517,24 @@ void IfStmt::EmitCode(FunctionEmitContext *ctx) const {
 
         // Jump to the appropriate basic block based on the value of
         // the 'if' test
-        ctx->BranchInst(bthen, belse, testValue);
+        llvm::Instruction *branchInst = ctx->BranchInst(bthen, belse, testValue);
+        const ProfileCounts *thenCounts = lGetProfileCounts(pos, lProfileIfThen);
+        const ProfileCounts *elseCounts = lGetProfileCounts(pos, lProfileIfElse);
+        if (thenCounts != NULL && elseCounts != NULL && !emulateUniform)
+            ctx->SetBranchWeights(branchInst, thenCounts->calls, elseCounts->calls);
 
         // Emit code for the 'true' case
         ctx->SetCurrentBasicBlock(bthen);
+        if (!emulateUniform)
+            ctx->AddProfileSite(pos, lProfileIfThen);
         lEmitIfStatements(ctx, trueStmts, "true");
         if (ctx->GetCurrentBasicBlock())
             ctx->BranchInst(bexit);
 
         // Emit code for the 'false' case
         ctx->SetCurrentBasicBlock(belse);
+        if (!emulateUniform)
+            ctx->AddProfileSite(pos, lProfileIfElse);
         lEmitIfStatements(ctx, falseStmts, "false");
         if (ctx->GetCurrentBasicBlock())
             ctx->BranchInst(bexit);
@@ -518,7 +622,36 @@ void IfStmt::emitMaskedTrueAndFalse(FunctionEmitContext *ctx, llvm::Value *oldMa
  */
 void IfStmt::emitVaryingIf(FunctionEmitContext *ctx, llvm::Value *ltest) const {
     llvm::Value *oldMask = ctx->GetInternalMask();
-    if (doAllCheck) {
+    if (g->profileGenerate) {
+        // Record how often the mask going into the 'if' is all on and how
+        // often the test is true or false for all of its lanes.
+        llvm::Value *fullMask = ctx->GetFullMask();
+        ctx->AddProfileSite(pos, lProfileIfEntry, fullMask);
+        ctx->AddProfileSite(pos, lProfileIfTestTrue,
+                            ctx->BinaryOperator(llvm::Instruction::And, fullMask, ltest, "profile_test_true"));
+        ctx->AddProfileSite(
+            pos, lProfileIfTestFalse,
+            ctx->BinaryOperator(llvm::Instruction::And, fullMask, ctx->NotOperator(ltest), "profile_test_false"));
+    }
+
+    // The profile may show that checking whether the mask is all on isn't
+    // worth it for a 'cif', or that it is for an 'if'.
+    VaryingIfProfile profile(pos);
+    bool allCheck = doAllCheck;
+    if (profile.IsValid()) {
+        double allOn = lFraction(profile.AllOn(), profile.entry->calls);
+        double allOnCoherent = lFraction(profile.AllOnAllTrue() + profile.AllOnAllFalse(), profile.entry->calls);
+        if (doAllCheck && allOn < PROFILE_RARE) {
+            Debug(pos, "If statement: mask all on in %.1f%% of executions; not checking for it.", 100. * allOn);
+            allCheck = false;
+        } else if (!doAllCheck && !g->opt.disableCoherentControlFlow && allOnCoherent >= PROFILE_FREQUENT) {
+            Debug(pos, "If statement: mask all on and test coherent in %.1f%% of executions; checking for it.",
+                  100. * allOnCoherent);
+            allCheck = true;
+        }
+    }
+
+    if (allCheck) {
         // We can't tell if the mask going into the if is all on at the
         // compile time.  Emit code to check for this and then either run
         // the code for the 'all on' or the 'mixed' case depending on the
@@ -529,7 +662,9 @@ void IfStmt::emitVaryingIf(FunctionEmitContext *ctx, llvm::Value *ltest) const {
 
         // Jump to either bAllOn or bMixedOn, depending on the mask's value
         llvm::Value *maskAllQ = ctx->All(ctx->GetFullMask());
-        ctx->BranchInst(bAllOn, bMixedOn, maskAllQ);
+        llvm::Instruction *branchInst = ctx->BranchInst(bAllOn, bMixedOn, maskAllQ);
+        if (profile.IsValid())
+            ctx->SetBranchWeights(branchInst, profile.AllOn(), profile.entry->calls - profile.AllOn());
 
         // Emit code for the 'mask all on' case
         ctx->SetCurrentBasicBlock(bAllOn);
@@ -571,7 +706,20 @@ void IfStmt::emitVaryingIf(FunctionEmitContext *ctx, llvm::Value *ltest) const {
               (int)SafeToRunWithMaskAllOff(trueStmts), ::EstimateCost(falseStmts),
               (int)SafeToRunWithMaskAllOff(falseStmts));
 
-        if (safeToRunWithAllLanesOff && (costIsAcceptable || g->opt.disableCoherentControlFlow)) {
+        bool predicate = safeToRunWithAllLanesOff && (costIsAcceptable || g->opt.disableCoherentControlFlow);
+        if (!predicate && safeToRunWithAllLanesOff && profile.IsValid()) {
+            // Checking whether any lanes run the true and false
+            // statements is only worth it if it sometimes skips them.
+            uint64_t skipped = (trueStmts != NULL ? profile.testTrue->allOff : 0) +
+                               (falseStmts != NULL ? profile.testFalse->allOff : 0);
+            if (lFraction(skipped, profile.entry->calls) < PROFILE_RARE) {
+                Debug(pos, "If statement: statements skipped in %.1f%% of executions; running both.",
+                      100. * lFraction(skipped, profile.entry->calls));
+                predicate = true;
+            }
+        }
+
+        if (predicate) {
             ctx->StartVaryingIf(oldMask);
             emitMaskedTrueAndFalse(ctx, oldMask, ltest);
             AssertPos(pos, ctx->GetCurrentBasicBlock());
@@ -605,7 +753,10 @@ void IfStmt::emitMaskAllOn(FunctionEmitContext *ctx, llvm::Value *ltest, llvm::B
     llvm::BasicBlock *bTestAll = ctx->CreateBasicBlock("cif_test_all");
     llvm::BasicBlock *bTestNoneCheck = ctx->CreateBasicBlock("cif_test_none_check");
     llvm::Value *testAllQ = ctx->All(ltest);
-    ctx->BranchInst(bTestAll, bTestNoneCheck, testAllQ);
+    llvm::Instruction *branchInst = ctx->BranchInst(bTestAll, bTestNoneCheck, testAllQ);
+    VaryingIfProfile profile(pos);
+    if (profile.IsValid())
+        ctx->SetBranchWeights(branchInst, profile.AllOnAllTrue(), lSubtract(profile.AllOn(), profile.AllOnAllTrue()));
 
     // Emit code for the 'test is all true' case
     ctx->SetCurrentBasicBlock(bTestAll);
@@ -624,7 +775,10 @@ void IfStmt::emitMaskAllOn(FunctionEmitContext *ctx, llvm::Value *ltest, llvm::B
     llvm::BasicBlock *bTestNone = ctx->CreateBasicBlock("cif_test_none");
     llvm::BasicBlock *bTestMixed = ctx->CreateBasicBlock("cif_test_mixed");
     llvm::Value *testMixedQ = ctx->Any(ltest);
-    ctx->BranchInst(bTestMixed, bTestNone, testMixedQ);
+    branchInst = ctx->BranchInst(bTestMixed, bTestNone, testMixedQ);
+    if (profile.IsValid())
+        ctx->SetBranchWeights(branchInst, lSubtract(profile.AllOn(), profile.AllOnAllTrue() + profile.AllOnAllFalse()),
+                              profile.AllOnAllFalse());
 
     // Emit code for the 'test is all false' case
     ctx->SetCurrentBasicBlock(bTestNone);
@@ -667,7 +821,11 @@ void IfStmt::emitMaskMixed(FunctionEmitContext *ctx, llvm::Value *oldMask, llvm:
 
     llvm::Value *maskAnyTrueQ = ctx->Any(ctx->GetFullMask());
 
-    ctx->BranchInst(bRunTrue, bNext, maskAnyTrueQ);
+    llvm::Instruction *branchInst = ctx->BranchInst(bRunTrue, bNext, maskAnyTrueQ);
+    VaryingIfProfile profile(pos);
+    if (profile.IsValid())
+        ctx->SetBranchWeights(branchInst, lSubtract(profile.entry->calls, profile.testTrue->allOff),
+                              profile.testTrue->allOff);
 
     // Emit statements for true
     ctx->SetCurrentBasicBlock(bRunTrue);
@@ -685,7 +843,10 @@ void IfStmt::emitMaskMixed(FunctionEmitContext *ctx, llvm::Value *oldMask, llvm:
     // run the 'false' block...
 
     llvm::Value *maskAnyFalseQ = ctx->Any(ctx->GetFullMask());
-    ctx->BranchInst(bRunFalse, bDone, maskAnyFalseQ);
+    branchInst = ctx->BranchInst(bRunFalse, bDone, maskAnyFalseQ);
+    if (profile.IsValid())
+        ctx->SetBranchWeights(branchInst, lSubtract(profile.entry->calls, profile.testFalse->allOff),
+                              profile.testFalse->allOff);
 
     // Emit code for false
     ctx->SetCurrentBasicBlock(bRunFalse);
@@ -821,11 +982,16 @@ void DoStmt::EmitCode(FunctionEmitContext *ctx) const {
         ctx->StartScope();
 
     ctx->AddInstrumentationPoint("do loop body");
-    if (doCoherentCheck && !uniformTest) {
+    if (!emulateUniform)
+        ctx->AddProfileSite(pos, lProfileLoopBody);
+    if (!uniformTest && lUseCoherentLoopBody(doCoherentCheck, pos)) {
         // Check to see if the mask is all on
         llvm::BasicBlock *bAllOn = ctx->CreateBasicBlock("do_all_on");
         llvm::BasicBlock *bMixed = ctx->CreateBasicBlock("do_mixed");
-        ctx->BranchIfMaskAll(bAllOn, bMixed);
+        llvm::Instruction *allOnBranch = ctx->BranchIfMaskAll(bAllOn, bMixed);
+        const ProfileCounts *body = lGetProfileCounts(pos, lProfileLoopBody);
+        if (body != NULL)
+            ctx->SetBranchWeights(allOnBranch, body->allOn, body->calls - body->allOn);
 
         // If so, emit code for the 'mask all on' case.  In particular,
         // explicitly set the mask to 'all on' (see rationale in
@@ -888,13 +1054,17 @@ void DoStmt::EmitCode(FunctionEmitContext *ctx) const {
         // to the top of the loop.  Otherwise, jump out.
         llvm::Value *mask = ctx->GetInternalMask();
         ctx->SetInternalMaskAnd(mask, testValue);
-        ctx->BranchIfMaskAny(bloop, bexit);
+        branchInst = ctx->BranchIfMaskAny(bloop, bexit);
     }
+    if (!emulateUniform)
+        lSetLoopTestWeights(ctx, branchInst, pos, true /* body runs first */);
 
     // ...and we're done.  Set things up for subsequent code to be emitted
     // in the right basic block.
     ctx->SetCurrentBasicBlock(bexit);
     ctx->EndLoop();
+    if (!emulateUniform)
+        ctx->AddProfileSite(pos, lProfileLoopExit);
 }
 
 Stmt *DoStmt::TypeCheck() {
@@ -1029,27 +1199,35 @@ void ForStmt::EmitCode(FunctionEmitContext *ctx) const {
                                    "statement.");
         if (!ctx->emitGenXHardwareMask())
             AssertPos(pos, ltest->getType() == LLVMTypes::BoolType);
-        ctx->BranchInst(bloop, bexit, ltest);
+        llvm::Instruction *branchInst = ctx->BranchInst(bloop, bexit, ltest);
+        if (!emulateUniform)
+            lSetLoopTestWeights(ctx, branchInst, pos, false /* body runs first */);
     } else {
         llvm::Value *mask = ctx->GetInternalMask();
         ctx->SetInternalMaskAnd(mask, ltest);
-        ctx->BranchIfMaskAny(bloop, bexit);
+        llvm::Instruction *branchInst = ctx->BranchIfMaskAny(bloop, bexit);
+        lSetLoopTestWeights(ctx, branchInst, pos, false /* body runs first */);
     }
 
     // On to emitting the code for the loop body.
     ctx->SetCurrentBasicBlock(bloop);
     ctx->SetBlockEntryMask(ctx->GetFullMask());
     ctx->AddInstrumentationPoint("for loop body");
+    if (!emulateUniform)
+        ctx->AddProfileSite(pos, lProfileLoopBody);
     if (!llvm::dyn_cast_or_null<StmtList>(stmts))
         ctx->StartScope();
 
-    if (doCoherentCheck && !uniformTest) {
+    if (!uniformTest && lUseCoherentLoopBody(doCoherentCheck, pos)) {
         // For 'varying' loops with the coherence check, we start by
         // checking to see if the mask is all on, after it has been updated
         // based on the value of the test.
         llvm::BasicBlock *bAllOn = ctx->CreateBasicBlock("for_all_on");
         llvm::BasicBlock *bMixed = ctx->CreateBasicBlock("for_mixed");
-        ctx->BranchIfMaskAll(bAllOn, bMixed);
+        llvm::Instruction *allOnBranch = ctx->BranchIfMaskAll(bAllOn, bMixed);
+        const ProfileCounts *body = lGetProfileCounts(pos, lProfileLoopBody);
+        if (body != NULL)
+            ctx->SetBranchWeights(allOnBranch, body->allOn, body->calls - body->allOn);
 
         // Emit code for the mask being all on.  Explicitly set the mask to
         // be on so that the optimizer can see that it's on (i.e. now that
@@ -1108,6 +1286,8 @@ void ForStmt::EmitCode(FunctionEmitContext *ctx) const {
     if (init)
         ctx->EndScope();
     ctx->EndLoop();
+    if (!emulateUniform)
+        ctx->AddProfileSite(pos, lProfileLoopExit);
 }
 
 Stmt *ForStmt::TypeCheck() {
@@ -1638,12 +1818,16 @@ void ForeachStmt::EmitCode(FunctionEmitContext *ctx) const {
     //   // run loop body with mask
     // }
     llvm::BasicBlock *bbPartialInnerAllOuter = ctx->CreateBasicBlock("partial_inner_all_outer");
+    const ProfileCounts *fullBodyCounts = lGetProfileCounts(pos, lProfileForeachFullBody);
+    const ProfileCounts *innerEndCounts = lGetProfileCounts(pos, lProfileForeachInnerEnd);
     ctx->SetCurrentBasicBlock(bbOuterNotInExtras);
     {
         llvm::Value *counter = ctx->LoadInst(uniformCounterPtrs[nDims - 1], NULL, "counter");
         llvm::Value *beforeAlignedEnd = ctx->CmpInst(llvm::Instruction::ICmp, llvm::CmpInst::ICMP_SLT, counter,
                                                      alignedEnd[nDims - 1], "before_aligned_end");
-        ctx->BranchInst(bbFullBody, bbPartialInnerAllOuter, beforeAlignedEnd);
+        llvm::Instruction *branchInst = ctx->BranchInst(bbFullBody, bbPartialInnerAllOuter, beforeAlignedEnd);
+        if (fullBodyCounts != NULL && innerEndCounts != NULL)
+            ctx->SetBranchWeights(branchInst, fullBodyCounts->calls, innerEndCounts->calls);
     }
 
     ///////////////////////////////////////////////////////////////////////////
@@ -1661,6 +1845,7 @@ void ForeachStmt::EmitCode(FunctionEmitContext *ctx) const {
                               span);
         ctx->SetContinueTarget(bbFullBodyContinue);
         ctx->AddInstrumentationPoint("foreach loop body (all on)");
+        ctx->AddProfileSite(pos, lProfileForeachFullBody);
         stmts->EmitCode(ctx);
         AssertPos(pos, ctx->GetCurrentBasicBlock() != NULL);
         ctx->BranchInst(bbFullBodyContinue);
@@ -1672,7 +1857,19 @@ void ForeachStmt::EmitCode(FunctionEmitContext *ctx) const {
         llvm::Value *newCounter =
             ctx->BinaryOperator(llvm::Instruction::Add, counter, LLVMInt32(span[nDims - 1]), "new_counter");
         ctx->StoreInst(newCounter, uniformCounterPtrs[nDims - 1]);
-        ctx->BranchInst(bbOuterNotInExtras);
+        llvm::Instruction *backEdge = ctx->BranchInst(bbOuterNotInExtras);
+
+        // The profile tells how many full vectors the innermost dimension
+        // usually has: unrolling the loop over them doesn't pay off if
+        // there are only one or two, and does if there are many.
+        if (fullBodyCounts != NULL && innerEndCounts != NULL && innerEndCounts->calls > 0) {
+            double trips = lFraction(fullBodyCounts->calls, innerEndCounts->calls);
+            Debug(pos, "Foreach statement: %.1f full vectors per run of the innermost dimension.", trips);
+            if (trips < PROFILE_NO_UNROLL_TRIPS)
+                ctx->setLoopUnrollMetadata(backEdge, std::make_pair(Globals::pragmaUnrollType::nounroll, 0), pos);
+            else if (trips >= PROFILE_UNROLL_TRIPS)
+                ctx->setLoopUnrollMetadata(backEdge, std::make_pair(Globals::pragmaUnrollType::unroll, 0), pos);
+        }
     }
 
     ///////////////////////////////////////////////////////////////////////////
@@ -1682,6 +1879,7 @@ void ForeachStmt::EmitCode(FunctionEmitContext *ctx) const {
     llvm::BasicBlock *bbSetInnerMask = ctx->CreateBasicBlock("partial_inner_only");
     ctx->SetCurrentBasicBlock(bbPartialInnerAllOuter);
     {
+        ctx->AddProfileSite(pos, lProfileForeachInnerEnd);
         llvm::Value *counter = ctx->LoadInst(uniformCounterPtrs[nDims - 1], NULL, "counter");
         llvm::Value *beforeFullEnd = ctx->CmpInst(llvm::Instruction::ICmp, llvm::CmpInst::ICMP_SLT, counter,
                                                   endVals[nDims - 1], "before_full_end");
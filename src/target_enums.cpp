@@ -160,9 +160,13 @@ ISPCTarget ParseISPCTarget(std::string target) {
 // Given a comma-delimited string with one or more compilation targets of
 // the form "sse4-i32x4,avx2-i32x8", return a pair. First element of the pair is a vector
 // of correctly parsed targets, second element of the pair is a strings with targets, which
-// were not recognized.
-std::pair<std::vector<ISPCTarget>, std::string> ParseISPCTargets(const char *target) {
+// were not recognized.  Each target may be qualified with a CPU, as in
+// "avx512skx-i32x16:icelake-server"; the CPUs are returned in targetCPUs,
+// parallel to the targets, with empty strings for unqualified targets.
+std::pair<std::vector<ISPCTarget>, std::string> ParseISPCTargets(const char *target,
+                                                                 std::vector<std::string> &targetCPUs) {
     std::vector<ISPCTarget> targets;
+    targetCPUs.clear();
     std::string error_target;
     const char *tstart = target;
     bool done = false;
@@ -173,6 +177,12 @@ std::pair<std::vector<ISPCTarget>, std::string> ParseISPCTargets(const char *tar
             tend = strchr(tstart, '\0');
         }
         std::string target_string = std::string(tstart, tend);
+        std::string cpu_string;
+        size_t colon = target_string.find(':');
+        if (colon != std::string::npos) {
+            cpu_string = target_string.substr(colon + 1);
+            target_string.erase(colon);
+        }
         ISPCTarget target_parsed = ParseISPCTarget(target_string);
         if (target_parsed == ISPCTarget::error) {
             if (!error_target.empty()) {
@@ -181,6 +191,7 @@ std::pair<std::vector<ISPCTarget>, std::string> ParseISPCTargets(const char *tar
             error_target += target_string;
         } else {
             targets.push_back(target_parsed);
+            targetCPUs.push_back(cpu_string);
         }
         tstart = tend + 1;
     }
@@ -89,7 +89,8 @@ enum class ISPCTarget {
 };
 
 ISPCTarget ParseISPCTarget(std::string target);
-std::pair<std::vector<ISPCTarget>, std::string> ParseISPCTargets(const char *target);
+std::pair<std::vector<ISPCTarget>, std::string> ParseISPCTargets(const char *target,
+                                                                 std::vector<std::string> &targetCPUs);
 std::string ISPCTargetToString(ISPCTarget target);
 bool ISPCTargetIsX86(ISPCTarget target);
 bool ISPCTargetIsNeon(ISPCTarget target);
@@ -580,11 +580,13 @@ const EnumType *EnumType::GetBaseType() const { return this; }
 const EnumType *EnumType::GetAsUniformType() const {
     if (IsUniformType())
         return this;
-    else {
+
+    if (conversions.asUniformType == NULL) {
         EnumType *enumType = new EnumType(*this);
         enumType->variability = Variability::Uniform;
-        return enumType;
+        conversions.asUniformType = enumType;
     }
+    return conversions.asUniformType;
 }
 
 const EnumType *EnumType::ResolveUnboundVariability(Variability v) const {
@@ -600,21 +602,25 @@ const EnumType *EnumType::ResolveUnboundVariability(Variability v) const {
 const EnumType *EnumType::GetAsVaryingType() const {
     if (IsVaryingType())
         return this;
-    else {
+
+    if (conversions.asVaryingType == NULL) {
         EnumType *enumType = new EnumType(*this);
         enumType->variability = Variability(Variability::Varying);
-        return enumType;
+        conversions.asVaryingType = enumType;
     }
+    return conversions.asVaryingType;
 }
 
 const EnumType *EnumType::GetAsUnboundVariabilityType() const {
     if (HasUnboundVariability())
         return this;
-    else {
+
+    if (conversions.asUnboundVariabilityType == NULL) {
         EnumType *enumType = new EnumType(*this);
         enumType->variability = Variability(Variability::Unbound);
-        return enumType;
+        conversions.asUnboundVariabilityType = enumType;
     }
+    return conversions.asUnboundVariabilityType;
 }
 
 const EnumType *EnumType::GetAsSOAType(int width) const {
@@ -630,21 +636,25 @@ const EnumType *EnumType::GetAsSOAType(int width) const {
 const EnumType *EnumType::GetAsConstType() const {
     if (isConst)
         return this;
-    else {
+
+    if (conversions.asConstType == NULL) {
         EnumType *enumType = new EnumType(*this);
         enumType->isConst = true;
-        return enumType;
+        conversions.asConstType = enumType;
     }
+    return conversions.asConstType;
 }
 
 const EnumType *EnumType::GetAsNonConstType() const {
     if (!isConst)
         return this;
-    else {
+
+    if (conversions.asNonConstType == NULL) {
         EnumType *enumType = new EnumType(*this);
         enumType->isConst = false;
-        return enumType;
+        conversions.asNonConstType = enumType;
     }
+    return conversions.asNonConstType;
 }
 
 std::string EnumType::GetString() const {
@@ -758,7 +768,11 @@ llvm::DIType *EnumType::GetDIType(llvm::DIScope *scope) const {
     }
 }
 
-void EnumType::SetEnumerators(const std::vector<Symbol *> &e) { enumerators = e; }
+void EnumType::SetEnumerators(const std::vector<Symbol *> &e) {
+    enumerators = e;
+    // Conversions made before now don't have the enumerators.
+    conversions.Reset();
+}
 
 int EnumType::GetEnumeratorCount() const { return (int)enumerators.size(); }
 
@@ -803,22 +817,31 @@ const Type *PointerType::GetBaseType() const { return baseType; }
 const PointerType *PointerType::GetAsVaryingType() const {
     if (variability == Variability::Varying)
         return this;
-    else
-        return new PointerType(baseType, Variability(Variability::Varying), isConst, isSlice, isFrozen);
+
+    if (conversions.asVaryingType == NULL)
+        conversions.asVaryingType =
+            new PointerType(baseType, Variability(Variability::Varying), isConst, isSlice, isFrozen);
+    return conversions.asVaryingType;
 }
 
 const PointerType *PointerType::GetAsUniformType() const {
     if (variability == Variability::Uniform)
         return this;
-    else
-        return new PointerType(baseType, Variability(Variability::Uniform), isConst, isSlice, isFrozen);
+
+    if (conversions.asUniformType == NULL)
+        conversions.asUniformType =
+            new PointerType(baseType, Variability(Variability::Uniform), isConst, isSlice, isFrozen);
+    return conversions.asUniformType;
 }
 
 const PointerType *PointerType::GetAsUnboundVariabilityType() const {
     if (variability == Variability::Unbound)
         return this;
-    else
-        return new PointerType(baseType, Variability(Variability::Unbound), isConst, isSlice, isFrozen);
+
+    if (conversions.asUnboundVariabilityType == NULL)
+        conversions.asUnboundVariabilityType =
+            new PointerType(baseType, Variability(Variability::Unbound), isConst, isSlice, isFrozen);
+    return conversions.asUnboundVariabilityType;
 }
 
 const PointerType *PointerType::GetAsSOAType(int width) const {
@@ -861,15 +884,19 @@ const PointerType *PointerType::ResolveUnboundVariability(Variability v) const {
 const PointerType *PointerType::GetAsConstType() const {
     if (isConst == true)
         return this;
-    else
-        return new PointerType(baseType, variability, true, isSlice);
+
+    if (conversions.asConstType == NULL)
+        conversions.asConstType = new PointerType(baseType, variability, true, isSlice);
+    return conversions.asConstType;
 }
 
 const PointerType *PointerType::GetAsNonConstType() const {
     if (isConst == false)
         return this;
-    else
-        return new PointerType(baseType, variability, false, isSlice);
+
+    if (conversions.asNonConstType == NULL)
+        conversions.asNonConstType = new PointerType(baseType, variability, false, isSlice);
+    return conversions.asNonConstType;
 }
 
 std::string PointerType::GetString() const {
@@ -1099,7 +1126,11 @@ const ArrayType *ArrayType::GetAsVaryingType() const {
         Assert(m->errorCount > 0);
         return NULL;
     }
-    return new ArrayType(child->GetAsVaryingType(), numElements);
+    if (conversions.asVaryingType == NULL) {
+        const Type *convertedChild = child->GetAsVaryingType();
+        conversions.asVaryingType = (convertedChild == child) ? this : new ArrayType(convertedChild, numElements);
+    }
+    return conversions.asVaryingType;
 }
 
 const ArrayType *ArrayType::GetAsUniformType() const {
@@ -1107,7 +1138,11 @@ const ArrayType *ArrayType::GetAsUniformType() const {
         Assert(m->errorCount > 0);
         return NULL;
     }
-    return new ArrayType(child->GetAsUniformType(), numElements);
+    if (conversions.asUniformType == NULL) {
+        const Type *convertedChild = child->GetAsUniformType();
+        conversions.asUniformType = (convertedChild == child) ? this : new ArrayType(convertedChild, numElements);
+    }
+    return conversions.asUniformType;
 }
 
 const ArrayType *ArrayType::GetAsUnboundVariabilityType() const {
@@ -1115,7 +1150,12 @@ const ArrayType *ArrayType::GetAsUnboundVariabilityType() const {
         Assert(m->errorCount > 0);
         return NULL;
     }
-    return new ArrayType(child->GetAsUnboundVariabilityType(), numElements);
+    if (conversions.asUnboundVariabilityType == NULL) {
+        const Type *convertedChild = child->GetAsUnboundVariabilityType();
+        conversions.asUnboundVariabilityType =
+            (convertedChild == child) ? this : new ArrayType(convertedChild, numElements);
+    }
+    return conversions.asUnboundVariabilityType;
 }
 
 const ArrayType *ArrayType::GetAsSOAType(int width) const {
@@ -1147,7 +1187,11 @@ const ArrayType *ArrayType::GetAsConstType() const {
         Assert(m->errorCount > 0);
         return NULL;
     }
-    return new ArrayType(child->GetAsConstType(), numElements);
+    if (conversions.asConstType == NULL) {
+        const Type *convertedChild = child->GetAsConstType();
+        conversions.asConstType = (convertedChild == child) ? this : new ArrayType(convertedChild, numElements);
+    }
+    return conversions.asConstType;
 }
 
 const ArrayType *ArrayType::GetAsNonConstType() const {
@@ -1155,7 +1199,11 @@ const ArrayType *ArrayType::GetAsNonConstType() const {
         Assert(m->errorCount > 0);
         return NULL;
     }
-    return new ArrayType(child->GetAsNonConstType(), numElements);
+    if (conversions.asNonConstType == NULL) {
+        const Type *convertedChild = child->GetAsNonConstType();
+        conversions.asNonConstType = (convertedChild == child) ? this : new ArrayType(convertedChild, numElements);
+    }
+    return conversions.asNonConstType;
 }
 
 int ArrayType::GetElementCount() const { return numElements; }
@@ -1340,12 +1388,29 @@ bool VectorType::IsConstType() const { return base->IsConstType(); }
 
 const Type *VectorType::GetBaseType() const { return base; }
 
-const VectorType *VectorType::GetAsVaryingType() const { return new VectorType(base->GetAsVaryingType(), numElements); }
+/** Returns a vector type with the given element type and the same number
+    of elements as the given vector type, or the vector type itself if it
+    already has that element type. */
+static const VectorType *lWithElementType(const VectorType *vt, const AtomicType *base) {
+    return (base == vt->GetElementType()) ? vt : new VectorType(base, vt->GetElementCount());
+}
 
-const VectorType *VectorType::GetAsUniformType() const { return new VectorType(base->GetAsUniformType(), numElements); }
+const VectorType *VectorType::GetAsVaryingType() const {
+    if (conversions.asVaryingType == NULL)
+        conversions.asVaryingType = lWithElementType(this, base->GetAsVaryingType());
+    return conversions.asVaryingType;
+}
+
+const VectorType *VectorType::GetAsUniformType() const {
+    if (conversions.asUniformType == NULL)
+        conversions.asUniformType = lWithElementType(this, base->GetAsUniformType());
+    return conversions.asUniformType;
+}
 
 const VectorType *VectorType::GetAsUnboundVariabilityType() const {
-    return new VectorType(base->GetAsUnboundVariabilityType(), numElements);
+    if (conversions.asUnboundVariabilityType == NULL)
+        conversions.asUnboundVariabilityType = lWithElementType(this, base->GetAsUnboundVariabilityType());
+    return conversions.asUnboundVariabilityType;
 }
 
 const VectorType *VectorType::GetAsSOAType(int width) const {
@@ -1364,10 +1429,16 @@ const VectorType *VectorType::GetAsUnsignedType() const {
     return new VectorType(base->GetAsUnsignedType(), numElements);
 }
 
-const VectorType *VectorType::GetAsConstType() const { return new VectorType(base->GetAsConstType(), numElements); }
+const VectorType *VectorType::GetAsConstType() const {
+    if (conversions.asConstType == NULL)
+        conversions.asConstType = lWithElementType(this, base->GetAsConstType());
+    return conversions.asConstType;
+}
 
 const VectorType *VectorType::GetAsNonConstType() const {
-    return new VectorType(base->GetAsNonConstType(), numElements);
+    if (conversions.asNonConstType == NULL)
+        conversions.asNonConstType = lWithElementType(this, base->GetAsNonConstType());
+    return conversions.asNonConstType;
 }
 
 std::string VectorType::GetString() const {
@@ -1654,25 +1725,32 @@ const Type *StructType::GetBaseType() const { return this; }
 const StructType *StructType::GetAsVaryingType() const {
     if (IsVaryingType())
         return this;
-    else
-        return new StructType(name, elementTypes, elementNames, elementPositions, isConst,
-                              Variability(Variability::Varying), isAnonymous, pos);
+
+    if (conversions.asVaryingType == NULL)
+        conversions.asVaryingType = new StructType(name, elementTypes, elementNames, elementPositions, isConst,
+                                                   Variability(Variability::Varying), isAnonymous, pos);
+    return conversions.asVaryingType;
 }
 
 const StructType *StructType::GetAsUniformType() const {
     if (IsUniformType())
         return this;
-    else
-        return new StructType(name, elementTypes, elementNames, elementPositions, isConst,
-                              Variability(Variability::Uniform), isAnonymous, pos);
+
+    if (conversions.asUniformType == NULL)
+        conversions.asUniformType = new StructType(name, elementTypes, elementNames, elementPositions, isConst,
+                                                   Variability(Variability::Uniform), isAnonymous, pos);
+    return conversions.asUniformType;
 }
 
 const StructType *StructType::GetAsUnboundVariabilityType() const {
     if (HasUnboundVariability())
         return this;
-    else
-        return new StructType(name, elementTypes, elementNames, elementPositions, isConst,
-                              Variability(Variability::Unbound), isAnonymous, pos);
+
+    if (conversions.asUnboundVariabilityType == NULL)
+        conversions.asUnboundVariabilityType =
+            new StructType(name, elementTypes, elementNames, elementPositions, isConst,
+                           Variability(Variability::Unbound), isAnonymous, pos);
+    return conversions.asUnboundVariabilityType;
 }
 
 const StructType *StructType::GetAsSOAType(int width) const {
@@ -1930,19 +2008,28 @@ const Type *UndefinedStructType::GetBaseType() const { return this; }
 const UndefinedStructType *UndefinedStructType::GetAsVaryingType() const {
     if (variability == Variability::Varying)
         return this;
-    return new UndefinedStructType(name, Variability::Varying, isConst, pos);
+
+    if (conversions.asVaryingType == NULL)
+        conversions.asVaryingType = new UndefinedStructType(name, Variability::Varying, isConst, pos);
+    return conversions.asVaryingType;
 }
 
 const UndefinedStructType *UndefinedStructType::GetAsUniformType() const {
     if (variability == Variability::Uniform)
         return this;
-    return new UndefinedStructType(name, Variability::Uniform, isConst, pos);
+
+    if (conversions.asUniformType == NULL)
+        conversions.asUniformType = new UndefinedStructType(name, Variability::Uniform, isConst, pos);
+    return conversions.asUniformType;
 }
 
 const UndefinedStructType *UndefinedStructType::GetAsUnboundVariabilityType() const {
     if (variability == Variability::Unbound)
         return this;
-    return new UndefinedStructType(name, Variability::Unbound, isConst, pos);
+
+    if (conversions.asUnboundVariabilityType == NULL)
+        conversions.asUnboundVariabilityType = new UndefinedStructType(name, Variability::Unbound, isConst, pos);
+    return conversions.asUnboundVariabilityType;
 }
 
 const UndefinedStructType *UndefinedStructType::GetAsSOAType(int width) const {
@@ -1959,13 +2046,19 @@ const UndefinedStructType *UndefinedStructType::ResolveUnboundVariability(Variab
 const UndefinedStructType *UndefinedStructType::GetAsConstType() const {
     if (isConst)
         return this;
-    return new UndefinedStructType(name, variability, true, pos);
+
+    if (conversions.asConstType == NULL)
+        conversions.asConstType = new UndefinedStructType(name, variability, true, pos);
+    return conversions.asConstType;
 }
 
 const UndefinedStructType *UndefinedStructType::GetAsNonConstType() const {
     if (isConst == false)
         return this;
-    return new UndefinedStructType(name, variability, false, pos);
+
+    if (conversions.asNonConstType == NULL)
+        conversions.asNonConstType = new UndefinedStructType(name, variability, false, pos);
+    return conversions.asNonConstType;
 }
 
 std::string UndefinedStructType::GetString() const {
@@ -2082,7 +2175,10 @@ const ReferenceType *ReferenceType::GetAsVaryingType() const {
     }
     if (IsVaryingType())
         return this;
-    return new ReferenceType(targetType->GetAsVaryingType());
+
+    if (conversions.asVaryingType == NULL)
+        conversions.asVaryingType = new ReferenceType(targetType->GetAsVaryingType());
+    return conversions.asVaryingType;
 }
 
 const ReferenceType *ReferenceType::GetAsUniformType() const {
@@ -2092,7 +2188,10 @@ const ReferenceType *ReferenceType::GetAsUniformType() const {
     }
     if (IsUniformType())
         return this;
-    return new ReferenceType(targetType->GetAsUniformType());
+
+    if (conversions.asUniformType == NULL)
+        conversions.asUniformType = new ReferenceType(targetType->GetAsUniformType());
+    return conversions.asUniformType;
 }
 
 const ReferenceType *ReferenceType::GetAsUnboundVariabilityType() const {
@@ -2102,7 +2201,10 @@ const ReferenceType *ReferenceType::GetAsUnboundVariabilityType() const {
     }
     if (HasUnboundVariability())
         return this;
-    return new ReferenceType(targetType->GetAsUnboundVariabilityType());
+
+    if (conversions.asUnboundVariabilityType == NULL)
+        conversions.asUnboundVariabilityType = new ReferenceType(targetType->GetAsUnboundVariabilityType());
+    return conversions.asUnboundVariabilityType;
 }
 
 const Type *ReferenceType::GetAsSOAType(int width) const {
@@ -2304,6 +2406,7 @@ const FunctionType *FunctionType::ResolveUnboundVariability(Variability v) const
         new FunctionType(rt, pt, paramNames, paramDefaults, paramPositions, isTask, isExported, isExternC, isUnmasked);
     ret->isSafe = isSafe;
     ret->costOverride = costOverride;
+    ret->specializations = specializations;
 
     return ret;
 }
@@ -2752,6 +2855,11 @@ static bool lCheckTypeEquality(const Type *a, const Type *b, bool ignoreConst) {
     if (a == NULL || b == NULL)
         return false;
 
+    // Conversions are memoized, so equal types are frequently the same
+    // instance.
+    if (a == b)
+        return true;
+
     if (ignoreConst == false && a->IsConstType() != b->IsConstType())
         return false;
 
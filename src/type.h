@@ -82,6 +82,26 @@ enum TypeId {
     FUNCTION_TYPE          // 8
 };
 
+/** Memoized results of the variability and const conversions of a type
+    (GetAsUniformType() and friends).  Converting a type a second time
+    returns the same instance rather than allocating a new one, which
+    saves allocations during type checking and lets Type::Equal() return
+    early for the common case of comparing a type with itself.  Copying a
+    type doesn't copy its conversions, since they refer to the original. */
+template <typename T> struct TypeConversions {
+    TypeConversions() { Reset(); }
+    TypeConversions(const TypeConversions &) { Reset(); }
+    TypeConversions &operator=(const TypeConversions &) = delete;
+
+    void Reset() {
+        asUniformType = asVaryingType = asUnboundVariabilityType = NULL;
+        asConstType = asNonConstType = NULL;
+    }
+
+    const T *asUniformType, *asVaryingType, *asUnboundVariabilityType;
+    const T *asConstType, *asNonConstType;
+};
+
 /** @brief Interface class that defines the type abstraction.
 
     Abstract base class that defines the interface that must be implemented
@@ -394,6 +414,8 @@ class EnumType : public Type {
     Variability variability;
     bool isConst;
     std::vector<Symbol *> enumerators;
+
+    mutable TypeConversions<EnumType> conversions;
 };
 
 /** @brief Type implementation for pointers to other types
@@ -467,6 +489,8 @@ class PointerType : public Type {
     const bool isConst;
     const bool isSlice, isFrozen;
     const Type *baseType;
+
+    mutable TypeConversions<PointerType> conversions;
 };
 
 /** @brief Abstract base class for types that represent collections of
@@ -584,6 +608,8 @@ class ArrayType : public SequentialType {
     const Type *const child;
     /** Number of elements in the array. */
     const int numElements;
+
+    mutable TypeConversions<ArrayType> conversions;
 };
 
 /** @brief A (short) vector of atomic types.
@@ -638,6 +664,8 @@ class VectorType : public SequentialType {
     /** Number of elements in the vector */
     const int numElements;
 
+    mutable TypeConversions<VectorType> conversions;
+
   public:
     /** Returns the number of elements stored in memory for the vector.
         For uniform vectors, this is rounded up so that the number of
@@ -731,6 +759,7 @@ class StructType : public CollectionType {
     mutable llvm::SmallVector<const Type *, 8> finalElementTypes;
 
     mutable const StructType *oppositeConstStructType;
+    mutable TypeConversions<StructType> conversions;
 };
 
 /** Type implementation representing a struct name that has been declared
@@ -776,6 +805,8 @@ class UndefinedStructType : public Type {
     const Variability variability;
     const bool isConst;
     const SourcePos pos;
+
+    mutable TypeConversions<UndefinedStructType> conversions;
 };
 
 /** @brief Type representing a reference to another (non-reference) type.
@@ -814,6 +845,7 @@ class ReferenceType : public Type {
   private:
     const Type *const targetType;
     mutable const ReferenceType *asOtherConstType;
+    mutable TypeConversions<ReferenceType> conversions;
 };
 
 /** @brief Type representing a function (return type + argument types)
@@ -903,6 +935,12 @@ class FunctionType : public Type {
         function estimate for the function. */
     int costOverride;
 
+    /** Argument values that an 'export' function has been specialized for
+        with __declspec(specialize(...)).  Each element is one specialized
+        variant, given as pairs of a parameter index and the value of that
+        (uniform integer) parameter. */
+    std::vector<std::vector<std::pair<int, int64_t>>> specializations;
+
   private:
     const Type *const returnType;
 
@@ -388,6 +388,9 @@ void Warning(SourcePos p, const char *fmt, ...) {
     if (g->disableWarnings || g->quiet)
         return;
 
+    if (m != NULL)
+        ++m->warningCount;
+
     va_list args;
     va_start(args, fmt);
     lPrint(g->warningsAsErrors ? "Error" : "Warning", g->warningsAsErrors, p, fmt, args);
@@ -410,6 +413,8 @@ void PerformanceWarning(SourcePos p, const char *fmt, ...) {
 
     if (g->warningsAsErrors && m != NULL)
         ++m->errorCount;
+    if (m != NULL)
+        ++m->warningCount;
 
     va_list args;
     va_start(args, fmt);